@@ -55,6 +55,7 @@ static constexpr std::int16_t ErrInvalidState           = 1001;
 static constexpr std::int16_t ErrAppImageTooLarge       = 1002;
 static constexpr std::int16_t ErrROMWriteFailure        = 1003;
 static constexpr std::int16_t ErrInvalidParams          = 1004;
+static constexpr std::int16_t ErrNotSupported           = 1005;
 
 /**
  * The library performs operations on data blocks not larger than this.
@@ -263,6 +264,21 @@ public:
      * @return Negative on error, non-negative on success.
      */
     virtual std::int16_t handleNextDataChunk(const void* data, std::uint16_t size) = 0;
+
+    /**
+     * Writes the data chunk at the specified offset from the beginning of the image.
+     * This is used by protocols that deliver the image out of order; the storage backend must support
+     * non-sequential writes then. The data chunk length cannot exceed 32767 bytes.
+     * The default implementation is for the sinks that support only sequential writes; it rejects the data.
+     * @return Negative on error, non-negative on success.
+     */
+    virtual std::int16_t handleDataChunkAt(std::size_t offset, const void* data, std::uint16_t size)
+    {
+        (void) offset;
+        (void) data;
+        (void) size;
+        return -ErrNotSupported;
+    }
 };
 
 /**
@@ -312,6 +328,16 @@ class BootloaderController final
         std::size_t offset_ = 0;
 
         std::int16_t handleNextDataChunk(const void* data, std::uint16_t size) final
+        {
+            const auto res = handleDataChunkAt(offset_, data, size);
+            if (res >= 0)
+            {
+                offset_ += size;
+            }
+            return res;
+        }
+
+        std::int16_t handleDataChunkAt(std::size_t offset, const void* data, std::uint16_t size) final
         {
             if (size > MaxDataBlockSize)
             {
@@ -320,15 +346,14 @@ class BootloaderController final
 
             MutexLocker mlock(platform_);
 
-            if ((offset_ + size) <= max_image_size_)
+            if ((offset + size) <= max_image_size_)
             {
-                const auto res = backend_.write(offset_, data, size);
+                const auto res = backend_.write(offset, data, size);
                 if ((res >= 0) && (res != int(size)))
                 {
                     return -ErrROMWriteFailure;
                 }
 
-                offset_ += size;
                 return res;
             }
             else
@@ -361,6 +386,9 @@ class BootloaderController final
     /// Caching is needed because app check can sometimes take a very long time (several seconds)
     std::optional<AppInfo> cached_app_info_;
 
+    /// Exists while the application is being upgraded
+    std::optional<ProxySink> upgrade_sink_;
+
     /**
      * Refer to the Brickproof Bootloader specs.
      * Note that the structure must be aligned at 8 bytes boundary, and the image must be padded to 8 bytes!
@@ -569,6 +597,36 @@ public:
         }
     }
 
+    /**
+     * Reads the installed application image from the storage backend, e.g. in order to serve it to other nodes.
+     * The read is limited to the image; reads past its end return zero bytes.
+     * The data chunk length cannot exceed 32767 bytes.
+     * @return number of bytes read; negative on error, or if there is no valid application in the ROM.
+     */
+    std::int16_t readApp(std::size_t offset, void* data, std::uint16_t size)
+    {
+        if (size > MaxDataBlockSize)
+        {
+            return -ErrInvalidParams;
+        }
+
+        MutexLocker mlock(platform_);
+
+        if ((state_ == State::AppUpgradeInProgress) || !cached_app_info_)
+        {
+            return -ErrInvalidState;
+        }
+
+        if (offset >= cached_app_info_->image_size)
+        {
+            return 0;
+        }
+
+        return backend_.read(offset,
+                             data,
+                             std::uint16_t(std::min<std::size_t>(size, cached_app_info_->image_size - offset)));
+    }
+
     /**
      * Switches the state to @ref BootCancelled, if allowed.
      */
@@ -620,41 +678,57 @@ public:
 
     /**
      * Template method that implements all of the high-level steps of the application update procedure.
+     * Blocks until the protocol has finished downloading the image; see beginAppUpgrade() for the alternative.
      * Returns zero on success, negative on failure.
      */
     std::int16_t upgradeApp(IProtocol& proto)
+    {
+        const auto [res, sink] = beginAppUpgrade();
+        if (res < 0)
+        {
+            return res;
+        }
+
+        return endAppUpgrade(proto.downloadImage(*sink));
+    }
+
+    /**
+     * The first half of upgradeApp(), for protocols that are driven by a superloop and cannot block.
+     * Prepares the storage and returns the sink that the new image shall be written into. The sink stays valid
+     * until endAppUpgrade() is invoked, which must be done once the download is finished or has failed.
+     * On failure, returns a negative error code and nullptr; endAppUpgrade() shall not be invoked then.
+     */
+    std::pair<std::int16_t, IDownloadSink*> beginAppUpgrade()
     {
         /*
          * Preparation stage.
          * Note that access to the backend and all members is always protected with the mutex, this is important.
          */
-        {
-            MutexLocker mlock(platform_);
+        MutexLocker mlock(platform_);
 
-            switch (state_)
-            {
-            case State::BootDelay:
-            case State::BootCancelled:
-            case State::NoAppToBoot:
-            {
-                break;      // OK, continuing below
-            }
-            case State::ReadyToBoot:
-            case State::AppUpgradeInProgress:
-            {
-                return -ErrInvalidState;
-            }
-            }
+        switch (state_)
+        {
+        case State::BootDelay:
+        case State::BootCancelled:
+        case State::NoAppToBoot:
+        {
+            break;      // OK, continuing below
+        }
+        case State::ReadyToBoot:
+        case State::AppUpgradeInProgress:
+        {
+            return {-ErrInvalidState, nullptr};
+        }
+        }
 
-            state_ = State::AppUpgradeInProgress;
-            cached_app_info_.reset();                           // Invalidate now, as we're going to modify the storage
+        state_ = State::AppUpgradeInProgress;
+        cached_app_info_.reset();                           // Invalidate now, as we're going to modify the storage
 
-            const auto res = backend_.beginUpgrade();
-            if (res < 0)
-            {
-                verifyAppAndUpdateState(State::BootCancelled);  // The backend could have modified the storage
-                return res;
-            }
+        const auto res = backend_.beginUpgrade();
+        if (res < 0)
+        {
+            verifyAppAndUpdateState(State::BootCancelled);  // The backend could have modified the storage
+            return {res, nullptr};
         }
 
         KOCHERGA_TRACE("Starting app upgrade...\n");
@@ -664,10 +738,17 @@ public:
          * New application is downloaded into the storage backend via the ProxySink proxy class.
          * Every write() via the ProxySink is mutex-protected.
          */
-        ProxySink sink(platform_, backend_, max_application_image_size_);
+        upgrade_sink_.emplace(platform_, backend_, max_application_image_size_);
+        return {ErrOK, &*upgrade_sink_};
+    }
 
-        auto res = proto.downloadImage(sink);
-        KOCHERGA_TRACE("App download finished with status %d\n", res);
+    /**
+     * The second half of upgradeApp(); the argument is the result of the download, negative if it has failed.
+     * Returns zero on success, negative on failure.
+     */
+    std::int16_t endAppUpgrade(std::int16_t download_result)
+    {
+        KOCHERGA_TRACE("App download finished with status %d\n", download_result);
 
         /*
          * Finalization stage.
@@ -676,17 +757,23 @@ public:
          */
         MutexLocker mlock(platform_);
 
-        assert(state_ == State::AppUpgradeInProgress);
+        if (state_ != State::AppUpgradeInProgress)
+        {
+            assert(false);
+            return -ErrInvalidState;
+        }
+
+        upgrade_sink_.reset();
         state_ = State::NoAppToBoot;                // Default state until proven otherwise
 
-        if (res < 0)                                // Download failed
+        if (download_result < 0)                    // Download failed
         {
             (void)backend_.endUpgrade(false);       // Making sure the backend is finalized; error is irrelevant
             verifyAppAndUpdateState(State::BootCancelled);
-            return res;
+            return download_result;
         }
 
-        res = backend_.endUpgrade(true);
+        const auto res = backend_.endUpgrade(true);
         if (res < 0)                                // Finalization failed
         {
             KOCHERGA_TRACE("App storage backend finalization failed (%d)\n", res);
@@ -30,6 +30,7 @@
 // Third-party dependencies:
 #include <popcop.hpp>                   // Popcop protocol implementation in C++
 
+#include <algorithm>
 #include <utility>
 
 
@@ -38,8 +39,119 @@ namespace kocherga_popcop
 /**
  * Error codes specific to this protocol.
  */
-static constexpr std::int16_t ErrTimeout    = 4001;
-static constexpr std::int16_t ErrCancelled  = 4002;
+static constexpr std::int16_t ErrTimeout      = 4001;
+static constexpr std::int16_t ErrCancelled    = 4002;
+static constexpr std::int16_t ErrNotSupported = 4003;
+static constexpr std::int16_t ErrNoUpgrade    = 4004;
+static constexpr std::int16_t ErrOutOfOrder   = 4005;
+
+/**
+ * Application-specific frame type codes used by the gateway that allows a host to serve files to other nodes
+ * through this endpoint, e.g. to update the nodes on a CAN bus through the USB port of one of them.
+ * All fields are little-endian; the paths are not null-terminated and extend until the end of the frame.
+ *
+ *      # File read request, sent by the endpoint whenever the local application needs data from the host
+ *      uint32 tag                      # Opaque; returned by the host in the response
+ *      uint64 offset
+ *      uint8[<=200] path
+ *
+ *      # File read response, sent by the host
+ *      uint32 tag
+ *      int16 error                     # See uavcan.protocol.file.Error; zero on success
+ *      uint8[<=256] data               # Shorter than 256 bytes only at the end of the file
+ *
+ *      # Peer firmware update request, sent by the host
+ *      uint8 node_id
+ *      uint8[<=200] path
+ *
+ *      # Peer firmware update response, sent by the endpoint
+ *      uint8 node_id
+ *      int16 result                    # Negative error code or zero
+ *
+ * The endpoint imposes no limit on the number of file read requests in flight, so the host should process them
+ * as they arrive, without waiting for the previous responses to be consumed.
+ */
+static constexpr std::uint8_t FileReadGatewayFrameTypeCode           = 0x70;
+static constexpr std::uint8_t PeerFirmwareUpdateGatewayFrameTypeCode = 0x71;
+
+/**
+ * Application-specific frame type code used by the host to switch the serial port to a higher bit rate.
+ * All fields are little-endian.
+ *
+ *      # Bit rate change request, sent by the host at the current bit rate
+ *      uint32 bit_rate                 # Zero requests the default bit rate of the port
+ *
+ *      # Bit rate change response, sent by the endpoint at the current bit rate
+ *      uint32 bit_rate
+ *      int16 result                    # Negative error code or zero
+ *
+ *      # Link verification request, sent by the host at the new bit rate
+ *      uint32 bit_rate
+ *      uint8[256] pattern              # The n-th byte equals n; every byte value occurs once
+ *
+ *      # Link verification response, sent by the endpoint at the new bit rate; echoes the request
+ *
+ * If the result is zero, both sides switch to the new bit rate right after the response, and the host sends the
+ * link verification request. If the endpoint does not receive the request within BitRateVerificationTimeout,
+ * it reverts to the default bit rate; the host should do the same if it does not receive the verification response.
+ * Once verified, the endpoint also reverts to the default bit rate if it receives no frames for BitRateIdleTimeout,
+ * so that a host that has lost the connection can always reconnect at the default bit rate.
+ */
+static constexpr std::uint8_t BitRateChangeFrameTypeCode = 0x72;
+static constexpr std::uint16_t BitRateTestPatternSize    = 256;
+static constexpr std::chrono::microseconds BitRateVerificationTimeout{1'000'000};  // NOLINT
+static constexpr std::chrono::microseconds BitRateIdleTimeout{10'000'000};         // NOLINT
+
+/**
+ * Application-specific frame type codes that make the application image upload more efficient than
+ * with the standard BootloaderImageData messages alone. All fields are little-endian.
+ *
+ *      # Upload options request, sent by the host before the upgrade is started
+ *      uint8 flags                     # 1 - compact image data acknowledgements
+ *      uint8 window                    # Image data requests in flight; optional, one if omitted
+ *      uint16 chunk_size               # Maximum image data chunk size; optional, 256 if omitted
+ *
+ *      # Upload options response, sent by the endpoint; same layout, contains the options that are now in effect
+ *
+ *      # Image data request, sent by the host instead of BootloaderImageDataRequest; always acknowledged compactly
+ *      uint64 image_offset
+ *      uint8 flags                     # 1 - this is the last chunk of the image
+ *      uint8[<=2048] image_data        # Not larger than the negotiated chunk size, possibly empty
+ *
+ *      # Compact image data acknowledgement, sent by the endpoint instead of BootloaderImageDataResponse
+ *      uint64 image_offset             # Same as in the request
+ *      int16 status                    # Negative error code or zero
+ *      uint32 crc                      # CRC-32C of the received image data, see popcop::transport::CRCComputer
+ *      uint64 next_offset              # The image is committed without gaps up to this offset
+ *
+ * With compact acknowledgements, the image data is not sent back to the host, which halves the traffic on
+ * half-duplex links; the host compares the CRC with that of the data it has sent instead.
+ * This applies only to the application image; the certificate of authenticity is always read back in full.
+ *
+ * The window is the number of image data requests the host may send without waiting for the responses.
+ * The endpoint grants at most IPopcopPlatform::getMaxImageDataWindow(). The requests are committed and
+ * acknowledged in the order of arrival; a request whose offset is past the end of the committed data indicates
+ * that a preceding request has been lost, so it is rejected with ErrOutOfOrder, and the host resends the data
+ * starting from next_offset. Requests below next_offset are acknowledged without being written again.
+ *
+ * The standard messages carry at most 256 bytes of image data, and a shorter chunk ends the image.
+ * The image data request defined here carries chunks of up to the negotiated size, which amortizes the per-frame
+ * overhead, and marks the end of the image explicitly, so the chunks need not be of the same size.
+ * The endpoint may grant a smaller chunk size than requested, at most IPopcopPlatform::getMaxImageDataChunkSize(),
+ * but never smaller than 256 bytes.
+ *
+ * The options are retained until changed, but the endpoint resets them when restarted, so the host should
+ * request them before every upgrade.
+ */
+static constexpr std::uint8_t UploadOptionsFrameTypeCode = 0x73;
+static constexpr std::uint8_t ImageDataAckFrameTypeCode  = 0x74;
+static constexpr std::uint8_t ImageDataFrameTypeCode     = 0x75;
+
+static constexpr std::uint8_t UploadOptionCompactAcks = 1;
+static constexpr std::uint8_t ImageDataFlagLastChunk  = 1;
+
+static constexpr std::uint16_t DefaultImageDataChunkSize = 256;
+static constexpr std::uint16_t MaxImageDataChunkSize     = 2048;
 
 /**
  * Platform abstraction interface for the Popcop protocol.
@@ -62,12 +174,16 @@ public:
     /**
      * Sends one byte to the opposite endpoint.
      * If timed out, do nothing. @ref IOByteTimeout
+     * If the endpoint is driven via PopcopProtocol::step() from a superloop, this method should not block at all,
+     * queueing the byte for transmission instead; a byte that does not fit into the queue may be dropped.
      */
     virtual void emit(std::uint8_t byte) = 0;
 
     /**
      * Receives one byte from the serial port input buffer.
      * If timed out, returns an empty option. @ref IOByteTimeout
+     * If the endpoint is driven via PopcopProtocol::step() from a superloop, this method should not block at all,
+     * returning an empty option immediately if the input buffer is empty.
      */
     virtual std::optional<std::uint8_t> receive() = 0;
 
@@ -130,30 +246,114 @@ public:
      * This method is invoked by the endpoint periodically to check if it should terminate.
      */
     virtual bool shouldExit() const = 0;
+
+    /**
+     * This method is invoked when the host responds to a request sent via PopcopProtocol::sendFileReadRequest().
+     * The data is valid only until the method returns.
+     * The default implementation does nothing.
+     */
+    virtual void processFileReadResponse(std::uint32_t tag,
+                                         std::int16_t error,
+                                         const std::uint8_t* data,
+                                         std::uint16_t size)
+    {
+        (void) tag;
+        (void) error;
+        (void) data;
+        (void) size;
+    }
+
+    /**
+     * This method is invoked when the host requests the local application to command a peer node to update
+     * its firmware from the specified file, which the host is expected to serve via the file read gateway.
+     * The return value is reported back to the host; it is zero on success and a negative error code otherwise.
+     * The default implementation reports that the feature is not supported.
+     */
+    virtual std::int16_t processPeerFirmwareUpdateRequest(std::uint8_t node_id, const senoval::String<200>& path)
+    {
+        (void) node_id;
+        (void) path;
+        return -ErrNotSupported;
+    }
+
+    /**
+     * Returns the maximum number of image data requests that the host may keep in flight; see
+     * UploadOptionsFrameTypeCode. The requests that are not yet processed wait in the input buffer of the port,
+     * so the window must not be larger than the buffer can accommodate unless the link has flow control.
+     * The default implementation does not allow more than one request in flight.
+     */
+    virtual std::uint8_t getMaxImageDataWindow() const
+    {
+        return 1;
+    }
+
+    /**
+     * Returns the maximum image data chunk size that the host may use; see UploadOptionsFrameTypeCode.
+     * Same as with the window, the request must fit into the input buffer of the port unless the link has
+     * flow control. Values below DefaultImageDataChunkSize are ignored, as the standard messages carry that much.
+     * The default implementation allows the maximum supported by the protocol.
+     */
+    virtual std::uint16_t getMaxImageDataChunkSize() const
+    {
+        return MaxImageDataChunkSize;
+    }
+
+    /**
+     * This method is invoked when the host requests a different bit rate of the serial port;
+     * see BitRateChangeFrameTypeCode. The endpoint rejects the request if this method returns false.
+     * The default implementation does not support bit rate switching.
+     */
+    virtual bool isBitRateSupported(std::uint32_t bit_rate) const
+    {
+        (void) bit_rate;
+        return false;
+    }
+
+    /**
+     * Switches the serial port to the specified bit rate, which is either supported or zero.
+     * Zero means the default bit rate of the port, which must always be restored successfully.
+     * The endpoint may have emitted a frame right before the call; it must leave the port at the old bit rate.
+     * The default implementation does nothing.
+     */
+    virtual void setBitRate(std::uint32_t bit_rate)
+    {
+        (void) bit_rate;
+    }
 };
 
 /**
  * Popcop bootloader endpoint implementation.
  * Either instantiate one instance per available port, or switch the same instance between available ports.
  */
-class PopcopProtocol final : private kocherga::IProtocol
+class PopcopProtocol final
 {
     static constexpr std::chrono::microseconds ImageDataTimeout{10'000'000};  // NOLINT
 
+    static constexpr std::size_t ImageDataHeaderSize = 9;
+
     ::kocherga::BootloaderController& blc_;
     IPopcopPlatform& platform_;
     const popcop::standard::EndpointInfoMessage endpoint_info_prototype_;
 
-    popcop::transport::Parser<> parser_{};
+    popcop::transport::Parser<ImageDataHeaderSize + MaxImageDataChunkSize> parser_{};
 
-    kocherga::IDownloadSink* download_sink_ = nullptr;
+    bool upgrade_in_progress_ = false;
+    kocherga::IDownloadSink* download_sink_ = nullptr;         ///< Nullified when the last chunk is received
     std::int16_t upgrade_status_code_ = 0;
     std::chrono::microseconds last_application_image_data_request_at_{};
 
+    std::uint8_t upload_options_ = 0;
+    std::uint64_t next_image_offset_ = 0;                       ///< The image is contiguous up to this offset
+    std::optional<std::uint64_t> image_size_;                   ///< Set once the last chunk has been committed
 
-    // Sends out one frame, ignores errors
-    template <typename M>
-    void send(const M& message)
+    std::uint32_t bit_rate_ = 0;                               ///< Zero if the port runs at the default bit rate
+    bool bit_rate_verified_ = true;
+    std::chrono::microseconds bit_rate_deadline_{};             ///< Reverting to the default bit rate afterwards
+
+
+    // Sends out one frame; the encoder is invoked with the output iterator
+    template <typename Encoder>
+    void emitFrame(std::uint8_t type_code, const Encoder& encoder)
     {
         struct
         {
@@ -167,8 +367,14 @@ class PopcopProtocol final : private kocherga::IProtocol
         {
             &platform_
         };
-        (void) message.encode(popcop::transport::StreamEmitter(popcop::presentation::StandardFrameTypeCode,
-                                                               sender).begin());
+        encoder(popcop::transport::StreamEmitter(type_code, sender).begin());
+    }
+
+    // Sends out one frame, ignores errors
+    template <typename M>
+    void send(const M& message)
+    {
+        emitFrame(popcop::presentation::StandardFrameTypeCode, [&message](auto it) { (void) message.encode(it); });
     }
 
     void processEndpointInfoRequest()
@@ -234,7 +440,7 @@ class PopcopProtocol final : private kocherga::IProtocol
         }
         case kocherga::State::AppUpgradeInProgress:
         {
-            assert(download_sink_ != nullptr);
+            // The sink may be missing if the upgrade is being performed via a different protocol
             resp.state = popcop::standard::BootloaderState::AppUpgradeInProgress;
             break;
         }
@@ -261,7 +467,7 @@ class PopcopProtocol final : private kocherga::IProtocol
         case popcop::standard::BootloaderState::BootCancelled:
         {
             blc_.cancelBoot();
-            if (download_sink_ != nullptr)
+            if (upgrade_in_progress_)
             {
                 upgrade_status_code_ = -ErrCancelled;
                 // The response will be sent later
@@ -275,15 +481,20 @@ class PopcopProtocol final : private kocherga::IProtocol
 
         case popcop::standard::BootloaderState::AppUpgradeInProgress:
         {
-            if (download_sink_ == nullptr)
+            if (!upgrade_in_progress_)
             {
-                upgrade_status_code_ = 0;
-                last_application_image_data_request_at_ = blc_.getMonotonicUptime();
-
-                // This function blocks for a long time; it will send the response itself
-                (void) blc_.upgradeApp(*this);
+                const auto [res, sink] = blc_.beginAppUpgrade();
+                if (res >= 0)
+                {
+                    upgrade_in_progress_ = true;
+                    download_sink_ = sink;
+                    upgrade_status_code_ = 0;
+                    next_image_offset_ = 0;
+                    image_size_.reset();
+                    last_application_image_data_request_at_ = blc_.getMonotonicUptime();
+                }
 
-                // And then we send another response at the end regardless
+                // Another response will be sent when the upgrade is finished, regardless of its outcome
                 sendBootloaderStatusResponse();
             }
             else
@@ -296,7 +507,7 @@ class PopcopProtocol final : private kocherga::IProtocol
         case popcop::standard::BootloaderState::ReadyToBoot:
         {
             blc_.requestBoot();
-            if (download_sink_ != nullptr)
+            if (upgrade_in_progress_)
             {
                 upgrade_status_code_ = -ErrCancelled;
                 // The response will be sent later
@@ -323,6 +534,68 @@ class PopcopProtocol final : private kocherga::IProtocol
         }
     }
 
+    /// Returns the status of the chunk that is reported back to the host
+    std::int16_t processApplicationImageData(std::uint64_t offset,
+                                             const std::uint8_t* data,
+                                             std::size_t size,
+                                             bool last_chunk)
+    {
+        last_application_image_data_request_at_ = blc_.getMonotonicUptime();
+
+        if (download_sink_ == nullptr)
+        {
+            // The acknowledgement of the last chunk may have been lost, in which case the host sends it again
+            if (last_chunk && image_size_ && ((offset + size) == *image_size_))
+            {
+                return 0;
+            }
+            return -ErrNoUpgrade;
+        }
+
+        if (offset > next_image_offset_)
+        {
+            // A preceding request has been lost, the host will resend the data from the reported offset
+            KOCHERGA_TRACE("Popcop: Image data gap at %llu, expected %llu\n",
+                           static_cast<unsigned long long>(offset),
+                           static_cast<unsigned long long>(next_image_offset_));
+            return -ErrOutOfOrder;
+        }
+
+        if (offset < next_image_offset_)
+        {
+            const std::uint64_t committed = next_image_offset_ - offset;
+            if (committed >= size)
+            {
+                return 0;   // Repeated request whose response did not make it to the host; the data is committed
+            }
+
+            // The request straddles the committed boundary (e.g. the host has changed the chunk size); writing the tail
+            data += committed;
+            size -= std::size_t(committed);
+        }
+
+        if (size > 0)
+        {
+            const auto result = download_sink_->handleNextDataChunk(data, std::uint16_t(size));
+            if (result < 0)
+            {
+                upgrade_status_code_ = result;
+                return result;
+            }
+
+            upgrade_status_code_ = 0;
+            next_image_offset_ += size;
+        }
+
+        if (last_chunk)
+        {
+            download_sink_ = nullptr;       // The upgrade will be finalized in the next step
+            image_size_ = next_image_offset_;
+        }
+
+        return 0;
+    }
+
     void processBootloaderImageDataRequest(const popcop::standard::BootloaderImageDataRequestMessage& req)
     {
         popcop::standard::BootloaderImageDataResponseMessage resp{};
@@ -333,34 +606,21 @@ class PopcopProtocol final : private kocherga::IProtocol
         {
         case popcop::standard::BootloaderImageType::Application:
         {
-            last_application_image_data_request_at_ = blc_.getMonotonicUptime();
-
-            if (download_sink_ != nullptr)
+            // A chunk shorter than the maximum ends the image
+            const std::int16_t status = processApplicationImageData(req.image_offset,
+                                                                    req.image_data.data(),
+                                                                    req.image_data.size(),
+                                                                    req.image_data.size() < req.image_data.max_size());
+            if ((upload_options_ & UploadOptionCompactAcks) != 0)
             {
-                // Observe that we ignore the offset here! The protocol requires that the offset must grow sequentially.
-                // If it doesn't, the downloaded image will be invalid; the bootloader controller will catch that later.
-                if (!req.image_data.empty())
-                {
-                    const auto result = download_sink_->handleNextDataChunk(req.image_data.data(),
-                                                                            std::uint16_t(req.image_data.size()));
-                    if (result >= 0)
-                    {
-                        resp.image_data = req.image_data;
-                        upgrade_status_code_ = 0;
-                    }
-                    else
-                    {
-                        upgrade_status_code_ = result;
-                    }
-                }
-
-                if (req.image_data.size() < req.image_data.max_size())
-                {
-                    // Last chunk received, terminate
-                    download_sink_ = nullptr;
-                }
+                sendImageDataAck(req.image_offset, status, req.image_data.data(), req.image_data.size());
+                return;
             }
 
+            if (status >= 0)
+            {
+                resp.image_data = req.image_data;
+            }
             break;
         }
 
@@ -400,8 +660,187 @@ class PopcopProtocol final : private kocherga::IProtocol
         send(resp);
     }
 
+    void sendImageDataAck(std::uint64_t offset, std::int16_t status, const std::uint8_t* data, std::size_t size)
+    {
+        popcop::transport::CRCComputer crc;
+        crc.add(data, size);
+
+        emitFrame(ImageDataAckFrameTypeCode, [&](auto it)
+        {
+            popcop::presentation::StreamEncoder encoder(it);
+            encoder.addU64(offset);
+            encoder.addI16(status);
+            encoder.addU32(crc.get());
+            encoder.addU64(next_image_offset_);
+        });
+    }
+
+    void processImageDataRequest(const popcop::transport::ParserOutput::AlignedBufferView& payload)
+    {
+        if ((payload.size() < ImageDataHeaderSize) || (payload.size() > (ImageDataHeaderSize + MaxImageDataChunkSize)))
+        {
+            KOCHERGA_TRACE("Popcop: Bad image data len %u\n", unsigned(payload.size()));
+            return;
+        }
+
+        popcop::presentation::StreamDecoder decoder(payload.begin(), payload.end());
+        const std::uint64_t offset = decoder.fetchU64();
+        const bool last_chunk = (decoder.fetchU8() & ImageDataFlagLastChunk) != 0;
+        const std::uint8_t* const data = payload.begin() + ImageDataHeaderSize;
+        const std::size_t size = payload.size() - ImageDataHeaderSize;
+
+        sendImageDataAck(offset, processApplicationImageData(offset, data, size, last_chunk), data, size);
+    }
+
+    void processUploadOptionsRequest(const popcop::transport::ParserOutput::AlignedBufferView& payload)
+    {
+        if (payload.size() < 1)
+        {
+            return;
+        }
+
+        // Unknown flags are dropped, so the host can tell which options are supported from the response
+        popcop::presentation::StreamDecoder decoder(payload.begin(), payload.end());
+        upload_options_ = std::uint8_t(decoder.fetchU8() & UploadOptionCompactAcks);
+
+        const std::uint8_t window = (decoder.getRemainingLength() > 0) ? decoder.fetchU8() : std::uint8_t(1);
+        const std::uint8_t granted_window =
+            std::max<std::uint8_t>(1, std::min(window, platform_.getMaxImageDataWindow()));
+
+        const std::uint16_t chunk_size =
+            (decoder.getRemainingLength() >= 2) ? decoder.fetchU16() : DefaultImageDataChunkSize;
+        const std::uint16_t max_chunk_size =
+            std::clamp(platform_.getMaxImageDataChunkSize(), DefaultImageDataChunkSize, MaxImageDataChunkSize);
+        const std::uint16_t granted_chunk_size = std::clamp(chunk_size, DefaultImageDataChunkSize, max_chunk_size);
+
+        KOCHERGA_TRACE("Popcop: Upload options 0x%02x, window %u, chunk %u\n",
+                       unsigned(upload_options_), unsigned(granted_window), unsigned(granted_chunk_size));
+
+        emitFrame(UploadOptionsFrameTypeCode, [&](auto it)
+        {
+            popcop::presentation::StreamEncoder encoder(it);
+            encoder.addU8(upload_options_);
+            encoder.addU8(granted_window);
+            encoder.addU16(granted_chunk_size);
+        });
+    }
+
+    void processFileReadResponse(const popcop::transport::ParserOutput::AlignedBufferView& payload)
+    {
+        static constexpr std::size_t HeaderSize = 6;
+        static constexpr std::size_t MaxDataSize = 256;
+
+        if ((payload.size() < HeaderSize) || (payload.size() > (HeaderSize + MaxDataSize)))
+        {
+            KOCHERGA_TRACE("Popcop: Bad file read resp len %u\n", unsigned(payload.size()));
+            return;
+        }
+
+        popcop::presentation::StreamDecoder decoder(payload.begin(), payload.end());
+        const std::uint32_t tag = decoder.fetchU32();
+        const std::int16_t error = decoder.fetchI16();
+
+        platform_.processFileReadResponse(tag, error, payload.begin() + HeaderSize,
+                                          std::uint16_t(payload.size() - HeaderSize));
+    }
+
+    void processPeerFirmwareUpdateRequest(const popcop::transport::ParserOutput::AlignedBufferView& payload)
+    {
+        if (payload.size() < 2)
+        {
+            return;
+        }
+
+        popcop::presentation::StreamDecoder decoder(payload.begin(), payload.end());
+        const std::uint8_t node_id = decoder.fetchU8();
+        senoval::String<200> path;
+        while ((decoder.getRemainingLength() > 0) && (path.length() < path.max_size()))
+        {
+            path.push_back(char(decoder.fetchU8()));
+        }
+
+        const std::int16_t result = platform_.processPeerFirmwareUpdateRequest(node_id, path);
+
+        emitFrame(PeerFirmwareUpdateGatewayFrameTypeCode, [&](auto it)
+        {
+            popcop::presentation::StreamEncoder encoder(it);
+            encoder.addU8(node_id);
+            encoder.addI16(result);
+        });
+    }
+
+    void switchBitRate(std::uint32_t bit_rate)
+    {
+        platform_.setBitRate(bit_rate);
+        bit_rate_ = bit_rate;
+        bit_rate_verified_ = (bit_rate == 0);
+        bit_rate_deadline_ = blc_.getMonotonicUptime() + BitRateVerificationTimeout;
+    }
+
+    void processBitRateChangeRequest(const popcop::transport::ParserOutput::AlignedBufferView& payload)
+    {
+        popcop::presentation::StreamDecoder decoder(payload.begin(), payload.end());
+
+        if (payload.size() == 4)
+        {
+            const std::uint32_t bit_rate = decoder.fetchU32();
+            const bool supported = (bit_rate == 0) || platform_.isBitRateSupported(bit_rate);
+            const std::int16_t result = supported ? std::int16_t(0) : std::int16_t(-ErrNotSupported);
+            KOCHERGA_TRACE("Popcop: Bit rate %u req, result %d\n", unsigned(bit_rate), result);
+
+            emitFrame(BitRateChangeFrameTypeCode, [&](auto it)
+            {
+                popcop::presentation::StreamEncoder encoder(it);
+                encoder.addU32(bit_rate);
+                encoder.addI16(result);
+            });
+
+            if (result >= 0)
+            {
+                switchBitRate(bit_rate);
+            }
+        }
+        else if (payload.size() == (4U + BitRateTestPatternSize))
+        {
+            // The pattern can only be intact if the link works at the new bit rate in both directions
+            bool intact = (decoder.fetchU32() == bit_rate_) && (bit_rate_ != 0);
+            for (std::uint16_t i = 0; i < BitRateTestPatternSize; i++)
+            {
+                intact = intact && (decoder.fetchU8() == std::uint8_t(i));
+            }
+
+            if (intact)
+            {
+                bit_rate_verified_ = true;
+                bit_rate_deadline_ = blc_.getMonotonicUptime() + BitRateIdleTimeout;
+                emitFrame(BitRateChangeFrameTypeCode, [&payload](auto it)
+                {
+                    std::copy(payload.begin(), payload.end(), it);
+                });
+            }
+            else if (!bit_rate_verified_)
+            {
+                KOCHERGA_TRACE("Popcop: Bit rate verification failed\n");
+                switchBitRate(0);
+            }
+            else
+            {
+                ;   // Not expected at this time, ignore
+            }
+        }
+        else
+        {
+            KOCHERGA_TRACE("Popcop: Bad bit rate req len %u\n", unsigned(payload.size()));
+        }
+    }
+
     void processFrame(const popcop::transport::ParserOutput::Frame& frame)
     {
+        if ((bit_rate_ != 0) && bit_rate_verified_)
+        {
+            bit_rate_deadline_ = blc_.getMonotonicUptime() + BitRateIdleTimeout;
+        }
+
         if (frame.type_code == popcop::presentation::StandardFrameTypeCode)
         {
             const auto& payload = frame.payload;
@@ -435,6 +874,27 @@ class PopcopProtocol final : private kocherga::IProtocol
                 platform_.processUnhandledFrame(frame);
             }
         }
+        else if (frame.type_code == FileReadGatewayFrameTypeCode)
+        {
+            processFileReadResponse(frame.payload);
+        }
+        else if (frame.type_code == PeerFirmwareUpdateGatewayFrameTypeCode)
+        {
+            KOCHERGA_TRACE("Popcop: Peer FW update req\n");
+            processPeerFirmwareUpdateRequest(frame.payload);
+        }
+        else if (frame.type_code == BitRateChangeFrameTypeCode)
+        {
+            processBitRateChangeRequest(frame.payload);
+        }
+        else if (frame.type_code == UploadOptionsFrameTypeCode)
+        {
+            processUploadOptionsRequest(frame.payload);
+        }
+        else if (frame.type_code == ImageDataFrameTypeCode)
+        {
+            processImageDataRequest(frame.payload);
+        }
         else
         {
             KOCHERGA_TRACE("Popcop: Unhandled app frame type %u\n", frame.type_code);
@@ -442,7 +902,8 @@ class PopcopProtocol final : private kocherga::IProtocol
         }
     }
 
-    void processByte(std::uint8_t byte)
+    /// Returns true if the parser has produced an output (either a frame or extraneous data)
+    bool processByte(std::uint8_t byte)
     {
         const auto out = parser_.processNextByte(byte);
         if (auto frame = out.getReceivedFrame())
@@ -450,53 +911,30 @@ class PopcopProtocol final : private kocherga::IProtocol
             platform_.resetWatchdog();
             processFrame(*frame);
             platform_.resetWatchdog();
+            return true;
         }
         else if (auto ed = out.getExtraneousData())
         {
             platform_.resetWatchdog();
             platform_.processExtraneousData(ed->data(), ed->size());
             platform_.resetWatchdog();
+            return true;
         }
         else
         {
-            ;
-        }
-    }
-
-    void loopOnce()
-    {
-        platform_.resetWatchdog();
-        if (const auto res = platform_.receive())
-        {
-            processByte(*res);
+            return false;
         }
     }
 
-    std::int16_t downloadImage(kocherga::IDownloadSink& sink) final
+    void finishUpgrade(std::int16_t status)
     {
-        assert(download_sink_ == nullptr);
-        assert(upgrade_status_code_ == 0);
+        upgrade_in_progress_ = false;
+        download_sink_ = nullptr;
+        upgrade_status_code_ = 0;
 
-        download_sink_ = &sink;
+        (void) blc_.endAppUpgrade(status);
 
         sendBootloaderStatusResponse();
-
-        while (!platform_.shouldExit() &&
-               (download_sink_ != nullptr) &&
-               (upgrade_status_code_ >= 0))
-        {
-            loopOnce();
-
-            if ((blc_.getMonotonicUptime() - last_application_image_data_request_at_) > ImageDataTimeout)
-            {
-                KOCHERGA_TRACE("Popcop: Timeout\n");
-                upgrade_status_code_ = -ErrTimeout;
-                break;
-            }
-        }
-
-        download_sink_ = nullptr;
-        return upgrade_status_code_;
     }
 
     static popcop::standard::EndpointInfoMessage prepareEndpointInfoMessage(
@@ -520,13 +958,85 @@ public:
      * Runs the endpoint thread.
      * This function never returns unless IPopcopPlatform::shouldExit() returns true.
      * If an RTOS is available, it is advisable to run this method from a separate thread.
-     * Otherwise, it is possible to perform other tasks by hijacking certain platform API functions.
+     * Otherwise, use step() instead.
      */
     void run()
     {
         while (!platform_.shouldExit())
         {
-            loopOnce();
+            step();
+        }
+
+        if (upgrade_in_progress_)
+        {
+            finishUpgrade(-ErrCancelled);
+        }
+
+        if (bit_rate_ != 0)
+        {
+            switchBitRate(0);
+        }
+    }
+
+    /**
+     * Requests a chunk of a file from the host via the file read gateway; see FileReadGatewayFrameTypeCode.
+     * The response, if any, is delivered via IPopcopPlatform::processFileReadResponse() with the same tag.
+     * Must be invoked from the same thread as step() or run().
+     */
+    void sendFileReadRequest(std::uint32_t tag, std::uint64_t offset, const char* path, std::size_t path_length)
+    {
+        emitFrame(FileReadGatewayFrameTypeCode, [&](auto it)
+        {
+            popcop::presentation::StreamEncoder encoder(it);
+            encoder.addU32(tag);
+            encoder.addU64(offset);
+            for (std::size_t i = 0; i < path_length; i++)
+            {
+                encoder.addU8(std::uint8_t(path[i]));
+            }
+        });
+    }
+
+    /**
+     * Performs one iteration of the endpoint and returns; this is an alternative to run() for superloop applications.
+     * Reads the input bytes until either the input buffer is depleted or the parser has produced an output,
+     * then processes it and advances the application upgrade process, if there is one.
+     * The duration of the call is bounded by the time it takes to read one frame and to process it,
+     * assuming that IPopcopPlatform::receive() does not block.
+     */
+    void step()
+    {
+        platform_.resetWatchdog();
+
+        while (const auto res = platform_.receive())
+        {
+            if (processByte(*res))
+            {
+                break;
+            }
+        }
+
+        if (upgrade_in_progress_)
+        {
+            if ((download_sink_ == nullptr) || (upgrade_status_code_ < 0))
+            {
+                finishUpgrade(upgrade_status_code_);
+            }
+            else if ((blc_.getMonotonicUptime() - last_application_image_data_request_at_) > ImageDataTimeout)
+            {
+                KOCHERGA_TRACE("Popcop: Timeout\n");
+                finishUpgrade(-ErrTimeout);
+            }
+            else
+            {
+                ;   // Still downloading
+            }
+        }
+
+        if ((bit_rate_ != 0) && (blc_.getMonotonicUptime() > bit_rate_deadline_))
+        {
+            KOCHERGA_TRACE("Popcop: Bit rate %u timed out, reverting\n", unsigned(bit_rate_));
+            switchBitRate(0);
         }
     }
 };
@@ -32,7 +32,9 @@
 #include <senoval/string.hpp>           // Utility library for embedded systems
 #include <senoval/vector.hpp>           // Utility library for embedded systems
 
+#include <algorithm>
 #include <cstddef>
+#include <limits>
 
 /**
  * This macro can be defined by the application to provide log output from the UAVCAN node.
@@ -52,6 +54,37 @@ namespace kocherga_uavcan
 static constexpr std::int16_t ErrTimeout        = 3001;
 static constexpr std::int16_t ErrInterrupted    = 3002;
 static constexpr std::int16_t ErrFileReadFailed = 3003;
+static constexpr std::int16_t ErrNotReady       = 3004;
+
+/**
+ * Progress of the current or the last firmware download; see BootloaderNode::getDownloadProgress().
+ * The values are reset when the next download is started.
+ */
+struct DownloadProgress
+{
+    std::uint32_t bytes_downloaded = 0;
+    std::uint32_t expected_size = 0;                    ///< Zero if unknown, which is the case with file.Read
+    std::uint32_t throughput = 0;                       ///< Bytes per second, averaged over the last second
+    std::uint32_t retransmission_count = 0;             ///< Timed out file.Read requests or fleet fill-in requests
+    std::chrono::microseconds min_rtt{};                ///< Round trip time of file.Read; zero if not measured
+    std::chrono::microseconds avg_rtt{};
+    std::chrono::microseconds max_rtt{};
+    std::chrono::microseconds storage_write_time{};     ///< Total time spent waiting for the storage backend
+    std::chrono::microseconds elapsed{};                ///< Since the download was started
+};
+
+/**
+ * A uavcan.protocol.file.Read request from a peer that the node cannot serve by itself;
+ * see IUAVCANPlatform::forwardFileReadRequest().
+ */
+struct ForwardedFileReadRequest
+{
+    std::uint8_t requester_node_id = 0;
+    std::uint8_t transfer_id = 0;
+    std::uint8_t priority = 0;
+    std::uint64_t offset = 0;
+    senoval::String<200> path;
+};
 
 /**
  * Abstractions needed to run the UAVCAN node.
@@ -76,7 +109,7 @@ public:
      * CAN acceptance filter configuration.
      * Acceptance filters may be not supported in the underlying driver, this feature is optional.
      * Bit flags used here are the same as in libcanard.
-     * The default constructor makes a filter that accepts all frames.
+     * A value-initialized instance (CANAcceptanceFilterConfig{}) is a filter that accepts all frames.
      */
     struct CANAcceptanceFilterConfig
     {
@@ -84,6 +117,16 @@ public:
         std::uint32_t mask = 0;
     };
 
+    /**
+     * A frame shall be accepted if it matches any of the filters in the list.
+     * The list never contains more than MaxCANAcceptanceFilters entries; its size depends on the state of the node.
+     * If the hardware cannot accommodate all of them, the implementation may accept a superset of the specified
+     * frames (up to accepting all frames), because the node filters the received transfers in software anyway;
+     * but it shall never reject a frame that matches one of the filters.
+     */
+    static constexpr std::uint8_t MaxCANAcceptanceFilters = 8;
+    using CANAcceptanceFilterList = senoval::Vector<CANAcceptanceFilterConfig, MaxCANAcceptanceFilters>;
+
     virtual ~IUAVCANPlatform() = default;
 
     /**
@@ -110,17 +153,45 @@ public:
                                                    std::uint64_t upper_bound) const = 0;
 
     /**
-     * Initializes the CAN hardware in the specified mode.
-     * Observe that this implementation needs only one acceptance filter.
+     * Returns the number of redundant CAN interfaces available; the maximum is 8.
+     * All interfaces must be connected to the same logical bus: the node transmits every frame via every interface,
+     * and accepts each transfer from whichever interface delivers it first (this requires CANARD_MULTI_IFACE).
+     * Implementation is optional; the default implementation reports one interface.
+     */
+    virtual std::uint8_t getNumberOfInterfaces() const
+    {
+        return 1;
+    }
+
+    /**
+     * Returns the data phase bit rate to use with the specified nominal (arbitration phase) bit rate if the
+     * interfaces should operate in CAN FD mode, or zero if classic CAN should be used.
+     * If the returned value differs from the nominal bit rate, bit rate switching is used.
+     * CAN FD frames carry up to 64 bytes of payload; support for them requires CANARD_ENABLE_CANFD.
+     * Implementation is optional; the default implementation selects classic CAN.
+     */
+    virtual std::uint32_t getCANFDDataBitRate(std::uint32_t nominal_bit_rate) const
+    {
+        (void) nominal_bit_rate;
+        return 0;
+    }
+
+    /**
+     * Initializes the CAN hardware in the specified mode. All available interfaces must be initialized.
+     * If data_bit_rate is nonzero, the interfaces must be configured for CAN FD with the specified data phase
+     * bit rate (see getCANFDDataBitRate()); otherwise they must be configured for classic CAN.
+     * The acceptance filters are derived from the set of data types the node is interested in at the moment;
+     * see CANAcceptanceFilterList for the requirements.
      * @retval 0                Success
      * @retval negative         Error
      */
     virtual std::int16_t configure(std::uint32_t bitrate,
+                                   std::uint32_t data_bit_rate,
                                    CANMode mode,
-                                   const CANAcceptanceFilterConfig& acceptance_filter) = 0;
+                                   const CANAcceptanceFilterList& acceptance_filters) = 0;
 
     /**
-     * Transmits one CAN frame.
+     * Transmits one CAN frame via the interface specified in the field iface_id of the frame.
      *
      * @retval      1               Transmitted successfully
      * @retval      0               Timed out
@@ -129,13 +200,27 @@ public:
     virtual std::int16_t send(const ::CanardCANFrame& frame, std::chrono::microseconds timeout) = 0;
 
     /**
-     * Reads one CAN frame from the RX queue.
+     * A CAN frame received from the bus, along with the time of its reception.
+     * The timestamp should be captured as close to the actual reception as possible, e.g. by the driver in the RX
+     * interrupt, or by the hardware where supported; it must use the same time base as
+     * kocherga::IPlatform::getMonotonicUptime(). Zero means that the timestamp is not available, in which case
+     * the node uses the time when the frame was read from the platform.
+     */
+    struct ReceivedCANFrame
+    {
+        ::CanardCANFrame frame;
+        std::chrono::microseconds timestamp;
+    };
+
+    /**
+     * Reads one CAN frame from the RX queue of any interface.
+     * The field iface_id of the returned frame must be set to the index of the interface it was received from.
      * Return integer values:
      * @retval      1               Read successfully; the second value contains a valid CAN frame object.
      * @retval      0               Timed out
      * @retval      negative        Error
      */
-    virtual std::pair<std::int16_t, ::CanardCANFrame> receive(std::chrono::microseconds timeout) = 0;
+    virtual std::pair<std::int16_t, ReceivedCANFrame> receive(std::chrono::microseconds timeout) = 0;
 
     /**
      * This method is invoked by the node periodically to check if it should terminate.
@@ -147,11 +232,42 @@ public:
      * Returns true on success, false if reboot cannot be performed.
      */
     virtual bool tryScheduleReboot() = 0;
+
+    /**
+     * Invoked by the node once the CAN bus bit rate and the local node ID are determined and confirmed.
+     * The application can keep these parameters in a memory that survives reset and supply them to
+     * BootloaderNode::run() on the next start-up, which allows the node to skip bit rate detection and
+     * dynamic node ID allocation. Implementation is optional; the default implementation does nothing.
+     */
+    virtual void onBusParametersConfirmed(std::uint32_t can_bus_bit_rate, std::uint8_t node_id)
+    {
+        (void) can_bus_bit_rate;
+        (void) node_id;
+    }
+
+    /**
+     * Invoked by the node when a peer requests a file via uavcan.protocol.file.Read that the node does not serve
+     * by itself. This allows the node to act as a gateway: the application may forward the request elsewhere,
+     * e.g. to a host over a serial link, and deliver the response later via BootloaderNode::respondToFileRead().
+     * Any number of requests may be in flight at once; the peers retry the ones that are never responded to.
+     * Returns true if the request has been forwarded; otherwise the node reports that the file is not found.
+     * Implementation is optional; the default implementation does not forward anything.
+     */
+    virtual bool forwardFileReadRequest(const ForwardedFileReadRequest& request)
+    {
+        (void) request;
+        return false;
+    }
 };
 
 
 using NodeName = senoval::String<80>;
 
+/**
+ * Bit mask type with one bit per CAN interface; its width limits the number of interfaces the node can use.
+ */
+using InterfaceMask = std::uint8_t;
+
 struct HardwareInfo
 {
     std::uint8_t major = 0;                                     ///< Required field
@@ -179,6 +295,131 @@ static constexpr std::chrono::microseconds DefaultServiceRequestTimeout{1'000'00
  */
 static constexpr std::chrono::microseconds DefaultProgressReportInterval{10'000'000};  // NOLINT
 
+/**
+ * The lower bound of the adaptive FileRead response timeout; the upper bound is DefaultServiceRequestTimeout.
+ */
+static constexpr std::chrono::microseconds MinFileReadTimeout{20'000};  // NOLINT
+
+/**
+ * The adaptive FileRead response timeout exceeds the smoothed RTT by at least this much, like the clock granularity
+ * term of RFC 6298; otherwise a steady RTT drives the variation estimate to zero and the timeout down to the RTT.
+ */
+static constexpr std::chrono::microseconds MinFileReadTimeoutMargin{5'000};  // NOLINT
+
+/**
+ * A FileRead request that has timed out is retransmitted up to this many times before the download is aborted.
+ */
+static constexpr std::uint8_t MaxFileReadRetransmissions = 5;
+
+/**
+ * See uavcan.protocol.file.Error.
+ */
+static constexpr std::int16_t FileErrorNotFound     = 2;
+static constexpr std::int16_t FileErrorIO           = 5;
+static constexpr std::int16_t FileErrorInvalidValue = 22;
+
+/**
+ * How long the node listens to the bus before using a node ID that was not supplied by the application.
+ * Must exceed the maximum NodeStatus broadcasting interval defined by the specification (1 second),
+ * so that every active node on the bus is heard at least once.
+ */
+static constexpr std::chrono::microseconds NodeIDConflictCheckDuration{1'100'000};  // NOLINT
+
+/**
+ * If a frame has been transmitted via at least one interface, the other interfaces are given this much time
+ * to accept it; afterwards the frame is abandoned on them. This keeps a congested or faulty bus from stalling
+ * the communication over the healthy ones.
+ */
+static constexpr std::chrono::microseconds RedundantFrameTransmissionTimeout{100'000};  // NOLINT
+
+/**
+ * Fleet distribution: the image is broadcast in chunks of this size (except the last one), aligned at it.
+ */
+static constexpr std::uint16_t FleetChunkSize = 256;
+
+/**
+ * Fleet distribution: if no chunk has been received for this long, the stream is considered finished or paused,
+ * and the node begins requesting the missing ranges.
+ */
+static constexpr std::chrono::microseconds FleetStreamIdleTimeout{1'000'000};  // NOLINT
+
+/**
+ * Fleet distribution: the download is aborted after this many fill-in requests that yielded no new data.
+ */
+static constexpr std::uint8_t FleetMaxFillInAttempts = 10;
+
+/**
+ * Fleet distribution: the maximum number of chunks requested by one fill-in request.
+ */
+static constexpr std::uint8_t FleetMaxChunksPerFillInRequest = 16;
+
+/**
+ * The bit rates tried by the autodetection, in this order.
+ * These are defined by the specification; 100 Kbps is added due to its popularity.
+ */
+static constexpr std::array<std::uint32_t, 5> StandardCANBitRates
+{{
+    1000000,        ///< Standard, recommended by UAVCAN
+     500000,        ///< Standard
+     250000,        ///< Standard
+     125000,        ///< Standard
+     100000         ///< Popular bit rate that is not defined by the specification
+}};
+
+/**
+ * How long the autodetection listens to the bus at each bit rate.
+ */
+static constexpr std::chrono::microseconds CANBitRateDetectionListeningDuration{1'100'000};  // NOLINT
+
+/**
+ * The node doesn't access the CAN driver for this long after a driver error.
+ */
+static constexpr std::chrono::microseconds DriverErrorRecoveryDelay{1'000'000};  // NOLINT
+
+
+/**
+ * Derives the service response timeout from the measured round trip times, like the TCP retransmission timer
+ * (RFC 6298). Until the first measurement is available, the default timeout defined by the specification is used.
+ */
+class ResponseTimeoutEstimator
+{
+    std::chrono::microseconds smoothed_rtt_{};
+    std::chrono::microseconds rtt_variation_{};
+    bool has_samples_ = false;
+
+public:
+    /**
+     * Samples must be taken only from requests that were not retransmitted (Karn's algorithm).
+     */
+    void addSample(const std::chrono::microseconds rtt)
+    {
+        if (has_samples_)
+        {
+            const auto deviation = (smoothed_rtt_ > rtt) ? (smoothed_rtt_ - rtt) : (rtt - smoothed_rtt_);
+            rtt_variation_ = (rtt_variation_ * 3 + deviation) / 4;
+            smoothed_rtt_  = (smoothed_rtt_ * 7 + rtt) / 8;
+        }
+        else
+        {
+            smoothed_rtt_  = rtt;
+            rtt_variation_ = rtt / 2;
+            has_samples_ = true;
+        }
+    }
+
+    std::chrono::microseconds getTimeout() const
+    {
+        if (!has_samples_)
+        {
+            return DefaultServiceRequestTimeout;
+        }
+
+        return std::clamp(smoothed_rtt_ + std::max(rtt_variation_ * 4, MinFileReadTimeoutMargin),
+                          MinFileReadTimeout,
+                          DefaultServiceRequestTimeout);
+    }
+};
+
 
 namespace dsdl
 {
@@ -188,6 +429,81 @@ static inline constexpr std::uint16_t bitlen2bytelen(std::uint32_t x) noexcept
     return std::uint16_t((x + 7) / 8);
 }
 
+/**
+ * A scalar field at a fixed position in the serialized representation of a data type.
+ * The position is checked against the maximum encoded length of the type at compile time, and so is the width
+ * of the value type. The encoding method is selected at compile time as well: byte-aligned fields are written
+ * with plain byte stores, fields that fit within one byte are merged into it with a constant mask,
+ * and only the remaining ones are handed over to the generic bit copy routine of libcanard.
+ * The bit order matches that of canardEncodeScalar().
+ */
+template <std::uint32_t BitOffset, std::uint8_t BitLength, std::uint32_t MaxEncodedBitLength>
+struct ScalarField
+{
+    static_assert((BitLength > 0) && (BitLength <= 64), "Invalid field length");
+    static_assert((BitOffset + BitLength) <= MaxEncodedBitLength, "The field does not fit into the data type");
+
+    template <typename T>
+    static void encode(std::uint8_t* const buffer, const T value)
+    {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "Only scalars can be encoded");
+        static_assert((sizeof(T) * 8U) >= BitLength, "The value type is too narrow for the field");
+
+        constexpr std::uint32_t ByteOffset = BitOffset / 8U;
+        constexpr std::uint8_t  BitShift   = BitOffset % 8U;
+        const auto bits = std::uint64_t(value);
+
+        if constexpr ((BitShift == 0) && ((BitLength % 8U) == 0))
+        {
+            for (std::uint8_t i = 0; i < (BitLength / 8U); i++)
+            {
+                buffer[ByteOffset + i] = std::uint8_t(bits >> (i * 8U));
+            }
+        }
+        else if constexpr ((BitShift + BitLength) <= 8U)
+        {
+            constexpr std::uint8_t Shift = std::uint8_t(8U - BitShift - BitLength);
+            constexpr std::uint8_t Mask = std::uint8_t(((1U << BitLength) - 1U) << Shift);
+            constexpr std::uint8_t InverseMask = std::uint8_t(~Mask);
+            const auto field = std::uint8_t((bits << Shift) & Mask);
+            buffer[ByteOffset] = std::uint8_t((buffer[ByteOffset] & InverseMask) | field);
+        }
+        else
+        {
+            using Storage = std::conditional_t<(BitLength <= 16), std::uint16_t,
+                            std::conditional_t<(BitLength <= 32), std::uint32_t, std::uint64_t>>;
+            const auto storage = Storage(bits);
+            ::canardEncodeScalar(buffer, BitOffset, BitLength, &storage);
+        }
+    }
+};
+
+/**
+ * A byte array at a fixed byte-aligned position, either with an explicit length prefix placed elsewhere,
+ * or at the end of the data type, in which case its length is implied by the length of the transfer.
+ */
+template <std::uint32_t BitOffset, std::uint16_t MaxLength, std::uint32_t MaxEncodedBitLength>
+struct ByteArrayField
+{
+    static_assert((BitOffset % 8U) == 0, "Byte arrays must be byte-aligned");
+    static_assert((BitOffset + MaxLength * 8U) <= MaxEncodedBitLength, "The field does not fit into the data type");
+
+    static constexpr std::uint16_t ByteOffset = std::uint16_t(BitOffset / 8U);
+    static constexpr std::uint16_t Capacity   = MaxLength;
+
+    /// Returns the offset of the end of the array, which is the size of the encoded data if the array is the last field
+    static std::uint16_t encode(std::uint8_t* const buffer, const void* const data, const std::size_t length)
+    {
+        assert(length <= MaxLength);
+        const auto len = std::uint16_t(std::min<std::size_t>(length, MaxLength));
+        if (len > 0)
+        {
+            std::memmove(&buffer[ByteOffset], data, len);
+        }
+        return std::uint16_t(ByteOffset + len);
+    }
+};
+
 template <std::uint32_t DataTypeID_,
           std::uint64_t DataTypeSignature_,     // Not to be confused with DSDL signature
           std::uint32_t MaxEncodedBitLength_>
@@ -197,6 +513,12 @@ struct MessageTypeInfo
     static constexpr std::uint64_t DataTypeSignature    = DataTypeSignature_;
 
     static constexpr std::uint16_t MaxSizeBytes         = bitlen2bytelen(MaxEncodedBitLength_);
+
+    template <std::uint32_t BitOffset, std::uint8_t BitLength>
+    using Field = ScalarField<BitOffset, BitLength, MaxEncodedBitLength_>;
+
+    template <std::uint32_t BitOffset, std::uint16_t MaxLength>
+    using Bytes = ByteArrayField<BitOffset, MaxLength, MaxEncodedBitLength_>;
 };
 
 template <std::uint32_t DataTypeID_,
@@ -211,17 +533,104 @@ struct ServiceTypeInfo
     static constexpr std::uint16_t MaxSizeBytesRequest          = bitlen2bytelen(MaxEncodedBitLengthRequest_);
 
     static constexpr std::uint16_t MaxSizeBytesResponse         = bitlen2bytelen(MaxEncodedBitLengthResponse_);
+
+    template <std::uint32_t BitOffset, std::uint8_t BitLength>
+    using RequestField = ScalarField<BitOffset, BitLength, MaxEncodedBitLengthRequest_>;
+
+    template <std::uint32_t BitOffset, std::uint16_t MaxLength>
+    using RequestBytes = ByteArrayField<BitOffset, MaxLength, MaxEncodedBitLengthRequest_>;
+
+    template <std::uint32_t BitOffset, std::uint8_t BitLength>
+    using ResponseField = ScalarField<BitOffset, BitLength, MaxEncodedBitLengthResponse_>;
+
+    template <std::uint32_t BitOffset, std::uint16_t MaxLength>
+    using ResponseBytes = ByteArrayField<BitOffset, MaxLength, MaxEncodedBitLengthResponse_>;
 };
 
 // The values have been obtained with the help of the script show_data_type_info.py from libcanard.
-using NodeStatus                = MessageTypeInfo<  341U, 0x0f0868d0c1a7c6f1ULL,    56U>;
-using NodeIDAllocation          = MessageTypeInfo<    1U, 0x0b2a812620a11d40ULL,   141U>;
-using LogMessage                = MessageTypeInfo<16383U, 0xd654a48e0c049d75ULL,   983U>;
+// Only the fields that are encoded by the node are defined.
+struct NodeStatus : public MessageTypeInfo<341U, 0x0f0868d0c1a7c6f1ULL, 56U>
+{
+    using Uptime                    = Field< 0, 32>;
+    using Health                    = Field<32,  2>;
+    using Mode                      = Field<34,  3>;
+    using VendorSpecificStatusCode  = Field<40, 16>;
+};
+
+struct NodeIDAllocation : public MessageTypeInfo<1U, 0x0b2a812620a11d40ULL, 141U>
+{
+    using NodeID                    = Field<0, 7>;
+    using FirstPartOfUniqueID       = Field<7, 1>;
+    using UniqueID                  = Bytes<8, 16>;
+};
+
+struct LogMessage : public MessageTypeInfo<16383U, 0xd654a48e0c049d75ULL, 983U>
+{
+    using Level                     = Field<0, 3>;
+    using SourceLength              = Field<3, 5>;
+    using Source                    = Bytes<8, 31>;         // Followed by the text
+};
+
+struct GetNodeInfo : public ServiceTypeInfo<1U, 0xee468a8121c46a9eULL, 0U, 3015U>
+{
+    static constexpr std::uint32_t SoftwareVersionOffset = 56;
+    static constexpr std::uint32_t HardwareVersionOffset = 176;
+
+    using SoftwareMajor             = ResponseField<SoftwareVersionOffset +   0,  8>;
+    using SoftwareMinor             = ResponseField<SoftwareVersionOffset +   8,  8>;
+    using SoftwareOptionalFlags     = ResponseField<SoftwareVersionOffset +  16,  8>;
+    using SoftwareVCSCommit         = ResponseField<SoftwareVersionOffset +  24, 32>;
+    using SoftwareImageCRC          = ResponseField<SoftwareVersionOffset +  56, 64>;
+
+    using HardwareMajor             = ResponseField<HardwareVersionOffset +   0,  8>;
+    using HardwareMinor             = ResponseField<HardwareVersionOffset +   8,  8>;
+    using HardwareUniqueID          = ResponseBytes<HardwareVersionOffset +  16, 16>;
+    using CoALength                 = ResponseField<HardwareVersionOffset + 144,  8>;
+    using CoA                       = ResponseBytes<HardwareVersionOffset + 152, 255>;     // Followed by the name
+};
+
+struct BeginFirmwareUpdate : public ServiceTypeInfo<40U, 0xb7d725df72724126ULL, 1616U, 1031U>
+{
+    using SourceNodeID              = RequestField<0, 8>;
+    using ImageFilePath             = RequestBytes<8, 200>;
+};
+
+struct FileRead : public ServiceTypeInfo<48U, 0x8dcdca939f33f678ULL, 1648U, 2073U>
+{
+    using Offset                    = RequestField<0, 40>;
+    using Path                      = RequestBytes<40, 200>;
+    using Error                     = ResponseField<0, 16>;
+    using Data                      = ResponseBytes<16, 256>;
+};
+
+struct RestartNode : public ServiceTypeInfo<5U, 0x569e05394a3017f0ULL, 40U, 1U>
+{
+    using OK                        = ResponseField<0, 1>;
+};
 
-using GetNodeInfo               = ServiceTypeInfo<    1U, 0xee468a8121c46a9eULL,     0U,  3015U>;
-using BeginFirmwareUpdate       = ServiceTypeInfo<   40U, 0xb7d725df72724126ULL,  1616U,  1031U>;
-using FileRead                  = ServiceTypeInfo<   48U, 0x8dcdca939f33f678ULL,  1648U,  2073U>;
-using RestartNode               = ServiceTypeInfo<    5U, 0x569e05394a3017f0ULL,    40U,     1U>;
+// Vendor-specific types used for fleet firmware distribution; refer to BootloaderNode for the definitions.
+using FleetFirmwareChunk = MessageTypeInfo<20100U, 0x1249aca4f0c8bf8dULL, 2249U>;
+
+struct FleetFirmwareChunkRequest : public MessageTypeInfo<20101U, 0x85e96a081b26c65cULL, 128U>
+{
+    using ImageCRC                  = Field< 0, 64>;
+    using Offset                    = Field<64, 32>;
+    using Length                    = Field<96, 32>;
+};
+
+// Vendor-specific type used for download telemetry; refer to BootloaderNode for the definition.
+struct DownloadProgress : public MessageTypeInfo<20102U, 0xa72ee1ed8ad6437aULL, 288U>
+{
+    using BytesDownloaded           = Field<  0, 32>;
+    using ExpectedSize              = Field< 32, 32>;
+    using Throughput                = Field< 64, 32>;
+    using RetransmissionCount       = Field< 96, 32>;
+    using MinRTT                    = Field<128, 32>;
+    using AvgRTT                    = Field<160, 32>;
+    using MaxRTT                    = Field<192, 32>;
+    using StorageWriteTime          = Field<224, 32>;
+    using Elapsed                   = Field<256, 32>;
+};
 
 
 enum class NodeHealth : std::uint8_t
@@ -249,8 +658,71 @@ enum class LogLevel : std::uint8_t
     Error   = 3,
 };
 
+/**
+ * Number of memory pool blocks occupied by a transfer of the specified size while it is being received:
+ * the reassembly state that also holds the head of the payload, plus the buffer blocks for the rest.
+ */
+constexpr std::size_t computeRxTransferBlockCount(const std::size_t payload_size)
+{
+    return 1U + ((payload_size > CANARD_MULTIFRAME_RX_PAYLOAD_HEAD_SIZE) ?
+                 ((payload_size - CANARD_MULTIFRAME_RX_PAYLOAD_HEAD_SIZE + CANARD_BUFFER_BLOCK_DATA_SIZE - 1U) /
+                  CANARD_BUFFER_BLOCK_DATA_SIZE) : 0U);
+}
+
+/**
+ * Number of memory pool blocks occupied by a transfer of the specified size while it is waiting in the
+ * transmission queue, which is one per frame. Classic CAN frames are assumed, since they yield the most frames.
+ */
+constexpr std::size_t computeTxTransferBlockCount(const std::size_t payload_size)
+{
+    return (payload_size < CANARD_CAN_FRAME_MAX_DATA_LEN) ? 1U :
+           ((payload_size + 2U + CANARD_CAN_FRAME_MAX_DATA_LEN - 2U) / (CANARD_CAN_FRAME_MAX_DATA_LEN - 1U));
+}
+
 }       // namespace impl_
 
+/**
+ * Returns the size of the memory pool, in bytes, that BootloaderNode<>, configured with the same MaxFleetImageSize,
+ * needs in the worst case: every transfer the node can emit is waiting in the transmission queue at the same time,
+ * and every transfer the node accepts is being received concurrently, from one remote node per data type.
+ * The exception is the FileRead requests from the peers that download the installed image from this node
+ * (or whose requests are forwarded by the application): up to MaxConcurrentFileReadPeers of them are served
+ * concurrently, each with a request being received and a response waiting in the transmission queue.
+ * The requests of any further peers may be dropped for the lack of memory; the peers retransmit them later.
+ * The result can be used directly as the MemoryPoolSize template argument. The actual usage can be checked at
+ * run time using BootloaderNode<>::getMemoryPoolStatistics().
+ */
+template <std::size_t MaxFleetImageSize = 0, std::size_t MaxConcurrentFileReadPeers = 1>
+constexpr std::size_t computeWorstCaseMemoryPoolSize()
+{
+    namespace dsdl = impl_::dsdl;
+    constexpr bool Fleet = MaxFleetImageSize > 0;
+
+    const std::size_t tx_blocks =
+        impl_::computeTxTransferBlockCount(dsdl::NodeStatus::MaxSizeBytes) +
+        impl_::computeTxTransferBlockCount(dsdl::NodeIDAllocation::MaxSizeBytes) +
+        impl_::computeTxTransferBlockCount(dsdl::LogMessage::MaxSizeBytes) +
+        impl_::computeTxTransferBlockCount(dsdl::DownloadProgress::MaxSizeBytes) +
+        impl_::computeTxTransferBlockCount(dsdl::GetNodeInfo::MaxSizeBytesResponse) +
+        impl_::computeTxTransferBlockCount(dsdl::BeginFirmwareUpdate::MaxSizeBytesRequest) +
+        impl_::computeTxTransferBlockCount(dsdl::BeginFirmwareUpdate::MaxSizeBytesResponse) +
+        impl_::computeTxTransferBlockCount(dsdl::FileRead::MaxSizeBytesRequest) +
+        impl_::computeTxTransferBlockCount(dsdl::FileRead::MaxSizeBytesResponse) * MaxConcurrentFileReadPeers +
+        impl_::computeTxTransferBlockCount(dsdl::RestartNode::MaxSizeBytesResponse) +
+        (Fleet ? impl_::computeTxTransferBlockCount(dsdl::FleetFirmwareChunkRequest::MaxSizeBytes) : 0U);
+
+    const std::size_t rx_blocks =
+        impl_::computeRxTransferBlockCount(dsdl::NodeIDAllocation::MaxSizeBytes) +
+        impl_::computeRxTransferBlockCount(dsdl::GetNodeInfo::MaxSizeBytesRequest) +
+        impl_::computeRxTransferBlockCount(dsdl::BeginFirmwareUpdate::MaxSizeBytesRequest) +
+        impl_::computeRxTransferBlockCount(dsdl::FileRead::MaxSizeBytesRequest) * MaxConcurrentFileReadPeers +
+        impl_::computeRxTransferBlockCount(dsdl::FileRead::MaxSizeBytesResponse) +
+        impl_::computeRxTransferBlockCount(dsdl::RestartNode::MaxSizeBytesRequest) +
+        (Fleet ? impl_::computeRxTransferBlockCount(dsdl::FleetFirmwareChunk::MaxSizeBytes) : 0U);
+
+    return (tx_blocks + rx_blocks) * CANARD_MEM_BLOCK_SIZE;
+}
+
 /**
  * A UAVCAN node that is useful solely for the purpose of firmware update.
  *
@@ -258,28 +730,120 @@ enum class LogLevel : std::uint8_t
  * Avoid reading this code unless you've familiarized yourself with the UAVCAN specification.
  *
  * The API is thread-safe.
+ *
+ * The node can be run either in its own thread via run(), or from a superloop together with other tasks:
+ * invoke start() once, then invoke step() continuously; step() never blocks.
+ *
+ * Besides the standard unicast update via uavcan.protocol.file.Read, the node supports fleet distribution,
+ * which allows a file server to update any number of identical nodes by streaming the image over the bus once.
+ * It is enabled by setting MaxFleetImageSize to the maximum size of the image; zero disables the feature.
+ * The following vendor-specific data types are used:
+ *
+ *      # com.zubax.kocherga.FleetFirmwareChunk (message, ID 20100), broadcast by the file server
+ *      uint64 hardware_class_id        # See getFleetHardwareClassID()
+ *      uint64 image_crc                # CRC-64-WE from the application descriptor of the image
+ *      uint32 image_size
+ *      uint32 offset                   # Multiple of 256
+ *      uint8[<=256] data               # Exactly 256 bytes unless this is the last chunk of the image
+ *
+ *      # com.zubax.kocherga.FleetFirmwareChunkRequest (message, ID 20101), broadcast by the node
+ *      uint64 image_crc
+ *      uint32 offset
+ *      uint32 length
+ *
+ * A node that has no valid application joins the stream of its hardware class on its own. A node that has one joins
+ * the stream only upon a BeginFirmwareUpdate request that names the streaming server as the file server and arrives
+ * while the stream is on (the path is ignored then), otherwise any node on the bus could replace the application
+ * by broadcasting an image. The image that is already installed is never downloaded again from the stream.
+ * The node writes the chunks as they arrive, and keeps track of them in a coverage bitmap. Once the stream stops,
+ * the node requests the missing ranges; the server is expected to re-broadcast them as regular chunks,
+ * which benefits every other node that has missed them as well.
+ *
+ * While the image is being downloaded, the node reports the progress once per second via the following
+ * vendor-specific message, and once more when the download is finished:
+ *
+ *      # com.zubax.kocherga.DownloadProgress (message, ID 20102), broadcast by the node
+ *      uint32 bytes_downloaded
+ *      uint32 expected_size            # Zero if unknown
+ *      uint32 throughput               # Bytes per second, averaged over the last second
+ *      uint32 retransmission_count     # Timed out file.Read requests or fleet fill-in requests
+ *      uint32 min_rtt                  # Round trip time of file.Read, microseconds; zero if not measured
+ *      uint32 avg_rtt
+ *      uint32 max_rtt
+ *      uint32 storage_write_time       # Total time spent waiting for the storage backend, microseconds
+ *      uint32 elapsed                  # Since the download was started, milliseconds
+ *
+ * The vendor-specific status code of NodeStatus contains the amount of data downloaded so far, in KiB,
+ * while the download is in progress; the absolute value of the error code if the last upgrade has failed;
+ * and zero otherwise.
+ *
+ * Once an image downloaded via uavcan.protocol.file.Read has been installed and verified, the node serves it to
+ * other nodes via the same service under the same path, reading it from the ROM. This allows a file server to
+ * direct the BeginFirmwareUpdate requests of the remaining nodes to the already updated ones, so that the update
+ * capacity of the network grows with every updated node. The image is available while the node stays in the
+ * bootloader, i.e. during the boot delay or after the boot has been cancelled.
+ *
+ * The requests for any other file can be forwarded by the application elsewhere, see
+ * IUAVCANPlatform::forwardFileReadRequest(). Together with requestPeerFirmwareUpdate(), this turns the node into
+ * a gateway that updates the entire bus from a file server that is not connected to the bus directly,
+ * e.g. a host computer connected to the node via a serial link.
  */
-template <std::size_t MemoryPoolSize = 8192>
-class BootloaderNode final : private ::kocherga::IProtocol
+template <std::size_t MemoryPoolSize = 8192, std::size_t MaxFleetImageSize = 0>
+class BootloaderNode final
 {
+    static constexpr std::size_t MaxFleetChunks =
+        (MaxFleetImageSize + impl_::FleetChunkSize - 1U) / impl_::FleetChunkSize;
+
     ::kocherga::BootloaderController& bootloader_;
     IUAVCANPlatform& platform_;
 
     const NodeName node_name_;
     const HardwareInfo hw_info_;
+    const std::uint64_t fleet_hardware_class_id_;
+
+    enum class Phase : std::uint8_t
+    {
+        CANBitRateDetection,
+        NodeIDConflictCheck,
+        NodeIDAllocation,
+        Operational,                ///< Waiting for an update request
+        Downloading,                ///< Downloading via uavcan.protocol.file.Read
+        FleetDownloading            ///< Receiving the fleet distribution stream
+    };
+
+    /// Stages of the unicast download; every stage is left as soon as its condition is met
+    enum class DownloadStage : std::uint8_t
+    {
+        SendRequest,
+        AwaitResponse,
+        Pause                       ///< Waiting in order to avoid bus congestion
+    };
+
+    static constexpr std::int16_t InProgress = 1;
 
     std::chrono::microseconds next_1hz_task_invocation_at_{};
     bool init_done_ = false;
 
+    Phase phase_ = Phase::CANBitRateDetection;
+    bool can_configured_ = false;                       ///< CAN is configured as required by the current phase
+    std::chrono::microseconds phase_deadline_{};
+    std::chrono::microseconds resume_at_{};             ///< The node is idle until then, e.g. after a driver error
+    std::uint8_t can_bit_rate_detection_index_ = 0;
+    bool node_id_conflict_check_bus_active_ = false;
+
     alignas(std::max_align_t) std::array<std::uint8_t, MemoryPoolSize> memory_pool_{};
     ::CanardInstance canard_{};
 
     std::uint32_t can_bus_bit_rate_ = 0;
     std::uint8_t confirmed_local_node_id_ = 0;          ///< This field is needed in order to avoid mutexes
+    std::uint8_t tentative_local_node_id_ = 0;          ///< Cached node ID that is yet to be checked for conflicts
 
     std::uint8_t remote_server_node_id_ = 0;
     senoval::String<200> firmware_file_path_;
 
+    bool serving_installed_file_ = false;               ///< The installed image is served to other nodes
+    senoval::String<200> installed_file_path_;
+
     std::chrono::microseconds send_next_node_id_allocation_request_at_{};
     std::uint8_t node_id_allocation_unique_id_offset_ = 0;
 
@@ -289,9 +853,53 @@ class BootloaderNode final : private ::kocherga::IProtocol
     std::uint8_t node_id_allocation_transfer_id_ = 0;
     std::uint8_t log_message_transfer_id_ = 0;
     std::uint8_t file_read_transfer_id_ = 0;
+    std::uint8_t begin_firmware_update_transfer_id_ = 0;
 
     std::array<std::uint8_t, 256> read_buffer_{};
     std::int16_t read_result_ = 0;
+    std::chrono::microseconds read_response_timestamp_{};
+    std::chrono::microseconds rx_frame_timestamp_{};    ///< Of the frame being processed, i.e., the last of a transfer
+
+    ::kocherga::IDownloadSink* download_sink_ = nullptr;  ///< Set while the image is being downloaded via file.Read
+    DownloadStage download_stage_ = DownloadStage::SendRequest;
+    std::uint64_t download_offset_ = 0;
+    impl_::ResponseTimeoutEstimator download_timeout_estimator_;
+    std::chrono::microseconds download_response_timeout_{};
+    std::uint8_t download_retransmission_count_ = 0;
+    std::chrono::microseconds download_request_sent_at_{};
+    std::chrono::microseconds download_stage_deadline_{};
+    std::chrono::microseconds next_progress_report_at_{};
+
+    DownloadProgress download_progress_;
+    std::chrono::microseconds download_started_at_{};
+    std::chrono::microseconds download_rtt_sum_{};
+    std::uint32_t download_rtt_count_ = 0;
+    std::uint32_t download_progress_bytes_at_last_report_ = 0;
+    std::chrono::microseconds download_progress_last_report_at_{};
+    std::uint8_t download_progress_transfer_id_ = 0;
+
+    std::uint8_t num_ifaces_ = 1;
+    ::CanardCANFrame pending_tx_frame_{};
+    InterfaceMask pending_tx_iface_mask_ = 0;             ///< Interfaces the pending frame is yet to be sent via
+    std::chrono::microseconds pending_tx_deadline_{};
+
+    bool fleet_download_ = false;                         ///< The current update uses fleet distribution
+    std::uint64_t fleet_image_crc_ = 0;
+    std::uint32_t fleet_image_size_ = 0;
+    std::array<std::uint8_t, (MaxFleetChunks + 7U) / 8U> fleet_coverage_{};     ///< One bit per received chunk
+    std::uint32_t fleet_num_chunks_received_ = 0;
+    std::chrono::microseconds fleet_last_activity_at_{};  ///< Last chunk reception or fill-in request
+    ::kocherga::IDownloadSink* fleet_sink_ = nullptr;     ///< Set while the image is being downloaded
+    std::int16_t fleet_sink_result_ = 0;
+    std::uint8_t fleet_chunk_request_transfer_id_ = 0;
+    std::uint32_t fleet_num_chunks_ = 0;
+    std::uint32_t fleet_num_chunks_at_last_fill_in_ = 0;
+    std::uint32_t fleet_fill_in_end_ = 0;     ///< Index of the chunk following the requested range, zero if none
+    std::uint8_t fleet_fill_in_attempts_ = 0;
+    std::uint8_t fleet_offered_server_node_id_ = 0;       ///< The last stream that may be joined upon request
+    std::uint64_t fleet_offered_image_crc_ = 0;
+    std::uint32_t fleet_offered_image_size_ = 0;
+    std::chrono::microseconds fleet_offered_at_{};
 
 
     std::uint64_t getMonotonicUptimeInMicroseconds() const
@@ -302,9 +910,7 @@ class BootloaderNode final : private ::kocherga::IProtocol
 
     void delayAfterDriverError()
     {
-        platform_.resetWatchdog();
-        platform_.sleep(std::chrono::microseconds(1'000'000));
-        platform_.resetWatchdog();
+        resume_at_ = bootloader_.getMonotonicUptime() + impl_::DriverErrorRecoveryDelay;
     }
 
     std::chrono::microseconds getRandomDuration(std::chrono::microseconds lower_bound,
@@ -362,10 +968,11 @@ class BootloaderNode final : private ::kocherga::IProtocol
         }
         }
 
-        ::canardEncodeScalar(buffer,  0, 32, &uptime_sec);
-        ::canardEncodeScalar(buffer, 32,  2, &node_health);
-        ::canardEncodeScalar(buffer, 34,  3, &node_mode);
-        ::canardEncodeScalar(buffer, 40, 16, &vendor_specific_status_);
+        using impl_::dsdl::NodeStatus;
+        NodeStatus::Uptime::encode(buffer, uptime_sec);
+        NodeStatus::Health::encode(buffer, node_health);
+        NodeStatus::Mode::encode(buffer, node_mode);
+        NodeStatus::VendorSpecificStatusCode::encode(buffer, vendor_specific_status_);
     }
 
     void sendNodeStatus()
@@ -388,13 +995,14 @@ class BootloaderNode final : private ::kocherga::IProtocol
 
     void sendLog(const impl_::LogLevel level, const senoval::String<90>& txt)
     {
-        static const senoval::String<31> SourceName("Bootloader");
-        std::uint8_t buffer[1 + 31 + 90]{};
-        buffer[0] = std::uint8_t(std::uint8_t(std::uint16_t(level) << 5U) | SourceName.length());
-        std::copy(SourceName.begin(), SourceName.end(), &buffer[1]);
-        std::copy(txt.begin(), txt.end(), &buffer[1 + SourceName.length()]);
-
         using impl_::dsdl::LogMessage;
+        static const senoval::String<LogMessage::Source::Capacity> SourceName("Bootloader");
+        std::uint8_t buffer[1 + LogMessage::Source::Capacity + 90]{};
+        LogMessage::Level::encode(buffer, level);
+        LogMessage::SourceLength::encode(buffer, std::uint8_t(SourceName.length()));
+        const auto text_offset = LogMessage::Source::encode(buffer, SourceName.data(), SourceName.length());
+        std::copy(txt.begin(), txt.end(), &buffer[text_offset]);
+
         const auto res = ::canardBroadcast(&canard_,
                                            LogMessage::DataTypeSignature,
                                            LogMessage::DataTypeID,
@@ -408,15 +1016,102 @@ class BootloaderNode final : private ::kocherga::IProtocol
         }
     }
 
+    void resetDownloadProgress(const std::uint32_t expected_size)
+    {
+        download_progress_ = DownloadProgress();
+        download_progress_.expected_size = expected_size;
+        download_started_at_ = bootloader_.getMonotonicUptime();
+        download_rtt_sum_ = {};
+        download_rtt_count_ = 0;
+        download_progress_bytes_at_last_report_ = 0;
+        download_progress_last_report_at_ = download_started_at_;
+        vendor_specific_status_ = 0;
+    }
+
+    void addDownloadRTTSample(const std::chrono::microseconds rtt)
+    {
+        auto& p = download_progress_;
+        p.min_rtt = (download_rtt_count_ == 0) ? rtt : std::min(p.min_rtt, rtt);
+        p.max_rtt = std::max(p.max_rtt, rtt);
+        download_rtt_sum_ += rtt;
+        download_rtt_count_++;
+        p.avg_rtt = download_rtt_sum_ / download_rtt_count_;
+    }
+
+    /// Writes into the storage via the supplied callable, accounting for the time it takes
+    template <typename F>
+    std::int16_t writeDownloadedData(const std::uint16_t size, const F& writer)
+    {
+        const auto started_at = bootloader_.getMonotonicUptime();
+        const std::int16_t res = writer();
+        download_progress_.storage_write_time += bootloader_.getMonotonicUptime() - started_at;
+        if (res >= 0)
+        {
+            download_progress_.bytes_downloaded += size;
+        }
+        return res;
+    }
+
+    void sendDownloadProgress()
+    {
+        using namespace impl_;
+
+        const auto ts = bootloader_.getMonotonicUptime();
+        auto& p = download_progress_;
+
+        const auto interval = ts - download_progress_last_report_at_;
+        if (interval.count() > 0)
+        {
+            p.throughput = std::uint32_t((std::uint64_t(p.bytes_downloaded - download_progress_bytes_at_last_report_) *
+                                          1'000'000ULL) / std::uint64_t(interval.count()));
+        }
+        download_progress_bytes_at_last_report_ = p.bytes_downloaded;
+        download_progress_last_report_at_ = ts;
+        p.elapsed = ts - download_started_at_;
+
+        vendor_specific_status_ = std::uint16_t(std::min<std::uint32_t>(p.bytes_downloaded / 1024U, 0xFFFFU));
+
+        const auto saturate = [](const auto x)     // Keeps the units of the duration, e.g. milliseconds
+        {
+            return std::uint32_t(std::clamp<std::int64_t>(x.count(), 0, std::numeric_limits<std::uint32_t>::max()));
+        };
+
+        using dsdl::DownloadProgress;
+        std::uint8_t buffer[DownloadProgress::MaxSizeBytes]{};
+        DownloadProgress::BytesDownloaded::encode(buffer, p.bytes_downloaded);
+        DownloadProgress::ExpectedSize::encode(buffer, p.expected_size);
+        DownloadProgress::Throughput::encode(buffer, p.throughput);
+        DownloadProgress::RetransmissionCount::encode(buffer, p.retransmission_count);
+        DownloadProgress::MinRTT::encode(buffer, saturate(p.min_rtt));
+        DownloadProgress::AvgRTT::encode(buffer, saturate(p.avg_rtt));
+        DownloadProgress::MaxRTT::encode(buffer, saturate(p.max_rtt));
+        DownloadProgress::StorageWriteTime::encode(buffer, saturate(p.storage_write_time));
+        DownloadProgress::Elapsed::encode(buffer,
+                                          saturate(std::chrono::duration_cast<std::chrono::milliseconds>(p.elapsed)));
+
+        const auto res = ::canardBroadcast(&canard_,
+                                           dsdl::DownloadProgress::DataTypeSignature,
+                                           dsdl::DownloadProgress::DataTypeID,
+                                           &download_progress_transfer_id_,
+                                           CANARD_TRANSFER_PRIORITY_LOWEST,
+                                           buffer,
+                                           dsdl::DownloadProgress::MaxSizeBytes);
+        if (res <= 0)
+        {
+            KOCHERGA_UAVCAN_LOG("Progress bc err %d\n", res);
+        }
+    }
+
     auto initCAN(const std::uint32_t bitrate,
                  const IUAVCANPlatform::CANMode mode,
-                 const IUAVCANPlatform::CANAcceptanceFilterConfig& acceptance_filter =
-                     IUAVCANPlatform::CANAcceptanceFilterConfig())
+                 const IUAVCANPlatform::CANAcceptanceFilterList& acceptance_filters =
+                     IUAVCANPlatform::CANAcceptanceFilterList{IUAVCANPlatform::CANAcceptanceFilterConfig{}})
     {
-        const auto res = platform_.configure(bitrate, mode, acceptance_filter);
+        const auto data_bit_rate = platform_.getCANFDDataBitRate(bitrate);
+        const auto res = platform_.configure(bitrate, data_bit_rate, mode, acceptance_filters);
         if (res < 0)
         {
-            KOCHERGA_UAVCAN_LOG("CAN init err @%u bps: %d\n", unsigned(bitrate), res);
+            KOCHERGA_UAVCAN_LOG("CAN init err @%u/%u bps: %d\n", unsigned(bitrate), unsigned(data_bit_rate), res);
         }
         return res;
     }
@@ -449,13 +1144,17 @@ class BootloaderNode final : private ::kocherga::IProtocol
         // NodeStatus broadcasting
         if (init_done_ && (::canardGetLocalNodeID(&canard_) > 0))
         {
+            if ((phase_ == Phase::Downloading) || (phase_ == Phase::FleetDownloading))
+            {
+                sendDownloadProgress();     // Also updates the vendor-specific status code
+            }
             sendNodeStatus();
         }
 
         platform_.resetWatchdog();
     }
 
-    void poll()
+    void poll(const std::chrono::microseconds rx_timeout)
     {
         constexpr std::uint8_t MaxFramesPerSpin = 10;
 
@@ -464,33 +1163,66 @@ class BootloaderNode final : private ::kocherga::IProtocol
         {
             platform_.resetWatchdog();
 
-            const auto res = receive(std::chrono::microseconds(1'000));        // Blocking call
+            const auto res = receive(rx_timeout);       // Blocking call unless the timeout is zero
             if (res.first < 1)
             {
                 break;                          // Error or no frames
             }
 
-            ::canardHandleRxFrame(&canard_, &res.second, getMonotonicUptimeInMicroseconds());
+            const auto timestamp = (res.second.timestamp.count() > 0) ?
+                std::uint64_t(res.second.timestamp.count()) :
+                getMonotonicUptimeInMicroseconds();
+
+            rx_frame_timestamp_ = std::chrono::microseconds(timestamp);
+            ::canardHandleRxFrame(&canard_, &res.second.frame, timestamp);
         }
 
-        // Transmit
+        // Transmit; every frame goes via every interface
+        const auto all_ifaces_mask = InterfaceMask((1U << num_ifaces_) - 1U);
         for (std::uint8_t i = 0; i < MaxFramesPerSpin; i++)
         {
             platform_.resetWatchdog();
 
-            const ::CanardCANFrame* txf = ::canardPeekTxQueue(&canard_);
-            if (txf == nullptr)
+            if (pending_tx_iface_mask_ == 0)
             {
-                break;                          // Nothing to transmit
+                const ::CanardCANFrame* txf = ::canardPeekTxQueue(&canard_);
+                if (txf == nullptr)
+                {
+                    break;                      // Nothing to transmit
+                }
+
+                pending_tx_frame_ = *txf;
+                pending_tx_iface_mask_ = all_ifaces_mask;
+                pending_tx_deadline_ = bootloader_.getMonotonicUptime() + impl_::RedundantFrameTransmissionTimeout;
+                ::canardPopTxQueue(&canard_);
             }
 
-            const auto res = send(*txf, std::chrono::microseconds{});      // Non-blocking call
-            if (res == 0)
+            for (std::uint8_t iface = 0; iface < num_ifaces_; iface++)
             {
-                break;                          // Queue is full
+                const auto iface_bit = InterfaceMask(1U << iface);
+                if ((pending_tx_iface_mask_ & iface_bit) != 0)
+                {
+                    pending_tx_frame_.iface_id = iface;
+                    if (send(pending_tx_frame_, std::chrono::microseconds{}) != 0)   // Non-blocking call
+                    {
+                        // Transmitted successfully or error, either way this interface is done with the frame
+                        pending_tx_iface_mask_ = InterfaceMask(pending_tx_iface_mask_ & ~iface_bit);
+                    }
+                }
             }
 
-            ::canardPopTxQueue(&canard_);       // Transmitted successfully or error, either way remove the frame
+            if (pending_tx_iface_mask_ != 0)
+            {
+                // Some of the TX queues are full. The frame can be abandoned on them only if it has already
+                // been transmitted via another interface; otherwise keep trying.
+                if ((pending_tx_iface_mask_ == all_ifaces_mask) ||
+                    (bootloader_.getMonotonicUptime() < pending_tx_deadline_))
+                {
+                    break;
+                }
+
+                pending_tx_iface_mask_ = 0;
+            }
         }
 
         // 1Hz process
@@ -501,331 +1233,461 @@ class BootloaderNode final : private ::kocherga::IProtocol
         }
     }
 
-    void performCANBitRateDetection()
+    /**
+     * Selects the phase of the initialization process depending on which bus parameters are yet to be determined.
+     * The initialization is complete once both the bit rate and the node ID are known.
+     */
+    void enterNextInitializationPhase()
     {
-        /// These are defined by the specification; 100 Kbps is added due to its popularity.
-        static constexpr std::array<std::uint32_t, 5> StandardBitRates
-        {{
-            1000000,        ///< Standard, recommended by UAVCAN
-             500000,        ///< Standard
-             250000,        ///< Standard
-             125000,        ///< Standard
-             100000         ///< Popular bit rate that is not defined by the specification
-        }};
+        can_configured_ = false;
 
-        std::uint8_t current_bit_rate_index = 0;
-
-        // Loop forever until the bit rate is detected
-        while ((!platform_.shouldExit()) && (can_bus_bit_rate_ == 0))
+        if (can_bus_bit_rate_ == 0)
         {
-            platform_.resetWatchdog();
-
-            const std::uint32_t br = StandardBitRates[current_bit_rate_index];
-            current_bit_rate_index = std::uint8_t((current_bit_rate_index + 1U) % StandardBitRates.size());
-
-            if (initCAN(br, IUAVCANPlatform::CANMode::Silent) >= 0)
-            {
-                const auto res = receive(std::chrono::microseconds(1'100'000)).first;
-                if (res > 0)
-                {
-                    can_bus_bit_rate_ = br;
-                }
-                if (res < 0)
-                {
-                    delayAfterDriverError();
-                }
-            }
-            else
+            phase_ = Phase::CANBitRateDetection;
+        }
+        else if (tentative_local_node_id_ > 0)
+        {
+            phase_ = Phase::NodeIDConflictCheck;
+        }
+        else if (::canardGetLocalNodeID(&canard_) == 0)
+        {
+            phase_ = Phase::NodeIDAllocation;
+        }
+        else
+        {
+            confirmed_local_node_id_ = ::canardGetLocalNodeID(&canard_);
+
+            // This is the only info message we output during initialization.
+            // Fewer messages reduce the chances of breaking UART CLI data flow.
+            KOCHERGA_UAVCAN_LOG("CAN %u bps, NID %u\n", unsigned(can_bus_bit_rate_), confirmed_local_node_id_);
+
+            platform_.onBusParametersConfirmed(can_bus_bit_rate_, confirmed_local_node_id_);
+
+#if CANARD_ENABLE_CANFD
+            // Long frames are not emitted until the node ID is confirmed, so that the dynamic node ID allocation
+            // exchange follows the classic frame layout; reception of long frames is always possible
+            ::canardSetCANFDEnabled(&canard_, platform_.getCANFDDataBitRate(can_bus_bit_rate_) > 0);
+#endif
+
+            phase_ = Phase::Operational;
+        }
+    }
+
+    /**
+     * Listens to the bus in silent mode at every standard bit rate in turn until a frame is received.
+     */
+    void stepCANBitRateDetection(const std::chrono::microseconds rx_timeout)
+    {
+        using impl_::StandardCANBitRates;
+
+        if (!can_configured_)
+        {
+            if (initCAN(StandardCANBitRates[can_bit_rate_detection_index_], IUAVCANPlatform::CANMode::Silent) < 0)
             {
+                can_bit_rate_detection_index_ =
+                    std::uint8_t((can_bit_rate_detection_index_ + 1U) % StandardCANBitRates.size());
                 delayAfterDriverError();
+                return;
             }
+
+            can_configured_ = true;
+            phase_deadline_ = bootloader_.getMonotonicUptime() + impl_::CANBitRateDetectionListeningDuration;
         }
 
-        platform_.resetWatchdog();
+        const auto res = receive(rx_timeout).first;
+        if (res > 0)
+        {
+            can_bus_bit_rate_ = StandardCANBitRates[can_bit_rate_detection_index_];
+            enterNextInitializationPhase();
+        }
+        else if ((res < 0) || (bootloader_.getMonotonicUptime() >= phase_deadline_))
+        {
+            // Trying the next bit rate
+            can_bit_rate_detection_index_ =
+                std::uint8_t((can_bit_rate_detection_index_ + 1U) % StandardCANBitRates.size());
+            can_configured_ = false;
+            if (res < 0)
+            {
+                delayAfterDriverError();
+            }
+        }
+        else
+        {
+            ;   // Still listening
+        }
     }
 
-    void performDynamicNodeIDAllocation()
+    /**
+     * Listens to the bus in silent mode to make sure that the tentative node ID is not used by another node.
+     * If the bus is silent, the bit rate cannot be confirmed, so it is reset for the detection to run again;
+     * the tentative node ID is retained in that case. If a conflict is detected, the tentative node ID is discarded.
+     */
+    void stepNodeIDConflictCheck(const std::chrono::microseconds rx_timeout)
     {
-        // CAN bus initialization
-        while (true)
+        assert(tentative_local_node_id_ > 0);
+
+        if (!can_configured_)
         {
-            // Accept only messages with DTID = 1 (Allocation)
-            // Observe that we need both responses from allocators and requests from other nodes!
-            IUAVCANPlatform::CANAcceptanceFilterConfig filt;
-            filt.id   = 0b00000000000000000000100000000UL | CANARD_CAN_FRAME_EFF;
-            filt.mask = 0b00000000000000000001110000000UL | CANARD_CAN_FRAME_EFF | CANARD_CAN_FRAME_RTR |
-                        CANARD_CAN_FRAME_ERR;
+            node_id_conflict_check_bus_active_ = false;
 
-            if (initCAN(can_bus_bit_rate_, IUAVCANPlatform::CANMode::AutomaticTxAbortOnError, filt) >= 0)
+            if (initCAN(can_bus_bit_rate_, IUAVCANPlatform::CANMode::Silent) < 0)
             {
-                break;
+                delayAfterDriverError();
+                completeNodeIDConflictCheck(false);
+                return;
             }
 
-            delayAfterDriverError();
+            can_configured_ = true;
+            phase_deadline_ = bootloader_.getMonotonicUptime() + impl_::NodeIDConflictCheckDuration;
         }
 
-        using namespace impl_;
-
-        while ((!platform_.shouldExit()) && (::canardGetLocalNodeID(&canard_) == 0))
+        const auto res = receive(rx_timeout);
+        if (res.first < 0)
         {
-            platform_.resetWatchdog();
+            delayAfterDriverError();
+            completeNodeIDConflictCheck(false);
+            return;
+        }
 
-            send_next_node_id_allocation_request_at_ =
-                bootloader_.getMonotonicUptime() + getRandomDuration(std::chrono::microseconds(600'000),
-                                                                     std::chrono::microseconds(1'000'000));
+        if (res.first > 0)
+        {
+            node_id_conflict_check_bus_active_ = true;
 
-            while ((bootloader_.getMonotonicUptime() < send_next_node_id_allocation_request_at_) &&
-                   (::canardGetLocalNodeID(&canard_) == 0))
+            // The source node ID is located in the lowest 7 bits of the CAN ID for all transfer types
+            const std::uint32_t id = res.second.frame.id;
+            if (((id & CANARD_CAN_FRAME_EFF) != 0) &&
+                ((id & (CANARD_CAN_FRAME_RTR | CANARD_CAN_FRAME_ERR)) == 0) &&
+                ((id & 0x7FU) == tentative_local_node_id_))
             {
-                poll();
+                completeNodeIDConflictCheck(true);
+                return;
             }
+        }
 
-            if (::canardGetLocalNodeID(&canard_) != 0)
-            {
-                break;
-            }
+        if (bootloader_.getMonotonicUptime() >= phase_deadline_)
+        {
+            completeNodeIDConflictCheck(false);
+        }
+    }
 
-            // Structure of the request is documented in the DSDL definition
-            // See http://uavcan.org/Specification/6._Application_level_functions/#dynamic-node-id-allocation
-            std::uint8_t allocation_request[7]{};
+    void completeNodeIDConflictCheck(const bool conflict)
+    {
+        if (conflict)
+        {
+            KOCHERGA_UAVCAN_LOG("NID %u conflict\n", tentative_local_node_id_);
+            tentative_local_node_id_ = 0;
+        }
+        else if (!node_id_conflict_check_bus_active_)
+        {
+            can_bus_bit_rate_ = 0;
+        }
+        else
+        {
+            ::canardSetLocalNodeID(&canard_, tentative_local_node_id_);
+            tentative_local_node_id_ = 0;
+        }
 
-            if (node_id_allocation_unique_id_offset_ == 0)
-            {
-                allocation_request[0] |= 1;     // First part of unique ID
-            }
+        enterNextInitializationPhase();
+    }
 
-            static constexpr std::uint8_t MaxLenOfUniqueIDInRequest = 6;
-            std::uint8_t uid_size = std::uint8_t(hw_info_.unique_id.size() - node_id_allocation_unique_id_offset_);
-            if (uid_size > MaxLenOfUniqueIDInRequest)
-            {
-                uid_size = MaxLenOfUniqueIDInRequest;
-            }
+    void stepDynamicNodeIDAllocation(const std::chrono::microseconds rx_timeout)
+    {
+        if (!can_configured_)
+        {
+            // Accept only messages with DTID = 1 (Allocation)
+            // Observe that we need both responses from allocators and requests from other nodes!
+            IUAVCANPlatform::CANAcceptanceFilterConfig filt{};
+            filt.id   = 0b00000000000000000000100000000UL | CANARD_CAN_FRAME_EFF;
+            filt.mask = 0b00000000000000000001110000000UL | CANARD_CAN_FRAME_EFF | CANARD_CAN_FRAME_RTR |
+                        CANARD_CAN_FRAME_ERR;
 
-            // Paranoia time
-            assert(node_id_allocation_unique_id_offset_ < hw_info_.unique_id.size());
-            assert(uid_size <= MaxLenOfUniqueIDInRequest);
-            assert(uid_size > 0);
-            assert(std::uint16_t(uid_size + node_id_allocation_unique_id_offset_) <= hw_info_.unique_id.size());
-
-            std::memmove(&allocation_request[1], &hw_info_.unique_id[node_id_allocation_unique_id_offset_], uid_size);
-
-            // Broadcasting the request
-            const auto bcast_res = ::canardBroadcast(&canard_,
-                                                     dsdl::NodeIDAllocation::DataTypeSignature,
-                                                     dsdl::NodeIDAllocation::DataTypeID,
-                                                     &node_id_allocation_transfer_id_,
-                                                     CANARD_TRANSFER_PRIORITY_LOW,
-                                                     &allocation_request[0],
-                                                     std::uint16_t(uid_size + 1U));
-            if (bcast_res < 0)
+            if (initCAN(can_bus_bit_rate_, IUAVCANPlatform::CANMode::AutomaticTxAbortOnError, {filt}) < 0)
             {
-                KOCHERGA_UAVCAN_LOG("NID alloc bc err %d\n", bcast_res);
+                delayAfterDriverError();
+                return;
             }
 
-            // Preparing for timeout; if response is received, this value will be updated from the callback.
-            node_id_allocation_unique_id_offset_ = 0;
+            can_configured_ = true;
+            send_next_node_id_allocation_request_at_ =
+                bootloader_.getMonotonicUptime() + getRandomDuration(std::chrono::microseconds(600'000),
+                                                                     std::chrono::microseconds(1'000'000));
         }
 
-        platform_.resetWatchdog();
-    }
+        poll(rx_timeout);
 
-    void runNodeThread()
-    {
-        /*
-         * CAN bit rate
-         */
-        platform_.resetWatchdog();
-
-        if (can_bus_bit_rate_ == 0)
+        if (::canardGetLocalNodeID(&canard_) != 0)
         {
-            performCANBitRateDetection();
+            enterNextInitializationPhase();
+            return;
         }
 
-        if (platform_.shouldExit())
+        if (bootloader_.getMonotonicUptime() < send_next_node_id_allocation_request_at_)
         {
             return;
         }
 
-        /*
-         * Node ID
-         */
-        platform_.resetWatchdog();
+        // Structure of the request is documented in the DSDL definition
+        // See http://uavcan.org/Specification/6._Application_level_functions/#dynamic-node-id-allocation
+        using namespace impl_;
+        std::uint8_t allocation_request[7]{};
 
-        if (::canardGetLocalNodeID(&canard_) == 0)
+        dsdl::NodeIDAllocation::FirstPartOfUniqueID::encode(allocation_request,
+                                                            std::uint8_t(node_id_allocation_unique_id_offset_ == 0));
+
+        static constexpr std::uint8_t MaxLenOfUniqueIDInRequest = 6;
+        std::uint8_t uid_size = std::uint8_t(hw_info_.unique_id.size() - node_id_allocation_unique_id_offset_);
+        if (uid_size > MaxLenOfUniqueIDInRequest)
         {
-            performDynamicNodeIDAllocation();
+            uid_size = MaxLenOfUniqueIDInRequest;
         }
 
-        if (platform_.shouldExit())
+        // Paranoia time
+        assert(node_id_allocation_unique_id_offset_ < hw_info_.unique_id.size());
+        assert(uid_size <= MaxLenOfUniqueIDInRequest);
+        assert(uid_size > 0);
+        assert(std::uint16_t(uid_size + node_id_allocation_unique_id_offset_) <= hw_info_.unique_id.size());
+
+        const auto size = dsdl::NodeIDAllocation::UniqueID::encode(
+            allocation_request,
+            &hw_info_.unique_id[node_id_allocation_unique_id_offset_],
+            uid_size);
+
+        // Broadcasting the request
+        const auto bcast_res = ::canardBroadcast(&canard_,
+                                                 dsdl::NodeIDAllocation::DataTypeSignature,
+                                                 dsdl::NodeIDAllocation::DataTypeID,
+                                                 &node_id_allocation_transfer_id_,
+                                                 CANARD_TRANSFER_PRIORITY_LOW,
+                                                 &allocation_request[0],
+                                                 size);
+        if (bcast_res < 0)
         {
-            return;
+            KOCHERGA_UAVCAN_LOG("NID alloc bc err %d\n", bcast_res);
         }
 
-        confirmed_local_node_id_ = ::canardGetLocalNodeID(&canard_);
-
-        // This is the only info message we output during initialization.
-        // Fewer messages reduce the chances of breaking UART CLI data flow.
-        KOCHERGA_UAVCAN_LOG("CAN %u bps, NID %u\n", unsigned(can_bus_bit_rate_), confirmed_local_node_id_);
-
-        using namespace impl_;
+        // Preparing for timeout; if response is received, these values will be updated from the callback.
+        node_id_allocation_unique_id_offset_ = 0;
+        send_next_node_id_allocation_request_at_ =
+            bootloader_.getMonotonicUptime() + getRandomDuration(std::chrono::microseconds(600'000),
+                                                                 std::chrono::microseconds(1'000'000));
+    }
 
-        /*
-         * Init CAN in proper mode now
-         */
-        platform_.resetWatchdog();
+    void stepOperational(const std::chrono::microseconds rx_timeout)
+    {
+        assert((confirmed_local_node_id_ > 0) && (::canardGetLocalNodeID(&canard_) > 0));
 
-        while (true)
+        if (!can_configured_)
         {
-            // Accept only correctly addressed service requests and responses
-            // We don't need message transfers anymore
-            IUAVCANPlatform::CANAcceptanceFilterConfig filt;
-            filt.id   = 0b00000000000000000000010000000UL |
-                        std::uint32_t(confirmed_local_node_id_ << 8U) | CANARD_CAN_FRAME_EFF;
-            filt.mask = 0b00000000000000111111110000000UL |
-                        CANARD_CAN_FRAME_EFF | CANARD_CAN_FRAME_RTR | CANARD_CAN_FRAME_ERR;
-
-            if (initCAN(can_bus_bit_rate_, IUAVCANPlatform::CANMode::Normal, filt) >= 0)
+            // Accept only the data types we can handle, services must be addressed to us
+            if (initCAN(can_bus_bit_rate_, IUAVCANPlatform::CANMode::Normal, makeAcceptanceFilters()) < 0)
             {
-                break;
+                delayAfterDriverError();
+                return;
             }
 
-            delayAfterDriverError();
+            can_configured_ = true;
+            init_done_ = true;
         }
 
-        init_done_ = true;
+        poll(rx_timeout);
 
-        /*
-         * Update loop; run forever because there's nothing else to do
-         */
-        while (!platform_.shouldExit())
+        // Waiting for the firmware update request
+        if (remote_server_node_id_ != 0)
         {
-            assert((confirmed_local_node_id_ > 0) && (::canardGetLocalNodeID(&canard_) > 0));
+            beginUpgrade();
+        }
+    }
 
-            platform_.resetWatchdog();
+    /**
+     * Rewrites the old firmware with the new file.
+     */
+    void beginUpgrade()
+    {
+        KOCHERGA_UAVCAN_LOG("FW server NID %u path %s\n",
+                            unsigned(remote_server_node_id_), firmware_file_path_.c_str());
 
-            /*
-             * Waiting for the firmware update request
-             */
-            if (remote_server_node_id_ == 0)
-            {
-                while ((!platform_.shouldExit()) && (remote_server_node_id_ == 0))
-                {
-                    platform_.resetWatchdog();
-                    poll();
-                }
-            }
+        serving_installed_file_ = false;
 
-            if (platform_.shouldExit())
+        const auto [res, sink] = bootloader_.beginAppUpgrade();
+        if (res < 0)
+        {
+            reportUpgradeResult(res);
+            return;
+        }
+
+        resetDownloadProgress(((MaxFleetImageSize > 0) && fleet_download_) ? fleet_image_size_ : 0U);
+        sendNodeStatus();       // Announcing the new state of the bootloader ASAP
+        next_progress_report_at_ = bootloader_.getMonotonicUptime();
+
+        if constexpr (MaxFleetImageSize > 0)
+        {
+            if (fleet_download_)
             {
-                break;
+                fleet_num_chunks_ = std::uint32_t((fleet_image_size_ + impl_::FleetChunkSize - 1U) /
+                                                  impl_::FleetChunkSize);
+                fleet_coverage_.fill(0);
+                fleet_num_chunks_received_ = 0;
+                fleet_last_activity_at_ = bootloader_.getMonotonicUptime();
+                fleet_sink_result_ = 0;
+                fleet_num_chunks_at_last_fill_in_ = 0;
+                fleet_fill_in_end_ = 0;
+                fleet_fill_in_attempts_ = 0;
+                fleet_sink_ = sink;     // Chunks are written from now on
+                phase_ = Phase::FleetDownloading;
+                return;
             }
+        }
 
-            KOCHERGA_UAVCAN_LOG("FW server NID %u path %s\n",
-                                unsigned(remote_server_node_id_), firmware_file_path_.c_str());
+        download_sink_ = sink;
+        download_stage_ = DownloadStage::SendRequest;
+        download_offset_ = 0;
+        download_timeout_estimator_ = impl_::ResponseTimeoutEstimator();
+        download_retransmission_count_ = 0;
+        phase_ = Phase::Downloading;
+    }
 
-            /*
-             * Rewriting the old firmware with the new file
-             */
-            platform_.resetWatchdog();
-            const auto result = bootloader_.upgradeApp(*this);
-            platform_.resetWatchdog();
+    void finishUpgrade(const std::int16_t download_result)
+    {
+        sendDownloadProgress();
 
-            sendNodeStatus();   // Announcing the new status of the bootloader ASAP
+        download_sink_ = nullptr;
+        fleet_sink_ = nullptr;
+        phase_ = Phase::Operational;
 
-            if (result >= 0)
+        reportUpgradeResult(bootloader_.endAppUpgrade(download_result));
+    }
+
+    void reportUpgradeResult(const std::int16_t result)
+    {
+        using namespace impl_;
+
+        platform_.resetWatchdog();
+
+        sendNodeStatus();   // Announcing the new status of the bootloader ASAP
+
+        if (result >= 0)
+        {
+            vendor_specific_status_ = 0;
+            if (bootloader_.getState() == kocherga::State::NoAppToBoot)
             {
-                vendor_specific_status_ = 0;
-                if (bootloader_.getState() == kocherga::State::NoAppToBoot)
-                {
-                    sendLog(LogLevel::Error, "Downloaded image is invalid");
-                }
-                else
-                {
-                    sendLog(LogLevel::Info, "OK");
-                }
+                sendLog(LogLevel::Error, "Downloaded image is invalid");
             }
             else
             {
-                vendor_specific_status_ = std::uint16_t(std::abs(result));
-                sendLog(LogLevel::Error,
-                        senoval::String<90>("Upgrade error ") + senoval::convertIntToString(result));
+                sendLog(LogLevel::Info, "OK");
+
+                // The verified image can now be served to the peers that request the same file from us
+                if (!fleet_download_)
+                {
+                    installed_file_path_ = firmware_file_path_;
+                    serving_installed_file_ = true;
+                }
             }
+        }
+        else
+        {
+            vendor_specific_status_ = std::uint16_t(std::abs(result));
+            sendLog(LogLevel::Error,
+                    senoval::String<90>("Upgrade error ") + senoval::convertIntToString(result));
+        }
 
-            /*
-             * Reset everything to zero and loop again, because there's nothing else to do.
-             * The outer logic will request reboot if necessary.
-             */
-            remote_server_node_id_ = 0;
-            firmware_file_path_.clear();
+        {
+            const auto stats = ::canardGetPoolAllocatorStatistics(&canard_);
+            senoval::String<90> text("Mem peak ");
+            text += senoval::convertIntToString(stats.peak_usage_blocks);
+            text += "/";
+            text += senoval::convertIntToString(stats.capacity_blocks);
+            text += " blk, OOM ";
+            text += senoval::convertIntToString(stats.oom_count);
+            sendLog(LogLevel::Info, text);
         }
 
-        KOCHERGA_UAVCAN_LOG("Exit\n");
-        platform_.resetWatchdog();
+        /*
+         * Reset everything to zero and wait for the next request, because there's nothing else to do.
+         * The outer logic will request reboot if necessary.
+         */
+        remote_server_node_id_ = 0;
+        firmware_file_path_.clear();
+        fleet_download_ = false;
     }
 
-    std::int16_t downloadImage(kocherga::IDownloadSink& sink) override
+    /**
+     * Advances the download via uavcan.protocol.file.Read.
+     * Returns a positive value while the download is in progress, zero on success, negative on failure.
+     */
+    std::int16_t stepDownload()
     {
         using namespace impl_;
 
-        std::uint64_t offset = 0;
-        auto next_progress_report_deadline = bootloader_.getMonotonicUptime();
-
-        sendNodeStatus();       // Announcing the new state of the bootloader ASAP
+        constexpr auto InvalidReadResult = std::numeric_limits<std::int16_t>::max();
 
-        while (true)
+        switch (download_stage_)
         {
-            platform_.resetWatchdog();
-
-            if (platform_.shouldExit())
+        case DownloadStage::SendRequest:
+        {
+            std::uint8_t buffer[dsdl::FileRead::MaxSizeBytesRequest]{};
+            dsdl::FileRead::Offset::encode(buffer, download_offset_);
+            const auto size = dsdl::FileRead::Path::encode(buffer,
+                                                           firmware_file_path_.data(),
+                                                           firmware_file_path_.length());
+
+            const auto res = ::canardRequestOrRespond(&canard_,
+                                                      remote_server_node_id_,
+                                                      dsdl::FileRead::DataTypeSignature,
+                                                      dsdl::FileRead::DataTypeID,
+                                                      &file_read_transfer_id_,
+                                                      CANARD_TRANSFER_PRIORITY_LOW,
+                                                      ::CanardRequest,
+                                                      buffer,
+                                                      size);
+            if (res < 0)
             {
-                return -ErrInterrupted;
+                KOCHERGA_UAVCAN_LOG("File req err %d\n", res);
+                return std::int16_t(res);
             }
 
-            /*
-             * Send request
-             */
-            {
-                std::uint8_t buffer[dsdl::FileRead::MaxSizeBytesRequest]{};
-                ::canardEncodeScalar(buffer, 0, 40, &offset);
-                std::copy(firmware_file_path_.begin(), firmware_file_path_.end(), &buffer[5]);
-
-                const auto res = ::canardRequestOrRespond(&canard_,
-                                                          remote_server_node_id_,
-                                                          dsdl::FileRead::DataTypeSignature,
-                                                          dsdl::FileRead::DataTypeID,
-                                                          &file_read_transfer_id_,
-                                                          CANARD_TRANSFER_PRIORITY_LOW,
-                                                          ::CanardRequest,
-                                                          buffer,
-                                                          std::uint16_t(firmware_file_path_.size() + 5U));
-                if (res < 0)
-                {
-                    KOCHERGA_UAVCAN_LOG("File req err %d\n", res);
-                    return std::int16_t(res);
-                }
-            }
-
-            /*
-             * Await response.
-             * Note that the watchdog is not reset in the loop, since its timeout is large enough to wait for response.
-             */
-            const std::chrono::microseconds response_deadline =
-                bootloader_.getMonotonicUptime() + DefaultServiceRequestTimeout;
+            // The timeout is doubled on every retransmission of the same request.
+            download_response_timeout_ = (download_retransmission_count_ == 0) ?
+                                         download_timeout_estimator_.getTimeout() :
+                                         std::min(download_response_timeout_ * 2, DefaultServiceRequestTimeout);
 
-            constexpr auto InvalidReadResult = std::numeric_limits<std::int16_t>::max();
+            download_request_sent_at_ = bootloader_.getMonotonicUptime();
+            download_stage_deadline_ = download_request_sent_at_ + download_response_timeout_;
             read_result_ = InvalidReadResult;
+            download_stage_ = DownloadStage::AwaitResponse;
+            return InProgress;
+        }
 
-            while (read_result_ == InvalidReadResult)
+        case DownloadStage::AwaitResponse:
+        {
+            if (read_result_ == InvalidReadResult)
             {
-                poll();
+                if (bootloader_.getMonotonicUptime() <= download_stage_deadline_)
+                {
+                    return InProgress;
+                }
 
-                if (bootloader_.getMonotonicUptime() > response_deadline)
+                if (download_retransmission_count_ >= MaxFileReadRetransmissions)
                 {
                     return -ErrTimeout;
                 }
+
+                download_retransmission_count_++;
+                download_progress_.retransmission_count++;
+                KOCHERGA_UAVCAN_LOG("File req timeout, retry %u\n", unsigned(download_retransmission_count_));
+                download_stage_ = DownloadStage::SendRequest;       // Requesting the same offset again
+                return InProgress;
             }
 
-            platform_.resetWatchdog();
+            if (download_retransmission_count_ == 0)
+            {
+                // The response timestamp comes from the driver, so the polling delay doesn't distort the sample
+                const auto rtt = std::max(read_response_timestamp_ - download_request_sent_at_,
+                                          std::chrono::microseconds{});
+                download_timeout_estimator_.addSample(rtt);
+                addDownloadRTTSample(rtt);
+            }
+            download_retransmission_count_ = 0;
 
             if (read_result_ < 0)
             {
@@ -837,52 +1699,390 @@ class BootloaderNode final : private ::kocherga::IProtocol
              * Observe that we don't constrain the maximum image size - either the bootloader
              * or the storage backend will return error if we exceed it.
              */
-            if (read_result_ > 0)
+            if (read_result_ == 0)
             {
-                offset = offset + std::uint64_t(read_result_);
-
-                const auto res = sink.handleNextDataChunk(read_buffer_.data(), std::uint16_t(read_result_));
-                if (res < 0)
-                {
-                    platform_.resetWatchdog();
-                    return res;
-                }
+                return 0;       // Done
             }
-            else
+
+            download_offset_ = download_offset_ + std::uint64_t(read_result_);
+
+            const auto res = writeDownloadedData(std::uint16_t(read_result_), [this]()
             {
-                platform_.resetWatchdog();
-                return 0;       // Done
+                return download_sink_->handleNextDataChunk(read_buffer_.data(), std::uint16_t(read_result_));
+            });
+            if (res < 0)
+            {
+                return res;
             }
 
             /*
              * Send a progress report if time is up
              */
-            if (bootloader_.getMonotonicUptime() > next_progress_report_deadline)
+            if (bootloader_.getMonotonicUptime() > next_progress_report_at_)
             {
-                next_progress_report_deadline += DefaultProgressReportInterval;
-                sendLog(LogLevel::Info, senoval::convertIntToString(offset) + senoval::String<90>("B down..."));
+                next_progress_report_at_ += DefaultProgressReportInterval;
+                sendLog(LogLevel::Info,
+                        senoval::convertIntToString(download_offset_) + senoval::String<90>("B down..."));
             }
 
             /*
              * Wait in order to avoid bus congestion
              * The magic shift ensures that the relative bus utilization does not depend on the bit rate.
              */
-            platform_.resetWatchdog();
-
-            const std::chrono::microseconds wait_deadline =
-                bootloader_.getMonotonicUptime() +
+            download_stage_deadline_ = bootloader_.getMonotonicUptime() +
                 std::chrono::microseconds(1'000'000UL / (1UL + (can_bus_bit_rate_ >> 16U)));
+            download_stage_ = DownloadStage::Pause;
+            return InProgress;
+        }
 
-            while (bootloader_.getMonotonicUptime() < wait_deadline)
+        case DownloadStage::Pause:
+        {
+            if (bootloader_.getMonotonicUptime() >= download_stage_deadline_)
             {
-                poll();
+                download_stage_ = DownloadStage::SendRequest;
             }
+            return InProgress;
+        }
         }
 
         assert(false);  // Should never get here
         return -1;
     }
 
+    bool isFleetChunkReceived(const std::uint32_t index) const
+    {
+        return (fleet_coverage_[index / 8U] & (1U << (index % 8U))) != 0;
+    }
+
+    std::uint32_t findFirstMissingFleetChunk(const std::uint32_t num_chunks) const
+    {
+        std::uint32_t index = 0;
+        while ((index < num_chunks) && isFleetChunkReceived(index))
+        {
+            index++;
+        }
+        return index;
+    }
+
+    /**
+     * Requests the first missing range of the image from the fleet distribution server.
+     * Returns the index of the chunk following the requested range.
+     */
+    std::uint32_t sendFleetFirmwareChunkRequest(const std::uint32_t num_chunks)
+    {
+        using namespace impl_;
+
+        const std::uint32_t first = findFirstMissingFleetChunk(num_chunks);
+
+        std::uint32_t last = first;
+        while ((last < num_chunks) && !isFleetChunkReceived(last) && ((last - first) < FleetMaxChunksPerFillInRequest))
+        {
+            last++;
+        }
+
+        const std::uint32_t offset = first * FleetChunkSize;
+        const std::uint32_t length = std::min(last * FleetChunkSize, fleet_image_size_) - offset;
+
+        std::uint8_t buffer[dsdl::FleetFirmwareChunkRequest::MaxSizeBytes]{};
+        dsdl::FleetFirmwareChunkRequest::ImageCRC::encode(buffer, fleet_image_crc_);
+        dsdl::FleetFirmwareChunkRequest::Offset::encode(buffer, offset);
+        dsdl::FleetFirmwareChunkRequest::Length::encode(buffer, length);
+
+        const auto res = ::canardBroadcast(&canard_,
+                                           dsdl::FleetFirmwareChunkRequest::DataTypeSignature,
+                                           dsdl::FleetFirmwareChunkRequest::DataTypeID,
+                                           &fleet_chunk_request_transfer_id_,
+                                           CANARD_TRANSFER_PRIORITY_LOW,
+                                           buffer,
+                                           dsdl::FleetFirmwareChunkRequest::MaxSizeBytes);
+        if (res <= 0)
+        {
+            KOCHERGA_UAVCAN_LOG("Chunk req err %d\n", res);
+        }
+
+        return last;
+    }
+
+    /**
+     * Advances the download via the fleet distribution stream; the chunks are written from the reception callback.
+     * Returns a positive value while the download is in progress, zero on success, negative on failure.
+     */
+    std::int16_t stepFleetDownload()
+    {
+        using namespace impl_;
+
+        if (fleet_sink_result_ < 0)
+        {
+            return fleet_sink_result_;
+        }
+
+        if (fleet_num_chunks_received_ >= fleet_num_chunks_)
+        {
+            return 0;           // Done
+        }
+
+        bool request_next_range = false;
+        if (fleet_num_chunks_received_ != fleet_num_chunks_at_last_fill_in_)
+        {
+            fleet_num_chunks_at_last_fill_in_ = fleet_num_chunks_received_;
+            fleet_fill_in_attempts_ = 0;
+            // Once the requested range is complete, the next one is requested without waiting for the timeout
+            request_next_range = (fleet_fill_in_end_ > 0) &&
+                                 (findFirstMissingFleetChunk(fleet_num_chunks_) >= fleet_fill_in_end_);
+        }
+
+        if (request_next_range ||
+            (bootloader_.getMonotonicUptime() >= (fleet_last_activity_at_ + FleetStreamIdleTimeout)))
+        {
+            if (fleet_fill_in_attempts_ >= FleetMaxFillInAttempts)
+            {
+                return -ErrTimeout;
+            }
+
+            fleet_fill_in_attempts_++;
+            download_progress_.retransmission_count++;
+            fleet_last_activity_at_ = bootloader_.getMonotonicUptime();
+            fleet_fill_in_end_ = sendFleetFirmwareChunkRequest(fleet_num_chunks_);
+        }
+
+        if (bootloader_.getMonotonicUptime() > next_progress_report_at_)
+        {
+            next_progress_report_at_ += DefaultProgressReportInterval;
+            senoval::String<90> text(senoval::convertIntToString(fleet_num_chunks_received_));
+            text += "/";
+            text += senoval::convertIntToString(fleet_num_chunks_);
+            text += " chunks down...";
+            sendLog(LogLevel::Info, text);
+        }
+
+        return InProgress;
+    }
+
+    /**
+     * Performs one iteration of the node. If the timeout is zero, never blocks;
+     * otherwise, may block for up to this amount of time waiting for the incoming frames.
+     */
+    void stepImpl(const std::chrono::microseconds rx_timeout)
+    {
+        platform_.resetWatchdog();
+
+        if (const auto ts = bootloader_.getMonotonicUptime(); ts < resume_at_)
+        {
+            if (rx_timeout.count() > 0)
+            {
+                platform_.sleep(resume_at_ - ts);
+                platform_.resetWatchdog();
+            }
+            return;
+        }
+
+        switch (phase_)
+        {
+        case Phase::CANBitRateDetection:
+        {
+            stepCANBitRateDetection(rx_timeout);
+            break;
+        }
+        case Phase::NodeIDConflictCheck:
+        {
+            stepNodeIDConflictCheck(rx_timeout);
+            break;
+        }
+        case Phase::NodeIDAllocation:
+        {
+            stepDynamicNodeIDAllocation(rx_timeout);
+            break;
+        }
+        case Phase::Operational:
+        {
+            stepOperational(rx_timeout);
+            break;
+        }
+        case Phase::Downloading:
+        {
+            poll(rx_timeout);
+            if (const auto res = stepDownload(); res <= 0)
+            {
+                finishUpgrade(res);
+            }
+            break;
+        }
+        case Phase::FleetDownloading:
+        {
+            poll(rx_timeout);
+            if (const auto res = stepFleetDownload(); res <= 0)
+            {
+                finishUpgrade(res);
+            }
+            break;
+        }
+        }
+
+        platform_.resetWatchdog();
+    }
+
+    void handleFleetFirmwareChunk(::CanardRxTransfer* const transfer)
+    {
+        using namespace impl_;
+
+        static constexpr std::uint16_t HeaderSize = 24;
+        if (transfer->payload_len < HeaderSize)
+        {
+            return;
+        }
+
+        std::uint64_t hardware_class_id = 0;
+        std::uint64_t image_crc = 0;
+        std::uint32_t image_size = 0;
+        std::uint32_t offset = 0;
+        (void) ::canardDecodeScalar(transfer,   0, 64, false, &hardware_class_id);
+        (void) ::canardDecodeScalar(transfer,  64, 64, false, &image_crc);
+        (void) ::canardDecodeScalar(transfer, 128, 32, false, &image_size);
+        (void) ::canardDecodeScalar(transfer, 160, 32, false, &offset);
+        const auto data_len = std::uint16_t(transfer->payload_len - HeaderSize);
+
+        if ((hardware_class_id != fleet_hardware_class_id_) ||
+            (image_size == 0) ||
+            (image_size > MaxFleetImageSize) ||
+            ((offset % FleetChunkSize) != 0) ||
+            (offset >= image_size) ||
+            (data_len != std::min<std::uint32_t>(FleetChunkSize, image_size - offset)))
+        {
+            return;
+        }
+
+        if (!fleet_download_)
+        {
+            // A node without a valid application joins the stream on its own, otherwise it waits for a request
+            const auto bl_state = bootloader_.getState();
+            const auto app_info = bootloader_.getAppInfo();
+            if ((remote_server_node_id_ == 0) &&
+                (bl_state == kocherga::State::NoAppToBoot))
+            {
+                fleet_download_ = true;
+                fleet_image_crc_ = image_crc;
+                fleet_image_size_ = image_size;
+                remote_server_node_id_ = transfer->source_node_id;
+                firmware_file_path_.clear();
+            }
+            else if (!app_info || (app_info->image_crc != image_crc))
+            {
+                fleet_offered_server_node_id_ = transfer->source_node_id;
+                fleet_offered_image_crc_ = image_crc;
+                fleet_offered_image_size_ = image_size;
+                fleet_offered_at_ = bootloader_.getMonotonicUptime();
+            }
+            return;     // The chunks that arrive before the upgrade is started will be requested later
+        }
+
+        const std::uint32_t index = offset / FleetChunkSize;
+        if ((fleet_sink_ == nullptr) ||
+            (image_crc != fleet_image_crc_) ||
+            (image_size != fleet_image_size_) ||
+            isFleetChunkReceived(index))
+        {
+            return;
+        }
+
+        for (std::uint16_t i = 0; i < data_len; i++)
+        {
+            (void) ::canardDecodeScalar(transfer, std::uint32_t((HeaderSize + i) * 8U), 8, false, &read_buffer_[i]);
+        }
+        ::canardReleaseRxTransferPayload(&canard_, transfer);
+
+        const auto res = writeDownloadedData(data_len, [&]()
+        {
+            return fleet_sink_->handleDataChunkAt(offset, read_buffer_.data(), data_len);
+        });
+        if (res < 0)
+        {
+            fleet_sink_result_ = res;
+            return;
+        }
+
+        fleet_coverage_[index / 8U] = std::uint8_t(fleet_coverage_[index / 8U] | (1U << (index % 8U)));
+        fleet_num_chunks_received_++;
+        fleet_last_activity_at_ = bootloader_.getMonotonicUptime();
+    }
+
+    void sendFileReadResponse(std::uint8_t destination_node_id,
+                              std::uint8_t transfer_id,
+                              std::uint8_t priority,
+                              std::uint8_t* buffer,       // The data shall be placed at FileRead::Data
+                              std::int16_t error,
+                              std::uint16_t data_len)
+    {
+        using impl_::dsdl::FileRead;
+        FileRead::Error::encode(buffer, error);
+
+        const auto res = ::canardRequestOrRespond(&canard_,
+                                                  destination_node_id,
+                                                  FileRead::DataTypeSignature,
+                                                  FileRead::DataTypeID,
+                                                  &transfer_id,
+                                                  priority,
+                                                  ::CanardResponse,
+                                                  buffer,
+                                                  std::uint16_t(FileRead::Data::ByteOffset + data_len));
+        if (res <= 0)
+        {
+            KOCHERGA_UAVCAN_LOG("FileRead resp err %d\n", res);
+        }
+    }
+
+    /**
+     * Serves the installed image to the peers, so that every updated node becomes a secondary file server.
+     * The requests for other files are offered to the platform for forwarding.
+     */
+    void handleFileReadRequest(::CanardRxTransfer* const transfer)
+    {
+        using namespace impl_;
+
+        ForwardedFileReadRequest req;
+        req.requester_node_id = transfer->source_node_id;
+        req.transfer_id = transfer->transfer_id;
+        req.priority = transfer->priority;
+
+        std::uint8_t buffer[dsdl::FileRead::MaxSizeBytesResponse]{};
+        if (transfer->payload_len < dsdl::FileRead::Path::ByteOffset)     // Malformed, the offset is truncated
+        {
+            ::canardReleaseRxTransferPayload(&canard_, transfer);
+            sendFileReadResponse(req.requester_node_id, req.transfer_id, req.priority, buffer,
+                                 FileErrorInvalidValue, 0);
+            return;
+        }
+
+        (void) ::canardDecodeScalar(transfer, 0, 40, false, &req.offset);
+
+        const auto path_len = std::min<std::size_t>(transfer->payload_len - 5U, req.path.max_size());
+        for (std::uint16_t i = 0; i < path_len; i++)
+        {
+            char val = '\0';
+            (void) ::canardDecodeScalar(transfer, i * 8U + 40U, 8, false, &val);
+            req.path.push_back(val);
+        }
+
+        ::canardReleaseRxTransferPayload(&canard_, transfer);
+
+        if (serving_installed_file_ && (req.path == installed_file_path_))
+        {
+            const auto res = bootloader_.readApp(std::size_t(req.offset),
+                                                 &buffer[dsdl::FileRead::Data::ByteOffset],
+                                                 dsdl::FileRead::Data::Capacity);
+            sendFileReadResponse(req.requester_node_id, req.transfer_id, req.priority, buffer,
+                                 (res < 0) ? FileErrorIO : 0,
+                                 (res < 0) ? 0 : std::uint16_t(res));
+        }
+        else if (!platform_.forwardFileReadRequest(req))
+        {
+            sendFileReadResponse(req.requester_node_id, req.transfer_id, req.priority, buffer, FileErrorNotFound, 0);
+        }
+        else
+        {
+            ;   // The response will be delivered via respondToFileRead()
+        }
+    }
+
     void onTransferReception(::CanardRxTransfer* const transfer)
     {
         using namespace impl_;
@@ -952,12 +2152,12 @@ class BootloaderNode final : private ::kocherga::IProtocol
 
         /*
          * GetNodeInfo request.
-         * Someday this mess should be replaced with auto-generated message serialization code, like in libuavcan.
          */
         if ((transfer->transfer_type == ::CanardTransferTypeRequest) &&
             (transfer->data_type_id == dsdl::GetNodeInfo::DataTypeID))
         {
-            std::uint8_t buffer[dsdl::GetNodeInfo::MaxSizeBytesResponse]{};
+            using dsdl::GetNodeInfo;
+            std::uint8_t buffer[GetNodeInfo::MaxSizeBytesResponse]{};
 
             // NodeStatus
             makeNodeStatusMessage(buffer);
@@ -966,35 +2166,32 @@ class BootloaderNode final : private ::kocherga::IProtocol
             if (auto sw_success = bootloader_.getAppInfo())
             {
                 const ::kocherga::AppInfo sw = *sw_success;
-                buffer[7] = sw.major_version;
-                buffer[8] = sw.minor_version;
-                buffer[9] = 3;                                              // Optional field flags
-                ::canardEncodeScalar(buffer,  80, 32, &sw.vcs_commit);
-                ::canardEncodeScalar(buffer, 112, 64, &sw.image_crc);
+                GetNodeInfo::SoftwareMajor::encode(buffer, sw.major_version);
+                GetNodeInfo::SoftwareMinor::encode(buffer, sw.minor_version);
+                GetNodeInfo::SoftwareOptionalFlags::encode(buffer, std::uint8_t(3));    // VCS commit and image CRC
+                GetNodeInfo::SoftwareVCSCommit::encode(buffer, sw.vcs_commit);
+                GetNodeInfo::SoftwareImageCRC::encode(buffer, sw.image_crc);
             }
 
             // HardwareVersion
-            buffer[22] = hw_info_.major;
-            buffer[23] = hw_info_.minor;
-            std::memmove(&buffer[24], hw_info_.unique_id.data(), hw_info_.unique_id.size());
-            buffer[40] = std::uint8_t(hw_info_.certificate_of_authenticity.size());
-            std::memmove(&buffer[41],
-                         hw_info_.certificate_of_authenticity.data(),
-                         hw_info_.certificate_of_authenticity.size());
+            const auto& coa = hw_info_.certificate_of_authenticity;
+            GetNodeInfo::HardwareMajor::encode(buffer, hw_info_.major);
+            GetNodeInfo::HardwareMinor::encode(buffer, hw_info_.minor);
+            (void) GetNodeInfo::HardwareUniqueID::encode(buffer, hw_info_.unique_id.data(), hw_info_.unique_id.size());
+            GetNodeInfo::CoALength::encode(buffer, std::uint8_t(coa.size()));
+            const auto name_offset = GetNodeInfo::CoA::encode(buffer, coa.data(), coa.size());
 
             // Name
-            std::memcpy(&buffer[41 + hw_info_.certificate_of_authenticity.size()],
-                        node_name_.c_str(),
-                        node_name_.length());
+            std::memcpy(&buffer[name_offset], node_name_.c_str(), node_name_.length());
 
-            const std::size_t total_size = 41 + hw_info_.certificate_of_authenticity.size() + node_name_.length();
-            assert(total_size <= dsdl::GetNodeInfo::MaxSizeBytesResponse);
+            const std::size_t total_size = name_offset + node_name_.length();
+            assert(total_size <= GetNodeInfo::MaxSizeBytesResponse);
 
             // No need to release the transfer payload, it's empty
             const auto resp_res = ::canardRequestOrRespond(&canard_,
                                                            transfer->source_node_id,
-                                                           dsdl::GetNodeInfo::DataTypeSignature,
-                                                           dsdl::GetNodeInfo::DataTypeID,
+                                                           GetNodeInfo::DataTypeSignature,
+                                                           GetNodeInfo::DataTypeID,
                                                            &transfer->transfer_id,
                                                            transfer->priority,
                                                            ::CanardResponse,
@@ -1012,7 +2209,7 @@ class BootloaderNode final : private ::kocherga::IProtocol
         if ((transfer->transfer_type == ::CanardTransferTypeRequest) &&
             (transfer->data_type_id == dsdl::RestartNode::DataTypeID))
         {
-            std::uint8_t response = 0;                          // 1 - ok, 0 - rejected
+            std::uint8_t response = 0;                          // Rejected unless set otherwise
 
             std::uint64_t magic_number = 0;
             (void) ::canardDecodeScalar(transfer, 0, 40, false, &magic_number);
@@ -1021,7 +2218,7 @@ class BootloaderNode final : private ::kocherga::IProtocol
             {
                 if (platform_.tryScheduleReboot())
                 {
-                    response = 1U << 7U;
+                    dsdl::RestartNode::OK::encode(&response, std::uint8_t(1));
                 }
             }
 
@@ -1064,6 +2261,17 @@ class BootloaderNode final : private ::kocherga::IProtocol
                     remote_server_node_id_ = transfer->source_node_id;
                 }
 
+                // If the server is streaming an image for our hardware class, the stream is joined instead
+                if ((MaxFleetImageSize > 0) &&
+                    (fleet_offered_server_node_id_ == remote_server_node_id_) &&
+                    (bootloader_.getMonotonicUptime() < (fleet_offered_at_ + impl_::FleetStreamIdleTimeout)))
+                {
+                    fleet_download_ = true;
+                    fleet_image_crc_ = fleet_offered_image_crc_;
+                    fleet_image_size_ = fleet_offered_image_size_;
+                }
+                fleet_offered_server_node_id_ = 0;
+
                 // Copy the path
                 firmware_file_path_.clear();
                 for (std::uint16_t i = 0;
@@ -1095,6 +2303,15 @@ class BootloaderNode final : private ::kocherga::IProtocol
             }
         }
 
+        /*
+         * File read request.
+         */
+        if ((transfer->transfer_type == ::CanardTransferTypeRequest) &&
+            (transfer->data_type_id == dsdl::FileRead::DataTypeID))
+        {
+            handleFileReadRequest(transfer);
+        }
+
         /*
          * File read response.
          */
@@ -1102,6 +2319,9 @@ class BootloaderNode final : private ::kocherga::IProtocol
             (transfer->data_type_id == dsdl::FileRead::DataTypeID) &&
             (((transfer->transfer_id + 1U) & 31U) == file_read_transfer_id_))
         {
+            // The transfer timestamp is that of its first frame, but the response is not usable until the last one
+            read_response_timestamp_ = rx_frame_timestamp_;
+
             std::int16_t error = 0;
             (void) ::canardDecodeScalar(transfer, 0, 16, false, &error);
             if (error != 0)
@@ -1121,6 +2341,63 @@ class BootloaderNode final : private ::kocherga::IProtocol
                 }
             }
         }
+
+        /*
+         * Fleet distribution chunk.
+         */
+        if constexpr (MaxFleetImageSize > 0)
+        {
+            if ((transfer->transfer_type == ::CanardTransferTypeBroadcast) &&
+                (transfer->data_type_id == dsdl::FleetFirmwareChunk::DataTypeID))
+            {
+                handleFleetFirmwareChunk(transfer);
+            }
+        }
+    }
+
+    /**
+     * Builds the acceptance filters for the normal mode of operation, one per data type accepted by
+     * shouldAcceptTransfer() after the node ID is assigned; the two must be kept in sync.
+     */
+    IUAVCANPlatform::CANAcceptanceFilterList makeAcceptanceFilters() const
+    {
+        using namespace impl_::dsdl;
+
+        // UAVCAN v0 CAN ID layout, see the specification
+        static constexpr std::uint32_t ServiceNotMessage     = 1UL << 7U;
+        static constexpr std::uint32_t RequestNotResponse    = 1UL << 15U;
+        static constexpr std::uint32_t DestinationNodeIDMask = 0x7FUL << 8U;
+        static constexpr std::uint32_t ServiceTypeIDMask     = 0xFFUL << 16U;
+        static constexpr std::uint32_t MessageTypeIDMask     = 0xFFFFUL << 8U;
+        static constexpr std::uint32_t FrameTypeMask         =
+            CANARD_CAN_FRAME_EFF | CANARD_CAN_FRAME_RTR | CANARD_CAN_FRAME_ERR;
+
+        IUAVCANPlatform::CANAcceptanceFilterList out;
+
+        const auto add_service = [&out, this](const std::uint32_t data_type_id, const bool requests_only)
+        {
+            IUAVCANPlatform::CANAcceptanceFilterConfig filt{};
+            filt.id   = (data_type_id << 16U) | (requests_only ? RequestNotResponse : 0U) |
+                        (std::uint32_t(confirmed_local_node_id_) << 8U) | ServiceNotMessage | CANARD_CAN_FRAME_EFF;
+            filt.mask = ServiceTypeIDMask | (requests_only ? RequestNotResponse : 0U) |
+                        DestinationNodeIDMask | ServiceNotMessage | FrameTypeMask;
+            out.push_back(filt);
+        };
+
+        add_service(GetNodeInfo::DataTypeID, true);
+        add_service(BeginFirmwareUpdate::DataTypeID, true);
+        add_service(FileRead::DataTypeID, false);          // Responses to our requests and requests from the peers
+        add_service(RestartNode::DataTypeID, true);
+
+        if constexpr (MaxFleetImageSize > 0)
+        {
+            IUAVCANPlatform::CANAcceptanceFilterConfig filt{};
+            filt.id   = (std::uint32_t(FleetFirmwareChunk::DataTypeID) << 8U) | CANARD_CAN_FRAME_EFF;
+            filt.mask = MessageTypeIDMask | ServiceNotMessage | FrameTypeMask;
+            out.push_back(filt);
+        }
+
+        return out;
     }
 
     bool shouldAcceptTransfer(std::uint64_t* out_data_type_signature,
@@ -1144,6 +2421,8 @@ class BootloaderNode final : private ::kocherga::IProtocol
         }
         else
         {
+            // The hardware acceptance filters are derived from the types below, see makeAcceptanceFilters()
+
             // GetNodeInfo REQUEST
             if ((transfer_type == ::CanardTransferTypeRequest) &&
                 (data_type_id == GetNodeInfo::DataTypeID))
@@ -1160,8 +2439,8 @@ class BootloaderNode final : private ::kocherga::IProtocol
                 return true;
             }
 
-            // FileRead RESPONSE (we don't serve requests of this type)
-            if ((transfer_type == ::CanardTransferTypeResponse) &&
+            // FileRead RESPONSE and REQUEST (the latter is served once an image has been installed)
+            if (((transfer_type == ::CanardTransferTypeResponse) || (transfer_type == ::CanardTransferTypeRequest)) &&
                 (data_type_id == FileRead::DataTypeID))
             {
                 *out_data_type_signature = FileRead::DataTypeSignature;
@@ -1175,6 +2454,15 @@ class BootloaderNode final : private ::kocherga::IProtocol
                 *out_data_type_signature = RestartNode::DataTypeSignature;
                 return true;
             }
+
+            // FleetFirmwareChunk MESSAGE
+            if ((MaxFleetImageSize > 0) &&
+                (transfer_type == ::CanardTransferTypeBroadcast) &&
+                (data_type_id == FleetFirmwareChunk::DataTypeID))
+            {
+                *out_data_type_signature = FleetFirmwareChunk::DataTypeSignature;
+                return true;
+            }
         }
 
         return false;
@@ -1217,27 +2505,30 @@ public:
         bootloader_(blc),
         platform_(platform),
         node_name_(name),
-        hw_info_(hw)
+        hw_info_(hw),
+        fleet_hardware_class_id_(getFleetHardwareClassID(name, hw))
     {
         next_1hz_task_invocation_at_ = bootloader_.getMonotonicUptime();
     }
 
     /**
-     * Runs the node thread.
-     * This function never returns unless IUAVCANPlatform::shouldExit() returns true.
-     * If an RTOS is available, it is advisable to run this method from a separate thread.
-     * Otherwise, it is possible to perform other tasks by hijacking certain platform API functions,
-     * such as sleep(), receive(), send(), and resetWatchdog().
+     * Initializes the node; afterwards, the node shall be driven by invoking step() continuously.
+     * Use run() instead if the node is to be run in a dedicated thread.
      *
      * @param can_bus_bit_rate          set if known; defaults to zero, which initiates CAN bit rate autodetect
      * @param node_id                   set if known; defaults to zero, which initiates dynamic node ID allocation
      * @param remote_server_node_id     set if known; defaults to zero, which makes the node wait for an update request
      * @param remote_file_path          set if known; defaults to an empty string, which can be a valid path too
+     * @param verify_node_id            set if the node ID was not supplied by the application but restored from
+     *                                  a cache (see IUAVCANPlatform::onBusParametersConfirmed()); the node will
+     *                                  listen to the bus before using the node ID, and if it turns out to be
+     *                                  taken by another node, dynamic node ID allocation will be performed
      */
-    void run(const std::uint32_t can_bus_bit_rate = 0,
-             const std::uint8_t node_id = 0,
-             const std::uint8_t remote_server_node_id = 0,
-             const char* const remote_file_path = "")
+    void start(const std::uint32_t can_bus_bit_rate = 0,
+               const std::uint8_t node_id = 0,
+               const std::uint8_t remote_server_node_id = 0,
+               const char* const remote_file_path = "",
+               const bool verify_node_id = false)
     {
         this->can_bus_bit_rate_ = can_bus_bit_rate;
 
@@ -1248,6 +2539,10 @@ public:
             this->firmware_file_path_ = remote_file_path;
         }
 
+        this->num_ifaces_ = platform_.getNumberOfInterfaces();
+        assert((num_ifaces_ >= 1) && (num_ifaces_ <= std::numeric_limits<InterfaceMask>::digits));
+        assert((num_ifaces_ == 1) || CANARD_MULTI_IFACE);      // Transfers would be received multiple times
+
         ::canardInit(&canard_,
                      memory_pool_.data(),
                      memory_pool_.size(),
@@ -1258,10 +2553,141 @@ public:
         if ((node_id >= CANARD_MIN_NODE_ID) &&
             (node_id <= CANARD_MAX_NODE_ID))
         {
-            ::canardSetLocalNodeID(&canard_, node_id);
+            if (verify_node_id)
+            {
+                this->tentative_local_node_id_ = node_id;
+            }
+            else
+            {
+                ::canardSetLocalNodeID(&canard_, node_id);
+            }
         }
 
-        runNodeThread();
+        platform_.resetWatchdog();
+        enterNextInitializationPhase();
+    }
+
+    /**
+     * Performs one iteration of the node and returns without blocking; start() must be invoked beforehand.
+     * This method should be invoked from the superloop of the application as often as possible,
+     * because the incoming frames are only processed from here. IUAVCANPlatform::receive() and send()
+     * are invoked with zero timeout, and IUAVCANPlatform::sleep() is never invoked.
+     * IUAVCANPlatform::shouldExit() is not used in this mode of operation.
+     */
+    void step()
+    {
+        stepImpl(std::chrono::microseconds(0));
+    }
+
+    /**
+     * Runs the node thread.
+     * This function never returns unless IUAVCANPlatform::shouldExit() returns true.
+     * If an RTOS is available, it is advisable to run this method from a separate thread.
+     * Otherwise, use start() and step() instead.
+     * The arguments are documented at start().
+     */
+    void run(const std::uint32_t can_bus_bit_rate = 0,
+             const std::uint8_t node_id = 0,
+             const std::uint8_t remote_server_node_id = 0,
+             const char* const remote_file_path = "",
+             const bool verify_node_id = false)
+    {
+        start(can_bus_bit_rate, node_id, remote_server_node_id, remote_file_path, verify_node_id);
+
+        while (!platform_.shouldExit())
+        {
+            stepImpl(std::chrono::microseconds(1'000));
+        }
+
+        if ((phase_ == Phase::Downloading) || (phase_ == Phase::FleetDownloading))
+        {
+            finishUpgrade(-ErrInterrupted);
+        }
+
+        KOCHERGA_UAVCAN_LOG("Exit\n");
+        platform_.resetWatchdog();
+    }
+
+    /**
+     * Delivers the response to a request forwarded via IUAVCANPlatform::forwardFileReadRequest() to the requester.
+     * Must be invoked from the same thread as step() or run().
+     *
+     * @param request       the forwarded request; only the requester node ID, transfer ID, and priority are used
+     * @param error         uavcan.protocol.file.Error; zero on success
+     * @param data          the file data at the requested offset; shorter than 256 bytes at the end of the file
+     * @param size          size of the data, at most 256 bytes; ignored if the error is nonzero
+     */
+    void respondToFileRead(const ForwardedFileReadRequest& request,
+                           const std::int16_t error,
+                           const std::uint8_t* const data,
+                           const std::uint16_t size)
+    {
+        using impl_::dsdl::FileRead;
+        std::uint8_t buffer[FileRead::MaxSizeBytesResponse]{};
+        const auto data_len = (error == 0) ? std::min(size, FileRead::Data::Capacity) : std::uint16_t(0);
+        (void) FileRead::Data::encode(buffer, data, data_len);
+        sendFileReadResponse(request.requester_node_id, request.transfer_id, request.priority,
+                             buffer, error, data_len);
+    }
+
+    /**
+     * Commands the specified peer to update its firmware from the specified file served by this node,
+     * via uavcan.protocol.file.BeginFirmwareUpdate. The node must be able to serve the file, either by itself
+     * or via IUAVCANPlatform::forwardFileReadRequest(). The response of the peer is not awaited.
+     * Must be invoked from the same thread as step() or run().
+     * Returns a negative error code if the request could not be sent, e.g. if the node is not yet initialized.
+     */
+    std::int16_t requestPeerFirmwareUpdate(const std::uint8_t node_id, const senoval::String<200>& path)
+    {
+        using namespace impl_;
+
+        if ((confirmed_local_node_id_ == 0) ||
+            (node_id < CANARD_MIN_NODE_ID) || (node_id > CANARD_MAX_NODE_ID) || (node_id == confirmed_local_node_id_))
+        {
+            return -ErrNotReady;
+        }
+
+        std::uint8_t buffer[dsdl::BeginFirmwareUpdate::MaxSizeBytesRequest]{};
+        dsdl::BeginFirmwareUpdate::SourceNodeID::encode(buffer, confirmed_local_node_id_);  // This node serves the file
+        const auto size = dsdl::BeginFirmwareUpdate::ImageFilePath::encode(buffer, path.data(), path.length());
+
+        const auto res = ::canardRequestOrRespond(&canard_,
+                                                  node_id,
+                                                  dsdl::BeginFirmwareUpdate::DataTypeSignature,
+                                                  dsdl::BeginFirmwareUpdate::DataTypeID,
+                                                  &begin_firmware_update_transfer_id_,
+                                                  CANARD_TRANSFER_PRIORITY_LOW,
+                                                  ::CanardRequest,
+                                                  buffer,
+                                                  size);
+        if (res < 0)
+        {
+            KOCHERGA_UAVCAN_LOG("BeginFWUpdate req err %d\n", res);
+            return std::int16_t(res);
+        }
+        return 0;
+    }
+
+    /**
+     * Returns the identifier of the hardware class the node belongs to for the purposes of fleet distribution:
+     * CRC-64-WE of the node name followed by the major hardware version number.
+     */
+    static std::uint64_t getFleetHardwareClassID(const NodeName& name, const HardwareInfo& hw)
+    {
+        ::kocherga::CRC64 crc;
+        crc.add(name.c_str(), name.length());
+        crc.add(&hw.major, 1);
+        return crc.get();
+    }
+
+    /**
+     * Returns the progress of the current download, or of the last one if there is none in progress.
+     * The statistics are updated continuously, except for the throughput and the elapsed time,
+     * which are updated once per second. The fields are not read atomically as a whole.
+     */
+    DownloadProgress getDownloadProgress() const
+    {
+        return download_progress_;
     }
 
     /**
@@ -1279,6 +2705,17 @@ public:
     {
         return confirmed_local_node_id_;        // No thread sync is needed, read is atomic
     }
+
+    /**
+     * Returns the usage statistics of the memory pool, in blocks of CANARD_MEM_BLOCK_SIZE bytes, and the number of
+     * failed allocations. A nonzero failure count means that MemoryPoolSize is insufficient and some transfers have
+     * been lost; see computeWorstCaseMemoryPoolSize(). The fields are not read atomically as a whole,
+     * so they may be slightly inconsistent with each other while the node is running.
+     */
+    ::CanardPoolAllocatorStatistics getMemoryPoolStatistics()
+    {
+        return ::canardGetPoolAllocatorStatistics(&canard_);
+    }
 };
 
 }
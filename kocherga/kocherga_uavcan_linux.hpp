@@ -0,0 +1,560 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Zubax Robotics
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+#pragma once
+
+#include <kocherga_uavcan.hpp>
+
+// POSIX and Linux APIs:
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace kocherga_uavcan_linux
+{
+namespace impl_
+{
+/**
+ * Returns the current errno negated and saturated to int16, like the libcanard SocketCAN driver does.
+ */
+inline std::int16_t getErrorCode()
+{
+    const int error = (errno > 0) ? errno : EIO;
+    return std::int16_t(-std::min<int>(error, std::numeric_limits<std::int16_t>::max()));
+}
+
+inline std::chrono::microseconds readClock(const ::clockid_t clock)
+{
+    ::timespec ts{};
+    (void) ::clock_gettime(clock, &ts);
+    return std::chrono::seconds(ts.tv_sec) +
+           std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(ts.tv_nsec));
+}
+
+inline std::chrono::microseconds getMonotonicTime()
+{
+    return readClock(CLOCK_MONOTONIC);
+}
+
+inline ::timespec makeTimespec(const std::chrono::microseconds time)
+{
+    ::timespec ts{};
+    ts.tv_sec  = decltype(ts.tv_sec)(time.count() / 1'000'000);
+    ts.tv_nsec = decltype(ts.tv_nsec)((time.count() % 1'000'000) * 1'000);
+    return ts;
+}
+
+/**
+ * Owns a file descriptor and closes it on destruction.
+ */
+class FileDescriptor
+{
+    int fd_ = -1;
+
+public:
+    FileDescriptor() = default;
+
+    explicit FileDescriptor(const int fd) : fd_(fd) { }
+
+    ~FileDescriptor() { reset(); }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    FileDescriptor(FileDescriptor&& other) noexcept : fd_(std::exchange(other.fd_, -1)) { }
+
+    FileDescriptor& operator=(FileDescriptor&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset(std::exchange(other.fd_, -1));
+        }
+        return *this;
+    }
+
+    void reset(const int fd = -1)
+    {
+        if (fd_ >= 0)
+        {
+            (void) ::close(fd_);
+        }
+        fd_ = fd;
+    }
+
+    int get() const { return fd_; }
+
+    bool isValid() const { return fd_ >= 0; }
+};
+
+}       // namespace impl_
+
+/**
+ * The bootloader core platform for GNU/Linux. The time base is CLOCK_MONOTONIC, which is also the time base
+ * of the reception timestamps reported by SocketCANPlatform. The mutex allows the bootloader controller
+ * to be accessed from other threads while the node is running in its own thread.
+ */
+class MonotonicClockPlatform final : public kocherga::IPlatform
+{
+    std::recursive_mutex mutex_;
+
+    void lockMutex() override { mutex_.lock(); }
+
+    void unlockMutex() override { mutex_.unlock(); }
+
+public:
+    std::chrono::microseconds getMonotonicUptime() const override
+    {
+        return impl_::getMonotonicTime();
+    }
+};
+
+/**
+ * IUAVCANPlatform for GNU/Linux built on SocketCAN. All CAN sockets and the deadlines are multiplexed through
+ * epoll, and the deadlines are kept by a timerfd on CLOCK_MONOTONIC, so that receive() and send() block exactly
+ * until the next frame (or TX buffer space), or until the deadline, without polling.
+ * The random numbers are drawn from the kernel CSPRNG via getrandom().
+ *
+ * The interfaces must be brought up by the system beforehand, e.g.:
+ *      ip link set can0 up type can bitrate 1000000
+ * Their bit rates cannot be changed by an unprivileged process. If the bit rate is passed to the constructor,
+ * configure() rejects all other bit rates, so that the automatic bit rate detection of the node settles on it;
+ * otherwise any bit rate is accepted. Silent mode is emulated by refusing to transmit; the automatic transmission
+ * abort on error is not available per socket and is ignored. Acceptance filters are installed in the kernel.
+ *
+ * The application derives from this class and implements resetWatchdog(), shouldExit(), and tryScheduleReboot(),
+ * which are specific to the application. The API is not thread-safe; it is used by the node thread only.
+ */
+class SocketCANPlatform : public kocherga_uavcan::IUAVCANPlatform
+{
+    static constexpr std::size_t MaxInterfaces = std::numeric_limits<kocherga_uavcan::InterfaceMask>::digits;
+    static constexpr std::uint32_t TimerEventTag = 0xFFFF'FFFFUL;
+
+    /**
+     * The kernel does not notify the socket when the TX queue of the interface (as opposed to the socket send
+     * buffer) becomes available again after ENOBUFS, so the transmission is retried at this interval.
+     */
+    static constexpr std::chrono::microseconds TxQueueRetryInterval{1'000};  // NOLINT
+
+    const std::vector<std::string> iface_names_;
+    const std::uint32_t bit_rate_;
+    const std::uint32_t data_bit_rate_;
+
+    std::vector<impl_::FileDescriptor> sockets_;
+    impl_::FileDescriptor rx_epoll_;            ///< All sockets (for reading) and the timer
+    impl_::FileDescriptor tx_epoll_;            ///< The timer, and the socket that is waited on for TX space
+    impl_::FileDescriptor timer_;
+    CANMode mode_ = CANMode::Normal;
+    bool canfd_brs_ = false;
+    std::uint8_t next_rx_iface_index_ = 0;      ///< Interfaces are read in round robin so that none is starved
+
+
+    static std::int16_t addToEpoll(const impl_::FileDescriptor& epoll,
+                                   const int fd,
+                                   const std::uint32_t events,
+                                   const std::uint32_t tag)
+    {
+        ::epoll_event ev{};
+        ev.events = events;
+        ev.data.u32 = tag;
+        return (::epoll_ctl(epoll.get(), EPOLL_CTL_ADD, fd, &ev) < 0) ? impl_::getErrorCode() : std::int16_t(0);
+    }
+
+    static std::pair<std::int16_t, impl_::FileDescriptor> openSocket(const std::string& iface_name,
+                                                                     const bool canfd,
+                                                                     const CANAcceptanceFilterList& filters)
+    {
+        impl_::FileDescriptor fd(::socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW));
+        if (!fd.isValid())
+        {
+            return {impl_::getErrorCode(), impl_::FileDescriptor()};
+        }
+
+        ::sockaddr_can addr{};
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = int(::if_nametoindex(iface_name.c_str()));
+        if (addr.can_ifindex == 0)
+        {
+            return {impl_::getErrorCode(), impl_::FileDescriptor()};
+        }
+
+        const int enable = 1;
+        if (canfd && (::setsockopt(fd.get(), SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0))
+        {
+            return {impl_::getErrorCode(), impl_::FileDescriptor()};
+        }
+
+        // The flag bits of libcanard are the same as those of SocketCAN, except that the kernel would interpret
+        // the error frame flag in a filter as an inverted match
+        std::array<::can_filter, MaxCANAcceptanceFilters> kernel_filters{};
+        for (std::size_t i = 0; i < filters.size(); i++)
+        {
+            kernel_filters[i].can_id = filters[i].id & ~std::uint32_t(CAN_INV_FILTER);
+            kernel_filters[i].can_mask = filters[i].mask;
+        }
+        if (::setsockopt(fd.get(), SOL_CAN_RAW, CAN_RAW_FILTER,
+                         kernel_filters.data(), ::socklen_t(filters.size() * sizeof(::can_filter))) < 0)
+        {
+            return {impl_::getErrorCode(), impl_::FileDescriptor()};
+        }
+
+        if (::setsockopt(fd.get(), SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0)
+        {
+            return {impl_::getErrorCode(), impl_::FileDescriptor()};
+        }
+
+        if (::bind(fd.get(), reinterpret_cast<::sockaddr*>(&addr), sizeof(addr)) < 0)
+        {
+            return {impl_::getErrorCode(), impl_::FileDescriptor()};
+        }
+
+        return {0, std::move(fd)};
+    }
+
+    /**
+     * Blocks until one of the file descriptors registered with the epoll instance is ready, or until the specified
+     * point in time on the monotonic clock. Returns 1 if a file descriptor is ready, 0 on timeout.
+     */
+    std::int16_t waitUntil(const impl_::FileDescriptor& epoll, const std::chrono::microseconds deadline) const
+    {
+        // A zero expiration time would disarm the timer instead; re-arming also resets a stale expiration
+        ::itimerspec spec{};
+        spec.it_value = impl_::makeTimespec(std::max(deadline, std::chrono::microseconds(1)));
+        if (::timerfd_settime(timer_.get(), TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+        {
+            return impl_::getErrorCode();
+        }
+
+        std::array<::epoll_event, MaxInterfaces + 1U> events{};
+        while (true)
+        {
+            const int num_events = ::epoll_wait(epoll.get(), events.data(), int(events.size()), -1);
+            if (num_events < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return impl_::getErrorCode();
+            }
+
+            for (int i = 0; i < num_events; i++)
+            {
+                if (events[std::size_t(i)].data.u32 != TimerEventTag)
+                {
+                    return 1;
+                }
+            }
+            return 0;
+        }
+    }
+
+    /**
+     * Reads one frame from the specified interface without blocking. Returns 0 if there are no frames.
+     */
+    std::pair<std::int16_t, ReceivedCANFrame> readFrame(const std::uint8_t iface_index)
+    {
+        ::canfd_frame buffer{};         // A classic frame is a prefix of a CAN FD frame
+        ::iovec iov{};
+        iov.iov_base = &buffer;
+        iov.iov_len = sizeof(buffer);
+
+        alignas(::cmsghdr) std::array<std::uint8_t, CMSG_SPACE(sizeof(::timespec))> control{};
+        ::msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        const auto size = ::recvmsg(sockets_[iface_index].get(), &msg, MSG_DONTWAIT);
+        if (size < 0)
+        {
+            return {((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ?
+                    std::int16_t(0) : impl_::getErrorCode(), {}};
+        }
+        if ((std::size_t(size) != CAN_MTU) && (std::size_t(size) != CANFD_MTU))
+        {
+            return {-EIO, {}};
+        }
+
+        // Error and remote frames are not used by UAVCAN; they are not delivered unless requested anyway
+        if (((buffer.can_id & (CAN_ERR_FLAG | CAN_RTR_FLAG)) != 0) ||
+            (buffer.len > sizeof(::CanardCANFrame{}.data)))
+        {
+            return {0, {}};
+        }
+
+        ReceivedCANFrame out{};
+        out.frame.id = buffer.can_id;
+        out.frame.data_len = buffer.len;
+        out.frame.iface_id = iface_index;
+        std::memcpy(out.frame.data, buffer.data, buffer.len);
+
+        // The kernel timestamps the frame upon reception with the real time clock; translating to the monotonic one
+        for (::cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+            {
+                ::timespec ts{};
+                std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                const auto received_at = std::chrono::seconds(ts.tv_sec) +
+                    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(ts.tv_nsec));
+                const auto monotonic_now = impl_::getMonotonicTime();
+                const auto age = impl_::readClock(CLOCK_REALTIME) - received_at;
+                out.timestamp = std::clamp(monotonic_now - age, std::chrono::microseconds(1), monotonic_now);
+            }
+        }
+
+        return {1, out};
+    }
+
+    bool isConfigured() const
+    {
+        return !sockets_.empty();
+    }
+
+public:
+    /**
+     * @param iface_names       names of the redundant interfaces connected to the same bus, e.g. {"can0"};
+     *                          at least one and at most 8
+     * @param bit_rate          bit rate the interfaces are configured with, if known; zero accepts any
+     * @param data_bit_rate     data phase bit rate for CAN FD; zero selects classic CAN
+     */
+    explicit SocketCANPlatform(std::vector<std::string> iface_names,
+                               const std::uint32_t bit_rate = 0,
+                               const std::uint32_t data_bit_rate = 0) :
+        iface_names_(std::move(iface_names)),
+        bit_rate_(bit_rate),
+        data_bit_rate_(data_bit_rate)
+    {
+        assert(!iface_names_.empty() && (iface_names_.size() <= MaxInterfaces));
+        assert((data_bit_rate_ == 0) || CANARD_ENABLE_CANFD);
+    }
+
+    std::uint8_t getNumberOfInterfaces() const override
+    {
+        return std::uint8_t(iface_names_.size());
+    }
+
+    std::uint32_t getCANFDDataBitRate(std::uint32_t nominal_bit_rate) const override
+    {
+        (void) nominal_bit_rate;
+        return data_bit_rate_;
+    }
+
+    void sleep(const std::chrono::microseconds duration) const override
+    {
+        const auto deadline = impl_::makeTimespec(impl_::getMonotonicTime() + duration);
+        while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+        {
+            // Interrupted by a signal; the deadline is absolute, so just resume
+        }
+    }
+
+    std::uint64_t getRandomUnsignedInteger(const std::uint64_t lower_bound,
+                                           const std::uint64_t upper_bound) const override
+    {
+        if (lower_bound >= upper_bound)
+        {
+            assert(false);
+            return lower_bound;
+        }
+
+        std::uint64_t rnd = 0;
+        while (::getrandom(&rnd, sizeof(rnd), 0) != ::ssize_t(sizeof(rnd)))
+        {
+            assert(errno == EINTR);             // Cannot fail otherwise with a buffer this small
+        }
+        return lower_bound + rnd % (upper_bound - lower_bound);
+    }
+
+    std::int16_t configure(const std::uint32_t bitrate,
+                           const std::uint32_t data_bit_rate,
+                           const CANMode mode,
+                           const CANAcceptanceFilterList& acceptance_filters) override
+    {
+        if ((bit_rate_ != 0) && (bitrate != bit_rate_))
+        {
+            return -EINVAL;
+        }
+
+        sockets_.clear();
+        timer_.reset(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+        rx_epoll_.reset(::epoll_create1(EPOLL_CLOEXEC));
+        tx_epoll_.reset(::epoll_create1(EPOLL_CLOEXEC));
+        if (!timer_.isValid() || !rx_epoll_.isValid() || !tx_epoll_.isValid())
+        {
+            return impl_::getErrorCode();
+        }
+
+        for (const auto* epoll : {&rx_epoll_, &tx_epoll_})
+        {
+            if (const auto res = addToEpoll(*epoll, timer_.get(), EPOLLIN, TimerEventTag); res < 0)
+            {
+                return res;
+            }
+        }
+
+        std::vector<impl_::FileDescriptor> sockets;
+        for (std::size_t i = 0; i < iface_names_.size(); i++)
+        {
+            auto [res, fd] = openSocket(iface_names_[i], data_bit_rate != 0, acceptance_filters);
+            if (res >= 0)
+            {
+                res = addToEpoll(rx_epoll_, fd.get(), EPOLLIN, std::uint32_t(i));
+            }
+            if (res < 0)
+            {
+                return res;
+            }
+            sockets.push_back(std::move(fd));
+        }
+
+        sockets_ = std::move(sockets);
+        mode_ = mode;
+        canfd_brs_ = (data_bit_rate != 0) && (data_bit_rate != bitrate);
+        next_rx_iface_index_ = 0;
+        return 0;
+    }
+
+    std::int16_t send(const ::CanardCANFrame& frame, const std::chrono::microseconds timeout) override
+    {
+        if (!isConfigured() || (frame.iface_id >= sockets_.size()))
+        {
+            return -EBADF;
+        }
+        if (mode_ == CANMode::Silent)
+        {
+            return -EPERM;
+        }
+
+        ::canfd_frame buffer{};
+        buffer.can_id = frame.id;
+        buffer.len = frame.data_len;
+        std::memcpy(buffer.data, frame.data, frame.data_len);
+        const bool canfd = frame.data_len > CAN_MAX_DLEN;
+        if (canfd)
+        {
+            buffer.flags = std::uint8_t(canfd_brs_ ? CANFD_BRS : 0U);
+        }
+        const std::size_t size = canfd ? CANFD_MTU : CAN_MTU;
+
+        const int fd = sockets_[frame.iface_id].get();
+        const auto deadline = impl_::getMonotonicTime() + timeout;
+        while (true)
+        {
+            const auto res = ::write(fd, &buffer, size);
+            if (res >= 0)
+            {
+                return (std::size_t(res) == size) ? std::int16_t(1) : std::int16_t(-EIO);
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS))
+            {
+                return impl_::getErrorCode();
+            }
+
+            // The socket send buffer is full (EAGAIN), or the TX queue of the interface is full (ENOBUFS)
+            const bool queue_full = errno == ENOBUFS;
+            const auto now = impl_::getMonotonicTime();
+            if (now >= deadline)
+            {
+                return 0;
+            }
+
+            if (!queue_full)
+            {
+                if (const auto add_res = addToEpoll(tx_epoll_, fd, EPOLLOUT, 0); add_res < 0)
+                {
+                    return add_res;
+                }
+            }
+            const auto wait_res = waitUntil(tx_epoll_, queue_full ? std::min(deadline, now + TxQueueRetryInterval) :
+                                                                    deadline);
+            if (!queue_full)
+            {
+                (void) ::epoll_ctl(tx_epoll_.get(), EPOLL_CTL_DEL, fd, nullptr);
+            }
+            if (wait_res < 0)
+            {
+                return wait_res;
+            }
+        }
+    }
+
+    std::pair<std::int16_t, ReceivedCANFrame> receive(const std::chrono::microseconds timeout) override
+    {
+        if (!isConfigured())
+        {
+            return {-EBADF, {}};
+        }
+
+        const auto deadline = impl_::getMonotonicTime() + timeout;
+        while (true)
+        {
+            const auto num_ifaces = std::uint8_t(sockets_.size());
+            for (std::uint8_t i = 0; i < num_ifaces; i++)
+            {
+                const auto iface_index = std::uint8_t((next_rx_iface_index_ + i) % num_ifaces);
+                const auto res = readFrame(iface_index);
+                if (res.first != 0)
+                {
+                    next_rx_iface_index_ = std::uint8_t((iface_index + 1U) % num_ifaces);
+                    return res;
+                }
+            }
+
+            if (impl_::getMonotonicTime() >= deadline)
+            {
+                return {0, {}};
+            }
+
+            if (const auto res = waitUntil(rx_epoll_, deadline); res <= 0)
+            {
+                return {res, {}};
+            }
+        }
+    }
+};
+
+}
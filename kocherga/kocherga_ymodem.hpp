@@ -28,6 +28,9 @@
 #include <kocherga.hpp>
 #include <utility>
 #include <numeric>
+#include <optional>
+#include <algorithm>
+#include <array>
 
 // Oh C, never change.
 #ifdef CAN
@@ -47,6 +50,56 @@ static constexpr std::int16_t ErrProtocolError                  = 2003;
 static constexpr std::int16_t ErrTransferCancelledByRemote      = 2004;
 static constexpr std::int16_t ErrRemoteRefusedToProvideFile     = 2005;
 static constexpr std::int16_t ErrPortError                      = 2006;
+static constexpr std::int16_t ErrNotStarted                     = 2007;
+static constexpr std::int16_t ErrStreamingFailed                = 2008;
+
+/**
+ * This is used to verify the integrity of the blocks in CRC mode.
+ * The blocks are validated while the next one is being received, so the kernel is table-driven
+ * (one lookup per byte); the table is computed at compile time and occupies 512 bytes of ROM.
+ *
+ * CRC-16/XMODEM, also known as CRC-16-CCITT with zero initial value
+ * Description: http://reveng.sourceforge.net/crc-catalogue/16.htm#crc.cat.crc-16-xmodem
+ * Initial value: 0x0000
+ * Poly: 0x1021
+ * Reverse: no
+ * Output xor: 0x0000
+ * Check: 0x31C3
+ */
+class CRC16
+{
+    static constexpr std::uint16_t Poly = 0x1021;
+
+    static constexpr std::array<std::uint16_t, 256> Table = []()
+    {
+        std::array<std::uint16_t, 256> table{};
+        for (std::uint16_t i = 0; i < table.size(); i++)
+        {
+            auto crc = std::uint16_t(i << 8U);
+            for (std::uint8_t bit = 0; bit < 8; bit++)
+            {
+                crc = std::uint16_t(((crc & 0x8000U) != 0) ? ((crc << 1U) ^ Poly) : (crc << 1U));
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    std::uint16_t crc_ = 0;
+
+public:
+    void add(const void* data, std::size_t len)
+    {
+        auto bytes = static_cast<const std::uint8_t*>(data);
+        assert(bytes != nullptr);
+        while (len --> 0)
+        {
+            crc_ = std::uint16_t((crc_ << 8U) ^ Table[((crc_ >> 8U) ^ *bytes++) & 0xFFU]);
+        }
+    }
+
+    std::uint16_t get() const { return crc_; }
+};
 
 /**
  * Abstracts a platform-specific serial port and related functions for the YMODEM protocol.
@@ -80,10 +133,44 @@ public:
      * Receives one byte from the port.
      * @param out_byte  A reference where to store the received byte.
      * @param timeout   The operation will be aborted if the byte could not be received in this amount of time.
+     *                  Zero timeout means that the method shall return immediately if there is no data to read.
      * @return          @ref Result.
      */
     virtual Result receive(std::uint8_t& out_byte, std::chrono::microseconds timeout) = 0;
 
+    /**
+     * Receives up to the specified number of bytes from the port in one operation.
+     * This is used to fetch the block payload, which makes up nearly all of the traffic; at high baud rates,
+     * a per-byte call with its own timeout handling and driver locking may be what limits the throughput.
+     * The method shall wait for the first byte up to the timeout, and then return whatever else is already
+     * available without waiting for the rest. The default implementation falls back to the per-byte receive().
+     * @param out_data  Where to store the received bytes.
+     * @param inout_size The maximum number of bytes to receive (non-zero); the number of received bytes on return.
+     * @param timeout   Like in the per-byte receive().
+     * @return          @ref Result; success means that at least one byte was received.
+     */
+    virtual Result receiveBulk(std::uint8_t* const out_data,
+                               std::uint16_t& inout_size,
+                               const std::chrono::microseconds timeout)
+    {
+        assert((out_data != nullptr) && (inout_size > 0));
+        const std::uint16_t max_size = inout_size;
+        inout_size = 0;
+
+        auto result = receive(out_data[0], timeout);
+        while (result == Result::Success)
+        {
+            inout_size++;
+            if (inout_size >= max_size)
+            {
+                break;
+            }
+            result = receive(out_data[inout_size], std::chrono::microseconds(0));
+        }
+
+        return (inout_size > 0) ? Result::Success : result;
+    }
+
     /**
      * Returns the time since boot as a monotonic (i.e. steady) clock.
      * The clock must never overflow.
@@ -96,14 +183,29 @@ public:
  * Downloads data using YMODEM or XMODEM protocol over the specified ChibiOS channel
  * (e.g. serial port, USB CDC ACM, TCP, ...).
  *
- * This class will request Checksum mode, in order to retain compatibility both with XMODEM and YMODEM senders
- * (YMODEM-compatible senders do support checksum mode as well as CRC mode).
+ * This class will request CRC mode first, because senders tend to keep 1K blocks only in CRC mode,
+ * and because the 8-bit checksum lets many line errors through to the image verification.
+ * If the sender does not respond to a few CRC mode requests, the class falls back to checksum mode,
+ * in order to retain compatibility with the original XMODEM senders.
  * Both 1K and 128-byte blocks are supported.
+ *
+ * Optionally, the class can request the streaming mode (YMODEM-g) first, where the sender transmits the blocks
+ * back-to-back without waiting for the confirmations, so the throughput is not limited by the link latency.
+ * There is no error recovery in this mode: any error aborts the transfer. It should only be used on links that
+ * are error-free and flow-controlled, such as USB CDC ACM: the link must hold the sender back while the received
+ * data is being written into the ROM. Senders that do not support the streaming mode are detected after a few
+ * requests, and the transfer falls back to CRC mode as usual.
+ *
  * Overall, the following protocols are supported:
  *      - YMODEM
+ *      - YMODEM-g
  *      - XMODEM
+ *      - XMODEM-CRC
  *      - XMODEM-1K
  *
+ * The download can be performed either in blocking mode via downloadImage(), or step-by-step from a superloop:
+ * invoke begin(), then invoke step() until it returns a non-positive value.
+ *
  * Reference: http://pauillac.inria.fr/~doligez/zmodem/ymodem.txt
  */
 class YModemProtocol final : public kocherga::IProtocol
@@ -118,8 +220,15 @@ class YModemProtocol final : public kocherga::IProtocol
     static constexpr std::chrono::microseconds InitialTimeout      {60'000'000};    // NOLINT
     static constexpr std::chrono::microseconds NextBlockTimeout     {5'000'000};    // NOLINT
     static constexpr std::chrono::microseconds BlockPayloadTimeout  {1'000'000};    // NOLINT
+    static constexpr std::chrono::microseconds ModeRequestTimeout   {3'000'000};    // NOLINT
 
     static constexpr std::uint8_t MaxRetries = 3;
+    static constexpr std::uint8_t MaxModeRequests = 3;          ///< Falling back to the next mode afterwards
+
+    static constexpr std::uint16_t ChecksumSize = 1;
+    static constexpr std::uint16_t CRCSize = 2;
+
+    static constexpr std::int16_t InProgress = 1;
 
     struct ControlCharacters
     {
@@ -129,11 +238,64 @@ class YModemProtocol final : public kocherga::IProtocol
         static constexpr std::uint8_t ACK = 0x06;
         static constexpr std::uint8_t NAK = 0x15;
         static constexpr std::uint8_t CAN = 0x18;
+        static constexpr std::uint8_t C   = 0x43;       ///< Requests the transfer in CRC mode instead of NAK
+        static constexpr std::uint8_t G   = 0x47;       ///< Requests the transfer in streaming CRC mode
+    };
+
+    enum class Phase : std::uint8_t
+    {
+        Idle,
+        Initiating,         ///< Awaiting the first block: zero block in YMODEM, first data block in XMODEM
+        Receiving           ///< Receiving the data blocks until EOT
+    };
+
+    enum class Mode : std::uint8_t
+    {
+        XModem,
+        YModem
+    };
+
+    enum class IntegrityCheck : std::uint8_t
+    {
+        CRC16,
+        Checksum
+    };
+
+    /// One block is received per request (NAK or ACK)
+    enum class BlockStage : std::uint8_t
+    {
+        Request,
+        Header,
+        SequenceID,
+        Payload
     };
 
     IYModemPlatform& platform_;
+    const bool request_streaming_;
     std::uint8_t buffer_[WorstCaseBlockSizeWithCRC]{};
 
+    // Transfer state
+    kocherga::IDownloadSink* sink_ = nullptr;
+    Phase phase_ = Phase::Idle;
+    Mode mode_{};
+    IntegrityCheck integrity_check_{};
+    bool streaming_ = false;
+    std::uint8_t mode_requests_ = 0;
+    bool awaiting_start_ = false;       ///< The sender expects 'G', 'C', or NAK that starts the data transmission
+    std::chrono::microseconds started_at_{};
+    std::uint32_t remaining_file_size_ = 0;
+    bool file_size_known_ = false;
+    std::uint8_t expected_sequence_id_ = 0;
+    std::uint8_t remaining_retries_ = 0;
+    bool ack_ = false;
+
+    // Block reception state
+    BlockStage block_stage_ = BlockStage::Request;
+    std::chrono::microseconds block_deadline_{};
+    std::uint16_t block_size_ = 0;
+    std::uint16_t block_offset_ = 0;
+    std::uint8_t sequence_id_bytes_[2]{};
+
 
     static std::uint8_t computeChecksum(const void* data, std::uint16_t size)
     {
@@ -141,6 +303,39 @@ class YModemProtocol final : public kocherga::IProtocol
         return std::uint8_t(std::accumulate(p, p + size, 0));
     }
 
+    std::uint16_t getIntegrityCheckSize() const
+    {
+        return (integrity_check_ == IntegrityCheck::CRC16) ? CRCSize : ChecksumSize;
+    }
+
+    /**
+     * Validates the block payload in the buffer against the checksum or the CRC that follows it.
+     * The CRC is transmitted in the big endian byte order.
+     */
+    bool isBlockIntact() const
+    {
+        if (integrity_check_ == IntegrityCheck::CRC16)
+        {
+            CRC16 crc;
+            crc.add(buffer_, block_size_);
+            const auto received = std::uint16_t((buffer_[block_size_] << 8U) | buffer_[block_size_ + 1U]);
+            if (crc.get() != received)
+            {
+                KOCHERGA_TRACE("YMODEM CRC error, 0x%x not 0x%x\n", unsigned(crc.get()), unsigned(received));
+                return false;
+            }
+            return true;
+        }
+
+        const auto checksum = computeChecksum(buffer_, block_size_);
+        if (checksum != buffer_[block_size_])
+        {
+            KOCHERGA_TRACE("YMODEM checksum error, %d not %d\n", checksum, buffer_[block_size_]);
+            return false;
+        }
+        return true;
+    }
+
     std::int16_t send(std::uint8_t byte)
     {
         KOCHERGA_TRACE("YMODEM TX 0x%x\n", byte);
@@ -163,46 +358,6 @@ class YModemProtocol final : public kocherga::IProtocol
         return -ErrPortError;
     }
 
-    std::int16_t receive(void* data, const std::uint16_t size, std::chrono::microseconds timeout)
-    {
-        assert(size <= kocherga::MaxDataBlockSize);
-        auto* ui8 = static_cast<std::uint8_t*>(data);
-        for (std::uint16_t i = 0; i < size; i++)
-        {
-            std::uint8_t byte = 0;
-            switch (platform_.receive(byte, CharReceiveTimeout))
-            {
-            case IYModemPlatform::Result::Success:
-            {
-                *ui8++ = std::uint8_t(byte);
-                break;
-            }
-            case IYModemPlatform::Result::Timeout:
-            {
-                /*
-                 * Note that we may greatly overstay the timeout here, but this is by design,
-                 * since the spec requires that each character must be received with 1 second timeout.
-                 */
-                if (timeout <= CharReceiveTimeout)
-                {
-                    return std::int16_t(i);
-                }
-                else
-                {
-                    timeout -= CharReceiveTimeout;
-                }
-                break;
-            }
-            case IYModemPlatform::Result::Error:
-            {
-                return -ErrPortError;
-            }
-            }
-        }
-
-        return std::int16_t(size);
-    }
-
     void abort()
     {
         constexpr std::uint8_t Times = 5;           // Multiple CAN are required!
@@ -221,98 +376,97 @@ class YModemProtocol final : public kocherga::IProtocol
         Timeout,
         EndOfTransmission,
         TransmissionCancelled,
-        ProtocolError,
-        SystemError
+        ProtocolError
     };
 
     /**
-     * Reads a block from the channel. This function does not transmit anything.
-     * @return First component: @ref BlockReceptionResult
-     *         Second component: system error code, if applicable
+     * Feeds the next received byte into the block reception state machine. This function does not transmit anything.
+     * @return An empty option if the block is not yet complete, @ref BlockReceptionResult otherwise.
      */
-    std::pair<BlockReceptionResult, std::int16_t> receiveBlock(std::uint16_t& out_size,
-                                                               std::uint8_t& out_sequence)
+    std::optional<BlockReceptionResult> processBlockByte(const std::uint8_t byte)
     {
-        // Header byte
-        std::uint8_t header_byte = 0;
-        std::int16_t res = receive(&header_byte, 1, NextBlockTimeout);
-        if (res < 0)
+        switch (block_stage_)
         {
-            return { BlockReceptionResult::SystemError, res };
-        }
-        if (res != 1)
+        case BlockStage::Header:
         {
-            return { BlockReceptionResult::Timeout, 0 };
-        }
-
-        switch (header_byte)
-        {
-        case ControlCharacters::STX:
-        {
-            out_size = BlockSize1K;
+            switch (byte)
+            {
+            case ControlCharacters::STX:
+            {
+                block_size_ = BlockSize1K;
+                break;
+            }
+            case ControlCharacters::SOH:
+            {
+                block_size_ = BlockSizeXModem;
+                break;
+            }
+            case ControlCharacters::EOT:
+            {
+                KOCHERGA_TRACE("YMODEM RX EOT\n");
+                return BlockReceptionResult::EndOfTransmission;
+            }
+            case ControlCharacters::CAN:
+            {
+                KOCHERGA_TRACE("YMODEM RX CAN\n");
+                return BlockReceptionResult::TransmissionCancelled;
+            }
+            default:
+            {
+                KOCHERGA_TRACE("YMODEM unexpected header 0x%x\n", byte);
+                return BlockReceptionResult::ProtocolError;
+            }
+            }
+            block_stage_ = BlockStage::SequenceID;
+            block_offset_ = 0;
             break;
         }
-        case ControlCharacters::SOH:
+        case BlockStage::SequenceID:
         {
-            out_size = BlockSizeXModem;
+            sequence_id_bytes_[block_offset_++] = byte;
+            if (block_offset_ >= sizeof(sequence_id_bytes_))
+            {
+                if (sequence_id_bytes_[0] != static_cast<std::uint8_t>(~sequence_id_bytes_[1]))
+                {
+                    KOCHERGA_TRACE("YMODEM non-inverted sequence ID: 0x%x 0x%x\n",
+                                   sequence_id_bytes_[0], sequence_id_bytes_[1]);
+                    return BlockReceptionResult::ProtocolError;
+                }
+                block_stage_ = BlockStage::Payload;
+                block_offset_ = 0;
+            }
             break;
         }
-        case ControlCharacters::EOT:
-        {
-            KOCHERGA_TRACE("YMODEM RX EOT\n");
-            return { BlockReceptionResult::EndOfTransmission, 0 };
-        }
-        case ControlCharacters::CAN:
-        {
-            KOCHERGA_TRACE("YMODEM RX CAN\n");
-            return { BlockReceptionResult::TransmissionCancelled, 0 };
-        }
+        case BlockStage::Payload:       // Received in bulk, see processPayload()
+        case BlockStage::Request:
         default:
         {
-            KOCHERGA_TRACE("YMODEM unexpected header 0x%x\n", header_byte);
-            return { BlockReceptionResult::ProtocolError, 0 };
+            assert(false);
+            return BlockReceptionResult::ProtocolError;
         }
         }
 
-        // Sequence ID
-        std::uint8_t sequence_id_bytes[2] = {};
-        res = receive(sequence_id_bytes, 2, BlockPayloadTimeout);
-        if (res < 0)
-        {
-            return { BlockReceptionResult::SystemError, res };
-        }
-        if (res != 2)
-        {
-            return { BlockReceptionResult::Timeout, 0 };
-        }
-        if (sequence_id_bytes[0] != static_cast<std::uint8_t>(~sequence_id_bytes[1]))       // Invalid sequence ID
-        {
-            KOCHERGA_TRACE("YMODEM non-inverted sequence ID: 0x%x 0x%x\n", sequence_id_bytes[0], sequence_id_bytes[1]);
-            return { BlockReceptionResult::ProtocolError, 0 };
-        }
-        out_sequence = sequence_id_bytes[0];
-
-        // Payload
-        constexpr auto ChecksumSize = 1;
-        const auto block_size_with_checksum = std::uint16_t(out_size + ChecksumSize);
-        res = receive(buffer_, block_size_with_checksum, BlockPayloadTimeout);
-        if (res < 0)
-        {
-            return { BlockReceptionResult::SystemError, res };
-        }
-        if (std::uint16_t(res) != block_size_with_checksum)
-        {
-            return { BlockReceptionResult::Timeout, 0 };
-        }
+        // The spec requires that each character of the block must be received with 1 second timeout
+        block_deadline_ = platform_.getMonotonicUptime() + BlockPayloadTimeout;
+        return {};
+    }
 
-        // Checksum validation
-        if (computeChecksum(buffer_, out_size) != buffer_[out_size])
+    /**
+     * Accounts for the payload bytes that have been received directly into the buffer at the current offset.
+     * @return An empty option if the block is not yet complete, @ref BlockReceptionResult otherwise.
+     */
+    std::optional<BlockReceptionResult> processPayload(const std::uint16_t size)
+    {
+        const auto full_size = std::uint16_t(block_size_ + getIntegrityCheckSize());
+        block_offset_ = std::uint16_t(block_offset_ + size);
+        assert(block_offset_ <= full_size);
+        if (block_offset_ >= full_size)
         {
-            KOCHERGA_TRACE("YMODEM checksum error, not %d\n", buffer_[out_size]);
-            return { BlockReceptionResult::ProtocolError, 0 };
+            return isBlockIntact() ? BlockReceptionResult::Success : BlockReceptionResult::ProtocolError;
         }
 
-        return { BlockReceptionResult::Success, 0 };
+        block_deadline_ = platform_.getMonotonicUptime() + BlockPayloadTimeout;
+        return {};
     }
 
     static bool tryParseZeroBlock(const std::uint8_t* const data,
@@ -372,268 +526,451 @@ class YModemProtocol final : public kocherga::IProtocol
         return sink.handleNextDataChunk(data, size);
     }
 
-public:
-    /**
-     * @param serial_port                   the serial port channel that will be used for downloading
-     */
-    explicit YModemProtocol(IYModemPlatform& serial_port) :
-        platform_(serial_port)
-    { }
-
-    std::int16_t downloadImage(kocherga::IDownloadSink& sink) override
+    std::int16_t requestNextBlock()
     {
-        // This thing will make sure there's no residual garbage in the RX buffer afterwards
-        struct Flusher
-        {
-            IYModemPlatform& port;
-            ~Flusher()
-            {
-                std::uint8_t dummy = 0;
-                while (port.receive(dummy, std::chrono::microseconds(1'000)) == IYModemPlatform::Result::Success)
-                {
-                    KOCHERGA_TRACE("YMODEM FLUSH RX 0x%x\n", unsigned(dummy));
-                }
-            }
-        } flusher_{platform_};
-
-        // State variables
-        std::uint32_t remaining_file_size = 0;
-        bool file_size_known{};
-        std::uint8_t expected_sequence_id = 123;             // Arbitrary invalid value
-
-        enum class Mode
-        {
-            XModem,
-            YModem
-        } mode{};
-
-        /*
-         * Initiating the transfer, receiving the first block.
-         * The sequence ID will be 0 in case of YMODEM, and 1 in case of XMODEM.
-         */
-        const auto started_at = platform_.getMonotonicUptime();
-        for (;;)
+        if (phase_ == Phase::Initiating)
         {
             KOCHERGA_TRACE("Trying to initiate X/YMODEM transfer...\n");
 
             // Abort if we couldn't get it going in InitialTimeout
-            if ((platform_.getMonotonicUptime() - started_at) > InitialTimeout)
+            if ((platform_.getMonotonicUptime() - started_at_) > InitialTimeout)
             {
                 abort();
                 return -ErrRetriesExhausted;
             }
 
-            // Requesting transmission in checksum mode
-            if (const auto res = send(ControlCharacters::NAK); res < 0)
+            // The senders ignore the mode requests they don't understand; the original XMODEM senders wait for NAK
+            if (mode_requests_ >= MaxModeRequests)
             {
-                abort();
-                return res;
+                if (streaming_)
+                {
+                    KOCHERGA_TRACE("YMODEM no response in streaming mode, falling back to CRC mode\n");
+                    streaming_ = false;
+                    mode_requests_ = 0;
+                }
+                else if (integrity_check_ == IntegrityCheck::CRC16)
+                {
+                    KOCHERGA_TRACE("YMODEM no response in CRC mode, falling back to checksum mode\n");
+                    integrity_check_ = IntegrityCheck::Checksum;
+                }
             }
-
-            // Receiving the block
-            std::uint16_t size = 0;
-            const auto block_rx_res = receiveBlock(size, expected_sequence_id);
-            if (block_rx_res.first == BlockReceptionResult::Success)
+        }
+        else
+        {
+            // Limiting retries
+            if (remaining_retries_ <= 0)
             {
-                ;
+                abort();
+                return -ErrRetriesExhausted;
             }
-            else if (block_rx_res.first == BlockReceptionResult::Timeout ||
-                     block_rx_res.first == BlockReceptionResult::ProtocolError ||
-                     block_rx_res.first == BlockReceptionResult::EndOfTransmission)
+            remaining_retries_--;
+        }
+
+        // Streamed blocks are not confirmed, the next one is already on its way
+        if (streaming_ && !awaiting_start_)
+        {
+            ack_ = false;
+            block_deadline_ = platform_.getMonotonicUptime() + NextBlockTimeout;
+            return InProgress;
+        }
+
+        // Confirming or re-requesting; the start of the transmission selects the mode: 'G', 'C', or NAK for checksum
+        std::uint8_t request = ControlCharacters::NAK;
+        if (ack_)
+        {
+            request = ControlCharacters::ACK;
+        }
+        else if (awaiting_start_)
+        {
+            if (streaming_)
             {
-                continue;   // EOT cannot be sent in response to the first block, it's an error; trying again...
+                request = ControlCharacters::G;
             }
-            else if (block_rx_res.first == BlockReceptionResult::TransmissionCancelled)
+            else if (integrity_check_ == IntegrityCheck::CRC16)
             {
-                abort();
-                return -ErrTransferCancelledByRemote;
+                request = ControlCharacters::C;
             }
-            else
+            mode_requests_++;
+        }
+
+        const auto res = send(request);
+        ack_ = false;
+        if (res < 0)
+        {
+            abort();
+            return res;
+        }
+
+        // Senders that do not understand the mode request are detected sooner, the spec allows three seconds
+        const bool mode_request = (request == ControlCharacters::G) || (request == ControlCharacters::C);
+        block_deadline_ = platform_.getMonotonicUptime() + (mode_request ? ModeRequestTimeout : NextBlockTimeout);
+        return InProgress;
+    }
+
+    /**
+     * Handles the first block of the transfer.
+     * The sequence ID will be 0 in case of YMODEM, and 1 in case of XMODEM.
+     */
+    std::int16_t processFirstBlock(const BlockReceptionResult result)
+    {
+        switch (result)
+        {
+        case BlockReceptionResult::Success:
+        {
+            break;
+        }
+        case BlockReceptionResult::ProtocolError:
+        {
+            if (streaming_)
             {
-                assert(block_rx_res.first == BlockReceptionResult::SystemError);
+                KOCHERGA_TRACE("YMODEM-g first block error\n");
                 abort();
-                return block_rx_res.second;
+                return -ErrStreamingFailed;
             }
+            return InProgress;
+        }
+        case BlockReceptionResult::Timeout:
+        case BlockReceptionResult::EndOfTransmission:
+        {
+            return InProgress;  // EOT cannot be sent in response to the first block, it's an error; trying again...
+        }
+        case BlockReceptionResult::TransmissionCancelled:
+        {
+            abort();
+            return -ErrTransferCancelledByRemote;
+        }
+        }
 
-            // Processing the block
-            if (expected_sequence_id == 0)
-            {
-                mode = Mode::YModem;
+        expected_sequence_id_ = sequence_id_bytes_[0];
 
-                bool is_null_block = true;
-                const bool zero_block_valid = tryParseZeroBlock(buffer_, size, is_null_block, remaining_file_size);
+        // Processing the block
+        if (expected_sequence_id_ == 0)
+        {
+            mode_ = Mode::YModem;
 
-                KOCHERGA_TRACE("YMODEM zero block: valid=%d null=%d size=%u\n",
-                               zero_block_valid, is_null_block, unsigned(remaining_file_size));
+            bool is_null_block = true;
+            const bool zero_block_valid = tryParseZeroBlock(buffer_, block_size_, is_null_block, remaining_file_size_);
 
-                if (!zero_block_valid)
-                {
-                    // Invalid zero block, that's a fatal error, it's checksum protected after all
-                    // Retrying here would make no sense, it's not a line hit, it's badly formed packet!
-                    abort();
-                    return -ErrProtocolError;
-                }
-                if (is_null_block)
-                {
-                    // Null block means that the sender is refusing to transmit the file
-                    // No point retrying too, the sender isn't going to change their mind
-                    abort();
-                    return -ErrRemoteRefusedToProvideFile;
-                }
-                file_size_known = remaining_file_size > 0;
+            KOCHERGA_TRACE("YMODEM zero block: valid=%d null=%d size=%u\n",
+                           zero_block_valid, is_null_block, unsigned(remaining_file_size_));
 
-                // The zero block requires a dedicated ACK, sending it now
-                if (const auto res = send(ControlCharacters::ACK); res < 0)
-                {
-                    abort();
-                    return res;
-                }
+            if (!zero_block_valid)
+            {
+                // Invalid zero block, that's a fatal error, it's checksum protected after all
+                // Retrying here would make no sense, it's not a line hit, it's badly formed packet!
+                abort();
+                return -ErrProtocolError;
             }
-            else if (expected_sequence_id == 1)
+            if (is_null_block)
             {
-                mode = Mode::XModem;
-                KOCHERGA_TRACE("YMODEM zero block skipped (XMODEM mode)\n");
+                // Null block means that the sender is refusing to transmit the file
+                // No point retrying too, the sender isn't going to change their mind
+                abort();
+                return -ErrRemoteRefusedToProvideFile;
+            }
+            file_size_known_ = remaining_file_size_ > 0;
 
-                if (const auto res = processDownloadedBlock(sink, buffer_, size); res < 0)
+            // The zero block requires a dedicated ACK, sending it now; YMODEM-g goes straight to the next 'G'
+            if (!streaming_)
+            {
+                if (const auto res = send(ControlCharacters::ACK); res < 0)
                 {
                     abort();
                     return res;
                 }
-                file_size_known = false;
             }
-            else                            // Invalid sequence number
+        }
+        else if (expected_sequence_id_ == 1)
+        {
+            mode_ = Mode::XModem;
+            KOCHERGA_TRACE("YMODEM zero block skipped (XMODEM mode)\n");
+
+            if (const auto res = processDownloadedBlock(*sink_, buffer_, block_size_); res < 0)
             {
                 abort();
-                return -ErrProtocolError;
+                return res;
             }
-
-            // Done!
-            expected_sequence_id = std::uint8_t(expected_sequence_id + 1);
-            break;
+            file_size_known_ = false;
+        }
+        else                            // Invalid sequence number
+        {
+            abort();
+            return -ErrProtocolError;
         }
 
-        assert(file_size_known ? true : (remaining_file_size == 0));
+        assert(file_size_known_ ? true : (remaining_file_size_ == 0));
 
-        /*
-         * Receiving the file
-         */
-        bool ack = mode == Mode::XModem;    // YMODEM requires another NAK after the zero block
-        auto remaining_retries = MaxRetries;
-        for (;;)
+        // Done, switching to the file reception
+        expected_sequence_id_ = std::uint8_t(expected_sequence_id_ + 1);
+        phase_ = Phase::Receiving;
+        ack_ = mode_ == Mode::XModem;               // YMODEM requires another 'C' or NAK after the zero block
+        awaiting_start_ = mode_ == Mode::YModem;
+        remaining_retries_ = MaxRetries;
+        return InProgress;
+    }
+
+    /**
+     * Handles the subsequent blocks of the transfer.
+     * Returns zero when the end of transmission is reached.
+     */
+    std::int16_t processNextBlock(const BlockReceptionResult result)
+    {
+        switch (result)
         {
-            // Limiting retries
-            if (remaining_retries <= 0)
+        case BlockReceptionResult::Success:
+        {
+            break;
+        }
+        case BlockReceptionResult::Timeout:
+        case BlockReceptionResult::ProtocolError:
+        {
+            if (streaming_)
             {
+                // The sender does not wait for NAK, so there is no way to request the block again
+                KOCHERGA_TRACE("YMODEM-g block lost\n");
                 abort();
-                return -ErrRetriesExhausted;
+                return -ErrStreamingFailed;
             }
-            remaining_retries--;
-
-            // Confirming or re-requesting
-            if (const auto res = send(ack ? ControlCharacters::ACK : ControlCharacters::NAK); res < 0)
+            return InProgress;
+        }
+        case BlockReceptionResult::EndOfTransmission:
+        {
+            if ((file_size_known_) && (remaining_file_size_ != 0))
             {
+                // The sender said that we're done, liar!
+                KOCHERGA_TRACE("YMODEM ended %u bytes early\n", unsigned(remaining_file_size_));
                 abort();
-                return res;
+                return -ErrProtocolError;
             }
-            ack = false;
+            KOCHERGA_TRACE("YMODEM end OK\n");
+            return ErrOK;
+        }
+        case BlockReceptionResult::TransmissionCancelled:
+        {
+            KOCHERGA_TRACE("YMODEM cancelled\n");
+            abort();
+            return -ErrTransferCancelledByRemote;
+        }
+        }
+        remaining_retries_ = MaxRetries;                        // Reset retries on successful reception
+        awaiting_start_ = false;
 
-            // Receiving the block
-            std::uint16_t size = 0;
-            std::uint8_t sequence_id = 0;
-            const auto block_rx_res = receiveBlock(size, sequence_id);
-            if (block_rx_res.first == BlockReceptionResult::Success)
+        // Processing the block
+        const std::uint8_t sequence_id = sequence_id_bytes_[0];
+        if ((sequence_id + 1) == expected_sequence_id_)         // Duplicate block, acknowledge silently
+        {
+            KOCHERGA_TRACE("YMODEM duplicate block skipped\n");
+            ack_ = true;
+            return InProgress;
+        }
+        if (sequence_id != expected_sequence_id_)               // Totally wrong sequence, abort
+        {
+            KOCHERGA_TRACE("YMODEM wrong sequence ID\n");
+            abort();
+            return -ErrProtocolError;
+        }
+        expected_sequence_id_ = std::uint8_t(expected_sequence_id_ + 1);
+
+        // Making sure we're not past the end of file
+        std::uint16_t size = block_size_;
+        if (file_size_known_)
+        {
+            if (remaining_file_size_ == 0)
             {
-                ;
+                KOCHERGA_TRACE("YMODEM transmission past the end of file\n");
+                abort();
+                return -ErrProtocolError;
             }
-            else if (block_rx_res.first == BlockReceptionResult::Timeout ||
-                     block_rx_res.first == BlockReceptionResult::ProtocolError)
+            if (size > remaining_file_size_)
             {
-                continue;
+                size = std::uint16_t(remaining_file_size_);
             }
-            else if (block_rx_res.first == BlockReceptionResult::EndOfTransmission)
+            remaining_file_size_ -= size;
+        }
+
+        // Sending the block over
+        if (const auto res = processDownloadedBlock(*sink_, buffer_, size); res < 0)
+        {
+            abort();
+            return res;
+        }
+
+        // Done, continue to the next block
+        ack_ = true;
+        return InProgress;
+    }
+
+    std::int16_t processBlock(const BlockReceptionResult result)
+    {
+        block_stage_ = BlockStage::Request;     // Whatever happens next, the next block will have to be requested
+
+        const auto res = (phase_ == Phase::Initiating) ? processFirstBlock(result) : processNextBlock(result);
+        if (res > 0)
+        {
+            return res;
+        }
+
+        if (res == ErrOK)
+        {
+            /*
+             * Final response and then leaving.
+             * Errors can be ignored - we got what we wanted anyway.
+             */
+            KOCHERGA_TRACE("YMODEM finalizing\n");
+
+            (void)send(ControlCharacters::ACK);         // If it fails, who cares.
+
+            if (mode_ == Mode::YModem)
             {
-                if ((file_size_known) && (remaining_file_size != 0))
-                {
-                    // The sender said that we're done, liar!
-                    KOCHERGA_TRACE("YMODEM ended %u bytes early\n", unsigned(remaining_file_size));
-                    abort();
-                    return -ErrProtocolError;
-                }
-                // Done, exiting and sending the final ACK
-                KOCHERGA_TRACE("YMODEM end OK\n");
-                break;
+                // Letting the sender know we don't want any other files. Is this compliant?
+                abort();
             }
-            else if (block_rx_res.first == BlockReceptionResult::TransmissionCancelled)
+        }
+
+        return finish(res);
+    }
+
+    std::int16_t finish(const std::int16_t result)
+    {
+        // Making sure there's no residual garbage in the RX buffer afterwards
+        std::uint8_t dummy = 0;
+        while (platform_.receive(dummy, std::chrono::microseconds(1'000)) == IYModemPlatform::Result::Success)
+        {
+            KOCHERGA_TRACE("YMODEM FLUSH RX 0x%x\n", unsigned(dummy));
+        }
+
+        sink_ = nullptr;
+        phase_ = Phase::Idle;
+        return result;
+    }
+
+    /**
+     * Advances the transfer. Returns after one block is processed, or after max_wait if no data is available.
+     * Zero max_wait means that the function will return as soon as the port input buffer is depleted.
+     */
+    std::int16_t stepImpl(const std::chrono::microseconds max_wait)
+    {
+        if (phase_ == Phase::Idle)
+        {
+            return -ErrNotStarted;
+        }
+
+        if (block_stage_ == BlockStage::Request)
+        {
+            if (const auto res = requestNextBlock(); res < 0)
             {
-                KOCHERGA_TRACE("YMODEM cancelled\n");
-                abort();
-                return -ErrTransferCancelledByRemote;
+                return finish(res);
             }
-            else
+            block_stage_ = BlockStage::Header;
+        }
+
+        for (;;)
+        {
+            const auto ts = platform_.getMonotonicUptime();
+            if (ts >= block_deadline_)
             {
-                assert(block_rx_res.first == BlockReceptionResult::SystemError);
-                abort();
-                return block_rx_res.second;
+                return processBlock(BlockReceptionResult::Timeout);
             }
-            remaining_retries = MaxRetries;                         // Reset retries on successful reception
 
-            // Processing the block
-            if ((sequence_id + 1) == expected_sequence_id)          // Duplicate block, acknowledge silently
+            const auto timeout = std::min(max_wait, block_deadline_ - ts);
+
+            // The payload is fetched in bulk directly into the buffer; never past the end of the current block
+            const bool payload = block_stage_ == BlockStage::Payload;
+            std::uint8_t byte = 0;
+            std::uint16_t size = 0;
+            IYModemPlatform::Result io_result{};
+            if (payload)
             {
-                KOCHERGA_TRACE("YMODEM duplicate block skipped\n");
-                ack = true;
-                continue;
+                size = std::uint16_t(block_size_ + getIntegrityCheckSize() - block_offset_);
+                io_result = platform_.receiveBulk(&buffer_[block_offset_], size, timeout);
             }
-            if (sequence_id != expected_sequence_id)                // Totally wrong sequence, abort
+            else
             {
-                KOCHERGA_TRACE("YMODEM wrong sequence ID\n");
-                abort();
-                return -ErrProtocolError;
+                io_result = platform_.receive(byte, timeout);
             }
-            expected_sequence_id = std::uint8_t(expected_sequence_id + 1);
 
-            // Making sure we're not past the end of file
-            if (file_size_known)
+            switch (io_result)
             {
-                if (remaining_file_size == 0)
+            case IYModemPlatform::Result::Success:
+            {
+                if (const auto result = payload ? processPayload(size) : processBlockByte(byte))
                 {
-                    KOCHERGA_TRACE("YMODEM transmission past the end of file\n");
-                    abort();
-                    return -ErrProtocolError;
+                    return processBlock(*result);
                 }
-                if (size > remaining_file_size)
+                break;
+            }
+            case IYModemPlatform::Result::Timeout:
+            {
+                if (max_wait.count() <= 0)
                 {
-                    size = std::uint16_t(remaining_file_size);
+                    return InProgress;
                 }
-                remaining_file_size -= size;
+                break;
             }
-
-            // Sending the block over
-            if (const auto res = processDownloadedBlock(sink, buffer_, size); res < 0)
+            case IYModemPlatform::Result::Error:
             {
                 abort();
-                return res;
+                return finish(-ErrPortError);
+            }
             }
-
-            // Done, continue to the next block
-            ack = true;
         }
+    }
 
-        /*
-         * Final response and then leaving.
-         * Errors can be ignored - we got what we wanted anyway.
-         */
-        KOCHERGA_TRACE("YMODEM finalizing\n");
+public:
+    /**
+     * @param serial_port                   the serial port channel that will be used for downloading
+     * @param request_streaming             request YMODEM-g first; only for error-free flow-controlled links
+     */
+    explicit YModemProtocol(IYModemPlatform& serial_port, const bool request_streaming = false) :
+        platform_(serial_port),
+        request_streaming_(request_streaming)
+    { }
 
-        (void)send(ControlCharacters::ACK);         // If it fails, who cares.
+    std::int16_t downloadImage(kocherga::IDownloadSink& sink) override
+    {
+        begin(sink);
 
-        if (mode == Mode::YModem)
+        std::int16_t res = 0;
+        do
         {
-            // Letting the sender know we don't want any other files. Is this compliant?
-            abort();
+            res = stepImpl(CharReceiveTimeout);
         }
+        while (res > 0);
 
-        return ErrOK;
+        return res;
+    }
+
+    /**
+     * Starts a new non-blocking download into the specified sink; the sink must outlive the download.
+     * The download is advanced by invoking step().
+     */
+    void begin(kocherga::IDownloadSink& sink)
+    {
+        sink_ = &sink;
+        phase_ = Phase::Initiating;
+        mode_ = {};
+        integrity_check_ = IntegrityCheck::CRC16;
+        streaming_ = request_streaming_;
+        mode_requests_ = 0;
+        awaiting_start_ = true;
+        started_at_ = platform_.getMonotonicUptime();
+        remaining_file_size_ = 0;
+        file_size_known_ = false;
+        expected_sequence_id_ = 123;                    // Arbitrary invalid value
+        remaining_retries_ = MaxRetries;
+        ack_ = false;
+        block_stage_ = BlockStage::Request;
+    }
+
+    /**
+     * Processes the received data without blocking and advances the download started with begin().
+     * The port is polled with zero timeout; see IYModemPlatform::receive().
+     * @return  Positive value if the download is still in progress, zero if it has completed successfully,
+     *          negative error code if it has failed. Returns -ErrNotStarted if there is no download in progress.
+     */
+    std::int16_t step()
+    {
+        return stepImpl(std::chrono::microseconds(0));
     }
 };
 
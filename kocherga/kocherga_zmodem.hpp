@@ -0,0 +1,1036 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Zubax Robotics
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+#pragma once
+
+#include <kocherga.hpp>
+#include <kocherga_ymodem.hpp>
+#include <array>
+#include <cstring>
+
+
+namespace kocherga_zmodem
+{
+/**
+ * Error codes specific to this module.
+ */
+static constexpr std::int16_t ErrOK                             = 0;
+static constexpr std::int16_t ErrPortWriteTimedOut              = 5001;
+static constexpr std::int16_t ErrRetriesExhausted               = 5002;
+static constexpr std::int16_t ErrProtocolError                  = 5003;
+static constexpr std::int16_t ErrTransferCancelledByRemote      = 5004;
+static constexpr std::int16_t ErrRemoteRefusedToProvideFile     = 5005;
+static constexpr std::int16_t ErrPortError                      = 5006;
+
+/**
+ * ZMODEM works over the same kind of byte stream as the YMODEM family, so the platform interface is shared.
+ * The bulk reception method of the interface is used for all input, so implementing it is recommended.
+ */
+using IZModemPlatform = kocherga_ymodem::IYModemPlatform;
+
+/**
+ * This is used to verify the integrity of the headers and the data subpackets in the 32-bit mode.
+ *
+ * CRC-32 (the one of Ethernet and ZIP)
+ * Description: http://reveng.sourceforge.net/crc-catalogue/17plus.htm#crc.cat.crc-32
+ * Initial value: 0xFFFFFFFF
+ * Poly: 0x04C11DB7 (reflected 0xEDB88320)
+ * Reverse: yes
+ * Output xor: 0xFFFFFFFF
+ * Check: 0xCBF43926
+ */
+class CRC32
+{
+    static constexpr std::uint32_t ReflectedPoly = 0xEDB88320UL;
+
+    static constexpr std::array<std::uint32_t, 256> Table = []()
+    {
+        std::array<std::uint32_t, 256> table{};
+        for (std::uint32_t i = 0; i < table.size(); i++)
+        {
+            std::uint32_t crc = i;
+            for (std::uint8_t bit = 0; bit < 8; bit++)
+            {
+                crc = ((crc & 1U) != 0) ? ((crc >> 1U) ^ ReflectedPoly) : (crc >> 1U);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    std::uint32_t crc_ = 0xFFFFFFFFUL;
+
+public:
+    void add(const void* data, std::size_t len)
+    {
+        auto bytes = static_cast<const std::uint8_t*>(data);
+        assert(bytes != nullptr);
+        while (len --> 0)
+        {
+            crc_ = (crc_ >> 8U) ^ Table[(crc_ ^ *bytes++) & 0xFFU];
+        }
+    }
+
+    std::uint32_t get() const { return crc_ ^ 0xFFFFFFFFUL; }
+};
+
+/**
+ * Downloads one file using the ZMODEM protocol; it is the receiving side, like the program 'rz'.
+ *
+ * The receiver advertises full duplex and 32-bit CRC, so the senders can stream the data subpackets
+ * without waiting for acknowledgements, protected with CRC-32 (16-bit CRC is supported as well).
+ * On a damaged or lost subpacket, the receiver requests the sender to continue from the last good offset (ZRPOS);
+ * the data received so far is kept, so the line noise costs only a fraction of a subpacket per hit.
+ * Since the data is always delivered in order, the storage backend does not need to support out-of-order writes.
+ *
+ * If the link is not flow-controlled and the ROM cannot be written as fast as the data arrives, a window size
+ * should be specified: the sender will then wait for an acknowledgement after each window worth of data.
+ *
+ * The subpackets can be up to 1024 bytes long, which is the limit of the original specification
+ * (the 8K extension is not supported). Compression, encryption, and file management features are not supported.
+ *
+ * Reference: http://pauillac.inria.fr/~doligez/zmodem/zmodem.txt
+ */
+class ZModemProtocol final : public kocherga::IProtocol
+{
+    static constexpr std::uint16_t MaxSubpacketSize = 1024;
+
+    static constexpr std::chrono::microseconds SendTimeout          {1'000'000};    // NOLINT
+    static constexpr std::chrono::microseconds ReceiveTimeout      {10'000'000};    // NOLINT
+    static constexpr std::chrono::microseconds SessionEndTimeout    {1'000'000};    // NOLINT
+
+    static constexpr std::uint8_t MaxRetries = 10;
+
+    /// This many bytes can be skipped while looking for a header, e.g. the rest of a damaged data frame
+    static constexpr std::uint16_t MaxGarbageCount = 4 * MaxSubpacketSize;
+
+    struct ControlCharacters
+    {
+        static constexpr std::uint8_t ZPAD   = '*';
+        static constexpr std::uint8_t ZDLE   = 0x18;      ///< Same as CAN
+        static constexpr std::uint8_t ZBIN   = 'A';
+        static constexpr std::uint8_t ZHEX   = 'B';
+        static constexpr std::uint8_t ZBIN32 = 'C';
+        static constexpr std::uint8_t ZCRCE  = 'h';       ///< End of frame, header follows
+        static constexpr std::uint8_t ZCRCG  = 'i';       ///< Frame continues nonstop
+        static constexpr std::uint8_t ZCRCQ  = 'j';       ///< Frame continues, ZACK expected
+        static constexpr std::uint8_t ZCRCW  = 'k';       ///< End of frame, ZACK expected
+        static constexpr std::uint8_t ZRUB0  = 'l';       ///< Escaped 0x7F
+        static constexpr std::uint8_t ZRUB1  = 'm';       ///< Escaped 0xFF
+        static constexpr std::uint8_t XON    = 0x11;
+        static constexpr std::uint8_t XOFF   = 0x13;
+        static constexpr std::uint8_t CR     = 0x0D;
+        static constexpr std::uint8_t LF     = 0x0A;
+        static constexpr std::uint8_t BS     = 0x08;
+    };
+
+    struct FrameTypes
+    {
+        static constexpr std::uint8_t ZRQINIT = 0;
+        static constexpr std::uint8_t ZRINIT  = 1;
+        static constexpr std::uint8_t ZSINIT  = 2;
+        static constexpr std::uint8_t ZACK    = 3;
+        static constexpr std::uint8_t ZFILE   = 4;
+        static constexpr std::uint8_t ZSKIP   = 5;
+        static constexpr std::uint8_t ZNAK    = 6;
+        static constexpr std::uint8_t ZABORT  = 7;
+        static constexpr std::uint8_t ZFIN    = 8;
+        static constexpr std::uint8_t ZRPOS   = 9;
+        static constexpr std::uint8_t ZDATA   = 10;
+        static constexpr std::uint8_t ZEOF    = 11;
+        static constexpr std::uint8_t ZFERR   = 12;
+        static constexpr std::uint8_t ZCAN    = 16;
+    };
+
+    /// Receiver capability flags reported in ZF0 of ZRINIT
+    struct ReceiverCapabilities
+    {
+        static constexpr std::uint8_t CANFDX  = 0x01;     ///< Full duplex
+        static constexpr std::uint8_t CANOVIO = 0x02;     ///< Can receive data while writing the storage
+        static constexpr std::uint8_t CANFC32 = 0x20;     ///< 32-bit CRC
+    };
+
+    /// The four header bytes; the positions are little-endian, the flags are in the reverse order (ZF0 is last)
+    using HeaderData = std::array<std::uint8_t, 4>;
+    static constexpr std::uint8_t ZF0 = 3;
+
+    struct Header
+    {
+        std::uint8_t type = 0;
+        HeaderData data{};
+
+        std::uint32_t getPosition() const
+        {
+            return std::uint32_t(data[0])         | (std::uint32_t(data[1]) << 8U) |
+                  (std::uint32_t(data[2]) << 16U) | (std::uint32_t(data[3]) << 24U);
+        }
+    };
+
+    /// Outcome of the reception functions below
+    enum class Got : std::uint8_t
+    {
+        Data,               ///< A byte, a header, or a subpacket
+        FrameEnd,           ///< A ZDLE-escaped subpacket terminator (decoder level only)
+        Timeout,
+        Garbage,            ///< Malformed input or a CRC error
+        Cancelled,          ///< The remote sent the cancel sequence
+        PortError
+    };
+
+    IZModemPlatform& platform_;
+    const std::uint16_t window_size_;
+
+    std::uint8_t rx_buffer_[64]{};
+    std::uint16_t rx_offset_ = 0;
+    std::uint16_t rx_size_ = 0;
+
+    std::uint8_t buffer_[MaxSubpacketSize]{};
+    bool crc32_frames_ = false;         ///< Selected by the format of the last binary header
+
+
+    static HeaderData makePositionHeader(const std::uint32_t position)
+    {
+        return {
+            std::uint8_t(position),
+            std::uint8_t(position >> 8U),
+            std::uint8_t(position >> 16U),
+            std::uint8_t(position >> 24U)
+        };
+    }
+
+    std::int16_t send(const std::uint8_t byte)
+    {
+        switch (platform_.emit(byte, SendTimeout))
+        {
+        case IZModemPlatform::Result::Success:
+        {
+            return 0;
+        }
+        case IZModemPlatform::Result::Timeout:
+        {
+            return -ErrPortWriteTimedOut;
+        }
+        case IZModemPlatform::Result::Error:
+        {
+            return -ErrPortError;
+        }
+        }
+
+        return -ErrPortError;
+    }
+
+    /**
+     * The receiver sends only hex headers, as the spec recommends; they need no escaping.
+     */
+    std::int16_t sendHeader(const std::uint8_t type, const HeaderData& data)
+    {
+        KOCHERGA_TRACE("ZMODEM TX header %u pos %u\n", unsigned(type),
+                       unsigned(Header{type, data}.getPosition()));
+
+        static constexpr char Digits[] = "0123456789abcdef";
+        std::uint8_t frame[4 + 14 + 3]{ControlCharacters::ZPAD, ControlCharacters::ZPAD, ControlCharacters::ZDLE,
+                                       ControlCharacters::ZHEX};
+        std::uint8_t size = 4;
+
+        kocherga_ymodem::CRC16 crc;
+        crc.add(&type, 1);
+        crc.add(data.data(), data.size());
+
+        const std::uint8_t raw[] = {type, data[0], data[1], data[2], data[3],
+                                    std::uint8_t(crc.get() >> 8U), std::uint8_t(crc.get())};
+        for (const std::uint8_t x : raw)
+        {
+            frame[size++] = std::uint8_t(Digits[x >> 4U]);
+            frame[size++] = std::uint8_t(Digits[x & 0x0FU]);
+        }
+
+        frame[size++] = ControlCharacters::CR;
+        frame[size++] = ControlCharacters::LF | 0x80U;
+        if ((type != FrameTypes::ZACK) && (type != FrameTypes::ZFIN))
+        {
+            frame[size++] = ControlCharacters::XON;         // Un-pausing the sender in case it was paused
+        }
+
+        for (std::uint8_t i = 0; i < size; i++)
+        {
+            if (const auto res = send(frame[i]); res < 0)
+            {
+                return res;
+            }
+        }
+        return 0;
+    }
+
+    void abort()
+    {
+        // Eight CAN cancel the session, the backspaces erase them from the terminal if they are not understood
+        for (std::uint8_t i = 0; i < 10; i++)
+        {
+            if (send(ControlCharacters::ZDLE) < 0)
+            {
+                return;
+            }
+        }
+        for (std::uint8_t i = 0; i < 10; i++)
+        {
+            if (send(ControlCharacters::BS) < 0)
+            {
+                return;
+            }
+        }
+    }
+
+    Got receiveRaw(std::uint8_t& out_byte, const std::chrono::microseconds timeout)
+    {
+        if (rx_offset_ >= rx_size_)
+        {
+            std::uint16_t size = sizeof(rx_buffer_);
+            switch (platform_.receiveBulk(rx_buffer_, size, timeout))
+            {
+            case IZModemPlatform::Result::Success:
+            {
+                break;
+            }
+            case IZModemPlatform::Result::Timeout:
+            {
+                return Got::Timeout;
+            }
+            case IZModemPlatform::Result::Error:
+            {
+                return Got::PortError;
+            }
+            }
+            assert((size > 0) && (size <= sizeof(rx_buffer_)));
+            rx_offset_ = 0;
+            rx_size_ = size;
+        }
+
+        out_byte = rx_buffer_[rx_offset_++];
+        return Got::Data;
+    }
+
+    static bool isFlowControl(const std::uint8_t byte)
+    {
+        return (byte & 0x7FU) == ControlCharacters::XON || (byte & 0x7FU) == ControlCharacters::XOFF;
+    }
+
+    /**
+     * Receives one byte of a binary header or a subpacket, removing the ZDLE escaping.
+     * The unescaped flow control characters are dropped. A subpacket terminator is reported as Got::FrameEnd.
+     */
+    Got receiveDecoded(std::uint8_t& out_byte)
+    {
+        for (;;)
+        {
+            if (const auto res = receiveRaw(out_byte, ReceiveTimeout); res != Got::Data)
+            {
+                return res;
+            }
+            if (out_byte == ControlCharacters::ZDLE)
+            {
+                break;
+            }
+            if (!isFlowControl(out_byte))
+            {
+                return Got::Data;
+            }
+        }
+
+        for (;;)
+        {
+            if (const auto res = receiveRaw(out_byte, ReceiveTimeout); res != Got::Data)
+            {
+                return res;
+            }
+            switch (out_byte)
+            {
+            case ControlCharacters::ZDLE:
+            {
+                // Five CAN in a row, counting the one that looked like ZDLE
+                for (std::uint8_t i = 0; i < 3; i++)
+                {
+                    if (const auto res = receiveRaw(out_byte, ReceiveTimeout); res != Got::Data)
+                    {
+                        return res;
+                    }
+                    if (out_byte != ControlCharacters::ZDLE)
+                    {
+                        return Got::Garbage;
+                    }
+                }
+                return Got::Cancelled;
+            }
+            case ControlCharacters::ZCRCE:
+            case ControlCharacters::ZCRCG:
+            case ControlCharacters::ZCRCQ:
+            case ControlCharacters::ZCRCW:
+            {
+                return Got::FrameEnd;
+            }
+            case ControlCharacters::ZRUB0:
+            {
+                out_byte = 0x7F;
+                return Got::Data;
+            }
+            case ControlCharacters::ZRUB1:
+            {
+                out_byte = 0xFF;
+                return Got::Data;
+            }
+            default:
+            {
+                if (isFlowControl(out_byte))
+                {
+                    break;
+                }
+                if ((out_byte & 0x60U) == 0x40U)
+                {
+                    out_byte ^= 0x40U;
+                    return Got::Data;
+                }
+                KOCHERGA_TRACE("ZMODEM bad escape 0x%x\n", unsigned(out_byte));
+                return Got::Garbage;
+            }
+            }
+        }
+    }
+
+    Got receiveDecodedBytes(std::uint8_t* const out_data, const std::uint8_t size)
+    {
+        for (std::uint8_t i = 0; i < size; i++)
+        {
+            if (const auto res = receiveDecoded(out_data[i]); res != Got::Data)
+            {
+                return (res == Got::FrameEnd) ? Got::Garbage : res;
+            }
+        }
+        return Got::Data;
+    }
+
+    Got receiveHexByte(std::uint8_t& out_byte)
+    {
+        out_byte = 0;
+        for (std::uint8_t i = 0; i < 2; i++)
+        {
+            std::uint8_t c = 0;
+            if (const auto res = receiveRaw(c, ReceiveTimeout); res != Got::Data)
+            {
+                return res;
+            }
+            c &= 0x7FU;
+            std::uint8_t nibble = 0;
+            if ((c >= '0') && (c <= '9'))
+            {
+                nibble = std::uint8_t(c - '0');
+            }
+            else if ((c >= 'a') && (c <= 'f'))
+            {
+                nibble = std::uint8_t(c - 'a' + 10);
+            }
+            else
+            {
+                return Got::Garbage;
+            }
+            out_byte = std::uint8_t((out_byte << 4U) | nibble);
+        }
+        return Got::Data;
+    }
+
+    Got receiveHexHeader(Header& out_header)
+    {
+        std::uint8_t raw[7]{};
+        for (auto& x : raw)
+        {
+            if (const auto res = receiveHexByte(x); res != Got::Data)
+            {
+                return res;
+            }
+        }
+
+        kocherga_ymodem::CRC16 crc;
+        crc.add(raw, 5);
+        if (crc.get() != ((std::uint16_t(raw[5]) << 8U) | raw[6]))
+        {
+            KOCHERGA_TRACE("ZMODEM hex header CRC error\n");
+            return Got::Garbage;
+        }
+
+        out_header.type = raw[0];
+        std::copy_n(&raw[1], out_header.data.size(), out_header.data.begin());
+
+        // The line terminator is optional; if anything else follows, it will be skipped later as garbage
+        std::uint8_t c = 0;
+        if ((receiveRaw(c, ReceiveTimeout) == Got::Data) && ((c & 0x7FU) == ControlCharacters::CR))
+        {
+            (void)receiveRaw(c, ReceiveTimeout);
+        }
+        return Got::Data;
+    }
+
+    Got receiveBinaryHeader(Header& out_header, const bool crc32)
+    {
+        std::uint8_t raw[5 + 4]{};
+        const std::uint8_t size = crc32 ? 9 : 7;
+        if (const auto res = receiveDecodedBytes(raw, size); res != Got::Data)
+        {
+            return res;
+        }
+
+        bool valid = false;
+        if (crc32)
+        {
+            CRC32 crc;
+            crc.add(raw, 5);
+            valid = crc.get() == (std::uint32_t(raw[5])         | (std::uint32_t(raw[6]) << 8U) |
+                                 (std::uint32_t(raw[7]) << 16U) | (std::uint32_t(raw[8]) << 24U));
+        }
+        else
+        {
+            kocherga_ymodem::CRC16 crc;
+            crc.add(raw, 5);
+            valid = crc.get() == ((std::uint16_t(raw[5]) << 8U) | raw[6]);
+        }
+        if (!valid)
+        {
+            KOCHERGA_TRACE("ZMODEM binary header CRC error\n");
+            return Got::Garbage;
+        }
+
+        out_header.type = raw[0];
+        std::copy_n(&raw[1], out_header.data.size(), out_header.data.begin());
+        crc32_frames_ = crc32;
+        return Got::Data;
+    }
+
+    /**
+     * Skips everything until a valid header is received. Gives up on timeout, cancellation, or too much garbage.
+     */
+    Got receiveHeader(Header& out_header)
+    {
+        std::uint16_t garbage_count = 0;
+        std::uint8_t can_count = 0;
+        for (;;)
+        {
+            std::uint8_t c = 0;
+            if (const auto res = receiveRaw(c, ReceiveTimeout); res != Got::Data)
+            {
+                return res;
+            }
+
+            can_count = (c == ControlCharacters::ZDLE) ? std::uint8_t(can_count + 1U) : 0;
+            if (can_count >= 5)
+            {
+                return Got::Cancelled;
+            }
+
+            if ((c & 0x7FU) == ControlCharacters::ZPAD)
+            {
+                // Any number of pads, then ZDLE, then the format
+                do
+                {
+                    if (const auto res = receiveRaw(c, ReceiveTimeout); res != Got::Data)
+                    {
+                        return res;
+                    }
+                }
+                while ((c & 0x7FU) == ControlCharacters::ZPAD);
+
+                if (c == ControlCharacters::ZDLE)
+                {
+                    if (const auto res = receiveRaw(c, ReceiveTimeout); res != Got::Data)
+                    {
+                        return res;
+                    }
+                    Got res = Got::Garbage;
+                    switch (c)
+                    {
+                    case ControlCharacters::ZHEX:
+                    {
+                        res = receiveHexHeader(out_header);
+                        break;
+                    }
+                    case ControlCharacters::ZBIN:
+                    case ControlCharacters::ZBIN32:
+                    {
+                        res = receiveBinaryHeader(out_header, c == ControlCharacters::ZBIN32);
+                        break;
+                    }
+                    default:
+                    {
+                        break;
+                    }
+                    }
+                    if (res == Got::Data)
+                    {
+                        KOCHERGA_TRACE("ZMODEM RX header %u pos %u\n",
+                                       unsigned(out_header.type), unsigned(out_header.getPosition()));
+                        return res;
+                    }
+                    if (res != Got::Garbage)
+                    {
+                        return res;
+                    }
+                }
+            }
+
+            if (++garbage_count > MaxGarbageCount)
+            {
+                KOCHERGA_TRACE("ZMODEM too much garbage\n");
+                return Got::Garbage;
+            }
+        }
+    }
+
+    /**
+     * Receives one data subpacket into the buffer and validates its CRC, which also covers the terminator.
+     */
+    Got receiveSubpacket(std::uint16_t& out_size, std::uint8_t& out_terminator)
+    {
+        out_size = 0;
+        for (;;)
+        {
+            std::uint8_t c = 0;
+            const auto res = receiveDecoded(c);
+            if (res == Got::FrameEnd)
+            {
+                out_terminator = c;
+                break;
+            }
+            if (res != Got::Data)
+            {
+                return res;
+            }
+            if (out_size >= MaxSubpacketSize)
+            {
+                KOCHERGA_TRACE("ZMODEM subpacket too long\n");
+                return Got::Garbage;
+            }
+            buffer_[out_size++] = c;
+        }
+
+        std::uint8_t received_crc[4]{};
+        if (const auto res = receiveDecodedBytes(received_crc, crc32_frames_ ? 4 : 2); res != Got::Data)
+        {
+            return res;
+        }
+
+        bool valid = false;
+        if (crc32_frames_)
+        {
+            CRC32 crc;
+            crc.add(buffer_, out_size);
+            crc.add(&out_terminator, 1);
+            valid = crc.get() == (std::uint32_t(received_crc[0])         | (std::uint32_t(received_crc[1]) << 8U) |
+                                 (std::uint32_t(received_crc[2]) << 16U) | (std::uint32_t(received_crc[3]) << 24U));
+        }
+        else
+        {
+            kocherga_ymodem::CRC16 crc;
+            crc.add(buffer_, out_size);
+            crc.add(&out_terminator, 1);
+            valid = crc.get() == ((std::uint16_t(received_crc[0]) << 8U) | received_crc[1]);
+        }
+
+        if (!valid)
+        {
+            KOCHERGA_TRACE("ZMODEM subpacket CRC error\n");
+            return Got::Garbage;
+        }
+        return Got::Data;
+    }
+
+    static std::uint32_t parseFileSize(const std::uint8_t* const data, const std::uint16_t size)
+    {
+        // Skipping the file name, then parsing the decimal size until a space
+        const auto end = data + size;
+        const auto name_end = std::find(data, end, 0);
+        std::uint32_t file_size = 0;
+        for (auto p = name_end; (++p < end) && (*p >= '0') && (*p <= '9');)
+        {
+            file_size = file_size * 10U + std::uint32_t(*p - '0');
+        }
+        return file_size;
+    }
+
+    /**
+     * Negotiates the session and waits for the file header. Returns the size of the file or a negative error.
+     */
+    std::pair<std::int16_t, std::uint32_t> receiveFileHeader()
+    {
+        HeaderData init{};
+        init[0] = std::uint8_t(window_size_);
+        init[1] = std::uint8_t(window_size_ >> 8U);
+        init[ZF0] = ReceiverCapabilities::CANFDX | ReceiverCapabilities::CANFC32;
+        if (window_size_ == 0)
+        {
+            init[ZF0] |= ReceiverCapabilities::CANOVIO;
+        }
+
+        bool send_init = true;
+        for (std::uint8_t retries = 0; retries < MaxRetries;)
+        {
+            if (send_init)
+            {
+                if (const auto res = sendHeader(FrameTypes::ZRINIT, init); res < 0)
+                {
+                    return {res, 0};
+                }
+            }
+            send_init = true;
+
+            Header header;
+            switch (receiveHeader(header))
+            {
+            case Got::Data:
+            {
+                break;
+            }
+            case Got::Cancelled:
+            {
+                return {-ErrTransferCancelledByRemote, 0};
+            }
+            case Got::PortError:
+            {
+                return {-ErrPortError, 0};
+            }
+            case Got::FrameEnd:
+            case Got::Timeout:
+            case Got::Garbage:
+            {
+                retries++;
+                continue;
+            }
+            }
+
+            switch (header.type)
+            {
+            case FrameTypes::ZSINIT:
+            {
+                // The attention string is not needed because the link is full duplex
+                std::uint16_t size = 0;
+                std::uint8_t terminator = 0;
+                if (receiveSubpacket(size, terminator) == Got::Data)
+                {
+                    if (const auto res = sendHeader(FrameTypes::ZACK, {}); res < 0)
+                    {
+                        return {res, 0};
+                    }
+                    send_init = false;
+                }
+                break;
+            }
+            case FrameTypes::ZFILE:
+            {
+                std::uint16_t size = 0;
+                std::uint8_t terminator = 0;
+                if (receiveSubpacket(size, terminator) == Got::Data)
+                {
+                    KOCHERGA_TRACE("ZMODEM file name: '%s'\n", reinterpret_cast<const char*>(buffer_));
+                    return {ErrOK, parseFileSize(buffer_, size)};
+                }
+                retries++;
+                break;
+            }
+            case FrameTypes::ZFIN:
+            {
+                (void)sendHeader(FrameTypes::ZFIN, {});
+                return {-ErrRemoteRefusedToProvideFile, 0};
+            }
+            case FrameTypes::ZCAN:
+            case FrameTypes::ZABORT:
+            {
+                return {-ErrTransferCancelledByRemote, 0};
+            }
+            default:                    // ZRQINIT or a stray header from a previous session
+            {
+                break;
+            }
+            }
+        }
+
+        return {-ErrRetriesExhausted, 0};
+    }
+
+    /**
+     * Receives the file data until ZEOF; the data is delivered to the sink strictly in order.
+     * Whenever the data is damaged or missing, the sender is requested to continue from the last good offset.
+     */
+    std::int16_t receiveFileData(kocherga::IDownloadSink& sink, const std::uint32_t file_size)
+    {
+        std::uint32_t offset = 0;
+        std::uint8_t remaining_retries = MaxRetries;
+        bool reposition = true;
+
+        for (;;)
+        {
+            if (reposition)
+            {
+                if (remaining_retries == 0)
+                {
+                    return -ErrRetriesExhausted;
+                }
+                remaining_retries--;
+
+                if (const auto res = sendHeader(FrameTypes::ZRPOS, makePositionHeader(offset)); res < 0)
+                {
+                    return res;
+                }
+            }
+            reposition = true;
+
+            Header header;
+            switch (receiveHeader(header))
+            {
+            case Got::Data:
+            {
+                break;
+            }
+            case Got::Cancelled:
+            {
+                return -ErrTransferCancelledByRemote;
+            }
+            case Got::PortError:
+            {
+                return -ErrPortError;
+            }
+            case Got::FrameEnd:
+            case Got::Timeout:
+            case Got::Garbage:
+            {
+                continue;
+            }
+            }
+
+            switch (header.type)
+            {
+            case FrameTypes::ZDATA:
+            {
+                if (header.getPosition() != offset)
+                {
+                    KOCHERGA_TRACE("ZMODEM data at %u, expected %u\n", unsigned(header.getPosition()), unsigned(offset));
+                    continue;
+                }
+                break;
+            }
+            case FrameTypes::ZEOF:
+            {
+                if (header.getPosition() != offset)
+                {
+                    reposition = false;         // Stale, the data that preceded it was discarded
+                    continue;
+                }
+                if ((file_size > 0) && (offset != file_size))
+                {
+                    KOCHERGA_TRACE("ZMODEM file size %u, received %u\n", unsigned(file_size), unsigned(offset));
+                    return -ErrProtocolError;
+                }
+                KOCHERGA_TRACE("ZMODEM end of file at %u\n", unsigned(offset));
+                return ErrOK;
+            }
+            case FrameTypes::ZFILE:
+            {
+                // Our ZRPOS was lost; the file info subpacket follows, it is skipped as garbage
+                continue;
+            }
+            case FrameTypes::ZFIN:
+            case FrameTypes::ZSKIP:
+            case FrameTypes::ZCAN:
+            case FrameTypes::ZABORT:
+            case FrameTypes::ZFERR:
+            {
+                return -ErrTransferCancelledByRemote;
+            }
+            default:
+            {
+                reposition = false;
+                continue;
+            }
+            }
+
+            // Receiving the subpackets of the frame
+            for (;;)
+            {
+                std::uint16_t size = 0;
+                std::uint8_t terminator = 0;
+                const auto res = receiveSubpacket(size, terminator);
+                if (res == Got::Cancelled)
+                {
+                    return -ErrTransferCancelledByRemote;
+                }
+                if (res == Got::PortError)
+                {
+                    return -ErrPortError;
+                }
+                if (res != Got::Data)
+                {
+                    KOCHERGA_TRACE("ZMODEM subpacket lost at %u\n", unsigned(offset));
+                    break;                      // Repositioning
+                }
+
+                if (size > 0)
+                {
+                    if (const auto sink_res = sink.handleNextDataChunk(buffer_, size); sink_res < 0)
+                    {
+                        return sink_res;
+                    }
+                }
+                offset += size;
+                remaining_retries = MaxRetries;
+
+                if ((terminator == ControlCharacters::ZCRCQ) || (terminator == ControlCharacters::ZCRCW))
+                {
+                    if (const auto ack_res = sendHeader(FrameTypes::ZACK, makePositionHeader(offset)); ack_res < 0)
+                    {
+                        return ack_res;
+                    }
+                }
+                if ((terminator == ControlCharacters::ZCRCE) || (terminator == ControlCharacters::ZCRCW))
+                {
+                    reposition = false;         // End of frame, the next header follows
+                    break;
+                }
+            }
+        }
+    }
+
+    /**
+     * Refuses any further files and completes the session with the ZFIN exchange.
+     */
+    std::int16_t endSession()
+    {
+        HeaderData init{};
+        init[ZF0] = ReceiverCapabilities::CANFDX | ReceiverCapabilities::CANFC32;
+
+        bool send_init = true;
+        for (std::uint8_t retries = 0; retries < MaxRetries;)
+        {
+            if (send_init)
+            {
+                if (const auto res = sendHeader(FrameTypes::ZRINIT, init); res < 0)
+                {
+                    return res;
+                }
+            }
+            send_init = true;
+
+            Header header;
+            switch (receiveHeader(header))
+            {
+            case Got::Data:
+            {
+                break;
+            }
+            case Got::Cancelled:
+            {
+                return -ErrTransferCancelledByRemote;
+            }
+            case Got::PortError:
+            {
+                return -ErrPortError;
+            }
+            case Got::FrameEnd:
+            case Got::Timeout:
+            case Got::Garbage:
+            {
+                retries++;
+                continue;
+            }
+            }
+
+            if (header.type == FrameTypes::ZFIN)
+            {
+                if (const auto res = sendHeader(FrameTypes::ZFIN, {}); res < 0)
+                {
+                    return res;
+                }
+                // The sender concludes with "OO" (over and out), which is consumed if it arrives in time
+                std::uint8_t c = 0;
+                for (std::uint8_t i = 0; i < 2; i++)
+                {
+                    if (receiveRaw(c, SessionEndTimeout) != Got::Data)
+                    {
+                        break;
+                    }
+                }
+                return ErrOK;
+            }
+            if (header.type == FrameTypes::ZFILE)
+            {
+                if (const auto res = sendHeader(FrameTypes::ZSKIP, {}); res < 0)
+                {
+                    return res;
+                }
+                send_init = false;
+            }
+        }
+
+        return -ErrRetriesExhausted;
+    }
+
+public:
+    /**
+     * @param serial_port       the serial port channel that will be used for downloading
+     * @param window_size       the sender will wait for an acknowledgement after this many bytes;
+     *                          zero means that the data is streamed without waiting, which requires the link
+     *                          to hold the sender back while the ROM is being written
+     */
+    explicit ZModemProtocol(IZModemPlatform& serial_port, const std::uint16_t window_size = 0) :
+        platform_(serial_port),
+        window_size_(window_size)
+    { }
+
+    std::int16_t downloadImage(kocherga::IDownloadSink& sink) override
+    {
+        rx_offset_ = rx_size_ = 0;
+        crc32_frames_ = false;
+
+        auto [res, file_size] = receiveFileHeader();
+        KOCHERGA_TRACE("ZMODEM file header result %d, size %u\n", int(res), unsigned(file_size));
+        if (res >= 0)
+        {
+            res = receiveFileData(sink, file_size);
+        }
+        if (res >= 0)
+        {
+            res = endSession();
+        }
+        else if ((res != -ErrTransferCancelledByRemote) && (res != -ErrRemoteRefusedToProvideFile))
+        {
+            abort();
+        }
+
+        // Making sure there's no residual garbage in the RX buffer afterwards
+        std::uint8_t dummy = 0;
+        rx_offset_ = rx_size_ = 0;
+        while (platform_.receive(dummy, std::chrono::microseconds(1'000)) == IZModemPlatform::Result::Success)
+        {
+            KOCHERGA_TRACE("ZMODEM FLUSH RX 0x%x\n", unsigned(dummy));
+        }
+
+        return res;
+    }
+};
+
+}
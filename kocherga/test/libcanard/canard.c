@@ -64,6 +64,7 @@ struct CanardTxQueueItem
     CanardTxQueueItem* next;
     CanardCANFrame frame;
 };
+CANARD_STATIC_ASSERT(sizeof(CanardTxQueueItem) <= CANARD_MEM_BLOCK_SIZE, "Invalid memory layout");
 
 
 /*
@@ -84,7 +85,11 @@ void canardInit(CanardInstance* out_ins,
      * If your application fails here, make sure it's not built in 64-bit mode.
      * Refer to the design documentation for more info.
      */
+#if CANARD_MULTI_IFACE
+    CANARD_ASSERT(CANARD_MULTIFRAME_RX_PAYLOAD_HEAD_SIZE >= 5);   // One byte is taken by the interface index
+#else
     CANARD_ASSERT(CANARD_MULTIFRAME_RX_PAYLOAD_HEAD_SIZE >= 6);
+#endif
 
     memset(out_ins, 0, sizeof(*out_ins));
 
@@ -131,6 +136,14 @@ uint8_t canardGetLocalNodeID(const CanardInstance* ins)
     return ins->node_id;
 }
 
+#if CANARD_ENABLE_CANFD
+void canardSetCANFDEnabled(CanardInstance* ins, bool enabled)
+{
+    CANARD_ASSERT(ins != NULL);
+    ins->canfd_tx = enabled;
+}
+#endif
+
 int16_t canardBroadcast(CanardInstance* ins,
                         uint64_t data_type_signature,
                         uint16_t data_type_id,
@@ -265,6 +278,13 @@ void canardHandleRxFrame(CanardInstance* ins, const CanardCANFrame* frame, uint6
         return;     // Unsupported frame, not UAVCAN - ignore
     }
 
+#if CANARD_MULTI_IFACE
+    if (frame->iface_id < CANARD_MULTI_IFACE_MAX_IFACES)
+    {
+        ins->iface_rx_timestamp_usec[frame->iface_id] = timestamp_usec;
+    }
+#endif
+
     if (transfer_type != CanardTransferTypeBroadcast &&
         destination_node_id != canardGetLocalNodeID(ins))
     {
@@ -280,11 +300,10 @@ void canardHandleRxFrame(CanardInstance* ins, const CanardCANFrame* frame, uint6
     const uint8_t tail_byte = frame->data[frame->data_len - 1];
 
     CanardRxState* rx_state = NULL;
+    uint64_t data_type_signature = 0;
 
     if (IS_START_OF_TRANSFER(tail_byte))
     {
-        uint64_t data_type_signature = 0;
-
         if (ins->should_accept(ins, &data_type_signature, data_type_id, transfer_type, source_node_id))
         {
             rx_state = traverseRxStates(ins, transfer_descriptor);
@@ -293,8 +312,6 @@ void canardHandleRxFrame(CanardInstance* ins, const CanardCANFrame* frame, uint6
             {
                 return; // No allocator room for this frame
             }
-
-            rx_state->calculated_crc = crcAddSignature(0xFFFFU, data_type_signature);
         }
         else
         {
@@ -315,18 +332,68 @@ void canardHandleRxFrame(CanardInstance* ins, const CanardCANFrame* frame, uint6
 
     // Resolving the state flags:
     const bool not_initialized = rx_state->timestamp_usec == 0;
-    const bool tid_timed_out = (timestamp_usec - rx_state->timestamp_usec) > TRANSFER_TIMEOUT_USEC;
+    // The timestamps are supplied by the driver, so a frame from a redundant interface may appear slightly older
+    const bool tid_timed_out = (timestamp_usec > rx_state->timestamp_usec) &&
+                               ((timestamp_usec - rx_state->timestamp_usec) > TRANSFER_TIMEOUT_USEC);
     const bool first_frame = IS_START_OF_TRANSFER(tail_byte);
-    const bool not_previous_tid =
-        computeTransferIDForwardDistance((uint8_t) rx_state->transfer_id, TRANSFER_ID_FROM_TAIL_BYTE(tail_byte)) > 1;
+    // A transfer ID other than the expected one starts a new transfer; it is not always the next one,
+    // e.g. the responses to retransmitted service requests skip the transfer IDs of the lost ones
+    const bool unexpected_tid =
+        computeTransferIDForwardDistance((uint8_t) rx_state->transfer_id, TRANSFER_ID_FROM_TAIL_BYTE(tail_byte)) != 0;
+
+#if CANARD_MULTI_IFACE
+    /*
+     * A transfer is received entirely via the interface it has been started on. Another interface can take over
+     * only at the beginning of the next expected transfer while no transfer is in progress, which means that
+     * whichever interface delivers a new transfer first wins, and the late copies from other interfaces are
+     * discarded because their transfer ID is not the next one anymore.
+     * If the current interface has gone silent, e.g. because its cable has been cut, the transfers that have been
+     * lost with it would leave a gap in the transfer IDs, so another interface can then take over at the beginning
+     * of any transfer whose transfer ID is ahead of the expected one. Late copies are behind, so they are still
+     * discarded.
+     */
+    const bool same_iface = rx_state->iface_id == frame->iface_id;
+    const int16_t tid_distance =
+            computeTransferIDForwardDistance((uint8_t) rx_state->transfer_id, TRANSFER_ID_FROM_TAIL_BYTE(tail_byte));
+    const bool iface_silent =
+            (rx_state->iface_id < CANARD_MULTI_IFACE_MAX_IFACES) &&
+            (timestamp_usec > ins->iface_rx_timestamp_usec[rx_state->iface_id]) &&
+            ((timestamp_usec - ins->iface_rx_timestamp_usec[rx_state->iface_id]) >
+             CANARD_MULTI_IFACE_SWITCH_DELAY_USEC);
+    const bool iface_switch =
+            (!same_iface) &&
+            first_frame &&
+            (((rx_state->payload_len == 0) && (rx_state->next_toggle == 0) && (tid_distance == 0)) ||
+             (iface_silent && (tid_distance < (int16_t)(1U << (TRANSFER_ID_BIT_LEN - 1U)))));
+
+    const bool need_restart =
+            (not_initialized) ||
+            (tid_timed_out) ||
+            (same_iface && first_frame && unexpected_tid) ||
+            (iface_switch);
 
+    if (!same_iface && !need_restart)
+    {
+        return;     // A redundant copy of a transfer that is already being received, or has been received
+    }
+#else
     const bool need_restart =
             (not_initialized) ||
             (tid_timed_out) ||
-            (first_frame && not_previous_tid);
+            (first_frame && unexpected_tid);
+#endif
+
+    // Not before the redundant copies are discarded, they would corrupt the CRC of the transfer in progress
+    if (first_frame)
+    {
+        rx_state->calculated_crc = crcAddSignature(0xFFFFU, data_type_signature);
+    }
 
     if (need_restart)
     {
+#if CANARD_MULTI_IFACE
+        rx_state->iface_id = frame->iface_id;
+#endif
         rx_state->transfer_id = TRANSFER_ID_FROM_TAIL_BYTE(tail_byte);
         rx_state->next_toggle = 0;
         releaseStatePayload(ins, rx_state);
@@ -431,8 +498,9 @@ void canardHandleRxFrame(CanardInstance* ins, const CanardCANFrame* frame, uint6
                 }
                 CANARD_ASSERT(block != NULL);
 
+                // If the last block is already full, the entire frame goes into the tail
                 const size_t offset_within_block = rx_state->payload_len - offset;
-                CANARD_ASSERT(offset_within_block < CANARD_BUFFER_BLOCK_DATA_SIZE);
+                CANARD_ASSERT(offset_within_block <= CANARD_BUFFER_BLOCK_DATA_SIZE);
 
                 for (size_t i = offset_within_block;
                      (i < CANARD_BUFFER_BLOCK_DATA_SIZE) && (tail_offset < frame_payload_size);
@@ -444,7 +512,7 @@ void canardHandleRxFrame(CanardInstance* ins, const CanardCANFrame* frame, uint6
         }
 
         CanardRxTransfer rx_transfer = {
-            .timestamp_usec = timestamp_usec,
+            .timestamp_usec = rx_state->timestamp_usec,     // Timestamp of the first frame
             .payload_head = rx_state->buffer_head,
             .payload_middle = rx_state->buffer_blocks,
             .payload_tail = (tail_offset >= frame_payload_size) ? NULL : (&frame->data[tail_offset]),
@@ -480,7 +548,8 @@ void canardCleanupStaleTransfers(CanardInstance* ins, uint64_t current_time_usec
 
     while (state != NULL)
     {
-        if ((current_time_usec - state->timestamp_usec) > TRANSFER_TIMEOUT_USEC)
+        if ((current_time_usec > state->timestamp_usec) &&
+            ((current_time_usec - state->timestamp_usec) > TRANSFER_TIMEOUT_USEC))
         {
             if (state == ins->rx_states)
             {
@@ -881,7 +950,16 @@ CANARD_INTERNAL int16_t enqueueTxFrames(CanardInstance* ins,
 
     int16_t result = 0;
 
-    if (payload_len < CANARD_CAN_FRAME_MAX_DATA_LEN)                        // Single frame transfer
+#if CANARD_ENABLE_CANFD
+    const uint8_t max_data_len = ins->canfd_tx ? CANARD_CANFD_FRAME_MAX_DATA_LEN : CANARD_CAN_FRAME_MAX_DATA_LEN;
+#else
+    const uint8_t max_data_len = CANARD_CAN_FRAME_MAX_DATA_LEN;
+#endif
+
+    // CAN FD frames are never padded, because the padding would be indistinguishable from the payload.
+    // Transfers that don't fit a valid frame length exactly are sent as multi-frame transfers instead.
+    if ((payload_len < max_data_len) &&
+        (roundDownFrameDataLength((uint8_t)(payload_len + 1U)) == payload_len + 1U))    // Single frame transfer
     {
         CanardTxQueueItem* queue_item = createTxItem(&ins->allocator);
         if (queue_item == NULL)
@@ -927,7 +1005,14 @@ CANARD_INTERNAL int16_t enqueueTxFrames(CanardInstance* ins,
                 i = 0;
             }
 
-            for (; i < (CANARD_CAN_FRAME_MAX_DATA_LEN - 1) && data_index < payload_len; i++, data_index++)
+            // The frame is shortened if necessary so that its length is valid without padding.
+            // The first frame must leave at least one byte for the next one, otherwise it would look like
+            // a single frame transfer.
+            const uint16_t remaining = (uint16_t)(payload_len - data_index - ((data_index == 0) ? 1U : 0U));
+            const uint8_t frame_data_len =
+                roundDownFrameDataLength((uint8_t)(i + MIN(max_data_len - 1U - i, remaining) + 1U));
+
+            for (; i < (frame_data_len - 1) && data_index < payload_len; i++, data_index++)
             {
                 queue_item->frame.data[i] = payload[data_index];
             }
@@ -948,6 +1033,26 @@ CANARD_INTERNAL int16_t enqueueTxFrames(CanardInstance* ins,
     return result;
 }
 
+CANARD_INTERNAL uint8_t roundDownFrameDataLength(uint8_t data_len)
+{
+    static const uint8_t ValidLengths[] = { 64, 48, 32, 24, 20, 16, 12 };
+
+    if (data_len <= CANARD_CAN_FRAME_MAX_DATA_LEN)
+    {
+        return data_len;
+    }
+
+    for (uint8_t i = 0; i < sizeof(ValidLengths); i++)
+    {
+        if (data_len >= ValidLengths[i])
+        {
+            return ValidLengths[i];
+        }
+    }
+
+    return CANARD_CAN_FRAME_MAX_DATA_LEN;
+}
+
 /**
  * Puts frame on on the TX queue. Higher priority placed first
  */
@@ -1549,6 +1654,7 @@ CANARD_INTERNAL void initPoolAllocator(CanardPoolAllocator* allocator,
     allocator->statistics.capacity_blocks = buf_len;
     allocator->statistics.current_usage_blocks = 0;
     allocator->statistics.peak_usage_blocks = 0;
+    allocator->statistics.oom_count = 0;
 }
 
 CANARD_INTERNAL void* allocateBlock(CanardPoolAllocator* allocator)
@@ -1556,6 +1662,10 @@ CANARD_INTERNAL void* allocateBlock(CanardPoolAllocator* allocator)
     // Check if there are any blocks available in the free list.
     if (allocator->free_list == NULL)
     {
+        if (allocator->statistics.oom_count < UINT16_MAX)
+        {
+            allocator->statistics.oom_count++;
+        }
         return NULL;
     }
 
@@ -17,6 +17,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/can.h>
+#include <linux/can/raw.h>
 #include <errno.h>
 #include <stdlib.h>
 
@@ -71,6 +72,15 @@ int16_t socketcanInit(SocketCANInstance* out_ins, const char* can_iface_name)
     addr.can_family = AF_CAN;
     addr.can_ifindex = ifr.ifr_ifindex;
 
+#if CANARD_ENABLE_CANFD
+    const int canfd_on = 1;
+    const int setsockopt_result = setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on));
+    if (setsockopt_result < 0)
+    {
+        goto fail1;
+    }
+#endif
+
     const int bind_result = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
     if (bind_result < 0)
     {
@@ -78,6 +88,9 @@ int16_t socketcanInit(SocketCANInstance* out_ins, const char* can_iface_name)
     }
 
     out_ins->fd = fd;
+#if CANARD_ENABLE_CANFD
+    out_ins->canfd_brs = false;
+#endif
     return 0;
 
 fail1:
@@ -114,6 +127,35 @@ int16_t socketcanTransmit(SocketCANInstance* ins, const CanardCANFrame* frame, i
         return -EIO;
     }
 
+#if CANARD_ENABLE_CANFD
+    if (frame->data_len > CAN_MAX_DLEN)
+    {
+        if (frame->data_len > CANFD_MAX_DLEN)
+        {
+            return -EINVAL;
+        }
+
+        struct canfd_frame transmit_frame;
+        memset(&transmit_frame, 0, sizeof(transmit_frame));
+        transmit_frame.can_id = frame->id;              // TODO: Map flags properly
+        transmit_frame.len = frame->data_len;
+        transmit_frame.flags = (uint8_t)(ins->canfd_brs ? CANFD_BRS : 0U);
+        memcpy(transmit_frame.data, frame->data, frame->data_len);
+
+        const ssize_t nbytes = write(ins->fd, &transmit_frame, sizeof(transmit_frame));
+        if (nbytes < 0)
+        {
+            return getErrorCode();
+        }
+        if ((size_t)nbytes != sizeof(transmit_frame))
+        {
+            return -EIO;
+        }
+
+        return 1;
+    }
+#endif
+
     struct can_frame transmit_frame;
     memset(&transmit_frame, 0, sizeof(transmit_frame));
     transmit_frame.can_id = frame->id;                  // TODO: Map flags properly
@@ -154,25 +196,37 @@ int16_t socketcanReceive(SocketCANInstance* ins, CanardCANFrame* out_frame, int3
         return -EIO;
     }
 
+#if CANARD_ENABLE_CANFD
+    // Classic frames are delivered as struct can_frame (CAN_MTU bytes), which is a prefix-compatible subset
+    struct canfd_frame receive_frame;
+    const size_t max_len = CANFD_MAX_DLEN;
+#else
     struct can_frame receive_frame;
+    const size_t max_len = CAN_MAX_DLEN;
+#endif
     const ssize_t nbytes = read(ins->fd, &receive_frame, sizeof(receive_frame));
     if (nbytes < 0)
     {
         return getErrorCode();
     }
-    if ((size_t)nbytes != sizeof(receive_frame))
+    if (((size_t)nbytes != CAN_MTU) && ((size_t)nbytes != sizeof(receive_frame)))
     {
         return -EIO;
     }
 
-    if (receive_frame.can_dlc > CAN_MAX_DLEN)           // Appeasing Coverity Scan
+#if CANARD_ENABLE_CANFD
+    const uint8_t len = receive_frame.len;
+#else
+    const uint8_t len = receive_frame.can_dlc;
+#endif
+    if (len > max_len)                                  // Appeasing Coverity Scan
     {
         return -EIO;
     }
 
     out_frame->id = receive_frame.can_id;               // TODO: Map flags properly
-    out_frame->data_len = receive_frame.can_dlc;
-    memcpy(out_frame->data, &receive_frame.data, receive_frame.can_dlc);
+    out_frame->data_len = len;
+    memcpy(out_frame->data, &receive_frame.data, len);
 
     return 1;
 }
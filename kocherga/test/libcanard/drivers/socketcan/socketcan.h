@@ -18,10 +18,15 @@ extern "C"
 typedef struct
 {
     int fd;
+#if CANARD_ENABLE_CANFD
+    bool canfd_brs;     ///< Set the bit rate switch flag on transmitted CAN FD frames
+#endif
 } SocketCANInstance;
 
 /**
  * Initializes the SocketCAN instance.
+ * If CANARD_ENABLE_CANFD is set, the socket is switched into CAN FD mode (CAN_RAW_FD_FRAMES); this requires
+ * an FD capable interface, such as vcan. Bit rate switching is disabled by default.
  * Returns 0 on success, negative on error.
  */
 int16_t socketcanInit(SocketCANInstance* out_ins, const char* can_iface_name);
@@ -34,6 +39,7 @@ int16_t socketcanClose(SocketCANInstance* ins);
 
 /**
  * Transmits a CanardCANFrame to the CAN socket.
+ * Frames longer than 8 bytes are transmitted as CAN FD frames.
  * Use negative timeout to block infinitely.
  * Returns 1 on successful transmission, 0 on timeout, negative on error.
  */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2016 UAVCAN Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Contributors: https://github.com/UAVCAN/libcanard/contributors
+ */
+
+
+#include <catch.hpp>
+#include "canard_internals.h"
+
+
+TEST_CASE("FrameLength, RoundDown")
+{
+    // Classic CAN lengths are all valid
+    for (uint8_t i = 0; i <= 8; i++)
+    {
+        REQUIRE(i == roundDownFrameDataLength(i));
+    }
+
+    // CAN FD lengths above 8 bytes are quantized
+    REQUIRE(8 == roundDownFrameDataLength(9));
+    REQUIRE(8 == roundDownFrameDataLength(11));
+    REQUIRE(12 == roundDownFrameDataLength(12));
+    REQUIRE(12 == roundDownFrameDataLength(15));
+    REQUIRE(16 == roundDownFrameDataLength(16));
+    REQUIRE(20 == roundDownFrameDataLength(23));
+    REQUIRE(24 == roundDownFrameDataLength(31));
+    REQUIRE(32 == roundDownFrameDataLength(47));
+    REQUIRE(48 == roundDownFrameDataLength(63));
+    REQUIRE(64 == roundDownFrameDataLength(64));
+    REQUIRE(64 == roundDownFrameDataLength(255));
+}
@@ -45,6 +45,7 @@ TEST_CASE("MemoryAllocatorTestGroup, FreeListIsConstructedCorrectly")
     REQUIRE(AVAILABLE_BLOCKS == allocator.statistics.capacity_blocks);
     REQUIRE(0 ==                allocator.statistics.current_usage_blocks);
     REQUIRE(0 ==                allocator.statistics.peak_usage_blocks);
+    REQUIRE(0 ==                allocator.statistics.oom_count);
 }
 
 TEST_CASE("MemoryAllocatorTestGroup, CanAllocateBlock")
@@ -63,6 +64,7 @@ TEST_CASE("MemoryAllocatorTestGroup, CanAllocateBlock")
     REQUIRE(AVAILABLE_BLOCKS == allocator.statistics.capacity_blocks);
     REQUIRE(1 ==                allocator.statistics.current_usage_blocks);
     REQUIRE(1 ==                allocator.statistics.peak_usage_blocks);
+    REQUIRE(0 ==                allocator.statistics.oom_count);
 }
 
 TEST_CASE("MemoryAllocatorTestGroup, ReturnsNullIfThereIsNoBlockLeft")
@@ -85,6 +87,7 @@ TEST_CASE("MemoryAllocatorTestGroup, ReturnsNullIfThereIsNoBlockLeft")
     REQUIRE(AVAILABLE_BLOCKS == allocator.statistics.capacity_blocks);
     REQUIRE(AVAILABLE_BLOCKS == allocator.statistics.current_usage_blocks);
     REQUIRE(AVAILABLE_BLOCKS == allocator.statistics.peak_usage_blocks);
+    REQUIRE(1 ==                allocator.statistics.oom_count);
 }
 
 TEST_CASE("MemoryAllocatorTestGroup, CanFreeBlock")
@@ -105,4 +108,5 @@ TEST_CASE("MemoryAllocatorTestGroup, CanFreeBlock")
     REQUIRE(AVAILABLE_BLOCKS == allocator.statistics.capacity_blocks);
     REQUIRE(0 ==                allocator.statistics.current_usage_blocks);
     REQUIRE(1 ==                allocator.statistics.peak_usage_blocks);
+    REQUIRE(0 ==                allocator.statistics.oom_count);
 }
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2016 UAVCAN Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Contributors: https://github.com/UAVCAN/libcanard/contributors
+ */
+
+#include <catch.hpp>
+#include <cstring>
+#include <vector>
+#include "canard.h"
+
+#if CANARD_MULTI_IFACE
+
+static std::vector<uint8_t> g_received_transfer_ids;
+
+static void onReception(CanardInstance*, CanardRxTransfer* transfer)
+{
+    g_received_transfer_ids.push_back(transfer->transfer_id);
+}
+
+static bool shouldAccept(const CanardInstance*, uint64_t* out_data_type_signature, uint16_t, CanardTransferType, uint8_t)
+{
+    *out_data_type_signature = 0x123456789ABCDEFULL;
+    return true;
+}
+
+namespace
+{
+/**
+ * Broadcasts a transfer and returns its frames, so that they can be delivered via several interfaces.
+ */
+class Publisher
+{
+    uint8_t pool_[1024];
+    CanardInstance ins_;
+    uint8_t transfer_id_ = 0;
+
+public:
+    Publisher()
+    {
+        canardInit(&ins_, pool_, sizeof(pool_), onReception, shouldAccept, nullptr);
+        canardSetLocalNodeID(&ins_, 42);
+    }
+
+    std::vector<CanardCANFrame> publish(uint16_t payload_len)
+    {
+        uint8_t payload[100];
+        std::memset(payload, 0xA5, sizeof(payload));
+        REQUIRE(canardBroadcast(&ins_, 0x123456789ABCDEFULL, 1000, &transfer_id_, 0, payload, payload_len) > 0);
+
+        std::vector<CanardCANFrame> frames;
+        for (const CanardCANFrame* f; (f = canardPeekTxQueue(&ins_)) != nullptr; canardPopTxQueue(&ins_))
+        {
+            frames.push_back(*f);
+        }
+        return frames;
+    }
+
+    /// Emulates a transfer that has been lost on all interfaces
+    void skip()
+    {
+        transfer_id_ = uint8_t((transfer_id_ + 1U) & 31U);
+    }
+};
+
+/**
+ * Delivers the frames of a transfer via the specified interface, 100 us apart.
+ */
+void deliver(CanardInstance* ins, std::vector<CanardCANFrame> frames, uint8_t iface_id, uint64_t& timestamp)
+{
+    for (CanardCANFrame& f : frames)
+    {
+        f.iface_id = iface_id;
+        canardHandleRxFrame(ins, &f, timestamp);
+        timestamp += 100;
+    }
+}
+}
+
+TEST_CASE("MultiIface, DuplicateSuppression")
+{
+    static uint8_t rx_pool[1024];
+    CanardInstance rx;
+    canardInit(&rx, rx_pool, sizeof(rx_pool), onReception, shouldAccept, nullptr);
+    canardSetLocalNodeID(&rx, 43);
+    Publisher pub;
+    g_received_transfer_ids.clear();
+
+    uint64_t timestamp = 1000000;
+    for (uint16_t payload_len : { 7, 40, 0, 7, 40, 40, 7 })
+    {
+        const auto frames = pub.publish(payload_len);
+        deliver(&rx, frames, 0, timestamp);
+        deliver(&rx, frames, 1, timestamp);
+        deliver(&rx, frames, 2, timestamp);
+        timestamp += 10000;
+    }
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 1, 2, 3, 4, 5, 6 }));
+
+    // Whichever interface delivers a transfer first wins
+    g_received_transfer_ids.clear();
+    for (uint8_t iface : { 1, 0, 2, 2, 1 })
+    {
+        const auto frames = pub.publish(40);
+        deliver(&rx, frames, iface, timestamp);
+        deliver(&rx, frames, uint8_t((iface + 1U) % 3U), timestamp);
+        deliver(&rx, frames, uint8_t((iface + 2U) % 3U), timestamp);
+        timestamp += 10000;
+    }
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 7, 8, 9, 10, 11 }));
+
+    // The interfaces deliver the frames of a multi-frame transfer interleaved
+    g_received_transfer_ids.clear();
+    {
+        const auto frames = pub.publish(40);
+        REQUIRE(frames.size() > 2);
+        for (std::size_t i = 0; i < frames.size(); i++)
+        {
+            deliver(&rx, { frames[i] }, 1, timestamp);
+            deliver(&rx, { frames[i] }, 0, timestamp);
+        }
+    }
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 12 }));
+}
+
+TEST_CASE("MultiIface, Failover")
+{
+    static uint8_t rx_pool[1024];
+    CanardInstance rx;
+    canardInit(&rx, rx_pool, sizeof(rx_pool), onReception, shouldAccept, nullptr);
+    canardSetLocalNodeID(&rx, 43);
+    Publisher pub;
+    g_received_transfer_ids.clear();
+
+    uint64_t timestamp = 1000000;
+    for (int i = 0; i < 3; i++)
+    {
+        const auto frames = pub.publish(40);
+        deliver(&rx, frames, 0, timestamp);
+        deliver(&rx, frames, 1, timestamp);
+        timestamp += 10000;
+    }
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 1, 2 }));
+
+    // Interface 0 fails at the same time when transfer 3 is lost, so the transfer IDs on interface 1 skip ahead.
+    // Interface 1 takes over at once because interface 0 has been silent longer than the switch delay.
+    pub.skip();
+    for (int i = 0; i < 3; i++)
+    {
+        deliver(&rx, pub.publish(40), 1, timestamp);
+        timestamp += 10000;
+    }
+    deliver(&rx, pub.publish(7), 1, timestamp);
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 1, 2, 4, 5, 6, 7 }));
+
+    // Interface 0 is back; its copies are behind, so they are discarded
+    g_received_transfer_ids.clear();
+    timestamp += 10000;
+    {
+        const auto frames = pub.publish(40);
+        deliver(&rx, frames, 1, timestamp);
+        deliver(&rx, frames, 0, timestamp);
+    }
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 8 }));
+
+    // Interface 1 fails in the middle of a transfer; interface 0 takes over and restarts it from the first frame
+    timestamp += 10000;
+    {
+        const auto frames = pub.publish(40);
+        deliver(&rx, { frames[0] }, 1, timestamp);
+        timestamp += CANARD_MULTI_IFACE_SWITCH_DELAY_USEC + 1000U;
+        deliver(&rx, frames, 0, timestamp);
+    }
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 8, 9 }));
+}
+
+TEST_CASE("MultiIface, SwitchDelay")
+{
+    static uint8_t rx_pool[1024];
+    CanardInstance rx;
+    canardInit(&rx, rx_pool, sizeof(rx_pool), onReception, shouldAccept, nullptr);
+    canardSetLocalNodeID(&rx, 43);
+    Publisher pub;
+    g_received_transfer_ids.clear();
+
+    uint64_t timestamp = 1000000;
+    deliver(&rx, pub.publish(7), 0, timestamp);
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0 }));
+
+    // Transfer 1 is lost. Interface 0 is still active, so a transfer ahead of the expected one can't be taken over
+    // by interface 1; it is received via interface 0 shortly after.
+    pub.skip();
+    {
+        const auto frames = pub.publish(7);
+        timestamp += CANARD_MULTI_IFACE_SWITCH_DELAY_USEC - 200U;
+        deliver(&rx, frames, 1, timestamp);
+        REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0 }));
+        deliver(&rx, frames, 0, timestamp);
+        REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 2 }));
+    }
+
+    // Interface 0 is silent for exactly the switch delay, which is not enough yet; a bit longer is
+    pub.skip();
+    {
+        const auto frames = pub.publish(7);
+        timestamp += CANARD_MULTI_IFACE_SWITCH_DELAY_USEC - 100U;
+        deliver(&rx, frames, 1, timestamp);
+        REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 2 }));
+    }
+    {
+        const auto frames = pub.publish(7);
+        timestamp += 1U;
+        deliver(&rx, frames, 1, timestamp);
+        REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 2, 5 }));
+    }
+}
+
+TEST_CASE("MultiIface, TransferIDTimeout")
+{
+    static uint8_t rx_pool[1024];
+    CanardInstance rx;
+    canardInit(&rx, rx_pool, sizeof(rx_pool), onReception, shouldAccept, nullptr);
+    canardSetLocalNodeID(&rx, 43);
+    Publisher pub;
+    g_received_transfer_ids.clear();
+
+    uint64_t timestamp = 1000000;
+    const auto frames = pub.publish(7);
+    deliver(&rx, frames, 0, timestamp);
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0 }));
+
+    // A late copy is discarded even though interface 0 has been silent since
+    timestamp += 1000000;
+    deliver(&rx, frames, 1, timestamp);
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0 }));
+
+    // Once the transfer ID times out, any transfer is accepted from any interface, e.g. after the publisher restart
+    timestamp += 1000000;
+    deliver(&rx, frames, 1, timestamp);
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 0 }));
+
+    // The copies from the original interface are discarded now
+    deliver(&rx, frames, 0, timestamp);
+    REQUIRE(g_received_transfer_ids == std::vector<uint8_t>({ 0, 0 }));
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Zubax Robotics
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+#pragma once
+
+#include <kocherga_ymodem.hpp>
+#include "piped_process.hpp"
+
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <poll.h>
+
+
+namespace piped_process
+{
+/**
+ * A serial port implementation that connects to the sender process via pipes.
+ * Pipes are used in place of a proper serial port here.
+ */
+class SerialPort final : public kocherga_ymodem::IYModemPlatform
+{
+    PipedProcessPtr proc_;
+
+public:
+    explicit SerialPort(PipedProcessPtr process) :
+        proc_(std::move(process))
+    {
+        proc_->makeIONonBlocking();
+    }
+
+    Result emit(std::uint8_t byte, std::chrono::microseconds timeout) final
+    {
+        {
+            ::pollfd pfd{};
+            pfd.fd = proc_->getInputFD();
+            pfd.events = POLLOUT;
+
+            if (::poll(&pfd, 1, std::max(1, int(timeout.count() / 1000))) < 0)
+            {
+                return Result::Error;
+            }
+
+            if ((unsigned(pfd.revents) & unsigned(POLLOUT)) == 0)
+            {
+                return Result::Timeout;
+            }
+        }
+
+        const auto out = proc_->writeInput(&byte, 1);
+        if (out && *out == 1)
+        {
+            return Result::Success;
+        }
+        else if (out && *out < 1)
+        {
+            return Result::Timeout;
+        }
+        else
+        {
+            return Result::Error;
+        }
+    }
+
+    Result receive(std::uint8_t& out_byte, std::chrono::microseconds timeout) final
+    {
+        std::uint16_t size = 1;
+        return receiveBulk(&out_byte, size, timeout);
+    }
+
+    Result receiveBulk(std::uint8_t* out_data, std::uint16_t& inout_size, std::chrono::microseconds timeout) final
+    {
+        {
+            ::pollfd pfd{};
+            pfd.fd = proc_->getOutputFD();
+            pfd.events = POLLIN;
+
+            if (::poll(&pfd, 1, std::max(1, int(timeout.count() / 1000))) < 0)
+            {
+                return Result::Error;
+            }
+
+            if ((unsigned(pfd.revents) & unsigned(POLLIN)) == 0)
+            {
+                return Result::Timeout;
+            }
+        }
+
+        const auto out = proc_->readOutput(out_data, inout_size);
+        if (out && *out > 0)
+        {
+            inout_size = std::uint16_t(*out);
+            return Result::Success;
+        }
+        else if (out)
+        {
+            return Result::Timeout;
+        }
+        else
+        {
+            return Result::Error;
+        }
+    }
+
+    std::chrono::microseconds getMonotonicUptime() const final
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch());
+    }
+};
+
+}
@@ -188,3 +188,28 @@ TEST_CASE("Vector")
         REQUIRE(vec4[3] == 4);
     }
 }
+
+
+TEST_CASE("VectorDefaultMemberInitializers")
+{
+    struct Pair
+    {
+        std::int32_t a = 0;
+        std::int32_t b = 0;
+    };
+
+    Vector<Pair, 4> vec({Pair{1, 2}, Pair{}});
+    REQUIRE(vec.size() == 2);
+    REQUIRE(vec[0].a == 1);
+    REQUIRE(vec[0].b == 2);
+    REQUIRE(vec[1].a == 0);
+    REQUIRE(vec[1].b == 0);
+
+    vec.resize(4);
+    REQUIRE(vec[3].a == 0);
+    REQUIRE(vec[3].b == 0);
+
+    const auto copy = vec;
+    REQUIRE(copy.size() == 4);
+    REQUIRE(copy[0].b == 2);
+}
@@ -52,6 +52,7 @@
 #include <sys/prctl.h>
 #include <csignal>
 #include <queue>
+#include <set>
 
 
 namespace
@@ -337,6 +338,102 @@ public:
 };
 
 
+/**
+ * Common test setup: an endpoint on top of a mock ROM, connected to the test via the queue.
+ * The endpoint can be driven either via step() from the test thread, or via run() from a dedicated thread.
+ * The Popcop platform type can be overridden to intercept the platform calls.
+ */
+template <typename PopcopPlatform = Platform>
+struct Fixture
+{
+    static constexpr std::uint32_t ROMSize = 1024 * 1024;
+
+    struct ImageDataAck
+    {
+        std::uint64_t offset = 0;
+        std::int16_t status = 0;
+        std::uint32_t crc = 0;
+        std::uint64_t next_offset = 0;
+    };
+
+    DuplexQueue& queue;
+    mocks::Platform platform;
+    mocks::FileMappedROMBackend rom_backend;
+    kocherga::BootloaderController blc;
+    PopcopPlatform popcop_platform;
+    kocherga_popcop::PopcopProtocol endpoint;
+    popcop::transport::Parser<> parser;
+    std::size_t num_status_responses = 0;       ///< Standard frames skipped by receiveAck()
+
+    Fixture(DuplexQueue& duplex_queue,
+            const std::string& rom_file_name,
+            const popcop::standard::EndpointInfoMessage& endpoint_info = {},
+            std::function<bool ()> exit_checker = nullptr) :
+        queue(duplex_queue),
+        rom_backend(rom_file_name, ROMSize),
+        blc(platform, rom_backend, ROMSize, std::chrono::microseconds(2'000'000)),
+        popcop_platform(queue, blc, std::move(exit_checker)),
+        endpoint(blc, popcop_platform, endpoint_info)
+    { }
+
+    /**
+     * Returns the next frame emitted by the endpoint; the type code is zero if there are none.
+     */
+    std::pair<std::uint8_t, std::vector<std::uint8_t>> receiveFrame()
+    {
+        while (auto b = queue.popTx())
+        {
+            const auto out = parser.processNextByte(*b);
+            if (auto frame = out.getReceivedFrame())
+            {
+                return {frame->type_code, {frame->payload.begin(), frame->payload.end()}};
+            }
+        }
+        return {};
+    }
+
+    void sendFrame(std::uint8_t type_code, const std::vector<std::uint8_t>& payload)
+    {
+        popcop::transport::StreamEmitter emitter(type_code, [this](std::uint8_t x) { queue.pushRx(x); });
+        std::copy(payload.begin(), payload.end(), emitter.begin());
+    }
+
+    template <typename Message>
+    void sendMessage(const Message& message)
+    {
+        (void) message.encode(popcop::transport::StreamEmitter(popcop::presentation::StandardFrameTypeCode,
+                                                               [this](std::uint8_t x) { queue.pushRx(x); }).begin());
+    }
+
+    /**
+     * Returns the next image data acknowledgement, or an empty option if the endpoint has emitted nothing.
+     * The status responses that the endpoint emits upon completion of the upgrade are counted and skipped.
+     */
+    std::optional<ImageDataAck> receiveAck()
+    {
+        auto [type_code, payload] = receiveFrame();
+        while (type_code == popcop::presentation::StandardFrameTypeCode)
+        {
+            num_status_responses++;
+            std::tie(type_code, payload) = receiveFrame();
+        }
+        if (type_code == 0)
+        {
+            return {};
+        }
+        REQUIRE(type_code == kocherga_popcop::ImageDataAckFrameTypeCode);
+        REQUIRE(payload.size() == 22);
+        popcop::presentation::StreamDecoder decoder(payload.begin(), payload.end());
+        ImageDataAck ack;
+        ack.offset = decoder.fetchU64();
+        ack.status = decoder.fetchI16();
+        ack.crc = decoder.fetchU32();
+        ack.next_offset = decoder.fetchU64();
+        return ack;
+    }
+};
+
+
 }  // namespace
 
 
@@ -355,14 +452,6 @@ TEST_CASE("Popcop-Basic")
             std::cout << "Endpoint is (re)starting..." << std::endl;
             num_restarts++;
 
-            mocks::Platform platform;
-            static constexpr std::uint32_t ROMSize = 1024 * 1024;
-            mocks::FileMappedROMBackend rom_backend("popcop-basic-rom.tmp", ROMSize);
-            kocherga::BootloaderController blc(platform,
-                                               rom_backend,
-                                               ROMSize,
-                                               std::chrono::microseconds(2'000'000));
-
             standard::EndpointInfoMessage ep_info;
 
             // The entire software version struct will be overwritten by the protocol implementation
@@ -391,10 +480,8 @@ TEST_CASE("Popcop-Basic")
                 ep_info.certificate_of_authenticity.push_back(std::uint8_t(i));
             }
 
-            Platform popcop_platform(queue, blc, [&]() { return should_exit; });
-
-            kocherga_popcop::PopcopProtocol endpoint(blc, popcop_platform, ep_info);
-            endpoint.run();
+            Fixture<> fixture(queue, "popcop-basic-rom.tmp", ep_info, [&]() { return should_exit; });
+            fixture.endpoint.run();
 
             std::this_thread::sleep_for(std::chrono::milliseconds(200));    // Give the other thread time to read the Q
             queue.reset();                                                  // <--- mighty reset!
@@ -411,7 +498,7 @@ TEST_CASE("Popcop-Basic")
     REQUIRE_FALSE(modem.receive(std::chrono::seconds(1)));    // Wait launch and ROM verification (takes time)
 
     modem.send(standard::EndpointInfoMessage());
-    if (auto response = modem.receive(std::chrono::milliseconds(100)))
+    if (auto response = modem.receive(std::chrono::seconds(2)))     // The ROM may still be verified
     {
         standard::EndpointInfoMessage m = std::get<standard::EndpointInfoMessage>(*response);
 
@@ -643,7 +730,7 @@ TEST_CASE("Popcop-Basic")
 
     // Upon timeout we're going to get a status message anyway, not necessary to request anything
     std::cout << "Waiting for image data timeout..." << std::endl;
-    if (auto response = modem.receive(std::chrono::seconds(11)))
+    if (auto response = modem.receive(std::chrono::seconds(13)))     // Timeout plus the ROM verification
     {
         standard::BootloaderStatusResponseMessage m = std::get<standard::BootloaderStatusResponseMessage>(*response);
         REQUIRE(m.state == standard::BootloaderState::NoAppToBoot);
@@ -671,4 +758,666 @@ TEST_CASE("Popcop-Basic")
     std::cout << "Endpoint thread joined, test finished." << std::endl;
 }
 
+TEST_CASE("Popcop-Gateway")
+{
+    using namespace popcop;
+
+    DuplexQueue queue;
+
+    struct GatewayPlatform : public Platform
+    {
+        std::uint32_t last_tag = 0;
+        std::int16_t last_error = 0;
+        std::vector<std::uint8_t> last_data;
+        std::uint8_t last_node_id = 0;
+        std::string last_path;
+
+        using Platform::Platform;
+
+        void processFileReadResponse(std::uint32_t tag,
+                                     std::int16_t error,
+                                     const std::uint8_t* data,
+                                     std::uint16_t size) override
+        {
+            last_tag = tag;
+            last_error = error;
+            last_data.assign(data, data + size);
+        }
+
+        std::int16_t processPeerFirmwareUpdateRequest(std::uint8_t node_id,
+                                                      const senoval::String<200>& path) override
+        {
+            last_node_id = node_id;
+            last_path.assign(path.begin(), path.end());
+            return (node_id == 42) ? 0 : -1;
+        }
+    };
+
+    Fixture<GatewayPlatform> fixture(queue, "popcop-gateway-rom.tmp");
+
+    /*
+     * File read request from the endpoint to the host
+     */
+    fixture.endpoint.sendFileReadRequest(0xAABBCCDDU, 0x0102030405ULL, "fw.bin", 6);
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == kocherga_popcop::FileReadGatewayFrameTypeCode);
+        REQUIRE(payload == std::vector<std::uint8_t>{0xDD, 0xCC, 0xBB, 0xAA,
+                                                     0x05, 0x04, 0x03, 0x02, 0x01, 0, 0, 0,
+                                                     'f', 'w', '.', 'b', 'i', 'n'});
+    }
+
+    /*
+     * File read response from the host
+     */
+    fixture.sendFrame(kocherga_popcop::FileReadGatewayFrameTypeCode, {0x78, 0x56, 0x34, 0x12, 0, 0, 1, 2, 3});
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.last_tag == 0x12345678U);
+    REQUIRE(fixture.popcop_platform.last_error == 0);
+    REQUIRE(fixture.popcop_platform.last_data == std::vector<std::uint8_t>{1, 2, 3});
+
+    fixture.sendFrame(kocherga_popcop::FileReadGatewayFrameTypeCode, {0x01, 0, 0, 0, 2, 0});
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.last_tag == 1);
+    REQUIRE(fixture.popcop_platform.last_error == 2);
+    REQUIRE(fixture.popcop_platform.last_data.empty());
+
+    fixture.sendFrame(kocherga_popcop::FileReadGatewayFrameTypeCode, {0x02, 0, 0, 0, 2});     // Malformed, ignored
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.last_tag == 1);
+
+    /*
+     * Peer firmware update request from the host
+     */
+    fixture.sendFrame(kocherga_popcop::PeerFirmwareUpdateGatewayFrameTypeCode, {42, 'f', 'w', '.', 'b', 'i', 'n'});
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.last_node_id == 42);
+    REQUIRE(fixture.popcop_platform.last_path == "fw.bin");
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == kocherga_popcop::PeerFirmwareUpdateGatewayFrameTypeCode);
+        REQUIRE(payload == std::vector<std::uint8_t>{42, 0, 0});
+    }
+
+    fixture.sendFrame(kocherga_popcop::PeerFirmwareUpdateGatewayFrameTypeCode, {43, 'x'});
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == kocherga_popcop::PeerFirmwareUpdateGatewayFrameTypeCode);
+        REQUIRE(payload == std::vector<std::uint8_t>{43, 0xFF, 0xFF});
+    }
+
+    REQUIRE_FALSE(queue.popTx());
+}
+
+TEST_CASE("Popcop-BitRate")
+{
+    using namespace popcop;
+
+    DuplexQueue queue;
+
+    struct BitRatePlatform : public Platform
+    {
+        std::vector<std::uint32_t> bit_rates;       ///< History of setBitRate() calls
+
+        using Platform::Platform;
+
+        bool isBitRateSupported(std::uint32_t bit_rate) const override
+        {
+            return (bit_rate == 921'600) || (bit_rate == 2'000'000);
+        }
+
+        void setBitRate(std::uint32_t bit_rate) override
+        {
+            bit_rates.push_back(bit_rate);
+        }
+    };
+
+    Fixture<BitRatePlatform> fixture(queue, "popcop-bitrate-rom.tmp");
+
+    const auto make_verification_request = [](std::uint32_t bit_rate)
+    {
+        std::vector<std::uint8_t> out{std::uint8_t(bit_rate),         std::uint8_t(bit_rate >> 8U),
+                                      std::uint8_t(bit_rate >> 16U),  std::uint8_t(bit_rate >> 24U)};
+        for (std::uint16_t i = 0; i < kocherga_popcop::BitRateTestPatternSize; i++)
+        {
+            out.push_back(std::uint8_t(i));
+        }
+        return out;
+    };
+
+    constexpr auto TypeCode = kocherga_popcop::BitRateChangeFrameTypeCode;
+
+    /*
+     * Unsupported bit rate is rejected at the current bit rate
+     */
+    fixture.sendFrame(TypeCode, {0x40, 0x4B, 0x4C, 0x00});                     // 5 Mbaud
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == TypeCode);
+        REQUIRE(payload == std::vector<std::uint8_t>{0x40, 0x4B, 0x4C, 0x00, 0x5D, 0xF0});   // -4003
+    }
+    REQUIRE(fixture.popcop_platform.bit_rates.empty());
+
+    /*
+     * Successful switch: accepted, then verified at the new bit rate
+     */
+    fixture.sendFrame(TypeCode, {0x00, 0x10, 0x0E, 0x00});                     // 921600
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == TypeCode);
+        REQUIRE(payload == std::vector<std::uint8_t>{0x00, 0x10, 0x0E, 0x00, 0, 0});
+    }
+    REQUIRE(fixture.popcop_platform.bit_rates == std::vector<std::uint32_t>{921'600});
+
+    fixture.sendFrame(TypeCode, make_verification_request(921'600));
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == TypeCode);
+        REQUIRE(payload == make_verification_request(921'600));
+    }
+
+    // Verified links stay at the new bit rate for as long as the host is active
+    std::this_thread::sleep_for(std::chrono::milliseconds(700));
+    fixture.sendFrame(presentation::StandardFrameTypeCode, {});
+    fixture.endpoint.step();
+    std::this_thread::sleep_for(std::chrono::milliseconds(700));
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.bit_rates == std::vector<std::uint32_t>{921'600});
+
+    // The host can return to the default bit rate explicitly
+    fixture.sendFrame(TypeCode, {0, 0, 0, 0});
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == TypeCode);
+        REQUIRE(payload == std::vector<std::uint8_t>{0, 0, 0, 0, 0, 0});
+    }
+    REQUIRE(fixture.popcop_platform.bit_rates == std::vector<std::uint32_t>{921'600, 0});
+
+    /*
+     * Corrupted test pattern: reverting immediately, no response
+     */
+    fixture.sendFrame(TypeCode, {0x80, 0x84, 0x1E, 0x00});                     // 2 Mbaud
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().first == TypeCode);
+    {
+        auto request = make_verification_request(2'000'000);
+        request.at(100) ^= 0x10U;
+        fixture.sendFrame(TypeCode, request);
+    }
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.bit_rates == std::vector<std::uint32_t>{921'600, 0, 2'000'000, 0});
+    REQUIRE_FALSE(queue.popTx());
+
+    /*
+     * No verification at all: reverting after the timeout
+     */
+    fixture.sendFrame(TypeCode, {0x80, 0x84, 0x1E, 0x00});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().first == TypeCode);
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.bit_rates.back() == 2'000'000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1'100));
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.bit_rates == std::vector<std::uint32_t>{921'600, 0, 2'000'000, 0, 2'000'000, 0});
+
+    // The late verification request is ignored
+    fixture.sendFrame(TypeCode, make_verification_request(2'000'000));
+    fixture.endpoint.step();
+    REQUIRE(fixture.popcop_platform.bit_rates.size() == 6);
+
+    REQUIRE_FALSE(queue.popTx());
+}
+
+TEST_CASE("Popcop-CompactAcks")
+{
+    using namespace popcop;
+
+    DuplexQueue queue;
+
+    Fixture<> fixture(queue, "popcop-compact-acks-rom.tmp");
+
+    const auto compute_crc = [](const auto& data)
+    {
+        transport::CRCComputer crc;
+        for (std::uint8_t x : data)
+        {
+            crc.add(x);
+        }
+        return crc.get();
+    };
+
+    /*
+     * Negotiation; unknown flags are dropped
+     */
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0xFF});
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == kocherga_popcop::UploadOptionsFrameTypeCode);
+        REQUIRE(payload == std::vector<std::uint8_t>{kocherga_popcop::UploadOptionCompactAcks, 1, 0, 1});
+    }
+
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {});       // Malformed, ignored
+    fixture.endpoint.step();
+    REQUIRE_FALSE(queue.popTx());
+
+    /*
+     * Image data while no upgrade is in progress
+     */
+    {
+        standard::BootloaderImageDataRequestMessage msg;
+        msg.image_type = standard::BootloaderImageType::Application;
+        msg.image_offset = 1234;
+        msg.image_data.push_back(42);
+        fixture.sendMessage(msg);
+        fixture.endpoint.step();
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        const auto [offset, status, crc, next_offset] = *ack;
+        REQUIRE(offset == 1234);
+        REQUIRE(next_offset == 0);
+        REQUIRE(status == -kocherga_popcop::ErrNoUpgrade);
+        REQUIRE(crc == compute_crc(msg.image_data));
+    }
+
+    /*
+     * Upload; the image data is never sent back
+     */
+    fixture.sendMessage(standard::BootloaderStatusRequestMessage{standard::BootloaderState::AppUpgradeInProgress});
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == presentation::StandardFrameTypeCode);
+        const auto m = standard::BootloaderStatusResponseMessage::tryDecode(payload.begin(), payload.end());
+        REQUIRE(m);
+        REQUIRE(m->state == standard::BootloaderState::AppUpgradeInProgress);
+    }
+
+    std::size_t offset = 0;
+    std::size_t num_acks = 0;
+    while (true)
+    {
+        standard::BootloaderImageDataRequestMessage msg;
+        msg.image_type = standard::BootloaderImageType::Application;
+        msg.image_offset = offset;
+        while ((offset < images::AppValid2.size()) && (msg.image_data.size() < msg.image_data.max_size()))
+        {
+            msg.image_data.push_back(images::AppValid2.at(offset));
+            offset++;
+        }
+
+        fixture.sendMessage(msg);
+        fixture.endpoint.step();
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        const auto [ack_offset, status, crc, next_offset] = *ack;
+        REQUIRE(ack_offset == msg.image_offset);
+        REQUIRE(next_offset == offset);
+        REQUIRE(status == 0);
+        REQUIRE(crc == compute_crc(msg.image_data));
+        num_acks++;
+
+        if (msg.image_data.size() < msg.image_data.max_size())
+        {
+            break;
+        }
+    }
+    REQUIRE(num_acks == ((images::AppValid2.size() / 256U) + 1U));
+
+    // The upgrade is finalized on the next step
+    fixture.endpoint.step();
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == presentation::StandardFrameTypeCode);
+        const auto m = standard::BootloaderStatusResponseMessage::tryDecode(payload.begin(), payload.end());
+        REQUIRE(m);
+        REQUIRE(m->state == standard::BootloaderState::BootDelay);
+    }
+    REQUIRE(fixture.blc.getAppInfo());
+    REQUIRE(fixture.blc.getAppInfo()->vcs_commit == images::AppValid2VCSCommit);
+
+    /*
+     * The certificate of authenticity is read back in full regardless
+     */
+    {
+        standard::BootloaderImageDataRequestMessage msg;
+        msg.image_type = standard::BootloaderImageType::CertificateOfAuthenticity;
+        msg.image_data.push_back(1);
+        msg.image_data.push_back(2);
+        fixture.sendMessage(msg);
+        fixture.endpoint.step();
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == presentation::StandardFrameTypeCode);
+        const auto m = standard::BootloaderImageDataResponseMessage::tryDecode(payload.begin(), payload.end());
+        REQUIRE(m);
+        REQUIRE(m->image_data == msg.image_data);
+    }
+
+    // Back to the standard responses
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{0, 1, 0, 1});
+    {
+        standard::BootloaderImageDataRequestMessage msg;
+        msg.image_type = standard::BootloaderImageType::Application;
+        fixture.sendMessage(msg);
+        fixture.endpoint.step();
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == presentation::StandardFrameTypeCode);
+        REQUIRE(standard::BootloaderImageDataResponseMessage::tryDecode(payload.begin(), payload.end()));
+    }
+
+    REQUIRE(fixture.num_status_responses == 0);
+    REQUIRE_FALSE(queue.popTx());
+}
+
+TEST_CASE("Popcop-Window")
+{
+    using namespace popcop;
+
+    DuplexQueue queue;
+
+    struct WindowPlatform : public Platform
+    {
+        using Platform::Platform;
+
+        std::uint8_t getMaxImageDataWindow() const override { return 8; }
+    };
+
+    Fixture<WindowPlatform> fixture(queue, "popcop-window-rom.tmp");
+
+    // The frame is not delivered if the request is lost
+    const auto send_chunk = [&](std::uint64_t offset, bool lost = false)
+    {
+        standard::BootloaderImageDataRequestMessage msg;
+        msg.image_type = standard::BootloaderImageType::Application;
+        msg.image_offset = offset;
+        while ((offset < images::AppValid2.size()) && (msg.image_data.size() < msg.image_data.max_size()))
+        {
+            msg.image_data.push_back(images::AppValid2.at(std::size_t(offset)));
+            offset++;
+        }
+        (void) msg.encode(transport::StreamEmitter(presentation::StandardFrameTypeCode,
+                                                   [&](std::uint8_t x) { if (!lost) { queue.pushRx(x); } }).begin());
+        return msg.image_data.size();
+    };
+
+    /*
+     * The window is limited by the platform
+     */
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {kocherga_popcop::UploadOptionCompactAcks, 16});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{kocherga_popcop::UploadOptionCompactAcks, 8, 0, 1});
+
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {kocherga_popcop::UploadOptionCompactAcks, 0});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{kocherga_popcop::UploadOptionCompactAcks, 1, 0, 1});
+
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {kocherga_popcop::UploadOptionCompactAcks, 8});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{kocherga_popcop::UploadOptionCompactAcks, 8, 0, 1});
+
+    fixture.sendMessage(standard::BootloaderStatusRequestMessage{standard::BootloaderState::AppUpgradeInProgress});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().first == presentation::StandardFrameTypeCode);
+
+    /*
+     * Repeated requests are acknowledged but not written again
+     */
+    for (std::uint8_t i = 0; i < 2; i++)
+    {
+        REQUIRE(send_chunk(0) == 256);
+        fixture.endpoint.step();
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        REQUIRE(ack->offset == 0);
+        REQUIRE(ack->status == 0);
+        REQUIRE(ack->next_offset == 256);
+    }
+
+    /*
+     * A request that straddles the committed boundary contributes only its tail; the go-back-N upload below
+     * starts with another such request
+     */
+    REQUIRE(send_chunk(128) == 256);
+    fixture.endpoint.step();
+    {
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        REQUIRE(ack->offset == 128);
+        REQUIRE(ack->status == 0);
+        REQUIRE(ack->next_offset == 384);
+    }
+
+    /*
+     * Go-back-N upload with eight requests in flight; some requests are lost on the way to the endpoint
+     */
+    std::set<std::uint64_t> offsets_to_lose{3 * 256, 4 * 256, 20 * 256};
+    std::uint64_t send_offset = 256;
+    std::uint64_t last_rewind_offset = 0;
+    std::size_t in_flight = 0;
+    std::size_t num_gaps = 0;
+    std::size_t num_requests = 2;
+    bool last_sent = false;
+    bool done = false;
+    while (!done)
+    {
+        while ((in_flight < 8) && !last_sent)
+        {
+            const bool lost = offsets_to_lose.erase(send_offset) > 0;
+            const std::size_t size = send_chunk(send_offset, lost);
+            if (!lost)
+            {
+                in_flight++;
+            }
+            num_requests++;
+            last_sent = size < 256;
+            send_offset += size;
+        }
+
+        fixture.endpoint.step();
+        while (const auto ack = fixture.receiveAck())
+        {
+            const auto [offset, status, crc, next_offset] = *ack;
+            REQUIRE(in_flight > 0);
+            in_flight--;
+            if (status == -kocherga_popcop::ErrOutOfOrder)
+            {
+                REQUIRE(next_offset < offset);
+                num_gaps++;
+                if (next_offset != last_rewind_offset)      // The rest of the window is stale, ignore it
+                {
+                    last_rewind_offset = next_offset;
+                    send_offset = next_offset;
+                    last_sent = false;
+                }
+            }
+            else
+            {
+                REQUIRE(status == 0);
+                REQUIRE(next_offset <= images::AppValid2.size());
+                done = next_offset == images::AppValid2.size();
+            }
+        }
+    }
+
+    REQUIRE(offsets_to_lose.empty());
+    REQUIRE(num_gaps > 0);
+    REQUIRE(num_requests > ((images::AppValid2.size() / 256U) + 1U));
+
+    // The stale requests that are still in flight are rejected because the download is over
+    while (in_flight > 0)
+    {
+        fixture.endpoint.step();
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        REQUIRE(ack->status == -kocherga_popcop::ErrNoUpgrade);
+        in_flight--;
+    }
+
+    REQUIRE(fixture.num_status_responses == 1);
+    REQUIRE(fixture.blc.getAppInfo());
+    REQUIRE(fixture.blc.getAppInfo()->vcs_commit == images::AppValid2VCSCommit);
+}
+
+TEST_CASE("Popcop-LargeChunks")
+{
+    using namespace popcop;
+
+    DuplexQueue queue;
+
+    Fixture<> fixture(queue, "popcop-large-chunks-rom.tmp");
+
+    const auto send_chunk = [&](std::size_t offset, std::size_t size, bool last)
+    {
+        std::vector<std::uint8_t> payload;
+        presentation::StreamEncoder encoder(std::back_inserter(payload));
+        encoder.addU64(offset);
+        encoder.addU8(last ? kocherga_popcop::ImageDataFlagLastChunk : 0U);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            payload.push_back(images::AppValid2.at(offset + i));
+        }
+        fixture.sendFrame(kocherga_popcop::ImageDataFrameTypeCode, payload);
+    };
+
+    /*
+     * The chunk size is clamped to the supported range
+     */
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0, 1, 0x00, 0x10});      // 4096
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{0, 1, 0x00, 0x08});
+
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0, 1, 100, 0});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{0, 1, 0x00, 0x01});
+
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0, 1, 0x00, 0x06});      // 1536
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{0, 1, 0x00, 0x06});
+
+    fixture.sendMessage(standard::BootloaderStatusRequestMessage{standard::BootloaderState::AppUpgradeInProgress});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().first == presentation::StandardFrameTypeCode);
+
+    /*
+     * The chunks need not be of the same size; even a full-size chunk can be the last one
+     */
+    fixture.sendFrame(kocherga_popcop::ImageDataFrameTypeCode, {0, 0, 0, 0, 0, 0, 0, 0});         // Malformed, ignored
+    fixture.endpoint.step();
+    REQUIRE_FALSE(queue.popTx());
+
+    std::size_t offset = 0;
+    const std::vector<std::size_t> sizes{2048, 1000, 2048, 17};
+    for (std::size_t size : sizes)
+    {
+        send_chunk(offset, size, false);
+        fixture.endpoint.step();
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        REQUIRE(ack->offset == offset);
+        REQUIRE(ack->status == 0);
+        offset += size;
+        REQUIRE(ack->next_offset == offset);
+    }
+
+    // Gaps are detected the same way as with the standard messages
+    send_chunk(offset + 1, 1, false);
+    fixture.endpoint.step();
+    {
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        REQUIRE(ack->offset == (offset + 1));
+        REQUIRE(ack->status == -kocherga_popcop::ErrOutOfOrder);
+        REQUIRE(ack->next_offset == offset);
+    }
+
+    const std::size_t remaining = images::AppValid2.size() - offset;
+    REQUIRE(remaining == 2048 * 2 + 1295);
+    send_chunk(offset, 2048, false);
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveAck().value().status == 0);
+    send_chunk(offset + 2048, 2048, false);
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveAck().value().status == 0);
+    send_chunk(offset + 4096, 1295, true);
+    fixture.endpoint.step();
+    {
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        REQUIRE(ack->offset == (offset + 4096));
+        REQUIRE(ack->status == 0);
+        REQUIRE(ack->next_offset == images::AppValid2.size());
+    }
+    {
+        const auto [type_code, payload] = fixture.receiveFrame();
+        REQUIRE(type_code == presentation::StandardFrameTypeCode);
+        const auto m = standard::BootloaderStatusResponseMessage::tryDecode(payload.begin(), payload.end());
+        REQUIRE(m);
+        REQUIRE(m->state == standard::BootloaderState::BootDelay);
+    }
+    REQUIRE(fixture.blc.getAppInfo());
+    REQUIRE(fixture.blc.getAppInfo()->vcs_commit == images::AppValid2VCSCommit);
+
+    // The last chunk is acknowledged again if the first acknowledgement has been lost; other chunks are not
+    send_chunk(offset + 4096, 1295, true);
+    fixture.endpoint.step();
+    {
+        const auto ack = fixture.receiveAck();
+        REQUIRE(ack);
+        REQUIRE(ack->status == 0);
+        REQUIRE(ack->next_offset == images::AppValid2.size());
+    }
+    send_chunk(offset + 2048, 2048, false);
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveAck().value().status == -kocherga_popcop::ErrNoUpgrade);
+    send_chunk(offset + 4096, 1000, true);
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveAck().value().status == -kocherga_popcop::ErrNoUpgrade);
+
+    // Oversized chunks are ignored
+    fixture.sendFrame(kocherga_popcop::ImageDataFrameTypeCode, std::vector<std::uint8_t>(9 + 2049));
+    fixture.endpoint.step();
+    REQUIRE(fixture.num_status_responses == 0);
+    REQUIRE_FALSE(queue.popTx());
+}
+
+TEST_CASE("Popcop-ChunkSizeLimit")
+{
+    DuplexQueue queue;
+
+    struct ChunkSizeLimitPlatform : public Platform
+    {
+        std::uint16_t max_chunk_size = 1000;
+
+        using Platform::Platform;
+
+        std::uint16_t getMaxImageDataChunkSize() const override { return max_chunk_size; }
+    };
+
+    Fixture<ChunkSizeLimitPlatform> fixture(queue, "popcop-chunk-size-limit-rom.tmp");
+
+    // The platform bounds the granted chunk size
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0, 1, 0x00, 0x08});      // 2048
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{0, 1, 0xE8, 0x03});
+
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0, 1, 0x00, 0x02});      // 512
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{0, 1, 0x00, 0x02});
+
+    // But never below the chunk size of the standard messages
+    fixture.popcop_platform.max_chunk_size = 100;
+    fixture.sendFrame(kocherga_popcop::UploadOptionsFrameTypeCode, {0, 1, 0x00, 0x08});
+    fixture.endpoint.step();
+    REQUIRE(fixture.receiveFrame().second == std::vector<std::uint8_t>{0, 1, 0x00, 0x01});
+
+    REQUIRE_FALSE(queue.popTx());
+}
+
 #endif // __clang__
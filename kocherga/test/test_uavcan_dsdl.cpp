@@ -0,0 +1,98 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Zubax Robotics
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+// We want to ensure that assertion checks are enabled when tests are run, for extra safety
+#ifdef NDEBUG
+# undef NDEBUG
+#endif
+
+// The library headers must be included first to make sure that they don't have any hidden include dependencies.
+#include <kocherga_uavcan.hpp>
+
+#include "catch.hpp"
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+
+TEST_CASE("UAVCAN-DSDL")
+{
+    using namespace kocherga_uavcan::impl_::dsdl;
+
+    std::srand(42);
+    const auto random_byte = []() { return std::uint8_t(std::rand()); };
+
+    // Compares the compile-time serializer against the generic one on a buffer filled with garbage
+    const auto check = [&](auto field, const auto value, const std::uint32_t bit_offset, const std::uint8_t bit_length)
+    {
+        std::array<std::uint8_t, 32> reference{};
+        std::generate(reference.begin(), reference.end(), random_byte);
+        auto buffer = reference;
+
+        ::canardEncodeScalar(reference.data(), bit_offset, bit_length, &value);
+        decltype(field)::encode(buffer.data(), value);
+        REQUIRE(buffer == reference);
+    };
+
+    for (std::uint16_t i = 0; i < 1000; i++)
+    {
+        const auto u64 = (std::uint64_t(std::rand()) << 33U) ^
+                         (std::uint64_t(std::rand()) << 11U) ^
+                         std::uint64_t(std::rand());
+
+        using M = MessageTypeInfo<0, 0, 256>;
+        check(M::Field< 0, 32>(), std::uint32_t(u64),            0, 32);      // Byte-aligned
+        check(M::Field< 0, 40>(), u64 & 0xFFFFFFFFFFULL,         0, 40);
+        check(M::Field<64, 64>(), u64,                          64, 64);
+        check(M::Field<16, 16>(), std::int16_t(u64),            16, 16);
+        check(M::Field<32,  2>(), std::uint8_t(u64 & 3U),       32,  2);      // Within one byte
+        check(M::Field<34,  3>(), std::uint8_t(u64 & 7U),       34,  3);
+        check(M::Field< 7,  1>(), std::uint8_t(u64 & 1U),        7,  1);
+        check(M::Field< 0,  7>(), std::uint8_t(u64 & 127U),      0,  7);
+        check(M::Field< 5, 13>(), std::uint16_t(u64 & 0x1FFFU),  5, 13);      // Generic
+        check(M::Field< 3, 32>(), std::uint32_t(u64),            3, 32);
+    }
+
+    // The layouts of the standard data types
+    std::uint8_t buffer[GetNodeInfo::MaxSizeBytesResponse]{};
+    NodeStatus::Health::encode(buffer, std::uint8_t(2));
+    NodeStatus::Mode::encode(buffer, std::uint8_t(3));
+    NodeStatus::VendorSpecificStatusCode::encode(buffer, std::uint16_t(0xBEEF));
+    REQUIRE(buffer[4] == ((2U << 6U) | (3U << 3U)));
+    REQUIRE(buffer[5] == 0xEF);
+    REQUIRE(buffer[6] == 0xBE);
+
+    GetNodeInfo::SoftwareVCSCommit::encode(buffer, std::uint32_t(0x12345678U));
+    REQUIRE(buffer[10] == 0x78);
+    REQUIRE(buffer[13] == 0x12);
+    REQUIRE(GetNodeInfo::HardwareUniqueID::ByteOffset == 24);
+    REQUIRE(GetNodeInfo::CoA::ByteOffset == 41);
+
+    const char path[] = "a/b.bin";
+    REQUIRE(FileRead::Path::encode(buffer, path, 7) == 12);
+    REQUIRE(std::memcmp(&buffer[5], path, 7) == 0);
+}
@@ -0,0 +1,198 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Zubax Robotics
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+// We want to ensure that assertion checks are enabled when tests are run, for extra safety
+#ifdef NDEBUG
+# undef NDEBUG
+#endif
+
+#define KOCHERGA_TRACE          std::printf
+#define KOCHERGA_UAVCAN_LOG     std::printf
+
+// The library headers must be included first to make sure that they don't have any hidden include dependencies.
+#include <kocherga_uavcan_linux.hpp>
+
+#include "catch.hpp"
+
+#include <set>
+#include <iostream>
+
+
+namespace
+{
+/**
+ * The same virtual interface is used by the UAVCAN-Python test; the part of the test that needs it
+ * is skipped if it does not exist.
+ */
+const std::string IfaceName = "kocherga0";  // NOLINT
+
+class Platform final : public kocherga_uavcan_linux::SocketCANPlatform
+{
+    void resetWatchdog() override { }
+
+    bool shouldExit() const override { return false; }
+
+    bool tryScheduleReboot() override { return false; }
+
+public:
+    using SocketCANPlatform::SocketCANPlatform;
+};
+
+std::chrono::microseconds now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch());
+}
+
+::CanardCANFrame makeFrame(const std::uint32_t id, const std::uint8_t size)
+{
+    ::CanardCANFrame frame{};
+    frame.id = id | CANARD_CAN_FRAME_EFF;
+    frame.data_len = size;
+    for (std::uint8_t i = 0; i < size; i++)
+    {
+        frame.data[i] = std::uint8_t(i + 1U);
+    }
+    return frame;
+}
+
+}
+
+
+TEST_CASE("UAVCAN-Linux-Basic")
+{
+    using kocherga_uavcan::IUAVCANPlatform;
+
+    // The time base must be the one of the steady clock, which is also what the reception timestamps use
+    kocherga_uavcan_linux::MonotonicClockPlatform core_platform;
+    const auto a = now();
+    const auto b = static_cast<kocherga::IPlatform&>(core_platform).getMonotonicUptime();
+    REQUIRE(b >= a);
+    REQUIRE(b < (a + std::chrono::seconds(1)));
+
+    Platform platform({"kocherga-nonexistent", "kocherga-nonexistent-too"}, 1'000'000);
+    IUAVCANPlatform& p = platform;
+    REQUIRE(p.getNumberOfInterfaces() == 2);
+    REQUIRE(p.getCANFDDataBitRate(1'000'000) == 0);
+
+    // Random numbers stay in range and are not degenerate
+    std::set<std::uint64_t> values;
+    for (int i = 0; i < 1000; i++)
+    {
+        const auto x = p.getRandomUnsignedInteger(100, 200);
+        REQUIRE(x >= 100);
+        REQUIRE(x < 200);
+        values.insert(x);
+    }
+    REQUIRE(values.size() > 50);
+
+    // Sleeping is accurate to well below a millisecond on a normal system; the upper bound is loose for CI
+    {
+        const auto started_at = now();
+        p.sleep(std::chrono::milliseconds(20));
+        const auto elapsed = now() - started_at;
+        REQUIRE(elapsed >= std::chrono::milliseconds(20));
+        REQUIRE(elapsed < std::chrono::milliseconds(200));
+    }
+
+    // Not configured
+    REQUIRE(p.receive(std::chrono::milliseconds(10)).first < 0);
+    REQUIRE(p.send(makeFrame(123, 8), std::chrono::milliseconds(10)) < 0);
+
+    // Other bit rates are rejected, so that the bit rate detection can find the right one
+    const IUAVCANPlatform::CANAcceptanceFilterList accept_all{IUAVCANPlatform::CANAcceptanceFilterConfig{}};
+    REQUIRE(p.configure(500'000, 0, IUAVCANPlatform::CANMode::Normal, accept_all) == -EINVAL);
+
+    // No such interface
+    REQUIRE(p.configure(1'000'000, 0, IUAVCANPlatform::CANMode::Normal, accept_all) < 0);
+    REQUIRE(p.receive(std::chrono::milliseconds(10)).first < 0);
+}
+
+
+TEST_CASE("UAVCAN-Linux-SocketCAN")
+{
+    using kocherga_uavcan::IUAVCANPlatform;
+
+    if (::if_nametoindex(IfaceName.c_str()) == 0)
+    {
+        WARN("Interface " + IfaceName + " does not exist, skipping; see UAVCAN-Python-slow for setup instructions");
+        return;
+    }
+
+    const IUAVCANPlatform::CANAcceptanceFilterList accept_all{IUAVCANPlatform::CANAcceptanceFilterConfig{}};
+
+    // The same interface twice looks like two redundant interfaces connected to the same bus
+    Platform receiver_platform({IfaceName, IfaceName});
+    Platform sender_platform({IfaceName});
+    IUAVCANPlatform& receiver = receiver_platform;
+    IUAVCANPlatform& sender = sender_platform;
+    REQUIRE(0 == receiver.configure(1'000'000, 0, IUAVCANPlatform::CANMode::Normal, accept_all));
+    REQUIRE(0 == sender.configure(1'000'000, 0, IUAVCANPlatform::CANMode::Normal, accept_all));
+
+    // Nothing to receive; the timeout is kept by the timer rather than by the millisecond timeout of epoll
+    {
+        const auto started_at = now();
+        REQUIRE(receiver.receive(std::chrono::microseconds(5'500)).first == 0);
+        const auto elapsed = now() - started_at;
+        REQUIRE(elapsed >= std::chrono::microseconds(5'500));
+        REQUIRE(elapsed < std::chrono::milliseconds(100));
+    }
+
+    // Each frame is received via both interfaces, with a timestamp taken on reception
+    const auto sent_at = now();
+    REQUIRE(1 == sender.send(makeFrame(0x1234, 8), std::chrono::milliseconds(100)));
+    std::set<std::uint8_t> ifaces;
+    for (int i = 0; i < 2; i++)
+    {
+        const auto [res, rx] = receiver.receive(std::chrono::milliseconds(100));
+        REQUIRE(res == 1);
+        REQUIRE(rx.frame.id == (0x1234U | CANARD_CAN_FRAME_EFF));
+        REQUIRE(rx.frame.data_len == 8);
+        REQUIRE(rx.frame.data[7] == 8);
+        REQUIRE(rx.timestamp >= (sent_at - std::chrono::milliseconds(1)));
+        REQUIRE(rx.timestamp <= now());
+        ifaces.insert(rx.frame.iface_id);
+    }
+    REQUIRE(ifaces == std::set<std::uint8_t>{0, 1});
+    REQUIRE(receiver.receive(std::chrono::milliseconds(10)).first == 0);
+
+    // Acceptance filters are applied by the kernel
+    REQUIRE(0 == receiver.configure(1'000'000, 0, IUAVCANPlatform::CANMode::Normal,
+                                    {IUAVCANPlatform::CANAcceptanceFilterConfig{0x100U, 0xF00U}}));
+    REQUIRE(1 == sender.send(makeFrame(0x234, 1), std::chrono::milliseconds(100)));
+    REQUIRE(1 == sender.send(makeFrame(0x123, 2), std::chrono::milliseconds(100)));
+    for (std::uint8_t i = 0; i < 2; i++)
+    {
+        const auto [res, rx] = receiver.receive(std::chrono::milliseconds(100));
+        REQUIRE(res == 1);
+        REQUIRE(rx.frame.id == (0x123U | CANARD_CAN_FRAME_EFF));
+        REQUIRE(rx.frame.data_len == 2);
+    }
+    REQUIRE(receiver.receive(std::chrono::milliseconds(10)).first == 0);
+
+    // Silent mode
+    REQUIRE(0 == sender.configure(1'000'000, 0, IUAVCANPlatform::CANMode::Silent, accept_all));
+    REQUIRE(sender.send(makeFrame(0x1234, 8), std::chrono::milliseconds(10)) < 0);
+}
@@ -69,7 +69,7 @@ class Platform final : public kocherga_uavcan::IUAVCANPlatform
     bool should_exit_ = false;
 
     std::optional<SocketCANInstance> socketcan_;
-    CANAcceptanceFilterConfig can_acceptance_filter_{};
+    CANAcceptanceFilterList can_acceptance_filters_{};
     CANMode can_mode_{};
 
     kocherga::BootloaderController& blc_;
@@ -117,15 +117,20 @@ class Platform final : public kocherga_uavcan::IUAVCANPlatform
     }
 
     std::int16_t configure(std::uint32_t bitrate,
+                           std::uint32_t data_bit_rate,
                            CANMode mode,
-                           const CANAcceptanceFilterConfig& acceptance_filter) override
+                           const CANAcceptanceFilterList& acceptance_filters) override
     {
         (void) bitrate;
-        KOCHERGA_TRACE("UAVCAN test: Configuring CAN; bitrate %u, mode %u, filter 0x%08x/0x%08x\n",
+        KOCHERGA_TRACE("UAVCAN test: Configuring CAN; bitrate %u/%u, mode %u, %u filters\n",
                        unsigned(bitrate),
+                       unsigned(data_bit_rate),
                        unsigned(mode),
-                       unsigned(acceptance_filter.id),
-                       unsigned(acceptance_filter.mask));
+                       unsigned(acceptance_filters.size()));
+        for (auto& f : acceptance_filters)
+        {
+            KOCHERGA_TRACE("UAVCAN test: Filter 0x%08x/0x%08x\n", unsigned(f.id), unsigned(f.mask));
+        }
 
         if (socketcan_)
         {
@@ -137,9 +142,10 @@ class Platform final : public kocherga_uavcan::IUAVCANPlatform
         {
             throw std::runtime_error("Could not init SocketCAN interface: errno=" + std::to_string(errno));
         }
+        socketcan_->canfd_brs = (data_bit_rate != 0) && (data_bit_rate != bitrate);
 
         can_mode_ = mode;
-        can_acceptance_filter_ = acceptance_filter;
+        can_acceptance_filters_ = acceptance_filters;
 
         return 0;
     }
@@ -161,7 +167,7 @@ class Platform final : public kocherga_uavcan::IUAVCANPlatform
                               int(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count())));
     }
 
-    std::pair<std::int16_t, ::CanardCANFrame> receive(std::chrono::microseconds timeout) override
+    std::pair<std::int16_t, ReceivedCANFrame> receive(std::chrono::microseconds timeout) override
     {
         if (!socketcan_)
         {
@@ -177,9 +183,12 @@ class Platform final : public kocherga_uavcan::IUAVCANPlatform
             if (res > 0)
             {
                 // Software acceptance filter emulation
-                if (((frame.id & can_acceptance_filter_.mask) ^ can_acceptance_filter_.id) == 0)
+                for (auto& f : can_acceptance_filters_)
                 {
-                    return {1, frame};
+                    if (((frame.id & f.mask) ^ f.id) == 0)
+                    {
+                        return {1, {frame, {}}};        // SocketCAN timestamps are not used by this driver
+                    }
                 }
             }
             else if (res == 0)
@@ -318,3 +327,4 @@ TEST_CASE("UAVCAN-Python-slow")
 
     std::cout << "Node thread joined, test finished." << std::endl;
 }
+
@@ -0,0 +1,1458 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Zubax Robotics
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+// We want to ensure that assertion checks are enabled when tests are run, for extra safety
+#ifdef NDEBUG
+# undef NDEBUG
+#endif
+
+#define KOCHERGA_TRACE          std::printf
+#define KOCHERGA_UAVCAN_LOG     std::printf
+
+// The library headers must be included first to make sure that they don't have any hidden include dependencies.
+#include <kocherga_uavcan.hpp>
+
+#include "catch.hpp"
+#include "images.hpp"
+
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <algorithm>
+
+
+namespace
+{
+/**
+ * The simulated nodes are dimensioned to serve this many peers at once.
+ */
+constexpr std::size_t MaxConcurrentFileReadPeers = 4;
+
+/**
+ * The file server and the client are fixed; the nodes are assigned consecutive IDs starting from FirstNodeID.
+ */
+constexpr std::uint8_t ServerNodeID = 1;
+constexpr std::uint8_t ClientNodeID = 2;
+constexpr std::uint8_t FirstNodeID = 10;
+
+const char* const FirmwareFilePath = "fw.bin";
+
+const char* const NodeName = "com.zubax.kocherga.test";
+
+/**
+ * Depth of the transmission mailbox of the simulated CAN controllers; most controllers have three.
+ */
+constexpr std::size_t TxMailboxDepth = 3;
+
+/**
+ * The simulation advances in steps of this size; all nodes and the file server are stepped once per quantum.
+ * It should be well below the duration of one frame at the highest simulated bit rate.
+ */
+constexpr std::chrono::microseconds SimulationQuantum{20};  // NOLINT
+
+/**
+ * Exact duration of a classic CAN 2.0B extended data frame on the wire, in bits, including the stuff bits
+ * and the interframe space. The fields subject to bit stuffing (SOF through the CRC) are serialized and stuffed
+ * explicitly; the rest of the frame has a fixed format.
+ */
+std::uint32_t computeFrameLengthInBits(const ::CanardCANFrame& frame)
+{
+    assert(frame.data_len <= 8);
+
+    std::vector<bool> bits;
+    const auto push = [&bits](const std::uint32_t value, const std::uint8_t width)
+    {
+        for (std::uint8_t i = width; i > 0; i--)
+        {
+            bits.push_back(((value >> (i - 1U)) & 1U) != 0);
+        }
+    };
+
+    const std::uint32_t id = frame.id & CANARD_CAN_EXT_ID_MASK;
+    push(0, 1);                                 // SOF
+    push(id >> 18U, 11);                        // Base ID
+    push(1, 1);                                 // SRR
+    push(1, 1);                                 // IDE
+    push(id & 0x3FFFFU, 18);                    // ID extension
+    push(0, 1);                                 // RTR
+    push(0, 2);                                 // r1, r0
+    push(frame.data_len, 4);                    // DLC
+    for (std::uint8_t i = 0; i < frame.data_len; i++)
+    {
+        push(frame.data[i], 8);
+    }
+
+    std::uint16_t crc = 0;                      // CRC-15-CAN
+    for (const bool b : bits)
+    {
+        const bool invert = b != (((crc >> 14U) & 1U) != 0);
+        crc = std::uint16_t((crc << 1U) & 0x7FFFU);
+        if (invert)
+        {
+            crc = std::uint16_t(crc ^ 0x4599U);
+        }
+    }
+    push(crc, 15);
+
+    std::uint32_t num_stuff_bits = 0;
+    std::uint8_t run_length = 0;
+    bool run_level = false;
+    for (const bool b : bits)
+    {
+        if ((run_length > 0) && (b == run_level))
+        {
+            run_length++;
+        }
+        else
+        {
+            run_level = b;
+            run_length = 1;
+        }
+
+        if (run_length == 5)                    // The stuff bit is complementary and starts a new run
+        {
+            num_stuff_bits++;
+            run_level = !b;
+            run_length = 1;
+        }
+    }
+
+    // CRC delimiter, ACK slot, ACK delimiter, EOF, intermission
+    return std::uint32_t(bits.size()) + num_stuff_bits + 1U + 1U + 1U + 7U + 3U;
+}
+
+/**
+ * A node's CAN controller attached to the simulated bus.
+ */
+struct SimulatedCANController
+{
+    struct PendingFrame
+    {
+        ::CanardCANFrame frame;
+        std::uint64_t sequence_number;          ///< Frames with equal IDs leave in the order of submission
+    };
+
+    std::vector<PendingFrame> tx_mailboxes;
+    std::deque<kocherga_uavcan::IUAVCANPlatform::ReceivedCANFrame> rx_queue;
+    kocherga_uavcan::IUAVCANPlatform::CANAcceptanceFilterList acceptance_filters;
+    bool accept_all = false;
+
+    bool isAccepted(const ::CanardCANFrame& frame) const
+    {
+        return accept_all || std::any_of(acceptance_filters.begin(), acceptance_filters.end(),
+                                         [&frame](const auto& f) { return ((frame.id ^ f.id) & f.mask) == 0; });
+    }
+};
+
+/**
+ * A shared CAN bus with bitwise arbitration and no errors. The transmission that wins arbitration occupies
+ * the bus for the exact duration of the frame, after which the frame is delivered to all other controllers
+ * whose acceptance filters match it, timestamped at the end of the frame.
+ */
+class SimulatedCANBus
+{
+    std::vector<SimulatedCANController*> controllers_;
+    std::chrono::microseconds now_{};
+    std::uint32_t bit_rate_;
+
+    struct Transmission
+    {
+        SimulatedCANController* sender;
+        ::CanardCANFrame frame;
+        std::chrono::microseconds ends_at;
+    };
+    std::optional<Transmission> ongoing_;
+
+    std::uint64_t next_sequence_number_ = 0;
+    std::uint64_t busy_bits_ = 0;
+    std::uint64_t frame_count_ = 0;
+
+    void startNextTransmission()
+    {
+        SimulatedCANController* winner = nullptr;
+        std::vector<SimulatedCANController::PendingFrame>::iterator winning_frame;
+
+        for (auto c : controllers_)
+        {
+            for (auto it = c->tx_mailboxes.begin(); it != c->tx_mailboxes.end(); ++it)
+            {
+                const auto id = it->frame.id & CANARD_CAN_EXT_ID_MASK;
+                if ((winner == nullptr) ||
+                    (id < (winning_frame->frame.id & CANARD_CAN_EXT_ID_MASK)) ||
+                    ((id == (winning_frame->frame.id & CANARD_CAN_EXT_ID_MASK)) &&
+                     (it->sequence_number < winning_frame->sequence_number)))
+                {
+                    winner = c;
+                    winning_frame = it;
+                }
+            }
+        }
+
+        if (winner != nullptr)
+        {
+            const auto bits = computeFrameLengthInBits(winning_frame->frame);
+            busy_bits_ += bits;
+            frame_count_++;
+            ongoing_ = Transmission{winner,
+                                    winning_frame->frame,
+                                    now_ + std::chrono::microseconds((std::uint64_t(bits) * 1'000'000U +
+                                                                      bit_rate_ - 1U) / bit_rate_)};
+            winner->tx_mailboxes.erase(winning_frame);
+        }
+    }
+
+public:
+    explicit SimulatedCANBus(const std::uint32_t bit_rate) : bit_rate_(bit_rate) { }
+
+    void attach(SimulatedCANController& controller)
+    {
+        controllers_.push_back(&controller);
+    }
+
+    /**
+     * Returns 1 if the frame was placed into a free mailbox, 0 if all mailboxes are busy.
+     */
+    std::int16_t submit(SimulatedCANController& controller, const ::CanardCANFrame& frame)
+    {
+        if (controller.tx_mailboxes.size() >= TxMailboxDepth)
+        {
+            return 0;
+        }
+        controller.tx_mailboxes.push_back({frame, next_sequence_number_++});
+        return 1;
+    }
+
+    /**
+     * Advances the bus to the specified point in time, performing all transmissions that complete before it.
+     * A transmission that has started is committed even if it completes later than that.
+     */
+    void runUntil(const std::chrono::microseconds until)
+    {
+        while (true)
+        {
+            if (!ongoing_)
+            {
+                startNextTransmission();
+                if (!ongoing_)
+                {
+                    break;
+                }
+            }
+
+            if (ongoing_->ends_at > until)
+            {
+                break;
+            }
+
+            now_ = ongoing_->ends_at;
+            for (auto c : controllers_)
+            {
+                if ((c != ongoing_->sender) && c->isAccepted(ongoing_->frame))
+                {
+                    c->rx_queue.push_back({ongoing_->frame, now_});
+                }
+            }
+            ongoing_.reset();
+        }
+
+        now_ = std::max(now_, until);
+    }
+
+    std::chrono::microseconds getTime() const { return now_; }
+
+    std::uint32_t getBitRate() const { return bit_rate_; }
+
+    std::uint64_t getFrameCount() const { return frame_count_; }
+
+    /**
+     * Fraction of time the bus has been occupied by frames since the beginning of the simulation.
+     */
+    double getUtilization() const
+    {
+        const double elapsed_bits = double(now_.count()) * 1e-6 * bit_rate_;
+        return (elapsed_bits > 0) ? (double(busy_bits_) / elapsed_bits) : 0.0;
+    }
+};
+
+/**
+ * The bootloader core platform; the time is taken from the simulated bus.
+ */
+class SimulatedPlatform final : public kocherga::IPlatform
+{
+    const SimulatedCANBus& bus_;
+
+public:
+    explicit SimulatedPlatform(const SimulatedCANBus& bus) : bus_(bus) { }
+
+    std::chrono::microseconds getMonotonicUptime() const override
+    {
+        return bus_.getTime();
+    }
+};
+
+/**
+ * ROM backend that keeps the image in memory; the file-mapped mock would be needlessly slow with many nodes.
+ */
+class InMemoryROMBackend final : public kocherga::IROMBackend
+{
+    std::vector<std::uint8_t> rom_;
+
+    std::int16_t beginUpgrade() override { return 0; }
+
+    std::int16_t endUpgrade(bool) override { return 0; }
+
+    std::int16_t write(std::size_t offset, const void* data, std::uint16_t size) override
+    {
+        if (offset >= rom_.size())
+        {
+            return 0;
+        }
+        size = std::uint16_t(std::min<std::size_t>(size, rom_.size() - offset));
+        std::memcpy(&rom_[offset], data, size);
+        return std::int16_t(size);
+    }
+
+    std::int16_t read(std::size_t offset, void* data, std::uint16_t size) const override
+    {
+        if (offset >= rom_.size())
+        {
+            return 0;
+        }
+        size = std::uint16_t(std::min<std::size_t>(size, rom_.size() - offset));
+        std::memcpy(data, &rom_[offset], size);
+        return std::int16_t(size);
+    }
+
+public:
+    InMemoryROMBackend(const std::size_t rom_size, const std::vector<std::uint8_t>& installed_image) :
+        rom_(rom_size, 0xFF)
+    {
+        assert(installed_image.size() <= rom_size);
+        std::copy(installed_image.begin(), installed_image.end(), rom_.begin());
+    }
+
+    bool isSameImage(const void* reference, const std::size_t reference_size) const
+    {
+        return (reference_size <= rom_.size()) && (std::memcmp(rom_.data(), reference, reference_size) == 0);
+    }
+};
+
+/**
+ * UAVCAN platform of a simulated node. It never blocks, because the simulation is single-threaded.
+ */
+class SimulatedUAVCANPlatform final : public kocherga_uavcan::IUAVCANPlatform
+{
+    SimulatedCANBus& bus_;
+    SimulatedCANController& controller_;
+    mutable std::mt19937_64 random_;
+
+    void resetWatchdog() override { }
+
+    void sleep(std::chrono::microseconds) const override { }
+
+    std::uint64_t getRandomUnsignedInteger(std::uint64_t lower_bound, std::uint64_t upper_bound) const override
+    {
+        assert(lower_bound < upper_bound);
+        return lower_bound + random_() % (upper_bound - lower_bound);
+    }
+
+    std::int16_t configure(std::uint32_t, std::uint32_t, CANMode, const CANAcceptanceFilterList& filters) override
+    {
+        controller_.acceptance_filters = filters;
+        return 0;
+    }
+
+    std::int16_t send(const ::CanardCANFrame& frame, std::chrono::microseconds) override
+    {
+        return bus_.submit(controller_, frame);
+    }
+
+    std::pair<std::int16_t, ReceivedCANFrame> receive(std::chrono::microseconds) override
+    {
+        if (controller_.rx_queue.empty())
+        {
+            return {0, {}};
+        }
+        const auto out = controller_.rx_queue.front();
+        controller_.rx_queue.pop_front();
+        return {1, out};
+    }
+
+    bool shouldExit() const override { return false; }
+
+    bool tryScheduleReboot() override { return false; }
+
+    void onBusParametersConfirmed(std::uint32_t can_bus_bit_rate, std::uint8_t node_id) override
+    {
+        confirmed_bus_parameters = {can_bus_bit_rate, node_id};
+    }
+
+public:
+    std::optional<std::pair<std::uint32_t, std::uint8_t>> confirmed_bus_parameters;
+
+    SimulatedUAVCANPlatform(SimulatedCANBus& bus, SimulatedCANController& controller, const std::uint8_t node_id) :
+        bus_(bus),
+        controller_(controller),
+        random_(node_id)
+    { }
+};
+
+/**
+ * A bootloader node with its simulated hardware. The node is to be started by the owner via getNode().start().
+ * It takes part in fleet distribution.
+ */
+class SimulatedNode final
+{
+    static constexpr std::size_t ROMSize = 64 * 1024;
+    static constexpr std::size_t MaxFleetImageSize = ROMSize;
+    static constexpr std::size_t MemoryPoolSize =
+        kocherga_uavcan::computeWorstCaseMemoryPoolSize<MaxFleetImageSize, MaxConcurrentFileReadPeers>();
+
+    SimulatedCANController controller_;
+    SimulatedPlatform platform_;
+    InMemoryROMBackend rom_;
+    kocherga::BootloaderController blc_;
+    SimulatedUAVCANPlatform uavcan_platform_;
+    kocherga_uavcan::BootloaderNode<MemoryPoolSize, MaxFleetImageSize> node_;
+    bool upgrade_started_ = false;
+    bool succeeded_ = false;
+    std::optional<std::chrono::microseconds> finished_at_;
+
+public:
+    /**
+     * The seed initializes the random number generator of the node. The ROM is empty unless an image is specified;
+     * if it is valid, the node stays in the boot delay state for the duration of the test.
+     */
+    SimulatedNode(SimulatedCANBus& bus,
+                  const std::uint8_t seed,
+                  const std::vector<std::uint8_t>& installed_image = {}) :
+        platform_(bus),
+        rom_(ROMSize, installed_image),
+        blc_(platform_, rom_, ROMSize, std::chrono::hours(1)),
+        uavcan_platform_(bus, controller_, seed),
+        node_(blc_, uavcan_platform_, NodeName, kocherga_uavcan::HardwareInfo())
+    {
+        bus.attach(controller_);
+    }
+
+    void step(const std::chrono::microseconds now)
+    {
+        if (!finished_at_)
+        {
+            node_.step();
+
+            const auto state = blc_.getState();
+            upgrade_started_ = upgrade_started_ || (state == kocherga::State::AppUpgradeInProgress);
+            if (upgrade_started_ && (state != kocherga::State::AppUpgradeInProgress))
+            {
+                finished_at_ = now;
+                succeeded_ = state == kocherga::State::BootDelay;
+            }
+        }
+    }
+
+    /**
+     * The time when the node has either installed the new image or given up; empty if neither has happened yet.
+     */
+    std::optional<std::chrono::microseconds> getFinishedAt() const { return finished_at_; }
+
+    bool isUpdated() const
+    {
+        return succeeded_ && rom_.isSameImage(images::AppValid2.data(), images::AppValid2.size());
+    }
+
+    bool isSameImage(const std::vector<std::uint8_t>& image) const { return rom_.isSameImage(image.data(), image.size()); }
+
+    kocherga_uavcan::DownloadProgress getDownloadProgress() const { return node_.getDownloadProgress(); }
+
+    kocherga_uavcan::BootloaderNode<MemoryPoolSize, MaxFleetImageSize>& getNode() { return node_; }
+
+    kocherga::BootloaderController& getBootloader() { return blc_; }
+
+    const SimulatedUAVCANPlatform& getPlatform() const { return uavcan_platform_; }
+};
+
+/**
+ * A node built directly on libcanard, which the file servers and clients derive from.
+ */
+class SimulatedCanardNode
+{
+    SimulatedCANBus& bus_;
+    SimulatedCANController controller_;
+    std::vector<std::uint8_t> memory_pool_;
+
+    static bool shouldAcceptTransfer(const ::CanardInstance* ins,
+                                     std::uint64_t* out_data_type_signature,
+                                     std::uint16_t data_type_id,
+                                     ::CanardTransferType transfer_type,
+                                     std::uint8_t)
+    {
+        auto self = static_cast<SimulatedCanardNode*>(::canardGetUserReference(const_cast<::CanardInstance*>(ins)));
+        return self->shouldAccept(data_type_id, transfer_type, *out_data_type_signature);
+    }
+
+    static void onTransferReception(::CanardInstance* ins, ::CanardRxTransfer* transfer)
+    {
+        static_cast<SimulatedCanardNode*>(::canardGetUserReference(ins))->handleTransfer(transfer);
+    }
+
+protected:
+    ::CanardInstance canard_{};
+
+    virtual bool shouldAccept(std::uint16_t data_type_id,
+                              ::CanardTransferType transfer_type,
+                              std::uint64_t& out_data_type_signature) const = 0;
+
+    virtual void handleTransfer(::CanardRxTransfer* transfer) = 0;
+
+public:
+    SimulatedCanardNode(SimulatedCANBus& bus, const std::uint8_t node_id) :
+        bus_(bus),
+        memory_pool_(1024 * 1024)
+    {
+        controller_.accept_all = true;
+        bus.attach(controller_);
+        ::canardInit(&canard_, memory_pool_.data(), memory_pool_.size(),
+                     &SimulatedCanardNode::onTransferReception, &SimulatedCanardNode::shouldAcceptTransfer, this);
+        ::canardSetLocalNodeID(&canard_, node_id);
+    }
+
+    virtual ~SimulatedCanardNode() = default;
+
+    SimulatedCanardNode(const SimulatedCanardNode&) = delete;
+    SimulatedCanardNode& operator=(const SimulatedCanardNode&) = delete;
+
+    void step()
+    {
+        while (!controller_.rx_queue.empty())
+        {
+            auto rx = controller_.rx_queue.front();
+            controller_.rx_queue.pop_front();
+            (void) ::canardHandleRxFrame(&canard_, &rx.frame, std::uint64_t(rx.timestamp.count()));
+        }
+
+        for (const ::CanardCANFrame* frame = nullptr; (frame = ::canardPeekTxQueue(&canard_)) != nullptr;)
+        {
+            if (bus_.submit(controller_, *frame) <= 0)
+            {
+                break;
+            }
+            ::canardPopTxQueue(&canard_);
+        }
+    }
+};
+
+/**
+ * A minimal file server. It serves one file to any number of nodes.
+ */
+class SimulatedFileServer final : public SimulatedCanardNode
+{
+    using FileRead = kocherga_uavcan::impl_::dsdl::FileRead;
+
+    const std::uint8_t* const file_data_;
+    const std::size_t file_size_;
+    std::uint64_t request_count_ = 0;
+
+    bool shouldAccept(std::uint16_t data_type_id,
+                      ::CanardTransferType transfer_type,
+                      std::uint64_t& out_data_type_signature) const override
+    {
+        if ((data_type_id == FileRead::DataTypeID) && (transfer_type == ::CanardTransferTypeRequest))
+        {
+            out_data_type_signature = FileRead::DataTypeSignature;
+            return true;
+        }
+        return false;
+    }
+
+    void handleTransfer(::CanardRxTransfer* const transfer) override
+    {
+        request_count_++;
+
+        std::uint64_t offset = 0;
+        (void) ::canardDecodeScalar(transfer, 0, 40, false, &offset);
+
+        std::string path;
+        for (std::uint16_t i = 5; i < transfer->payload_len; i++)
+        {
+            std::uint8_t c = 0;
+            (void) ::canardDecodeScalar(transfer, std::uint32_t(i * 8U), 8, false, &c);
+            path.push_back(char(c));
+        }
+
+        std::uint8_t buffer[FileRead::MaxSizeBytesResponse]{};
+        std::uint16_t data_len = 0;
+        if (path == FirmwareFilePath)
+        {
+            const auto start = std::size_t(std::min<std::uint64_t>(offset, file_size_));
+            data_len = std::uint16_t(std::min<std::size_t>(file_size_ - start, FileRead::Data::Capacity));
+            (void) FileRead::Data::encode(buffer, file_data_ + start, data_len);
+        }
+        else
+        {
+            FileRead::Error::encode(buffer, std::uint16_t(kocherga_uavcan::impl_::FileErrorNotFound));
+        }
+
+        std::uint8_t transfer_id = transfer->transfer_id;
+        const auto res = ::canardRequestOrRespond(&canard_,
+                                                  transfer->source_node_id,
+                                                  FileRead::DataTypeSignature,
+                                                  FileRead::DataTypeID,
+                                                  &transfer_id,
+                                                  transfer->priority,
+                                                  ::CanardResponse,
+                                                  buffer,
+                                                  std::uint16_t(FileRead::Data::ByteOffset + data_len));
+        REQUIRE(res > 0);
+    }
+
+public:
+    SimulatedFileServer(SimulatedCANBus& bus, const std::uint8_t* const file_data, const std::size_t file_size) :
+        SimulatedCanardNode(bus, ServerNodeID),
+        file_data_(file_data),
+        file_size_(file_size)
+    { }
+
+    std::uint64_t getRequestCount() const { return request_count_; }
+};
+
+/**
+ * A minimal client of the services of the bootloader nodes: it reads files from them and requests firmware updates.
+ */
+class SimulatedClient final : public SimulatedCanardNode
+{
+    using FileRead = kocherga_uavcan::impl_::dsdl::FileRead;
+    using BeginFirmwareUpdate = kocherga_uavcan::impl_::dsdl::BeginFirmwareUpdate;
+
+    std::uint8_t file_read_transfer_id_ = 0;
+    std::uint8_t begin_firmware_update_transfer_id_ = 0;
+
+    bool shouldAccept(std::uint16_t data_type_id,
+                      ::CanardTransferType transfer_type,
+                      std::uint64_t& out_data_type_signature) const override
+    {
+        if (transfer_type != ::CanardTransferTypeResponse)
+        {
+            return false;
+        }
+        if (data_type_id == FileRead::DataTypeID)
+        {
+            out_data_type_signature = FileRead::DataTypeSignature;
+            return true;
+        }
+        if (data_type_id == BeginFirmwareUpdate::DataTypeID)
+        {
+            out_data_type_signature = BeginFirmwareUpdate::DataTypeSignature;
+            return true;
+        }
+        return false;
+    }
+
+    void handleTransfer(::CanardRxTransfer* const transfer) override
+    {
+        if (transfer->data_type_id == BeginFirmwareUpdate::DataTypeID)
+        {
+            std::uint8_t error = 0;
+            (void) ::canardDecodeScalar(transfer, 0, 8, false, &error);
+            begin_firmware_update_error = error;
+            return;
+        }
+
+        FileReadResponse response;
+        (void) ::canardDecodeScalar(transfer, 0, 16, true, &response.error);
+        for (std::uint16_t i = FileRead::Data::ByteOffset; i < transfer->payload_len; i++)
+        {
+            std::uint8_t c = 0;
+            (void) ::canardDecodeScalar(transfer, std::uint32_t(i * 8U), 8, false, &c);
+            response.data.push_back(c);
+        }
+        file_read_response = response;
+    }
+
+public:
+    struct FileReadResponse
+    {
+        std::int16_t error = 0;
+        std::vector<std::uint8_t> data;
+
+        bool operator==(const FileReadResponse& rhs) const { return (error == rhs.error) && (data == rhs.data); }
+    };
+
+    std::optional<FileReadResponse> file_read_response;
+    std::optional<std::uint8_t> begin_firmware_update_error;
+
+    SimulatedClient(SimulatedCANBus& bus, const std::uint8_t node_id) : SimulatedCanardNode(bus, node_id) { }
+
+    /**
+     * The request payload is specified as is, so that malformed requests can be sent as well.
+     */
+    void sendFileReadRequest(const std::uint8_t node_id, const std::vector<std::uint8_t>& payload)
+    {
+        file_read_response.reset();
+        const auto res = ::canardRequestOrRespond(&canard_,
+                                                  node_id,
+                                                  FileRead::DataTypeSignature,
+                                                  FileRead::DataTypeID,
+                                                  &file_read_transfer_id_,
+                                                  CANARD_TRANSFER_PRIORITY_MEDIUM,
+                                                  ::CanardRequest,
+                                                  payload.data(),
+                                                  std::uint16_t(payload.size()));
+        REQUIRE(res > 0);
+    }
+
+    void sendFileReadRequest(const std::uint8_t node_id, const std::uint64_t offset, const std::string& path)
+    {
+        std::vector<std::uint8_t> payload(5U);
+        ::canardEncodeScalar(payload.data(), 0, 40, &offset);
+        payload.insert(payload.end(), path.begin(), path.end());
+        sendFileReadRequest(node_id, payload);
+    }
+
+    void requestFirmwareUpdate(const std::uint8_t node_id, const std::uint8_t server_node_id)
+    {
+        begin_firmware_update_error.reset();
+        std::uint8_t buffer[BeginFirmwareUpdate::MaxSizeBytesRequest]{};
+        buffer[0] = server_node_id;
+        const auto path_len = std::strlen(FirmwareFilePath);
+        std::memcpy(&buffer[1], FirmwareFilePath, path_len);
+        const auto res = ::canardRequestOrRespond(&canard_,
+                                                  node_id,
+                                                  BeginFirmwareUpdate::DataTypeSignature,
+                                                  BeginFirmwareUpdate::DataTypeID,
+                                                  &begin_firmware_update_transfer_id_,
+                                                  CANARD_TRANSFER_PRIORITY_MEDIUM,
+                                                  ::CanardRequest,
+                                                  buffer,
+                                                  std::uint16_t(1U + path_len));
+        REQUIRE(res > 0);
+    }
+};
+
+/**
+ * A fleet distribution server. While the stream is on, it broadcasts the image in chunks over and over again,
+ * so the fill-in requests of the nodes need not be served.
+ */
+class SimulatedFleetServer final : public SimulatedCanardNode
+{
+    using FleetFirmwareChunk = kocherga_uavcan::impl_::dsdl::FleetFirmwareChunk;
+
+    static constexpr std::uint16_t ChunkSize = kocherga_uavcan::impl_::FleetChunkSize;
+
+    const std::vector<std::uint8_t> image_;
+    const std::uint64_t image_crc_;
+    const std::uint64_t hardware_class_id_;
+    bool streaming_ = false;
+    std::uint32_t next_offset_ = 0;
+    std::uint8_t chunk_transfer_id_ = 0;
+
+    bool shouldAccept(std::uint16_t, ::CanardTransferType, std::uint64_t&) const override { return false; }
+
+    void handleTransfer(::CanardRxTransfer*) override { }
+
+    void broadcastNextChunk()
+    {
+        const auto data_len = std::uint16_t(std::min<std::size_t>(ChunkSize, image_.size() - next_offset_));
+
+        std::uint8_t buffer[FleetFirmwareChunk::MaxSizeBytes]{};
+        ::canardEncodeScalar(buffer,   0, 64, &hardware_class_id_);
+        ::canardEncodeScalar(buffer,  64, 64, &image_crc_);
+        const auto image_size = std::uint32_t(image_.size());
+        ::canardEncodeScalar(buffer, 128, 32, &image_size);
+        ::canardEncodeScalar(buffer, 160, 32, &next_offset_);
+        std::memcpy(&buffer[24], &image_[next_offset_], data_len);
+
+        const auto res = ::canardBroadcast(&canard_,
+                                           FleetFirmwareChunk::DataTypeSignature,
+                                           FleetFirmwareChunk::DataTypeID,
+                                           &chunk_transfer_id_,
+                                           CANARD_TRANSFER_PRIORITY_LOW,
+                                           buffer,
+                                           std::uint16_t(24U + data_len));
+        REQUIRE(res > 0);
+
+        next_offset_ += ChunkSize;
+        if (next_offset_ >= image_.size())
+        {
+            next_offset_ = 0;
+        }
+    }
+
+public:
+    SimulatedFleetServer(SimulatedCANBus& bus, const std::vector<std::uint8_t>& image, const std::uint64_t image_crc) :
+        SimulatedCanardNode(bus, ServerNodeID),
+        image_(image),
+        image_crc_(image_crc),
+        hardware_class_id_(kocherga_uavcan::BootloaderNode<>::getFleetHardwareClassID(NodeName,
+                                                                                      kocherga_uavcan::HardwareInfo()))
+    { }
+
+    void setStreaming(const bool streaming) { streaming_ = streaming; }
+
+    void step()
+    {
+        if (streaming_ && (::canardPeekTxQueue(&canard_) == nullptr))
+        {
+            broadcastNextChunk();
+        }
+        SimulatedCanardNode::step();
+    }
+};
+
+/**
+ * A passive node that records the download progress and node status broadcasts of the bootloader nodes.
+ */
+class SimulatedMonitor final : public SimulatedCanardNode
+{
+    using DownloadProgressMessage = kocherga_uavcan::impl_::dsdl::DownloadProgress;
+    using NodeStatusMessage = kocherga_uavcan::impl_::dsdl::NodeStatus;
+
+    bool shouldAccept(std::uint16_t data_type_id,
+                      ::CanardTransferType transfer_type,
+                      std::uint64_t& out_data_type_signature) const override
+    {
+        if (transfer_type != ::CanardTransferTypeBroadcast)
+        {
+            return false;
+        }
+        if (data_type_id == DownloadProgressMessage::DataTypeID)
+        {
+            out_data_type_signature = DownloadProgressMessage::DataTypeSignature;
+            return true;
+        }
+        if (data_type_id == NodeStatusMessage::DataTypeID)
+        {
+            out_data_type_signature = NodeStatusMessage::DataTypeSignature;
+            return true;
+        }
+        return false;
+    }
+
+    void handleTransfer(::CanardRxTransfer* const transfer) override
+    {
+        if (transfer->data_type_id == NodeStatusMessage::DataTypeID)
+        {
+            NodeStatus status;
+            (void) ::canardDecodeScalar(transfer, 34, 3, false, &status.mode);
+            (void) ::canardDecodeScalar(transfer, 40, 16, false, &status.vendor_specific_status_code);
+            node_status.push_back(status);
+            return;
+        }
+
+        REQUIRE(transfer->payload_len == DownloadProgressMessage::MaxSizeBytes);
+        DownloadProgress progress;
+        std::uint32_t* const fields[] = {
+            &progress.bytes_downloaded,
+            &progress.expected_size,
+            &progress.throughput,
+            &progress.retransmission_count,
+            &progress.min_rtt,
+            &progress.avg_rtt,
+            &progress.max_rtt,
+            &progress.storage_write_time,
+            &progress.elapsed,
+        };
+        for (std::uint32_t i = 0; i < std::size(fields); i++)
+        {
+            (void) ::canardDecodeScalar(transfer, i * 32U, 32, false, fields[i]);
+        }
+        download_progress.push_back(progress);
+        node_status_count_at_download_progress.push_back(node_status.size());
+    }
+
+public:
+    /// The fields as they appear on the bus: microseconds, except for the elapsed time, which is in milliseconds
+    struct DownloadProgress
+    {
+        std::uint32_t bytes_downloaded = 0;
+        std::uint32_t expected_size = 0;
+        std::uint32_t throughput = 0;
+        std::uint32_t retransmission_count = 0;
+        std::uint32_t min_rtt = 0;
+        std::uint32_t avg_rtt = 0;
+        std::uint32_t max_rtt = 0;
+        std::uint32_t storage_write_time = 0;
+        std::uint32_t elapsed = 0;
+    };
+
+    struct NodeStatus
+    {
+        std::uint8_t mode = 0;
+        std::uint16_t vendor_specific_status_code = 0;
+    };
+
+    std::vector<DownloadProgress> download_progress;
+    std::vector<NodeStatus> node_status;
+    std::vector<std::size_t> node_status_count_at_download_progress;    ///< To match the reports with the statuses
+
+    SimulatedMonitor(SimulatedCANBus& bus, const std::uint8_t node_id) : SimulatedCanardNode(bus, node_id) { }
+};
+
+/**
+ * Returns the CRC of the image from its application descriptor, as seen by the bootloader.
+ */
+std::uint64_t getImageCRC(const std::vector<std::uint8_t>& image)
+{
+    SimulatedCANBus bus(1'000'000);
+    SimulatedPlatform platform(bus);
+    InMemoryROMBackend rom(64 * 1024, image);
+    kocherga::BootloaderController blc(platform, rom, 64 * 1024, std::chrono::seconds(1));
+    const auto app_info = blc.getAppInfo();
+    REQUIRE(app_info);
+    return app_info->image_crc;
+}
+
+struct SimulationResult
+{
+    std::chrono::microseconds total_time{};
+    std::vector<std::chrono::microseconds> node_times;
+    std::uint32_t num_failed_nodes = 0;
+    std::uint64_t retransmission_count = 0;
+    std::uint64_t request_count = 0;
+    std::uint64_t frame_count = 0;
+    double bus_utilization = 0;
+};
+
+/**
+ * Updates the specified number of nodes from one file server simultaneously.
+ * The nodes start with a known bit rate and node ID, so that the result reflects the download only.
+ */
+SimulationResult simulate(const std::uint32_t bit_rate,
+                          const std::uint8_t num_nodes,
+                          const std::chrono::microseconds time_limit)
+{
+    SimulatedCANBus bus(bit_rate);
+    SimulatedFileServer server(bus, images::AppValid2.data(), images::AppValid2.size());
+
+    std::vector<std::unique_ptr<SimulatedNode>> nodes;
+    for (std::uint8_t i = 0; i < num_nodes; i++)
+    {
+        const auto node_id = std::uint8_t(FirstNodeID + i);
+        nodes.push_back(std::make_unique<SimulatedNode>(bus, node_id));
+        nodes.back()->getNode().start(bit_rate, node_id, ServerNodeID, FirmwareFilePath);
+    }
+
+    const auto all_finished = [&nodes]()
+    {
+        return std::all_of(nodes.begin(), nodes.end(), [](const auto& n) { return bool(n->getFinishedAt()); });
+    };
+
+    while (!all_finished() && (bus.getTime() < time_limit))
+    {
+        for (auto& n : nodes)
+        {
+            n->step(bus.getTime());
+        }
+        server.step();
+        bus.runUntil(bus.getTime() + SimulationQuantum);
+    }
+
+    SimulationResult result;
+    result.total_time = bus.getTime();
+    for (auto& n : nodes)
+    {
+        if (n->isUpdated())
+        {
+            result.node_times.push_back(*n->getFinishedAt());
+        }
+        else
+        {
+            result.num_failed_nodes++;
+        }
+        result.retransmission_count += n->getDownloadProgress().retransmission_count;
+    }
+    result.request_count = server.getRequestCount();
+    result.frame_count = bus.getFrameCount();
+    result.bus_utilization = bus.getUtilization();
+    return result;
+}
+
+/**
+ * Advances the simulation by the specified amount of time, invoking the step function once per quantum.
+ */
+template <typename F>
+void runFor(SimulatedCANBus& bus, const std::chrono::microseconds duration, const F& step)
+{
+    const auto until = bus.getTime() + duration;
+    while (bus.getTime() < until)
+    {
+        step();
+        bus.runUntil(bus.getTime() + SimulationQuantum);
+    }
+}
+
+double toSeconds(const std::chrono::microseconds x)
+{
+    return double(x.count()) * 1e-6;
+}
+
+}
+
+
+TEST_CASE("UAVCAN-Simulation-FrameLength")
+{
+    ::CanardCANFrame frame{};
+
+    // Five dominant bits at the start of the frame (SOF and the first four ID bits) require a stuff bit
+    frame.id = CANARD_CAN_FRAME_EFF;
+    frame.data_len = 0;
+    const auto empty_length = computeFrameLengthInBits(frame);
+    REQUIRE(empty_length >= 67U + 1U);
+    REQUIRE(empty_length <= 67U + 13U);
+
+    // Eight bytes of data can't be shorter than the unstuffed frame or longer than the fully stuffed one
+    std::mt19937 random(42);
+    for (int i = 0; i < 1000; i++)
+    {
+        frame.id = (std::uint32_t(random()) & CANARD_CAN_EXT_ID_MASK) | CANARD_CAN_FRAME_EFF;
+        frame.data_len = 8;
+        for (auto& x : frame.data)
+        {
+            x = std::uint8_t(random());
+        }
+        const auto length = computeFrameLengthInBits(frame);
+        REQUIRE(length >= 131U);
+        REQUIRE(length <= 160U);
+    }
+}
+
+
+TEST_CASE("UAVCAN-ResponseTimeoutEstimator")
+{
+    using kocherga_uavcan::impl_::ResponseTimeoutEstimator;
+    using kocherga_uavcan::impl_::DefaultServiceRequestTimeout;
+    using kocherga_uavcan::impl_::MinFileReadTimeout;
+    using kocherga_uavcan::impl_::MinFileReadTimeoutMargin;
+    using std::chrono::microseconds;
+    using std::chrono::milliseconds;
+
+    // No samples, the default timeout is used
+    ResponseTimeoutEstimator est;
+    REQUIRE(est.getTimeout() == DefaultServiceRequestTimeout);
+
+    // The first sample initializes the variation to half of the RTT
+    est.addSample(milliseconds(40));
+    REQUIRE(est.getTimeout() == milliseconds(40 + 4 * 20));
+
+    // A steady RTT drives the variation to zero; the timeout converges to the RTT plus the minimum margin
+    for (int i = 0; i < 200; i++)
+    {
+        est.addSample(milliseconds(30));
+    }
+    REQUIRE(est.getTimeout() >= (milliseconds(30) + MinFileReadTimeoutMargin));
+    REQUIRE(est.getTimeout() <= (milliseconds(30) + MinFileReadTimeoutMargin + microseconds(10)));
+
+    // A sudden increase of the RTT is covered by the timeout at once, thanks to the variation term
+    est.addSample(milliseconds(100));
+    REQUIRE(est.getTimeout() > milliseconds(100));
+
+    // A fast responder doesn't bring the timeout below the lower bound
+    ResponseTimeoutEstimator fast;
+    fast.addSample(microseconds(500));
+    REQUIRE(fast.getTimeout() == MinFileReadTimeout);
+    for (int i = 0; i < 200; i++)
+    {
+        fast.addSample(milliseconds(1));
+    }
+    REQUIRE(fast.getTimeout() == MinFileReadTimeout);
+
+    // A slow responder doesn't bring the timeout above the default one
+    ResponseTimeoutEstimator slow;
+    slow.addSample(milliseconds(700));
+    REQUIRE(slow.getTimeout() == DefaultServiceRequestTimeout);
+    for (int i = 0; i < 200; i++)
+    {
+        slow.addSample(milliseconds(2000));
+    }
+    REQUIRE(slow.getTimeout() == DefaultServiceRequestTimeout);
+}
+
+
+
+TEST_CASE("UAVCAN-Simulation")
+{
+    const auto result = simulate(1'000'000, 3, std::chrono::seconds(60));
+
+    REQUIRE(result.num_failed_nodes == 0);
+    REQUIRE(result.node_times.size() == 3);
+    REQUIRE(result.bus_utilization > 0.0);
+    REQUIRE(result.bus_utilization <= 1.0);
+    REQUIRE(result.request_count >= 3 * ((images::AppValid2.size() + 255) / 256));
+}
+
+
+/**
+ * The download progress is broadcast once per second while the image is being downloaded and once more when it is
+ * finished; the vendor-specific status code of NodeStatus follows it. A slow bus makes the download last a while.
+ */
+TEST_CASE("UAVCAN-Simulation-DownloadProgress")
+{
+    using Mode = kocherga_uavcan::impl_::dsdl::NodeMode;
+
+    constexpr std::uint32_t BitRate = 125'000;
+    const std::vector<std::uint8_t> Image(images::AppValid2.begin(), images::AppValid2.end());
+
+    SimulatedCANBus bus(BitRate);
+    SimulatedFileServer server(bus, Image.data(), Image.size());
+    SimulatedMonitor monitor(bus, ClientNodeID);
+    SimulatedNode node(bus, 2);
+    node.getNode().start(BitRate, FirstNodeID, ServerNodeID, FirmwareFilePath);
+
+    runFor(bus, std::chrono::seconds(30), [&]() { server.step(); monitor.step(); node.step(bus.getTime()); });
+    REQUIRE(node.isUpdated());
+
+    // The node is stepped directly from now on, because SimulatedNode::step() stops once the upgrade is finished,
+    // leaving the last report in the transmission queue
+    runFor(bus, std::chrono::seconds(2), [&]() { server.step(); monitor.step(); node.getNode().step(); });
+
+    const auto& reports = monitor.download_progress;
+    std::cout << "Download progress reports: " << reports.size() << std::endl;
+    REQUIRE(reports.size() >= 3);
+
+    for (std::size_t i = 0; i < reports.size(); i++)
+    {
+        const auto& r = reports[i];
+        REQUIRE(r.expected_size == 0);          // Unknown with file.Read
+        REQUIRE(r.bytes_downloaded <= Image.size());
+        REQUIRE(r.min_rtt <= r.avg_rtt);
+        REQUIRE(r.avg_rtt <= r.max_rtt);
+        if (i > 0)
+        {
+            REQUIRE(r.bytes_downloaded >= reports[i - 1].bytes_downloaded);
+            REQUIRE(r.retransmission_count >= reports[i - 1].retransmission_count);
+            REQUIRE(r.elapsed > reports[i - 1].elapsed);
+        }
+
+        // The periodic reports come with NodeStatus carrying the progress in KiB, which wins the arbitration
+        if (i + 1 < reports.size())
+        {
+            REQUIRE(r.throughput > 0);
+            REQUIRE(r.elapsed >= 1000U * (i + 1U));
+            REQUIRE(r.elapsed < 1000U * (i + 2U));
+            const auto status_count = monitor.node_status_count_at_download_progress[i];
+            REQUIRE(status_count > 0);
+            const auto& status = monitor.node_status[status_count - 1U];
+            REQUIRE(status.mode == std::uint8_t(Mode::SoftwareUpdate));
+            REQUIRE(status.vendor_specific_status_code == (r.bytes_downloaded / 1024U));
+        }
+    }
+
+    // The last report is sent when the download is finished; it matches the progress retained by the node
+    const auto& last = reports.back();
+    const auto progress = node.getDownloadProgress();
+    REQUIRE(last.bytes_downloaded == Image.size());
+    REQUIRE(last.bytes_downloaded == progress.bytes_downloaded);
+    REQUIRE(last.retransmission_count == progress.retransmission_count);
+    REQUIRE(last.min_rtt == progress.min_rtt.count());
+    REQUIRE(last.avg_rtt == progress.avg_rtt.count());
+    REQUIRE(last.max_rtt == progress.max_rtt.count());
+    REQUIRE(last.min_rtt > 0);
+    REQUIRE(last.elapsed == std::chrono::duration_cast<std::chrono::milliseconds>(progress.elapsed).count());
+    REQUIRE(reports[reports.size() - 2].bytes_downloaded >= 1024U);
+
+    // Once the download is over, the status code is cleared
+    REQUIRE(monitor.node_status.back().mode != std::uint8_t(Mode::SoftwareUpdate));
+    REQUIRE(monitor.node_status.back().vendor_specific_status_code == 0);
+}
+
+
+/**
+ * A node started with a cached node ID listens to the bus before using it. It adopts the node ID unless another node
+ * is heard using it; if the bus is silent, the bit rate is detected again before the check is repeated.
+ */
+TEST_CASE("UAVCAN-Simulation-NodeIDCache")
+{
+    constexpr std::uint32_t BitRate = 1'000'000;
+    constexpr std::uint8_t CachedNodeID = 42;
+    const auto Tolerance = std::chrono::milliseconds(100);
+
+    // No conflict: the node ID is adopted once the check is over, but not earlier
+    {
+        SimulatedCANBus bus(BitRate);
+        SimulatedNode peer(bus, 1);
+        SimulatedNode node(bus, 2);
+        peer.getNode().start(BitRate, CachedNodeID + 1);
+        node.getNode().start(BitRate, CachedNodeID, 0, "", true);
+
+        const auto step = [&]() { peer.step(bus.getTime()); node.step(bus.getTime()); };
+        runFor(bus, kocherga_uavcan::impl_::NodeIDConflictCheckDuration - Tolerance, step);
+        REQUIRE(node.getNode().getLocalNodeID() == 0);
+        REQUIRE(!node.getPlatform().confirmed_bus_parameters);
+
+        runFor(bus, Tolerance * 2, step);
+        REQUIRE(node.getNode().getLocalNodeID() == CachedNodeID);
+        REQUIRE(node.getNode().getCANBusBitRate() == BitRate);
+        REQUIRE(node.getPlatform().confirmed_bus_parameters ==
+                std::optional<std::pair<std::uint32_t, std::uint8_t>>({BitRate, CachedNodeID}));
+    }
+
+    // Conflict: the cached node ID is discarded in favor of the dynamic allocation, which can't complete here
+    {
+        SimulatedCANBus bus(BitRate);
+        SimulatedNode peer(bus, 1);
+        SimulatedNode node(bus, 2);
+        peer.getNode().start(BitRate, CachedNodeID);
+        node.getNode().start(BitRate, CachedNodeID, 0, "", true);
+
+        runFor(bus, std::chrono::seconds(5), [&]() { peer.step(bus.getTime()); node.step(bus.getTime()); });
+        REQUIRE(node.getNode().getLocalNodeID() == 0);
+        REQUIRE(!node.getPlatform().confirmed_bus_parameters);
+        REQUIRE(peer.getNode().getLocalNodeID() == CachedNodeID);
+    }
+
+    // Silent bus: the bit rate is not confirmed, so it is detected again; then the check is repeated
+    {
+        SimulatedCANBus bus(BitRate);
+        SimulatedNode node(bus, 2);
+        node.getNode().start(BitRate, CachedNodeID, 0, "", true);
+
+        runFor(bus, kocherga_uavcan::impl_::NodeIDConflictCheckDuration + Tolerance,
+               [&]() { node.step(bus.getTime()); });
+        REQUIRE(node.getNode().getLocalNodeID() == 0);
+        REQUIRE(node.getNode().getCANBusBitRate() == 0);
+        REQUIRE(!node.getPlatform().confirmed_bus_parameters);
+
+        SimulatedNode peer(bus, 1);
+        peer.getNode().start(BitRate, CachedNodeID + 1);
+
+        runFor(bus, std::chrono::seconds(5), [&]() { peer.step(bus.getTime()); node.step(bus.getTime()); });
+        REQUIRE(node.getNode().getLocalNodeID() == CachedNodeID);
+        REQUIRE(node.getNode().getCANBusBitRate() == BitRate);
+        REQUIRE(node.getPlatform().confirmed_bus_parameters ==
+                std::optional<std::pair<std::uint32_t, std::uint8_t>>({BitRate, CachedNodeID}));
+    }
+}
+
+
+/**
+ * Once a node has installed and verified an image downloaded via FileRead, it serves the image to its peers under
+ * the same path, but not while it is being upgraded again.
+ */
+TEST_CASE("UAVCAN-Simulation-PeerFileServing")
+{
+    using kocherga_uavcan::impl_::FileErrorNotFound;
+    using kocherga_uavcan::impl_::FileErrorInvalidValue;
+    using Response = SimulatedClient::FileReadResponse;
+
+    constexpr std::uint32_t BitRate = 1'000'000;
+    const std::vector<std::uint8_t> Image(images::AppValid2.begin(), images::AppValid2.end());
+
+    SimulatedCANBus bus(BitRate);
+    SimulatedFileServer server(bus, Image.data(), Image.size());
+    SimulatedClient client(bus, ClientNodeID);
+    SimulatedNode node(bus, 2);
+    node.getNode().start(BitRate, FirstNodeID, ServerNodeID, FirmwareFilePath);
+
+    // The node is stepped directly, because SimulatedNode::step() stops once the first upgrade is finished
+    const auto step = [&]() { server.step(); client.step(); node.getNode().step(); };
+    const auto read_raw = [&](const std::vector<std::uint8_t>& payload)
+    {
+        client.sendFileReadRequest(FirstNodeID, payload);
+        runFor(bus, std::chrono::milliseconds(20), step);
+        REQUIRE(client.file_read_response);
+        return *client.file_read_response;
+    };
+    const auto read = [&](const std::uint64_t offset, const std::string& path)
+    {
+        client.sendFileReadRequest(FirstNodeID, offset, path);
+        runFor(bus, std::chrono::milliseconds(20), step);
+        REQUIRE(client.file_read_response);
+        return *client.file_read_response;
+    };
+    const auto slice = [&Image](const std::size_t offset, const std::size_t size)
+    {
+        return std::vector<std::uint8_t>(Image.begin() + long(offset), Image.begin() + long(offset + size));
+    };
+
+    // Nothing is served before the image is installed
+    REQUIRE(read(0, FirmwareFilePath) == Response{FileErrorNotFound, {}});
+
+    runFor(bus, std::chrono::seconds(5), step);
+    REQUIRE(node.getBootloader().getState() == kocherga::State::BootDelay);
+    REQUIRE(node.isSameImage(Image));
+
+    // The reads are clamped to the size of the image
+    REQUIRE(read(0, FirmwareFilePath) == Response{0, slice(0, 256)});
+    REQUIRE(read(1000, FirmwareFilePath) == Response{0, slice(1000, 256)});
+    REQUIRE(read(Image.size() - 100U, FirmwareFilePath) == Response{0, slice(Image.size() - 100U, 100)});
+    REQUIRE(read(Image.size(), FirmwareFilePath) == Response{0, {}});
+    REQUIRE(read(Image.size() + 1000U, FirmwareFilePath) == Response{0, {}});
+
+    // Other files are not served; malformed requests are rejected
+    REQUIRE(read(0, "other.bin") == Response{FileErrorNotFound, {}});
+    REQUIRE(read(0, std::string(FirmwareFilePath) + "x") == Response{FileErrorNotFound, {}});
+    REQUIRE(read_raw({0, 0, 0}) == Response{FileErrorInvalidValue, {}});
+    REQUIRE(read_raw({}) == Response{FileErrorInvalidValue, {}});
+
+    // The image is not served while it is being overwritten
+    client.requestFirmwareUpdate(FirstNodeID, ServerNodeID);
+    runFor(bus, std::chrono::milliseconds(20), step);
+    REQUIRE(client.begin_firmware_update_error == std::optional<std::uint8_t>(0));
+    REQUIRE(node.getBootloader().getState() == kocherga::State::AppUpgradeInProgress);
+    REQUIRE(read(0, FirmwareFilePath) == Response{FileErrorNotFound, {}});
+
+    // Served again once the new image is installed
+    runFor(bus, std::chrono::seconds(5), step);
+    REQUIRE(node.getBootloader().getState() == kocherga::State::BootDelay);
+    REQUIRE(read(0, FirmwareFilePath) == Response{0, slice(0, 256)});
+
+    // Several peers requesting at once are all served without running out of memory
+    std::vector<std::unique_ptr<SimulatedClient>> peers;
+    for (std::size_t i = 0; i < MaxConcurrentFileReadPeers; i++)
+    {
+        peers.push_back(std::make_unique<SimulatedClient>(bus, std::uint8_t(ClientNodeID + 1U + i)));
+    }
+    const auto oom_count = node.getNode().getMemoryPoolStatistics().oom_count;
+    for (std::size_t i = 0; i < peers.size(); i++)
+    {
+        peers[i]->sendFileReadRequest(FirstNodeID, i * 256U, FirmwareFilePath);
+    }
+    runFor(bus, std::chrono::milliseconds(100), [&]()
+    {
+        step();
+        std::for_each(peers.begin(), peers.end(), [](auto& p) { p->step(); });
+    });
+    for (std::size_t i = 0; i < peers.size(); i++)
+    {
+        REQUIRE(peers[i]->file_read_response == Response{0, slice(i * 256U, 256)});
+    }
+    REQUIRE(node.getNode().getMemoryPoolStatistics().oom_count == oom_count);
+}
+
+
+/**
+ * A node that has no valid application joins a fleet distribution stream on its own. A node that has one ignores
+ * the stream until it is requested to update its firmware by the streaming server.
+ */
+TEST_CASE("UAVCAN-Simulation-FleetJoin")
+{
+    constexpr std::uint32_t BitRate = 1'000'000;
+    const std::vector<std::uint8_t> Image(images::AppValid2.begin(), images::AppValid2.end());
+    const std::vector<std::uint8_t> InstalledImage(images::AppValid.begin(), images::AppValid.end());
+    const auto ImageCRC = getImageCRC(Image);
+
+    // No application: the stream is joined right away
+    {
+        SimulatedCANBus bus(BitRate);
+        SimulatedFleetServer server(bus, Image, ImageCRC);
+        SimulatedNode node(bus, 2);
+        node.getNode().start(BitRate, FirstNodeID);
+        REQUIRE(node.getBootloader().getState() == kocherga::State::NoAppToBoot);
+
+        server.setStreaming(true);
+        runFor(bus, std::chrono::seconds(5), [&]() { server.step(); node.step(bus.getTime()); });
+        REQUIRE(node.getFinishedAt());
+        REQUIRE(node.isUpdated());
+    }
+
+    // Valid application: the stream is ignored until the server requests the update, then joined
+    {
+        SimulatedCANBus bus(BitRate);
+        SimulatedFleetServer server(bus, Image, ImageCRC);
+        SimulatedClient client(bus, ClientNodeID);
+        SimulatedNode node(bus, 2, InstalledImage);
+        node.getNode().start(BitRate, FirstNodeID);
+        REQUIRE(node.getBootloader().getState() == kocherga::State::BootDelay);
+
+        const auto step = [&]() { server.step(); client.step(); node.step(bus.getTime()); };
+        server.setStreaming(true);
+        runFor(bus, std::chrono::seconds(3), step);
+        REQUIRE(node.getBootloader().getState() == kocherga::State::BootDelay);
+        REQUIRE(node.getDownloadProgress().bytes_downloaded == 0);
+
+        // The server doesn't serve the file, so the node can only succeed via the stream
+        client.requestFirmwareUpdate(FirstNodeID, ServerNodeID);
+        runFor(bus, std::chrono::seconds(5), step);
+        REQUIRE(client.begin_firmware_update_error == std::optional<std::uint8_t>(0));
+        REQUIRE(node.getFinishedAt());
+        REQUIRE(node.isUpdated());
+    }
+
+    // Valid application, the request names another server: the stream is not joined
+    {
+        SimulatedCANBus bus(BitRate);
+        SimulatedFleetServer server(bus, Image, ImageCRC);
+        SimulatedClient client(bus, ClientNodeID);
+        SimulatedNode node(bus, 2, InstalledImage);
+        node.getNode().start(BitRate, FirstNodeID);
+
+        const auto step = [&]() { server.step(); client.step(); node.step(bus.getTime()); };
+        server.setStreaming(true);
+        runFor(bus, std::chrono::seconds(1), step);
+        client.requestFirmwareUpdate(FirstNodeID, ClientNodeID + 1U);
+        runFor(bus, std::chrono::seconds(1), step);
+        REQUIRE(client.begin_firmware_update_error == std::optional<std::uint8_t>(0));
+        REQUIRE(node.getBootloader().getState() == kocherga::State::AppUpgradeInProgress);
+        REQUIRE(node.getDownloadProgress().bytes_downloaded == 0);
+    }
+}
+
+
+/**
+ * Measures how the update time scales with the number of nodes updated simultaneously from one file server.
+ * The results are printed as a table. Nodes that give up after exhausting their retransmissions under congestion
+ * are reported rather than treated as a failure, because this is a property of the protocol being measured.
+ */
+TEST_CASE("UAVCAN-Simulation-Scaling-slow")
+{
+    for (const std::uint32_t bit_rate : {1'000'000U, 250'000U})
+    {
+        std::cout << "\nSimultaneous update of N nodes at " << (bit_rate / 1000U) << " kbps, image size "
+                  << images::AppValid2.size() << " bytes\n"
+                  << "    N   total, s   node min, s   node avg, s   node max, s   bus util, %   retransm.   frames   failed"
+                  << std::endl;
+
+        for (const unsigned num_nodes : {1U, 2U, 4U, 8U, 16U, 32U})
+        {
+            const auto r = simulate(bit_rate, std::uint8_t(num_nodes), std::chrono::seconds(600));
+            REQUIRE(r.node_times.size() + r.num_failed_nodes == num_nodes);
+            REQUIRE(!r.node_times.empty());
+
+            const auto [min, max] = std::minmax_element(r.node_times.begin(), r.node_times.end());
+            double avg = 0;
+            for (auto t : r.node_times)
+            {
+                avg += toSeconds(t) / double(r.node_times.size());
+            }
+
+            std::cout << std::fixed << std::setprecision(2)
+                      << std::setw(5) << num_nodes
+                      << std::setw(11) << toSeconds(r.total_time)
+                      << std::setw(14) << toSeconds(*min)
+                      << std::setw(14) << avg
+                      << std::setw(14) << toSeconds(*max)
+                      << std::setw(14) << (r.bus_utilization * 100.0)
+                      << std::setw(12) << r.retransmission_count
+                      << std::setw(9) << r.frame_count
+                      << std::setw(9) << r.num_failed_nodes
+                      << std::endl;
+        }
+    }
+}
@@ -36,14 +36,16 @@
 #include "catch.hpp"
 #include "mocks.hpp"
 #include "images.hpp"
-#include "piped_process.hpp"
+#include "piped_serial_port.hpp"
 
 #include <thread>
 #include <numeric>
 #include <functional>
 #include <iostream>
 #include <utility>
-#include <poll.h>
+#include <deque>
+#include <vector>
+#include <algorithm>
 
 
 namespace
@@ -79,103 +81,191 @@ void initImageFiles()
 }
 
 /**
- * A serial port implementation that connects to the sender process via pipes.
- * Pipes are used in place of a proper serial port here.
+ * The sender process is connected via pipes in place of a proper serial port.
  */
-class Platform final : public kocherga_ymodem::IYModemPlatform
+using Platform = piped_process::SerialPort;
+
+/// Standard control characters
+struct ControlCharacters
 {
-    piped_process::PipedProcessPtr proc_;
+    static constexpr std::uint8_t SOH = 0x01;
+    static constexpr std::uint8_t STX = 0x02;
+    static constexpr std::uint8_t EOT = 0x04;
+    static constexpr std::uint8_t ACK = 0x06;
+    static constexpr std::uint8_t NAK = 0x15;
+    static constexpr std::uint8_t CAN = 0x18;
+    static constexpr std::uint8_t C   = 0x43;
+    static constexpr std::uint8_t G   = 0x47;
+};
 
-public:
-    explicit Platform(piped_process::PipedProcessPtr process) :
-        proc_(std::move(process))
-    {
-        proc_->makeIONonBlocking();
-    }
+/**
+ * An XMODEM-1K sender that runs in-process on a virtual clock, so that the mode negotiation and its timeouts
+ * can be tested quickly and deterministically. Unless the sender supports CRC mode, it ignores 'C' like
+ * the original XMODEM senders do; same about 'G' and the streaming mode, where all blocks are sent at once. The specified block is corrupted once in a way that the checksum does not detect.
+ */
+class ScriptedSender final : public kocherga_ymodem::IYModemPlatform
+{
+    static constexpr std::size_t BlockSize = 1024;
 
-    Result emit(std::uint8_t byte, std::chrono::microseconds timeout) final
-    {
-        {
-            ::pollfd pfd{};
-            pfd.fd = proc_->getInputFD();
-            pfd.events = POLLOUT;
+    const std::vector<std::uint8_t> file_;
+    const bool crc_supported_;
+    std::uint8_t block_to_corrupt_;
 
-            if (::poll(&pfd, 1, std::max(1, int(timeout.count() / 1000))) < 0)
-            {
-                return Result::Error;
-            }
+    std::optional<bool> crc_mode_;
+    std::size_t offset_ = 0;
+    std::uint8_t sequence_id_ = 1;
+    bool eot_sent_ = false;
+    std::deque<std::uint8_t> output_;
+    std::chrono::microseconds now_{};
 
-            if ((unsigned(pfd.revents) & unsigned(POLLOUT)) == 0)
-            {
-                return Result::Timeout;
-            }
-        }
+    void sendBlock()
+    {
+        std::vector<std::uint8_t> payload(file_.begin() + std::ptrdiff_t(offset_),
+                                          file_.begin() + std::ptrdiff_t(std::min(offset_ + BlockSize, file_.size())));
+        payload.resize(BlockSize, 0x1A);
+
+        output_.push_back(ControlCharacters::STX);
+        output_.push_back(sequence_id_);
+        output_.push_back(std::uint8_t(~sequence_id_));
+        const auto payload_offset = output_.size();
+        output_.insert(output_.end(), payload.begin(), payload.end());
 
-        const auto out = proc_->writeInput(&byte, 1);
-        if (out && *out == 1)
+        if (*crc_mode_)
         {
-            return Result::Success;
+            kocherga_ymodem::CRC16 crc;
+            crc.add(payload.data(), payload.size());
+            output_.push_back(std::uint8_t(crc.get() >> 8U));
+            output_.push_back(std::uint8_t(crc.get() & 0xFFU));
         }
-        else if (out && *out < 1)
+        else
         {
-            return Result::Timeout;
+            output_.push_back(std::uint8_t(std::accumulate(payload.begin(), payload.end(), 0U) & 0xFFU));
         }
-        else
+
+        // Swapping two different bytes leaves the sum unchanged
+        if (sequence_id_ == block_to_corrupt_)
         {
-            return Result::Error;
+            block_to_corrupt_ = 0;
+            auto it = std::adjacent_find(output_.begin() + std::ptrdiff_t(payload_offset), output_.end(),
+                                         std::not_equal_to<>());
+            std::iter_swap(it, it + 1);
         }
     }
 
-    Result receive(std::uint8_t& out_byte, std::chrono::microseconds timeout) final
+public:
+    std::vector<std::uint8_t> requests;     ///< Everything the receiver has sent
+    std::size_t receive_calls = 0;
+    bool bulk_enabled = false;              ///< Otherwise the default per-byte implementation is used
+    bool streaming_supported = false;
+
+    ScriptedSender(std::vector<std::uint8_t> file, bool crc_supported, std::uint8_t block_to_corrupt) :
+        file_(std::move(file)),
+        crc_supported_(crc_supported),
+        block_to_corrupt_(block_to_corrupt)
+    { }
+
+    Result emit(std::uint8_t byte, std::chrono::microseconds) final
     {
+        requests.push_back(byte);
+        if (!crc_mode_)
         {
-            ::pollfd pfd{};
-            pfd.fd = proc_->getOutputFD();
-            pfd.events = POLLIN;
-
-            if (::poll(&pfd, 1, std::max(1, int(timeout.count() / 1000))) < 0)
+            if ((byte == ControlCharacters::G) && streaming_supported)
             {
-                return Result::Error;
+                crc_mode_ = true;
+                for (; offset_ < file_.size(); offset_ += BlockSize, sequence_id_++)
+                {
+                    sendBlock();
+                }
+                output_.push_back(ControlCharacters::EOT);
+                eot_sent_ = true;
             }
-
-            if ((unsigned(pfd.revents) & unsigned(POLLIN)) == 0)
+            else if ((byte == ControlCharacters::C) && crc_supported_)
             {
-                return Result::Timeout;
+                crc_mode_ = true;
+                sendBlock();
+            }
+            else if (byte == ControlCharacters::NAK)
+            {
+                crc_mode_ = false;
+                sendBlock();
             }
         }
-
-        const auto out = proc_->readOutput(&out_byte, 1);
-        if (out && *out == 1)
+        else if (byte == ControlCharacters::NAK)
         {
-            return Result::Success;
+            if (eot_sent_)
+            {
+                output_.push_back(ControlCharacters::EOT);
+            }
+            else
+            {
+                sendBlock();
+            }
         }
-        else if (out && *out < 1)
+        else if ((byte == ControlCharacters::ACK) && !eot_sent_)
         {
-            return Result::Timeout;
+            offset_ += BlockSize;
+            sequence_id_++;
+            if (offset_ < file_.size())
+            {
+                sendBlock();
+            }
+            else
+            {
+                output_.push_back(ControlCharacters::EOT);
+                eot_sent_ = true;
+            }
         }
-        else
+        return Result::Success;
+    }
+
+    Result receive(std::uint8_t& out_byte, std::chrono::microseconds timeout) final
+    {
+        receive_calls++;
+        if (output_.empty())
         {
-            return Result::Error;
+            now_ += timeout;
+            return Result::Timeout;
         }
+        out_byte = output_.front();
+        output_.pop_front();
+        return Result::Success;
     }
 
-    std::chrono::microseconds getMonotonicUptime() const final
+    Result receiveBulk(std::uint8_t* out_data, std::uint16_t& inout_size, std::chrono::microseconds timeout) final
     {
-        return std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::steady_clock::now().time_since_epoch());
+        if (!bulk_enabled)
+        {
+            return IYModemPlatform::receiveBulk(out_data, inout_size, timeout);
+        }
+        receive_calls++;
+        if (output_.empty())
+        {
+            now_ += timeout;
+            return Result::Timeout;
+        }
+        inout_size = std::uint16_t(std::min<std::size_t>(inout_size, output_.size()));
+        std::copy_n(output_.begin(), inout_size, out_data);
+        output_.erase(output_.begin(), output_.begin() + inout_size);
+        return Result::Success;
     }
+
+    std::chrono::microseconds getMonotonicUptime() const final { return now_; }
 };
 
-/// Standard control characters
-struct ControlCharacters
+/**
+ * Collects the downloaded data in memory.
+ */
+class MemorySink final : public kocherga::IDownloadSink
 {
-    static constexpr std::uint8_t SOH = 0x01;
-    static constexpr std::uint8_t STX = 0x02;
-    static constexpr std::uint8_t EOT = 0x04;
-    static constexpr std::uint8_t ACK = 0x06;
-    static constexpr std::uint8_t NAK = 0x15;
-    static constexpr std::uint8_t CAN = 0x18;
-    static constexpr std::uint8_t C   = 0x43;
+public:
+    std::vector<std::uint8_t> data;
+
+    std::int16_t handleNextDataChunk(const void* chunk, std::uint16_t size) final
+    {
+        auto p = static_cast<const std::uint8_t*>(chunk);
+        data.insert(data.end(), p, p + size);
+        return 0;
+    }
 };
 
 }
@@ -258,6 +348,15 @@ TEST_CASE("YModem-Basic")
         REQUIRE(kocherga::State::ReadyToBoot == blc.getState());
     }
 
+    // Test YMODEM-g
+    blc.cancelBoot();
+    {
+        Platform port(piped_process::launch(std::string("sz -vv --ymodem --1k ") + ValidImageFileName));
+        kocherga_ymodem::YModemProtocol ym(port, true);
+        REQUIRE(0 == blc.upgradeApp(ym));
+        REQUIRE(kocherga::State::ReadyToBoot == blc.getState());
+    }
+
     // Test XMODEM
     blc.cancelBoot();
     {
@@ -292,6 +391,46 @@ TEST_CASE("YModem-Basic")
 }
 
 
+TEST_CASE("YModem-Step")
+{
+    initImageFiles();
+    mocks::Platform platform;
+
+    static constexpr std::uint32_t ROMSize = 1024 * 1024;
+    mocks::FileMappedROMBackend rom_backend("ymodem-rom.tmp", ROMSize);
+    kocherga::BootloaderController blc(platform, rom_backend, ROMSize);
+    REQUIRE(kocherga::State::NoAppToBoot == blc.getState());
+
+    Platform port(piped_process::launch(std::string("sz -vv --ymodem --1k ") + ValidImageFileName));
+    kocherga_ymodem::YModemProtocol ym(port);
+    REQUIRE(kocherga_ymodem::ErrNotStarted == -ym.step());
+
+    const auto [begin_result, sink] = blc.beginAppUpgrade();
+    REQUIRE(0 == begin_result);
+    REQUIRE(sink != nullptr);
+    REQUIRE(kocherga::State::AppUpgradeInProgress == blc.getState());
+    REQUIRE(kocherga::ErrInvalidState == -blc.beginAppUpgrade().first);     // One upgrade at a time
+
+    // The superloop of the application would be doing other things between the steps
+    ym.begin(*sink);
+    std::int16_t result = 0;
+    do
+    {
+        result = ym.step();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    while (result > 0);
+
+    REQUIRE(0 == result);
+    REQUIRE(kocherga_ymodem::ErrNotStarted == -ym.step());
+    REQUIRE(0 == blc.endAppUpgrade(result));
+    REQUIRE(kocherga::State::ReadyToBoot == blc.getState());
+
+    const auto info = blc.getAppInfo();
+    REQUIRE(info);
+    REQUIRE(info->image_size == images::AppValid2.size());
+}
+
 TEST_CASE("YModem-Timeout-slow")
 {
     initImageFiles();
@@ -317,3 +456,116 @@ TEST_CASE("YModem-Timeout-slow")
         REQUIRE(seconds < 70);
     }
 }
+
+
+TEST_CASE("YModem-CRC16")
+{
+    kocherga_ymodem::CRC16 crc;
+    crc.add("123456789", 9);
+    REQUIRE(0x31C3 == crc.get());
+}
+
+
+TEST_CASE("YModem-ModeNegotiation")
+{
+    const std::vector<std::uint8_t> image(images::AppValid2.begin(), images::AppValid2.end());
+
+    // A CRC-capable sender is kept in CRC mode; the corrupted block is caught and requested again
+    {
+        ScriptedSender sender(image, true, 2);
+        kocherga_ymodem::YModemProtocol ym(sender);
+        MemorySink sink;
+        REQUIRE(0 == ym.downloadImage(sink));
+        REQUIRE(sink.data.size() >= image.size());
+        REQUIRE(std::equal(image.begin(), image.end(), sink.data.begin()));
+
+        REQUIRE(ControlCharacters::C == sender.requests.at(0));
+        REQUIRE(1 == std::count(sender.requests.begin(), sender.requests.end(), ControlCharacters::C));
+        REQUIRE(1 == std::count(sender.requests.begin(), sender.requests.end(), ControlCharacters::NAK));
+        REQUIRE(sender.getMonotonicUptime() < std::chrono::seconds(1));
+    }
+
+    // A checksum-only sender is detected after three unanswered CRC mode requests, three seconds each
+    {
+        ScriptedSender sender(image, false, 0);
+        kocherga_ymodem::YModemProtocol ym(sender);
+        MemorySink sink;
+        REQUIRE(0 == ym.downloadImage(sink));
+        REQUIRE(sink.data.size() >= image.size());
+        REQUIRE(std::equal(image.begin(), image.end(), sink.data.begin()));
+
+        REQUIRE(std::vector<std::uint8_t>{ControlCharacters::C, ControlCharacters::C, ControlCharacters::C,
+                                          ControlCharacters::NAK} ==
+                std::vector<std::uint8_t>(sender.requests.begin(), sender.requests.begin() + 4));
+        REQUIRE(sender.getMonotonicUptime() >= std::chrono::seconds(9));
+        REQUIRE(sender.getMonotonicUptime() < std::chrono::seconds(11));
+    }
+}
+
+
+TEST_CASE("YModem-BulkReceive")
+{
+    const std::vector<std::uint8_t> image(images::AppValid2.begin(), images::AppValid2.end());
+    const auto num_blocks = (image.size() + 1023U) / 1024U;
+
+    std::vector<std::size_t> receive_calls;
+    for (const bool bulk : {false, true})
+    {
+        ScriptedSender sender(image, true, 2);
+        sender.bulk_enabled = bulk;
+        kocherga_ymodem::YModemProtocol ym(sender);
+        MemorySink sink;
+        REQUIRE(0 == ym.downloadImage(sink));
+        REQUIRE(std::equal(image.begin(), image.end(), sink.data.begin()));
+        receive_calls.push_back(sender.receive_calls);
+    }
+
+    // Per-byte: at least one call per byte; bulk: the header, the sequence ID, and the payload in one go
+    std::cout << "Receive calls per-byte/bulk: " << receive_calls.at(0) << "/" << receive_calls.at(1) << std::endl;
+    REQUIRE(receive_calls.at(0) > (num_blocks * 1024U));
+    REQUIRE(receive_calls.at(1) < ((num_blocks + 1U) * 10U));
+}
+
+
+TEST_CASE("YModem-Streaming")
+{
+    const std::vector<std::uint8_t> image(images::AppValid2.begin(), images::AppValid2.end());
+
+    // The blocks are received back-to-back without confirmations; only EOT is confirmed
+    {
+        ScriptedSender sender(image, true, 0);
+        sender.streaming_supported = true;
+        kocherga_ymodem::YModemProtocol ym(sender, true);
+        MemorySink sink;
+        REQUIRE(0 == ym.downloadImage(sink));
+        REQUIRE(std::equal(image.begin(), image.end(), sink.data.begin()));
+        REQUIRE(std::vector<std::uint8_t>{ControlCharacters::G, ControlCharacters::ACK} == sender.requests);
+    }
+
+    // There is no error recovery in the streaming mode
+    {
+        ScriptedSender sender(image, true, 2);
+        sender.streaming_supported = true;
+        kocherga_ymodem::YModemProtocol ym(sender, true);
+        MemorySink sink;
+        REQUIRE(kocherga_ymodem::ErrStreamingFailed == -ym.downloadImage(sink));
+        REQUIRE(sink.data.size() == 1024);
+        REQUIRE(ControlCharacters::CAN == sender.requests.back());
+        REQUIRE(0 == std::count(sender.requests.begin(), sender.requests.end(), ControlCharacters::NAK));
+    }
+
+    // A sender that does not support the streaming mode is detected, the transfer continues in CRC mode
+    {
+        ScriptedSender sender(image, true, 2);
+        kocherga_ymodem::YModemProtocol ym(sender, true);
+        MemorySink sink;
+        REQUIRE(0 == ym.downloadImage(sink));
+        REQUIRE(std::equal(image.begin(), image.end(), sink.data.begin()));
+        REQUIRE(std::vector<std::uint8_t>{ControlCharacters::G, ControlCharacters::G, ControlCharacters::G,
+                                          ControlCharacters::C} ==
+                std::vector<std::uint8_t>(sender.requests.begin(), sender.requests.begin() + 4));
+        REQUIRE(1 == std::count(sender.requests.begin(), sender.requests.end(), ControlCharacters::NAK));
+        REQUIRE(sender.getMonotonicUptime() >= std::chrono::seconds(9));
+        REQUIRE(sender.getMonotonicUptime() < std::chrono::seconds(11));
+    }
+}
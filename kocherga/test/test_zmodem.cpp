@@ -0,0 +1,633 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Zubax Robotics
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Author: Pavel Kirienko <pavel.kirienko@zubax.com>
+ */
+
+// We want to ensure that assertion checks are enabled when tests are run, for extra safety
+#ifdef NDEBUG
+# undef NDEBUG
+#endif
+
+#define KOCHERGA_TRACE std::printf
+
+// The library headers must be included first to make sure that they don't have any hidden include dependencies.
+#include <kocherga_zmodem.hpp>
+
+#include "catch.hpp"
+#include "mocks.hpp"
+#include "images.hpp"
+#include "piped_serial_port.hpp"
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <optional>
+#include <iostream>
+#include <fstream>
+
+
+namespace
+{
+/**
+ * Reference bitwise implementations, independent from the table-driven ones of the library.
+ */
+std::uint16_t computeCRC16(const std::vector<std::uint8_t>& data)
+{
+    std::uint16_t crc = 0;
+    for (const auto x : data)
+    {
+        crc = std::uint16_t(crc ^ (x << 8U));
+        for (int i = 0; i < 8; i++)
+        {
+            crc = std::uint16_t(((crc & 0x8000U) != 0) ? ((crc << 1U) ^ 0x1021U) : (crc << 1U));
+        }
+    }
+    return crc;
+}
+
+std::uint32_t computeCRC32(const std::vector<std::uint8_t>& data)
+{
+    std::uint32_t crc = 0xFFFFFFFFUL;
+    for (const auto x : data)
+    {
+        crc ^= x;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = ((crc & 1U) != 0) ? ((crc >> 1U) ^ 0xEDB88320UL) : (crc >> 1U);
+        }
+    }
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+namespace zm
+{
+constexpr std::uint8_t ZPAD   = '*';
+constexpr std::uint8_t ZDLE   = 0x18;
+constexpr std::uint8_t ZBIN   = 'A';
+constexpr std::uint8_t ZHEX   = 'B';
+constexpr std::uint8_t ZBIN32 = 'C';
+constexpr std::uint8_t ZCRCE  = 'h';
+constexpr std::uint8_t ZCRCG  = 'i';
+constexpr std::uint8_t ZCRCW  = 'k';
+
+constexpr std::uint8_t ZRQINIT = 0;
+constexpr std::uint8_t ZRINIT  = 1;
+constexpr std::uint8_t ZACK    = 3;
+constexpr std::uint8_t ZFILE   = 4;
+constexpr std::uint8_t ZFIN    = 8;
+constexpr std::uint8_t ZRPOS   = 9;
+constexpr std::uint8_t ZDATA   = 10;
+constexpr std::uint8_t ZEOF    = 11;
+}
+
+/**
+ * A ZMODEM sender that runs in-process on a virtual clock, imitating 'sz': it streams the data subpackets
+ * while listening to the receiver, and repositions on ZRPOS. The subpackets are generated lazily,
+ * so at most one subpacket is in flight when the receiver requests repositioning, like on a real line.
+ * Faults are injected into the data subpackets at the specified offsets, one transmission per list entry.
+ */
+class ScriptedSender final : public kocherga_zmodem::IZModemPlatform
+{
+    enum class State
+    {
+        Init,
+        FileSent,
+        Data,
+        EOFSent,
+        FinSent,
+        Done
+    };
+
+    const std::vector<std::uint8_t> file_;
+    std::deque<std::uint8_t> output_;
+    std::vector<std::uint8_t> input_;
+    std::chrono::microseconds now_{};
+
+    State state_ = State::Init;
+    std::uint32_t position_ = 0;
+    bool frame_started_ = false;
+    bool awaiting_ack_ = false;
+    std::uint32_t window_ = 0;
+    std::uint32_t unacknowledged_ = 0;
+
+    void emitEscaped(const std::uint8_t x)
+    {
+        switch (x)
+        {
+        case zm::ZDLE:
+        case 0x10:
+        case 0x90:
+        case 0x11:
+        case 0x91:
+        case 0x13:
+        case 0x93:
+        {
+            output_.push_back(zm::ZDLE);
+            output_.push_back(std::uint8_t(x ^ 0x40U));
+            break;
+        }
+        case 0x7F:
+        {
+            output_.push_back(zm::ZDLE);
+            output_.push_back('l');
+            break;
+        }
+        case 0xFF:
+        {
+            output_.push_back(zm::ZDLE);
+            output_.push_back('m');
+            break;
+        }
+        default:
+        {
+            output_.push_back(x);
+            break;
+        }
+        }
+    }
+
+    static std::vector<std::uint8_t> makeHeader(const std::uint8_t type, const std::uint32_t position)
+    {
+        return {type, std::uint8_t(position), std::uint8_t(position >> 8U),
+                std::uint8_t(position >> 16U), std::uint8_t(position >> 24U)};
+    }
+
+    void sendHexHeader(const std::uint8_t type, const std::uint32_t position)
+    {
+        auto raw = makeHeader(type, position);
+        const auto crc = computeCRC16(raw);
+        raw.push_back(std::uint8_t(crc >> 8U));
+        raw.push_back(std::uint8_t(crc));
+
+        output_.insert(output_.end(), {zm::ZPAD, zm::ZPAD, zm::ZDLE, zm::ZHEX});
+        for (const auto x : raw)
+        {
+            static const char Digits[] = "0123456789abcdef";
+            output_.push_back(std::uint8_t(Digits[x >> 4U]));
+            output_.push_back(std::uint8_t(Digits[x & 0xFU]));
+        }
+        output_.insert(output_.end(), {0x0D, 0x8A, 0x11});
+    }
+
+    void sendBinaryHeader(const std::uint8_t type, const std::uint32_t position)
+    {
+        auto raw = makeHeader(type, position);
+        if (crc32)
+        {
+            const auto crc = computeCRC32(raw);
+            raw.insert(raw.end(), {std::uint8_t(crc), std::uint8_t(crc >> 8U),
+                                   std::uint8_t(crc >> 16U), std::uint8_t(crc >> 24U)});
+        }
+        else
+        {
+            const auto crc = computeCRC16(raw);
+            raw.insert(raw.end(), {std::uint8_t(crc >> 8U), std::uint8_t(crc)});
+        }
+
+        output_.insert(output_.end(), {zm::ZPAD, zm::ZDLE, crc32 ? zm::ZBIN32 : zm::ZBIN});
+        for (const auto x : raw)
+        {
+            emitEscaped(x);
+        }
+    }
+
+    static bool takeFault(std::vector<std::uint32_t>& offsets, const std::optional<std::uint32_t> offset)
+    {
+        const auto it = offset ? std::find(offsets.begin(), offsets.end(), *offset) : offsets.end();
+        if (it != offsets.end())
+        {
+            offsets.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+    void sendSubpacket(std::vector<std::uint8_t> data,
+                       const std::uint8_t terminator,
+                       const std::optional<std::uint32_t> offset = {})
+    {
+        const auto begin = output_.size();
+
+        auto covered = data;
+        covered.push_back(terminator);
+        std::vector<std::uint8_t> crc_bytes;
+        if (crc32)
+        {
+            const auto crc = computeCRC32(covered);
+            crc_bytes = {std::uint8_t(crc), std::uint8_t(crc >> 8U), std::uint8_t(crc >> 16U), std::uint8_t(crc >> 24U)};
+        }
+        else
+        {
+            const auto crc = computeCRC16(covered);
+            crc_bytes = {std::uint8_t(crc >> 8U), std::uint8_t(crc)};
+        }
+
+        if (takeFault(corrupted_offsets, offset))
+        {
+            data.at(data.size() / 2) ^= 0x04U;
+        }
+
+        for (const auto x : data)
+        {
+            emitEscaped(x);
+        }
+        output_.push_back(zm::ZDLE);
+        output_.push_back(terminator);
+        for (const auto x : crc_bytes)
+        {
+            emitEscaped(x);
+        }
+
+        if (takeFault(truncated_offsets, offset))
+        {
+            output_.resize(begin + (output_.size() - begin) / 2);
+        }
+    }
+
+    void sendFileHeader()
+    {
+        sendBinaryHeader(zm::ZFILE, 0);
+        const std::string info = "com.zubax.fw.bin" + std::string(1, '\0') + std::to_string(file_.size()) + " 0 0";
+        sendSubpacket(std::vector<std::uint8_t>(info.begin(), info.end()), zm::ZCRCW);
+    }
+
+    /// Produces the next portion of the data stream when the previous one is consumed by the receiver
+    void generate()
+    {
+        if ((state_ != State::Data) || awaiting_ack_)
+        {
+            return;
+        }
+
+        if (!frame_started_)
+        {
+            sendBinaryHeader(zm::ZDATA, position_);
+            frame_started_ = true;
+        }
+
+        const auto offset = position_;
+        const auto size = std::min<std::size_t>(subpacket_size, file_.size() - position_);
+        std::vector<std::uint8_t> data(file_.begin() + std::ptrdiff_t(position_),
+                                       file_.begin() + std::ptrdiff_t(position_ + size));
+        position_ += std::uint32_t(size);
+        unacknowledged_ += std::uint32_t(size);
+        bytes_sent += size;
+
+        if (position_ >= file_.size())
+        {
+            sendSubpacket(data, zm::ZCRCE, offset);
+            sendBinaryHeader(zm::ZEOF, position_);
+            state_ = State::EOFSent;
+        }
+        else if ((window_ > 0) && ((unacknowledged_ + subpacket_size) > window_))
+        {
+            sendSubpacket(data, zm::ZCRCW, offset);
+            awaiting_ack_ = true;
+        }
+        else
+        {
+            sendSubpacket(data, zm::ZCRCG, offset);
+        }
+    }
+
+    void handleHeader(const std::uint8_t type, const std::uint32_t position)
+    {
+        received_headers.push_back(type);
+        switch (type)
+        {
+        case zm::ZRINIT:
+        {
+            if (state_ == State::Init)
+            {
+                window_ = position & 0xFFFFU;
+                sendFileHeader();
+                state_ = State::FileSent;
+            }
+            else if (state_ == State::EOFSent)
+            {
+                sendHexHeader(zm::ZFIN, 0);
+                state_ = State::FinSent;
+            }
+            break;
+        }
+        case zm::ZRPOS:
+        {
+            if (state_ != State::Init)
+            {
+                position_ = position;
+                frame_started_ = false;
+                awaiting_ack_ = false;
+                unacknowledged_ = 0;
+                state_ = State::Data;
+            }
+            break;
+        }
+        case zm::ZACK:
+        {
+            if (awaiting_ack_ && (position == position_))
+            {
+                awaiting_ack_ = false;
+                frame_started_ = false;
+                unacknowledged_ = 0;
+            }
+            break;
+        }
+        case zm::ZFIN:
+        {
+            if (state_ == State::FinSent)
+            {
+                output_.insert(output_.end(), {'O', 'O'});
+                state_ = State::Done;
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+        }
+    }
+
+    /// The receiver sends only hex headers
+    void parseInput()
+    {
+        static constexpr std::size_t HexHeaderSize = 4 + 14;
+        for (;;)
+        {
+            const std::uint8_t start[] = {zm::ZPAD, zm::ZPAD, zm::ZDLE, zm::ZHEX};
+            const auto it = std::search(input_.begin(), input_.end(), std::begin(start), std::end(start));
+            if (std::size_t(input_.end() - it) < HexHeaderSize)
+            {
+                return;
+            }
+
+            std::vector<std::uint8_t> raw;
+            for (auto p = it + 4; p < (it + std::ptrdiff_t(HexHeaderSize)); p += 2)
+            {
+                raw.push_back(std::uint8_t(std::stoul(std::string(p, p + 2), nullptr, 16)));
+            }
+            input_.erase(input_.begin(), it + std::ptrdiff_t(HexHeaderSize));
+
+            const auto crc = std::uint16_t((raw.at(5) << 8U) | raw.at(6));
+            raw.resize(5);
+            REQUIRE(crc == computeCRC16(raw));
+            handleHeader(raw[0], std::uint32_t(raw[1] | (raw[2] << 8U) | (raw[3] << 16U) | (raw[4] << 24U)));
+        }
+    }
+
+public:
+    bool crc32 = true;
+    std::size_t subpacket_size = 1024;
+    std::vector<std::uint32_t> corrupted_offsets;
+    std::vector<std::uint32_t> truncated_offsets;
+
+    std::vector<std::uint8_t> received_headers;
+    std::size_t bytes_sent = 0;
+
+    explicit ScriptedSender(std::vector<std::uint8_t> file) :
+        file_(std::move(file))
+    {
+        const std::string command = "rz\r";
+        output_.insert(output_.end(), command.begin(), command.end());
+        sendHexHeader(zm::ZRQINIT, 0);
+    }
+
+    bool isDone() const { return state_ == State::Done; }
+
+    void cancel()
+    {
+        output_.insert(output_.end(), 8, zm::ZDLE);
+        output_.insert(output_.end(), 8, 0x08);
+    }
+
+    Result emit(std::uint8_t byte, std::chrono::microseconds) final
+    {
+        input_.push_back(byte);
+        parseInput();
+        return Result::Success;
+    }
+
+    Result receive(std::uint8_t& out_byte, std::chrono::microseconds timeout) final
+    {
+        if (output_.empty())
+        {
+            generate();
+        }
+        if (output_.empty())
+        {
+            now_ += timeout;
+            return Result::Timeout;
+        }
+        out_byte = output_.front();
+        output_.pop_front();
+        return Result::Success;
+    }
+
+    std::chrono::microseconds getMonotonicUptime() const final { return now_; }
+};
+
+/**
+ * Collects the downloaded data in memory.
+ */
+class MemorySink final : public kocherga::IDownloadSink
+{
+public:
+    std::vector<std::uint8_t> data;
+    std::size_t chunk_count = 0;
+
+    std::int16_t handleNextDataChunk(const void* chunk, std::uint16_t size) final
+    {
+        auto p = static_cast<const std::uint8_t*>(chunk);
+        data.insert(data.end(), p, p + size);
+        chunk_count++;
+        return 0;
+    }
+};
+
+const std::vector<std::uint8_t> Image(images::AppValid2.begin(), images::AppValid2.end());    // NOLINT
+
+const char* const ImageFileName = "zmodem-image.tmp";
+
+/**
+ * Writes the test image into a file, for use with the sender process.
+ */
+void initImageFile()
+{
+    if (std::ofstream f(ImageFileName, std::ios::binary | std::ios::out); f)
+    {
+        f.write(reinterpret_cast<const char*>(Image.data()), std::streamsize(Image.size()));
+    }
+    else
+    {
+        throw std::runtime_error("Image file init failure");
+    }
+}
+
+}
+
+
+TEST_CASE("ZModem-CRC32")
+{
+    kocherga_zmodem::CRC32 crc;
+    crc.add("123456789", 9);
+    REQUIRE(0xCBF43926UL == crc.get());
+}
+
+
+TEST_CASE("ZModem-Basic")
+{
+    mocks::Platform platform;
+
+    static constexpr std::uint32_t ROMSize = 1024 * 1024;
+    mocks::FileMappedROMBackend rom_backend("zmodem-rom.tmp", ROMSize);
+    kocherga::BootloaderController blc(platform, rom_backend, ROMSize);
+    REQUIRE(kocherga::State::NoAppToBoot == blc.getState());
+
+    for (const bool crc32 : {true, false})
+    {
+        ScriptedSender sender(Image);
+        sender.crc32 = crc32;
+        kocherga_zmodem::ZModemProtocol protocol(sender);
+        REQUIRE(0 == blc.upgradeApp(protocol));
+        REQUIRE(kocherga::State::ReadyToBoot == blc.getState());
+        REQUIRE(sender.isDone());
+        REQUIRE(sender.bytes_sent == Image.size());
+
+        // The data was streamed: no acknowledgements, and only the initial request for the data
+        REQUIRE(0 == std::count(sender.received_headers.begin(), sender.received_headers.end(), zm::ZACK));
+        REQUIRE(1 == std::count(sender.received_headers.begin(), sender.received_headers.end(), zm::ZRPOS));
+
+        const auto info = blc.getAppInfo();
+        REQUIRE(info);
+        REQUIRE(info->image_size == images::AppValid2.size());
+        REQUIRE(info->vcs_commit == images::AppValid2VCSCommit);
+        blc.cancelBoot();
+    }
+}
+
+
+TEST_CASE("ZModem-Sz")
+{
+    initImageFile();
+    mocks::Platform platform;
+
+    static constexpr std::uint32_t ROMSize = 1024 * 1024;
+    mocks::FileMappedROMBackend rom_backend("zmodem-sz-rom.tmp", ROMSize);
+    kocherga::BootloaderController blc(platform, rom_backend, ROMSize);
+    REQUIRE(kocherga::State::NoAppToBoot == blc.getState());
+
+    /*
+     * The tests below require the program 'sz'. On Debian-based systems, the package name is 'lrzsz'.
+     * Man page: http://manpages.ubuntu.com/manpages/artful/man1/sz.1.html
+     */
+    // Test ZMODEM, streaming
+    {
+        piped_process::SerialPort port(piped_process::launch(std::string("sz -vv --zmodem ") + ImageFileName));
+        kocherga_zmodem::ZModemProtocol protocol(port);
+        REQUIRE(0 == blc.upgradeApp(protocol));
+        REQUIRE(kocherga::State::ReadyToBoot == blc.getState());
+    }
+
+    // Test ZMODEM with 8 KiB subpackets
+    blc.cancelBoot();
+    {
+        piped_process::SerialPort port(piped_process::launch(std::string("sz -vv --zmodem --try-8k ") +
+                                                             ImageFileName));
+        kocherga_zmodem::ZModemProtocol protocol(port);
+        REQUIRE(0 == blc.upgradeApp(protocol));
+        REQUIRE(kocherga::State::ReadyToBoot == blc.getState());
+    }
+
+    // Test ZMODEM with a limited receive window, so that the sender has to wait for acknowledgements
+    blc.cancelBoot();
+    {
+        piped_process::SerialPort port(piped_process::launch(std::string("sz -vv --zmodem ") + ImageFileName));
+        kocherga_zmodem::ZModemProtocol protocol(port, 2048);
+        REQUIRE(0 == blc.upgradeApp(protocol));
+        REQUIRE(kocherga::State::ReadyToBoot == blc.getState());
+    }
+
+    const auto info = blc.getAppInfo();
+    REQUIRE(info);
+    REQUIRE(info->image_size == images::AppValid2.size());
+    REQUIRE(info->vcs_commit == images::AppValid2VCSCommit);
+}
+
+
+TEST_CASE("ZModem-Recovery")
+{
+    ScriptedSender sender(Image);
+    sender.corrupted_offsets = {2048, 2048};    // Including the retransmission
+    sender.truncated_offsets = {7168};
+    kocherga_zmodem::ZModemProtocol protocol(sender);
+    MemorySink sink;
+    REQUIRE(0 == protocol.downloadImage(sink));
+    REQUIRE(sink.data == Image);
+    REQUIRE(sender.isDone());
+
+    // The transfer resumes from the last good offset; the lost subpackets are sent again, and at most one more
+    std::cout << "ZMODEM bytes sent " << sender.bytes_sent << " for " << Image.size() << std::endl;
+    REQUIRE(4 == std::count(sender.received_headers.begin(), sender.received_headers.end(), zm::ZRPOS));
+    REQUIRE(sender.bytes_sent <= (Image.size() + 6U * 1024U));
+    REQUIRE(sender.getMonotonicUptime() < std::chrono::seconds(1));
+}
+
+
+TEST_CASE("ZModem-Window")
+{
+    ScriptedSender sender(Image);
+    sender.subpacket_size = 512;
+    kocherga_zmodem::ZModemProtocol protocol(sender, 2048);
+    MemorySink sink;
+    REQUIRE(0 == protocol.downloadImage(sink));
+    REQUIRE(sink.data == Image);
+    REQUIRE(sink.chunk_count == ((Image.size() + 511U) / 512U));
+
+    // The sender waits for an acknowledgement after each window; the last window ends with ZEOF instead
+    REQUIRE((Image.size() / 2048U) == std::size_t(std::count(sender.received_headers.begin(),
+                                                              sender.received_headers.end(), zm::ZACK)));
+}
+
+
+TEST_CASE("ZModem-Errors")
+{
+    // The sender cancels the session
+    {
+        ScriptedSender sender(Image);
+        sender.cancel();
+        kocherga_zmodem::ZModemProtocol protocol(sender);
+        MemorySink sink;
+        REQUIRE(kocherga_zmodem::ErrTransferCancelledByRemote == -protocol.downloadImage(sink));
+    }
+
+    // Every data subpacket is damaged, so the receiver gives up eventually
+    {
+        ScriptedSender sender(Image);
+        sender.corrupted_offsets.resize(100, 0);
+        kocherga_zmodem::ZModemProtocol protocol(sender);
+        MemorySink sink;
+        REQUIRE(kocherga_zmodem::ErrRetriesExhausted == -protocol.downloadImage(sink));
+        REQUIRE(sink.data.empty());
+    }
+}
@@ -59,6 +59,25 @@ extern "C" {
 # endif
 #endif
 
+/// Set this build config macro to 1 to enable deduplication of transfers received via redundant interfaces.
+/// Refer to the field CanardCANFrame.iface_id for details. This option costs one byte of the RX transfer head size.
+#ifndef CANARD_MULTI_IFACE
+# define CANARD_MULTI_IFACE         0
+#endif
+
+/// Number of redundant interfaces whose activity is tracked if CANARD_MULTI_IFACE is enabled; refer to
+/// CanardCANFrame.iface_id. Each tracked interface costs 8 bytes of the library instance.
+#ifndef CANARD_MULTI_IFACE_MAX_IFACES
+# define CANARD_MULTI_IFACE_MAX_IFACES              3U
+#endif
+
+/// If CANARD_MULTI_IFACE is enabled, a transfer may be taken over by another interface once the interface it has
+/// been received from delivers no frames for this long. It should exceed the duration of a CAN frame at the lowest
+/// bit rate in use, otherwise the interfaces could take turns on every transfer.
+#ifndef CANARD_MULTI_IFACE_SWITCH_DELAY_USEC
+# define CANARD_MULTI_IFACE_SWITCH_DELAY_USEC       2000U
+#endif
+
 /// Error code definitions; inverse of these values may be returned from API calls.
 #define CANARD_OK                                   0
 // Value 1 is omitted intentionally, since -1 is often used in 3rd party code
@@ -67,11 +86,22 @@ extern "C" {
 #define CANARD_ERROR_NODE_ID_NOT_SET                4
 #define CANARD_ERROR_INTERNAL                       9
 
+/// Set this build config macro to 1 to enable support for CAN FD frames carrying up to 64 bytes of data.
+/// This option increases the size of the memory block, because a TX queue item has to fit a CAN FD frame.
+#ifndef CANARD_ENABLE_CANFD
+# define CANARD_ENABLE_CANFD        0
+#endif
+
 /// The size of a memory block in bytes.
-#define CANARD_MEM_BLOCK_SIZE                       32U
+#if CANARD_ENABLE_CANFD
+# define CANARD_MEM_BLOCK_SIZE                      80U
+#else
+# define CANARD_MEM_BLOCK_SIZE                      32U
+#endif
 
-/// This will be changed when the support for CAN FD is added
+/// Maximum data length of a classic CAN frame and of a CAN FD frame
 #define CANARD_CAN_FRAME_MAX_DATA_LEN               8U
+#define CANARD_CANFD_FRAME_MAX_DATA_LEN             64U
 
 /// Node ID values. Refer to the specification for more info.
 #define CANARD_BROADCAST_NODE_ID                    0
@@ -117,8 +147,28 @@ typedef struct
      *  - CANARD_CAN_FRAME_ERR
      */
     uint32_t id;
+#if CANARD_ENABLE_CANFD
+    uint8_t data[CANARD_CANFD_FRAME_MAX_DATA_LEN];
+#else
     uint8_t data[CANARD_CAN_FRAME_MAX_DATA_LEN];
+#endif
+
+    /**
+     * Classic CAN frames carry up to 8 bytes. If CAN FD is enabled, a frame whose length exceeds 8 bytes
+     * must be transmitted in the CAN FD format; valid lengths of such frames are 12, 16, 20, 24, 32, 48, and 64.
+     */
     uint8_t data_len;
+
+    /**
+     * Index of the redundant interface the frame was received from, starting from zero; set by the driver.
+     * If CANARD_MULTI_IFACE is enabled, a transfer is accepted from the interface that delivered it first,
+     * and its copies delivered later via other interfaces are discarded. If the interface that has been delivering
+     * the transfers of a session goes silent for CANARD_MULTI_IFACE_SWITCH_DELAY_USEC, the next transfer is accepted
+     * from another interface even if some transfer IDs have been skipped.
+     * The library sets this field to zero in outgoing frames; the application is responsible for transmitting
+     * them via every available interface.
+     */
+    uint8_t iface_id;
 } CanardCANFrame;
 
 /**
@@ -191,6 +241,7 @@ typedef struct
     uint16_t capacity_blocks;               ///< Pool capacity in number of blocks
     uint16_t current_usage_blocks;          ///< Number of blocks that are currently allocated by the library
     uint16_t peak_usage_blocks;             ///< Maximum number of blocks used since initialization
+    uint16_t oom_count;                     ///< Number of failed allocations since initialization (saturating)
 } CanardPoolAllocatorStatistics;
 
 /**
@@ -233,6 +284,10 @@ struct CanardRxState
 
     uint16_t payload_crc;
 
+#if CANARD_MULTI_IFACE
+    uint8_t iface_id;
+#endif
+
     uint8_t buffer_head[];
 };
 CANARD_STATIC_ASSERT(offsetof(CanardRxState, buffer_head) <= 28, "Invalid memory layout");
@@ -255,6 +310,14 @@ struct CanardInstance
     CanardTxQueueItem* tx_queue;                    ///< TX frames awaiting transmission
 
     void* user_reference;                           ///< User pointer that can link this instance with other objects
+
+#if CANARD_ENABLE_CANFD
+    bool canfd_tx;                                  ///< Whether outgoing transfers may use CAN FD frames
+#endif
+
+#if CANARD_MULTI_IFACE
+    uint64_t iface_rx_timestamp_usec[CANARD_MULTI_IFACE_MAX_IFACES];    ///< When each interface last delivered a frame
+#endif
 };
 
 /**
@@ -343,6 +406,16 @@ void canardSetLocalNodeID(CanardInstance* ins,
  */
 uint8_t canardGetLocalNodeID(const CanardInstance* ins);
 
+#if CANARD_ENABLE_CANFD
+/**
+ * Allows or forbids the library to use CAN FD frames for outgoing transfers; forbidden by default.
+ * The frames that are already enqueued are not affected.
+ * CAN FD frames are always accepted on reception if CANARD_ENABLE_CANFD is set.
+ */
+void canardSetCANFDEnabled(CanardInstance* ins,
+                           bool enabled);
+#endif
+
 /**
  * Sends a broadcast transfer.
  * If the node is in passive mode, only single frame transfers will be allowed (they will be transmitted as anonymous).
@@ -412,6 +485,8 @@ void canardPopTxQueue(CanardInstance* ins);
 /**
  * Processes a received CAN frame with a timestamp.
  * The application will call this function when it receives a new frame from the CAN bus.
+ * The timestamp should be captured as close to the actual reception as possible, e.g. by the driver in the RX
+ * interrupt, or by the hardware; it must use the same clock as canardCleanupStaleTransfers().
  */
 void canardHandleRxFrame(CanardInstance* ins,
                          const CanardCANFrame* frame,
@@ -515,7 +590,7 @@ uint16_t canardConvertNativeFloatToFloat16(float value);
 float canardConvertFloat16ToNativeFloat(uint16_t value);
 
 /// Abort the build if the current platform is not supported.
-CANARD_STATIC_ASSERT(((uint32_t)CANARD_MULTIFRAME_RX_PAYLOAD_HEAD_SIZE) < 32,
+CANARD_STATIC_ASSERT(((uint32_t)CANARD_MULTIFRAME_RX_PAYLOAD_HEAD_SIZE) < CANARD_MEM_BLOCK_SIZE,
                      "Platforms where sizeof(void*) > 4 are not supported. "
                      "On AMD64 use 32-bit mode (e.g. GCC flag -m32).");
 
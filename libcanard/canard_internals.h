@@ -85,6 +85,9 @@ CANARD_INTERNAL void incrementTransferID(uint8_t* transfer_id);
 CANARD_INTERNAL uint64_t releaseStatePayload(CanardInstance* ins,
                                              CanardRxState* rxstate);
 
+/// Returns the largest valid frame data length that does not exceed the argument (CAN FD DLC granularity)
+CANARD_INTERNAL uint8_t roundDownFrameDataLength(uint8_t data_len);
+
 /// Returns the number of frames enqueued
 CANARD_INTERNAL int16_t enqueueTxFrames(CanardInstance* ins,
                                         uint32_t can_id,
@@ -17,6 +17,14 @@
 # define BXCAN                                                  CANARD_STM32_CAN1
 #endif
 
+#if (CANARD_STM32_NUM_IFACES < 1) || (CANARD_STM32_NUM_IFACES > 2)
+# error "CANARD_STM32_NUM_IFACES must be either 1 or 2"
+#endif
+
+#if (CANARD_STM32_NUM_IFACES > 1) && CANARD_STM32_USE_CAN2
+# error "CANARD_STM32_USE_CAN2 cannot be combined with CANARD_STM32_NUM_IFACES > 1"
+#endif
+
 /*
  * State variables
  */
@@ -24,6 +32,30 @@ static CanardSTM32Stats g_stats;
 
 static bool g_abort_tx_on_error = false;
 
+static uint8_t g_next_rx_iface_index = 0;
+
+
+static volatile CanardSTM32CANType* getIface(const uint8_t iface_index)
+{
+#if CANARD_STM32_NUM_IFACES > 1
+    return (iface_index == 0) ? CANARD_STM32_CAN1 : CANARD_STM32_CAN2;
+#else
+    (void) iface_index;
+    return BXCAN;
+#endif
+}
+
+/// Index of the first hardware acceptance filter bank that belongs to the specified interface.
+static uint8_t getFilterBankOffset(const uint8_t iface_index)
+{
+#if CANARD_STM32_USE_CAN2
+    (void) iface_index;
+    return CANARD_STM32_NUM_ACCEPTANCE_FILTERS;
+#else
+    return (uint8_t)(iface_index * CANARD_STM32_NUM_ACCEPTANCE_FILTERS);
+#endif
+}
+
 
 static bool isFramePriorityHigher(uint32_t a, uint32_t b)
 {
@@ -143,28 +175,67 @@ static bool waitMSRINAKBitStateChange(volatile const CanardSTM32CANType* const b
 }
 
 
-static void processErrorStatus(void)
+static void processErrorStatus(volatile CanardSTM32CANType* const bxcan)
 {
     /*
      * Aborting TX transmissions if abort on error was requested
      * Updating error counter
      */
-    const uint8_t lec = (uint8_t)((BXCAN->ESR & CANARD_STM32_CAN_ESR_LEC_MASK) >> CANARD_STM32_CAN_ESR_LEC_SHIFT);
+    const uint8_t lec = (uint8_t)((bxcan->ESR & CANARD_STM32_CAN_ESR_LEC_MASK) >> CANARD_STM32_CAN_ESR_LEC_SHIFT);
 
     if (lec != 0)
     {
-        BXCAN->ESR = 0;                 // This action does only affect the LEC bits, other bits are read only!
+        bxcan->ESR = 0;                 // This action does only affect the LEC bits, other bits are read only!
         g_stats.error_count++;
 
         // Abort pending transmissions if auto abort on error is enabled, or if we're in bus off mode
-        if (g_abort_tx_on_error || (BXCAN->ESR & CANARD_STM32_CAN_ESR_BOFF))
+        if (g_abort_tx_on_error || (bxcan->ESR & CANARD_STM32_CAN_ESR_BOFF))
         {
-            BXCAN->TSR = CANARD_STM32_CAN_TSR_ABRQ0 | CANARD_STM32_CAN_TSR_ABRQ1 | CANARD_STM32_CAN_TSR_ABRQ2;
+            bxcan->TSR = CANARD_STM32_CAN_TSR_ABRQ0 | CANARD_STM32_CAN_TSR_ABRQ1 | CANARD_STM32_CAN_TSR_ABRQ2;
         }
     }
 }
 
 
+static int16_t initIface(volatile CanardSTM32CANType* const bxcan,
+                         const CanardSTM32CANTimings* const timings,
+                         const CanardSTM32IfaceMode iface_mode)
+{
+    bxcan->IER = 0;                                             // We need no interrupts
+    bxcan->MCR &= ~CANARD_STM32_CAN_MCR_SLEEP;                  // Exit sleep mode
+    bxcan->MCR |= CANARD_STM32_CAN_MCR_INRQ;                    // Request init
+
+    if (!waitMSRINAKBitStateChange(bxcan, true))                // Wait for synchronization
+    {
+        bxcan->MCR = CANARD_STM32_CAN_MCR_RESET;
+        return -CANARD_STM32_ERROR_MSR_INAK_NOT_SET;
+    }
+
+    /*
+     * Hardware initialization (the hardware has already confirmed initialization mode, see above)
+     */
+    bxcan->MCR = CANARD_STM32_CAN_MCR_ABOM | CANARD_STM32_CAN_MCR_AWUM | CANARD_STM32_CAN_MCR_INRQ;  // RM page 648
+
+    bxcan->BTR = (((timings->max_resynchronization_jump_width - 1U) &    3U) << 24U) |
+                 (((timings->bit_segment_1 - 1U)                    &   15U) << 16U) |
+                 (((timings->bit_segment_2 - 1U)                    &    7U) << 20U) |
+                 ((timings->bit_rate_prescaler - 1U)                & 1023U) |
+                 ((iface_mode == CanardSTM32IfaceModeSilent) ? CANARD_STM32_CAN_BTR_SILM : 0);
+
+    CANARD_ASSERT(0 == bxcan->IER);             // Making sure the iterrupts are indeed disabled
+
+    bxcan->MCR &= ~CANARD_STM32_CAN_MCR_INRQ;   // Leave init mode
+
+    if (!waitMSRINAKBitStateChange(bxcan, false))
+    {
+        bxcan->MCR = CANARD_STM32_CAN_MCR_RESET;
+        return -CANARD_STM32_ERROR_MSR_INAK_NOT_CLEARED;
+    }
+
+    return 0;
+}
+
+
 int16_t canardSTM32Init(const CanardSTM32CANTimings* const timings,
                         const CanardSTM32IfaceMode iface_mode)
 {
@@ -208,35 +279,13 @@ int16_t canardSTM32Init(const CanardSTM32CANTimings* const timings,
     // CAN1 will be left in the initialization mode forever, in this mode it does not affect the bus at all.
 #endif
 
-    BXCAN->IER = 0;                                             // We need no interrupts
-    BXCAN->MCR &= ~CANARD_STM32_CAN_MCR_SLEEP;                  // Exit sleep mode
-    BXCAN->MCR |= CANARD_STM32_CAN_MCR_INRQ;                    // Request init
-
-    if (!waitMSRINAKBitStateChange(BXCAN, true))                // Wait for synchronization
+    for (uint8_t i = 0; i < CANARD_STM32_NUM_IFACES; i++)
     {
-        BXCAN->MCR = CANARD_STM32_CAN_MCR_RESET;
-        return -CANARD_STM32_ERROR_MSR_INAK_NOT_SET;
-    }
-
-    /*
-     * Hardware initialization (the hardware has already confirmed initialization mode, see above)
-     */
-    BXCAN->MCR = CANARD_STM32_CAN_MCR_ABOM | CANARD_STM32_CAN_MCR_AWUM | CANARD_STM32_CAN_MCR_INRQ;  // RM page 648
-
-    BXCAN->BTR = (((timings->max_resynchronization_jump_width - 1U) &    3U) << 24U) |
-                 (((timings->bit_segment_1 - 1U)                    &   15U) << 16U) |
-                 (((timings->bit_segment_2 - 1U)                    &    7U) << 20U) |
-                 ((timings->bit_rate_prescaler - 1U)                & 1023U) |
-                 ((iface_mode == CanardSTM32IfaceModeSilent) ? CANARD_STM32_CAN_BTR_SILM : 0);
-
-    CANARD_ASSERT(0 == BXCAN->IER);             // Making sure the iterrupts are indeed disabled
-
-    BXCAN->MCR &= ~CANARD_STM32_CAN_MCR_INRQ;   // Leave init mode
-
-    if (!waitMSRINAKBitStateChange(BXCAN, false))
-    {
-        BXCAN->MCR = CANARD_STM32_CAN_MCR_RESET;
-        return -CANARD_STM32_ERROR_MSR_INAK_NOT_CLEARED;
+        const int16_t res = initIface(getIface(i), timings, iface_mode);
+        if (res < 0)
+        {
+            return res;
+        }
     }
 
     /*
@@ -262,15 +311,14 @@ int16_t canardSTM32Init(const CanardSTM32CANTimings* const timings,
     // this too, since there will be no reordering within the same CAN ID.
     CANARD_STM32_CAN1->FFA1R = 0x0AAAAAAA;
 
-#if CANARD_STM32_USE_CAN2
-    CANARD_STM32_CAN1->FilterRegister[CANARD_STM32_NUM_ACCEPTANCE_FILTERS].FR1 = 0;
-    CANARD_STM32_CAN1->FilterRegister[CANARD_STM32_NUM_ACCEPTANCE_FILTERS].FR2 = 0;
-    CANARD_STM32_CAN1->FA1R = (1 << CANARD_STM32_NUM_ACCEPTANCE_FILTERS);  // One filter enabled
-#else
-    CANARD_STM32_CAN1->FilterRegister[0].FR1 = 0;
-    CANARD_STM32_CAN1->FilterRegister[0].FR2 = 0;
-    CANARD_STM32_CAN1->FA1R = 1;                                        // One filter enabled
-#endif
+    CANARD_STM32_CAN1->FA1R = 0;
+    for (uint8_t i = 0; i < CANARD_STM32_NUM_IFACES; i++)
+    {
+        const uint8_t filter_index = getFilterBankOffset(i);
+        CANARD_STM32_CAN1->FilterRegister[filter_index].FR1 = 0;
+        CANARD_STM32_CAN1->FilterRegister[filter_index].FR2 = 0;
+        CANARD_STM32_CAN1->FA1R |= 1U << filter_index;                  // One filter per interface enabled
+    }
 
     CANARD_STM32_CAN1->FMR &= ~CANARD_STM32_CAN_FMR_FINIT;              // Leave initialization mode
 
@@ -290,10 +338,19 @@ int16_t canardSTM32Transmit(const CanardCANFrame* const frame)
         return -CANARD_STM32_ERROR_UNSUPPORTED_FRAME_FORMAT;
     }
 
+#if CANARD_STM32_NUM_IFACES > 1
+    if (frame->iface_id >= CANARD_STM32_NUM_IFACES)
+    {
+        return -CANARD_ERROR_INVALID_ARGUMENT;
+    }
+#endif
+
+    volatile CanardSTM32CANType* const bxcan = getIface(frame->iface_id);
+
     /*
      * Handling error status might free up some slots through aborts
      */
-    processErrorStatus();
+    processErrorStatus(bxcan);
 
     /*
      * Seeking an empty slot, checking if priority inversion would occur if we enqueued now.
@@ -303,13 +360,13 @@ int16_t canardSTM32Transmit(const CanardCANFrame* const frame)
 
     static const uint32_t AllTME = CANARD_STM32_CAN_TSR_TME0 | CANARD_STM32_CAN_TSR_TME1 | CANARD_STM32_CAN_TSR_TME2;
 
-    if ((BXCAN->TSR & AllTME) != AllTME)                // At least one TX mailbox is used, detailed check is needed
+    if ((bxcan->TSR & AllTME) != AllTME)                // At least one TX mailbox is used, detailed check is needed
     {
         const bool tme[3] =
         {
-            (BXCAN->TSR & CANARD_STM32_CAN_TSR_TME0) != 0,
-            (BXCAN->TSR & CANARD_STM32_CAN_TSR_TME1) != 0,
-            (BXCAN->TSR & CANARD_STM32_CAN_TSR_TME2) != 0
+            (bxcan->TSR & CANARD_STM32_CAN_TSR_TME0) != 0,
+            (bxcan->TSR & CANARD_STM32_CAN_TSR_TME1) != 0,
+            (bxcan->TSR & CANARD_STM32_CAN_TSR_TME2) != 0
         };
 
         for (uint8_t i = 0; i < 3; i++)
@@ -320,7 +377,7 @@ int16_t canardSTM32Transmit(const CanardCANFrame* const frame)
             }
             else                                        // This TX mailbox is pending, check for priority inversion
             {
-                if (!isFramePriorityHigher(frame->id, convertFrameIDRegisterToCanard(BXCAN->TxMailbox[i].TIR)))
+                if (!isFramePriorityHigher(frame->id, convertFrameIDRegisterToCanard(bxcan->TxMailbox[i].TIR)))
                 {
                     // There's a mailbox whose priority is higher or equal the priority of the new frame.
                     return 0;                           // Priority inversion would occur! Reject transmission.
@@ -362,7 +419,7 @@ int16_t canardSTM32Transmit(const CanardCANFrame* const frame)
      * By this time we've proved that a priority inversion would not occur, and we've also found a free TX mailbox.
      * Therefore it is safe to enqueue the frame now.
      */
-    volatile CanardSTM32TxMailboxType* const mb = &BXCAN->TxMailbox[tx_mailbox];
+    volatile CanardSTM32TxMailboxType* const mb = &bxcan->TxMailbox[tx_mailbox];
 
     mb->TDTR = frame->data_len;                         // DLC equals data length except in CAN FD
 
@@ -391,53 +448,66 @@ int16_t canardSTM32Receive(CanardCANFrame* const out_frame)
         return -CANARD_ERROR_INVALID_ARGUMENT;
     }
 
-    static volatile uint32_t* const RFxR[2] =
-    {
-        &BXCAN->RF0R,
-        &BXCAN->RF1R
-    };
-
     /*
-     * This function must be polled periodically, so we use this opportunity to do it.
+     * Interfaces are served in a round-robin manner, so that a busy interface could not starve the other one
      */
-    processErrorStatus();
-
-    /*
-     * Reading the TX FIFO
-     */
-    for (uint_fast8_t i = 0; i < 2; i++)
+    for (uint_fast8_t k = 0; k < CANARD_STM32_NUM_IFACES; k++)
     {
-        volatile CanardSTM32RxMailboxType* const mb = &BXCAN->RxMailbox[i];
+        const uint8_t iface_index = g_next_rx_iface_index;
+        g_next_rx_iface_index = (uint8_t)((g_next_rx_iface_index + 1U) % CANARD_STM32_NUM_IFACES);
+
+        volatile CanardSTM32CANType* const bxcan = getIface(iface_index);
+
+        volatile uint32_t* const RFxR[2] =
+        {
+            &bxcan->RF0R,
+            &bxcan->RF1R
+        };
+
+        /*
+         * This function must be polled periodically, so we use this opportunity to do it.
+         */
+        processErrorStatus(bxcan);
 
-        if (((*RFxR[i]) & CANARD_STM32_CAN_RFR_FMP_MASK) != 0)
+        /*
+         * Reading the TX FIFO
+         */
+        for (uint_fast8_t i = 0; i < 2; i++)
         {
-            if (*RFxR[i] & CANARD_STM32_CAN_RFR_FOVR)
+            volatile CanardSTM32RxMailboxType* const mb = &bxcan->RxMailbox[i];
+
+            if (((*RFxR[i]) & CANARD_STM32_CAN_RFR_FMP_MASK) != 0)
             {
-                g_stats.rx_overflow_count++;
-            }
+                if (*RFxR[i] & CANARD_STM32_CAN_RFR_FOVR)
+                {
+                    g_stats.rx_overflow_count++;
+                }
+
+                out_frame->id = convertFrameIDRegisterToCanard(mb->RIR);
 
-            out_frame->id = convertFrameIDRegisterToCanard(mb->RIR);
+                out_frame->data_len = (uint8_t)(mb->RDTR & CANARD_STM32_CAN_RDTR_DLC_MASK);
 
-            out_frame->data_len = (uint8_t)(mb->RDTR & CANARD_STM32_CAN_RDTR_DLC_MASK);
+                out_frame->iface_id = iface_index;
 
-            // Caching to regular (non volatile) memory for faster reads
-            const uint32_t rdlr = mb->RDLR;
-            const uint32_t rdhr = mb->RDHR;
+                // Caching to regular (non volatile) memory for faster reads
+                const uint32_t rdlr = mb->RDLR;
+                const uint32_t rdhr = mb->RDHR;
 
-            out_frame->data[0] = (uint8_t)(0xFFU & (rdlr >>  0U));
-            out_frame->data[1] = (uint8_t)(0xFFU & (rdlr >>  8U));
-            out_frame->data[2] = (uint8_t)(0xFFU & (rdlr >> 16U));
-            out_frame->data[3] = (uint8_t)(0xFFU & (rdlr >> 24U));
-            out_frame->data[4] = (uint8_t)(0xFFU & (rdhr >>  0U));
-            out_frame->data[5] = (uint8_t)(0xFFU & (rdhr >>  8U));
-            out_frame->data[6] = (uint8_t)(0xFFU & (rdhr >> 16U));
-            out_frame->data[7] = (uint8_t)(0xFFU & (rdhr >> 24U));
+                out_frame->data[0] = (uint8_t)(0xFFU & (rdlr >>  0U));
+                out_frame->data[1] = (uint8_t)(0xFFU & (rdlr >>  8U));
+                out_frame->data[2] = (uint8_t)(0xFFU & (rdlr >> 16U));
+                out_frame->data[3] = (uint8_t)(0xFFU & (rdlr >> 24U));
+                out_frame->data[4] = (uint8_t)(0xFFU & (rdhr >>  0U));
+                out_frame->data[5] = (uint8_t)(0xFFU & (rdhr >>  8U));
+                out_frame->data[6] = (uint8_t)(0xFFU & (rdhr >> 16U));
+                out_frame->data[7] = (uint8_t)(0xFFU & (rdhr >> 24U));
 
-            // Release FIFO entry we just read
-            *RFxR[i] = CANARD_STM32_CAN_RFR_RFOM | CANARD_STM32_CAN_RFR_FOVR | CANARD_STM32_CAN_RFR_FULL;
+                // Release FIFO entry we just read
+                *RFxR[i] = CANARD_STM32_CAN_RFR_RFOM | CANARD_STM32_CAN_RFR_FOVR | CANARD_STM32_CAN_RFR_FULL;
 
-            // Reading successful
-            return 1;
+                // Reading successful
+                return 1;
+            }
         }
     }
 
@@ -546,16 +616,15 @@ int16_t canardSTM32ConfigureAcceptanceFilters(const CanardSTM32AcceptanceFilterC
         /*
          * Applying the converted representation to the registers.
          */
-        const uint8_t filter_index =
-#if CANARD_STM32_USE_CAN2
-            (uint8_t)(i + CANARD_STM32_NUM_ACCEPTANCE_FILTERS);
-#else
-            i;
-#endif
-        CANARD_STM32_CAN1->FilterRegister[filter_index].FR1 = id;
-        CANARD_STM32_CAN1->FilterRegister[filter_index].FR2 = mask;
+        for (uint8_t k = 0; k < CANARD_STM32_NUM_IFACES; k++)
+        {
+            const uint8_t filter_index = (uint8_t)(i + getFilterBankOffset(k));
+
+            CANARD_STM32_CAN1->FilterRegister[filter_index].FR1 = id;
+            CANARD_STM32_CAN1->FilterRegister[filter_index].FR2 = mask;
 
-        CANARD_STM32_CAN1->FA1R |= 1U << filter_index;      // Enable
+            CANARD_STM32_CAN1->FA1R |= 1U << filter_index;  // Enable
+        }
     }
 
     return 0;
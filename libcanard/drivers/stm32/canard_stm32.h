@@ -26,6 +26,15 @@ extern "C"
 # define CANARD_STM32_USE_CAN2                                  0
 #endif
 
+/**
+ * Set this build config macro to 2 to use both CAN1 and CAN2 at the same time, e.g. in redundant configurations.
+ * In this mode, the interface is selected on a per-frame basis via the field CanardCANFrame.iface_id,
+ * where 0 stands for CAN1 and 1 stands for CAN2. This option cannot be combined with CANARD_STM32_USE_CAN2.
+ */
+#if !defined(CANARD_STM32_NUM_IFACES)
+# define CANARD_STM32_NUM_IFACES                                1
+#endif
+
 /**
  * Trigger an assertion failure if inner priority inversion is detected at run time.
  * This setting has no effect in release builds, where NDEBUG is defined.
@@ -117,6 +126,7 @@ typedef struct
  * for more information about this topic.
  *
  * This function can be invoked any number of times; every invocation re-initializes everything from scratch.
+ * If multiple interfaces are used, all of them are initialized with the same configuration.
  *
  * WARNING: The clock of the CAN module must be enabled before this function is invoked!
  *          If CAN2 is used, CAN1 must be also enabled!
@@ -135,6 +145,7 @@ int16_t canardSTM32Init(const CanardSTM32CANTimings* const timings,
  * Pushes one frame into the TX buffer, if there is space.
  * Note that proper care is taken to ensure that no inner priority inversion is taking place.
  * This function does never block.
+ * If multiple interfaces are used, the frame is transmitted via the interface specified in the field iface_id.
  *
  * @retval      1               Transmitted successfully
  * @retval      0               No space in the buffer
@@ -145,6 +156,7 @@ int16_t canardSTM32Transmit(const CanardCANFrame* const frame);
 /**
  * Reads one frame from the hardware RX FIFO, unless all FIFO are empty.
  * This function does never block.
+ * The field iface_id of the output frame is set to the index of the interface the frame was received from.
  *
  * @retval      1               Read successfully
  * @retval      0               The buffer is empty
@@ -157,6 +169,8 @@ int16_t canardSTM32Receive(CanardCANFrame* const out_frame);
  * Note that when the interface is reinitialized, hardware acceptance filters are reset.
  * Also note that during filter reconfiguration, some RX frames may be lost.
  *
+ * If multiple interfaces are used, the same configuration is applied to all of them.
+ *
  * Setting zero filters will result in rejection of all frames.
  * In order to accept all frames, set one filter with ID = Mask = 0, which is also the default configuration.
  *
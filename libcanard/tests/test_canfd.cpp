@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2016 UAVCAN Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Contributors: https://github.com/UAVCAN/libcanard/contributors
+ */
+
+#include <catch.hpp>
+#include <cstring>
+#include <vector>
+#include "canard_internals.h"
+
+#if CANARD_ENABLE_CANFD
+
+static const uint64_t DataTypeSignature = 0x123456789ABCDEFULL;
+
+static std::vector<std::vector<uint8_t>> g_received_payloads;
+
+static void onReception(CanardInstance* ins, CanardRxTransfer* transfer)
+{
+    std::vector<uint8_t> payload(transfer->payload_len);
+    for (uint16_t i = 0; i < transfer->payload_len; i++)
+    {
+        REQUIRE(8 == canardDecodeScalar(transfer, i * 8U, 8, false, &payload[i]));
+    }
+    canardReleaseRxTransferPayload(ins, transfer);
+    g_received_payloads.push_back(payload);
+}
+
+static bool shouldAccept(const CanardInstance*, uint64_t* out_data_type_signature, uint16_t, CanardTransferType, uint8_t)
+{
+    *out_data_type_signature = DataTypeSignature;
+    return true;
+}
+
+/**
+ * Emulates the CAN FD controller, which can only transmit the frame lengths representable by the DLC
+ * and pads the data with zeros up to the next valid length.
+ */
+static CanardCANFrame padToDLC(const CanardCANFrame& frame)
+{
+    CanardCANFrame out = frame;
+    while (roundDownFrameDataLength(out.data_len) != out.data_len)
+    {
+        out.data[out.data_len++] = 0;
+    }
+    return out;
+}
+
+static std::vector<uint8_t> makePayload(uint16_t len)
+{
+    std::vector<uint8_t> payload(len);
+    for (uint16_t i = 0; i < len; i++)
+    {
+        payload[i] = uint8_t(i * 7U + len);
+    }
+    return payload;
+}
+
+/**
+ * Transmits a transfer, checks the frames, and delivers them to the receiver padded by the controller.
+ * Returns the number of frames.
+ */
+static std::size_t roundTrip(CanardInstance* tx, CanardInstance* rx, const std::vector<uint8_t>& payload,
+                             uint8_t max_data_len, uint64_t& timestamp)
+{
+    static uint8_t transfer_id = 0;
+    const int16_t res = canardBroadcast(tx, DataTypeSignature, 1000, &transfer_id, 0,
+                                        payload.data(), uint16_t(payload.size()));
+    REQUIRE(res > 0);
+
+    std::vector<CanardCANFrame> frames;
+    for (const CanardCANFrame* f; (f = canardPeekTxQueue(tx)) != nullptr; canardPopTxQueue(tx))
+    {
+        frames.push_back(*f);
+    }
+    REQUIRE(std::size_t(res) == frames.size());
+
+    // The frames are never padded, so the padding of the controller can't add bytes that aren't covered by the CRC
+    std::vector<uint8_t> wire_payload;
+    for (const CanardCANFrame& f : frames)
+    {
+        REQUIRE(f.data_len >= 1);
+        REQUIRE(roundDownFrameDataLength(f.data_len) == f.data_len);
+        REQUIRE(f.data_len <= max_data_len);
+        wire_payload.insert(wire_payload.end(), &f.data[0], &f.data[f.data_len - 1]);
+    }
+    if (frames.size() > 1)
+    {
+        const uint16_t crc = uint16_t(wire_payload.at(0) | (wire_payload.at(1) << 8U));
+        wire_payload.erase(wire_payload.begin(), wire_payload.begin() + 2);
+        REQUIRE(crc == crcAdd(crcAddSignature(0xFFFFU, DataTypeSignature), wire_payload.data(), wire_payload.size()));
+    }
+    REQUIRE(wire_payload == payload);
+
+    for (const CanardCANFrame& f : frames)
+    {
+        const CanardCANFrame padded = padToDLC(f);
+        canardHandleRxFrame(rx, &padded, timestamp);
+        timestamp += 100;
+    }
+    return frames.size();
+}
+
+TEST_CASE("CANFD, SingleFrame")
+{
+    static uint8_t tx_pool[4096];
+    static uint8_t rx_pool[4096];
+    CanardInstance tx;
+    CanardInstance rx;
+    canardInit(&tx, tx_pool, sizeof(tx_pool), onReception, shouldAccept, nullptr);
+    canardInit(&rx, rx_pool, sizeof(rx_pool), onReception, shouldAccept, nullptr);
+    canardSetLocalNodeID(&tx, 42);
+    canardSetLocalNodeID(&rx, 43);
+    canardSetCANFDEnabled(&tx, true);
+
+    uint64_t timestamp = 1000000;
+    for (uint16_t len = 0; len <= CANARD_CANFD_FRAME_MAX_DATA_LEN; len++)
+    {
+        g_received_payloads.clear();
+        const auto payload = makePayload(len);
+        const std::size_t num_frames = roundTrip(&tx, &rx, payload, CANARD_CANFD_FRAME_MAX_DATA_LEN, timestamp);
+
+        // A payload that would have to be padded is sent as a multi-frame transfer instead
+        const bool fits_dlc = roundDownFrameDataLength(uint8_t(len + 1U)) == (len + 1U);
+        REQUIRE((num_frames == 1) == fits_dlc);
+
+        REQUIRE(1 == g_received_payloads.size());
+        REQUIRE(payload == g_received_payloads.at(0));
+    }
+}
+
+TEST_CASE("CANFD, MultiFrame")
+{
+    static uint8_t tx_pool[4096];
+    static uint8_t rx_pool[4096];
+    CanardInstance tx;
+    CanardInstance rx;
+    canardInit(&tx, tx_pool, sizeof(tx_pool), onReception, shouldAccept, nullptr);
+    canardInit(&rx, rx_pool, sizeof(rx_pool), onReception, shouldAccept, nullptr);
+    canardSetLocalNodeID(&tx, 42);
+    canardSetLocalNodeID(&rx, 43);
+    canardSetCANFDEnabled(&tx, true);
+
+    uint64_t timestamp = 1000000;
+    for (uint16_t len = CANARD_CANFD_FRAME_MAX_DATA_LEN; len < 400; len++)
+    {
+        g_received_payloads.clear();
+        const auto payload = makePayload(len);
+        const std::size_t num_frames = roundTrip(&tx, &rx, payload, CANARD_CANFD_FRAME_MAX_DATA_LEN, timestamp);
+        REQUIRE(num_frames > 1);
+        // Only the last few frames may be shortened to a valid length
+        REQUIRE(num_frames <= ((len + 2U + 62U) / 63U + 2U));
+
+        REQUIRE(1 == g_received_payloads.size());
+        REQUIRE(payload == g_received_payloads.at(0));
+    }
+
+    // Classic CAN transfers are received as well
+    canardSetCANFDEnabled(&tx, false);
+    for (uint16_t len : { 0, 7, 8, 9, 100 })
+    {
+        g_received_payloads.clear();
+        const auto payload = makePayload(len);
+        REQUIRE(roundTrip(&tx, &rx, payload, CANARD_CAN_FRAME_MAX_DATA_LEN, timestamp) == ((len < 8) ? 1U : (len + 2U + 6U) / 7U));
+        REQUIRE(1 == g_received_payloads.size());
+        REQUIRE(payload == g_received_payloads.at(0));
+    }
+}
+
+#endif
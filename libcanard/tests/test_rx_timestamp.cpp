@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 UAVCAN Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Contributors: https://github.com/UAVCAN/libcanard/contributors
+ */
+
+
+
+#include <catch.hpp>
+#include <cstring>
+#include "canard.h"
+
+
+static uint64_t g_last_transfer_timestamp = 0;
+static unsigned g_num_transfers = 0;
+
+static void onReception(CanardInstance*, CanardRxTransfer* transfer)
+{
+    g_last_transfer_timestamp = transfer->timestamp_usec;
+    g_num_transfers++;
+}
+
+static bool shouldAccept(const CanardInstance*, uint64_t* out_data_type_signature, uint16_t, CanardTransferType, uint8_t)
+{
+    *out_data_type_signature = 0x123456789ABCDEFULL;
+    return true;
+}
+
+TEST_CASE("RxTimestamp, FirstFrame")
+{
+    static uint8_t tx_pool[1024];
+    static uint8_t rx_pool[1024];
+    CanardInstance tx;
+    CanardInstance rx;
+    canardInit(&tx, tx_pool, sizeof(tx_pool), onReception, shouldAccept, nullptr);
+    canardInit(&rx, rx_pool, sizeof(rx_pool), onReception, shouldAccept, nullptr);
+    canardSetLocalNodeID(&tx, 42);
+    canardSetLocalNodeID(&rx, 43);
+
+    uint8_t payload[40];
+    std::memset(payload, 0xA5, sizeof(payload));
+    uint8_t transfer_id = 0;
+    REQUIRE(canardBroadcast(&tx, 0x123456789ABCDEFULL, 1000, &transfer_id, 0, payload, sizeof(payload)) > 1);
+
+    // Frames arrive 100 us apart; the transfer must be timestamped by its first frame
+    g_num_transfers = 0;
+    uint64_t timestamp = 1000000;
+    for (const CanardCANFrame* f; (f = canardPeekTxQueue(&tx)) != nullptr; canardPopTxQueue(&tx))
+    {
+        canardHandleRxFrame(&rx, f, timestamp);
+        timestamp += 100;
+    }
+
+    REQUIRE(1 == g_num_transfers);
+    REQUIRE(1000000 == g_last_transfer_timestamp);
+
+    // A single-frame transfer is timestamped by its only frame; the timestamps need not be strictly increasing
+    REQUIRE(canardBroadcast(&tx, 0x123456789ABCDEFULL, 1000, &transfer_id, 0, payload, 7) == 1);
+    canardHandleRxFrame(&rx, canardPeekTxQueue(&tx), 999950);
+    canardPopTxQueue(&tx);
+
+    REQUIRE(2 == g_num_transfers);
+    REQUIRE(999950 == g_last_transfer_timestamp);
+}
@@ -51,6 +51,21 @@
 #include <senoval/string.hpp>
 #include <senoval/vector.hpp>
 
+/*
+ * The block CRC computation uses the CRC32C instructions if the target supports them, unless
+ * POPCOP_NO_HARDWARE_CRC is defined. Otherwise, a portable slice-by-8 implementation is used.
+ */
+#if !defined(POPCOP_NO_HARDWARE_CRC) && defined(__SSE4_2__) && defined(__x86_64__)
+# define POPCOP_HARDWARE_CRC 1
+# include <nmmintrin.h>
+#elif !defined(POPCOP_NO_HARDWARE_CRC) && defined(__ARM_FEATURE_CRC32) && defined(__aarch64__) && \
+      (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+# define POPCOP_HARDWARE_CRC 1
+# include <arm_acle.h>
+#else
+# define POPCOP_HARDWARE_CRC 0
+#endif
+
 
 namespace popcop
 {
@@ -75,6 +90,147 @@ static constexpr std::uint8_t EscapeCharacter = 0x9E;
  */
 static constexpr std::size_t ParserBufferAlignment = std::max<std::size_t>(64U, alignof(std::max_align_t)); // NOLINT
 
+/// Implementation details; do not use that in user code
+namespace detail_
+{
+/// The CRC-32C (Castagnoli) lookup table for one byte; it is shared by all implementations.
+inline constexpr std::uint32_t CRC32CTable[256] =
+{
+    0x00000000U, 0xF26B8303U, 0xE13B70F7U, 0x1350F3F4U, 0xC79A971FU, 0x35F1141CU, 0x26A1E7E8U, 0xD4CA64EBU,
+    0x8AD958CFU, 0x78B2DBCCU, 0x6BE22838U, 0x9989AB3BU, 0x4D43CFD0U, 0xBF284CD3U, 0xAC78BF27U, 0x5E133C24U,
+    0x105EC76FU, 0xE235446CU, 0xF165B798U, 0x030E349BU, 0xD7C45070U, 0x25AFD373U, 0x36FF2087U, 0xC494A384U,
+    0x9A879FA0U, 0x68EC1CA3U, 0x7BBCEF57U, 0x89D76C54U, 0x5D1D08BFU, 0xAF768BBCU, 0xBC267848U, 0x4E4DFB4BU,
+    0x20BD8EDEU, 0xD2D60DDDU, 0xC186FE29U, 0x33ED7D2AU, 0xE72719C1U, 0x154C9AC2U, 0x061C6936U, 0xF477EA35U,
+    0xAA64D611U, 0x580F5512U, 0x4B5FA6E6U, 0xB93425E5U, 0x6DFE410EU, 0x9F95C20DU, 0x8CC531F9U, 0x7EAEB2FAU,
+    0x30E349B1U, 0xC288CAB2U, 0xD1D83946U, 0x23B3BA45U, 0xF779DEAEU, 0x05125DADU, 0x1642AE59U, 0xE4292D5AU,
+    0xBA3A117EU, 0x4851927DU, 0x5B016189U, 0xA96AE28AU, 0x7DA08661U, 0x8FCB0562U, 0x9C9BF696U, 0x6EF07595U,
+    0x417B1DBCU, 0xB3109EBFU, 0xA0406D4BU, 0x522BEE48U, 0x86E18AA3U, 0x748A09A0U, 0x67DAFA54U, 0x95B17957U,
+    0xCBA24573U, 0x39C9C670U, 0x2A993584U, 0xD8F2B687U, 0x0C38D26CU, 0xFE53516FU, 0xED03A29BU, 0x1F682198U,
+    0x5125DAD3U, 0xA34E59D0U, 0xB01EAA24U, 0x42752927U, 0x96BF4DCCU, 0x64D4CECFU, 0x77843D3BU, 0x85EFBE38U,
+    0xDBFC821CU, 0x2997011FU, 0x3AC7F2EBU, 0xC8AC71E8U, 0x1C661503U, 0xEE0D9600U, 0xFD5D65F4U, 0x0F36E6F7U,
+    0x61C69362U, 0x93AD1061U, 0x80FDE395U, 0x72966096U, 0xA65C047DU, 0x5437877EU, 0x4767748AU, 0xB50CF789U,
+    0xEB1FCBADU, 0x197448AEU, 0x0A24BB5AU, 0xF84F3859U, 0x2C855CB2U, 0xDEEEDFB1U, 0xCDBE2C45U, 0x3FD5AF46U,
+    0x7198540DU, 0x83F3D70EU, 0x90A324FAU, 0x62C8A7F9U, 0xB602C312U, 0x44694011U, 0x5739B3E5U, 0xA55230E6U,
+    0xFB410CC2U, 0x092A8FC1U, 0x1A7A7C35U, 0xE811FF36U, 0x3CDB9BDDU, 0xCEB018DEU, 0xDDE0EB2AU, 0x2F8B6829U,
+    0x82F63B78U, 0x709DB87BU, 0x63CD4B8FU, 0x91A6C88CU, 0x456CAC67U, 0xB7072F64U, 0xA457DC90U, 0x563C5F93U,
+    0x082F63B7U, 0xFA44E0B4U, 0xE9141340U, 0x1B7F9043U, 0xCFB5F4A8U, 0x3DDE77ABU, 0x2E8E845FU, 0xDCE5075CU,
+    0x92A8FC17U, 0x60C37F14U, 0x73938CE0U, 0x81F80FE3U, 0x55326B08U, 0xA759E80BU, 0xB4091BFFU, 0x466298FCU,
+    0x1871A4D8U, 0xEA1A27DBU, 0xF94AD42FU, 0x0B21572CU, 0xDFEB33C7U, 0x2D80B0C4U, 0x3ED04330U, 0xCCBBC033U,
+    0xA24BB5A6U, 0x502036A5U, 0x4370C551U, 0xB11B4652U, 0x65D122B9U, 0x97BAA1BAU, 0x84EA524EU, 0x7681D14DU,
+    0x2892ED69U, 0xDAF96E6AU, 0xC9A99D9EU, 0x3BC21E9DU, 0xEF087A76U, 0x1D63F975U, 0x0E330A81U, 0xFC588982U,
+    0xB21572C9U, 0x407EF1CAU, 0x532E023EU, 0xA145813DU, 0x758FE5D6U, 0x87E466D5U, 0x94B49521U, 0x66DF1622U,
+    0x38CC2A06U, 0xCAA7A905U, 0xD9F75AF1U, 0x2B9CD9F2U, 0xFF56BD19U, 0x0D3D3E1AU, 0x1E6DCDEEU, 0xEC064EEDU,
+    0xC38D26C4U, 0x31E6A5C7U, 0x22B65633U, 0xD0DDD530U, 0x0417B1DBU, 0xF67C32D8U, 0xE52CC12CU, 0x1747422FU,
+    0x49547E0BU, 0xBB3FFD08U, 0xA86F0EFCU, 0x5A048DFFU, 0x8ECEE914U, 0x7CA56A17U, 0x6FF599E3U, 0x9D9E1AE0U,
+    0xD3D3E1ABU, 0x21B862A8U, 0x32E8915CU, 0xC083125FU, 0x144976B4U, 0xE622F5B7U, 0xF5720643U, 0x07198540U,
+    0x590AB964U, 0xAB613A67U, 0xB831C993U, 0x4A5A4A90U, 0x9E902E7BU, 0x6CFBAD78U, 0x7FAB5E8CU, 0x8DC0DD8FU,
+    0xE330A81AU, 0x115B2B19U, 0x020BD8EDU, 0xF0605BEEU, 0x24AA3F05U, 0xD6C1BC06U, 0xC5914FF2U, 0x37FACCF1U,
+    0x69E9F0D5U, 0x9B8273D6U, 0x88D28022U, 0x7AB90321U, 0xAE7367CAU, 0x5C18E4C9U, 0x4F48173DU, 0xBD23943EU,
+    0xF36E6F75U, 0x0105EC76U, 0x12551F82U, 0xE03E9C81U, 0x34F4F86AU, 0xC69F7B69U, 0xD5CF889DU, 0x27A40B9EU,
+    0x79B737BAU, 0x8BDCB4B9U, 0x988C474DU, 0x6AE7C44EU, 0xBE2DA0A5U, 0x4C4623A6U, 0x5F16D052U, 0xAD7D5351U,
+};
+static_assert(sizeof(CRC32CTable) == 1024, "Invalid CRC table");
+
+/// The slice-by-8 tables 1 to 7; the table 0 is CRC32CTable itself.
+using CRC32CSliceTables = std::array<std::array<std::uint32_t, 256>, 7>;
+
+/// Table k maps a byte to its contribution to the CRC when it is followed by k more bytes.
+constexpr CRC32CSliceTables makeCRC32CSliceBy8Tables()
+{
+    CRC32CSliceTables t{};
+    for (std::size_t i = 0; i < 256; i++)
+    {
+        t[0][i] = (CRC32CTable[i] >> 8U) ^ CRC32CTable[CRC32CTable[i] & 0xFFU];
+    }
+
+    for (std::size_t k = 1; k < t.size(); k++)
+    {
+        for (std::size_t i = 0; i < 256; i++)
+        {
+            t[k][i] = (t[k - 1][i] >> 8U) ^ CRC32CTable[t[k - 1][i] & 0xFFU];
+        }
+    }
+
+    return t;
+}
+
+/**
+ * CRC-32C kernels for blocks of data. They operate on the CRC register directly, without the output inversion.
+ * All of them produce the same result; the fastest one available is used by CRCComputer.
+ */
+class CRC32C
+{
+    // The tables take 7 KiB; they are linked in only if the block computation is actually used.
+    static constexpr CRC32CSliceTables SliceBy8Tables = makeCRC32CSliceBy8Tables();
+
+    static std::uint32_t loadLittleEndian32(const std::uint8_t* p)
+    {
+        return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8U) |
+               (std::uint32_t(p[2]) << 16U) | (std::uint32_t(p[3]) << 24U);
+    }
+
+public:
+    static std::uint32_t updateBytewise(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+    {
+        const auto& t = CRC32CTable;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            crc = t[(crc ^ data[i]) & 0xFFU] ^ (crc >> 8U);
+        }
+        return crc;
+    }
+
+    static std::uint32_t updateSliceBy8(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+    {
+        const auto& t = SliceBy8Tables;        // Table k is at t[k - 1]
+        for (; size >= 8; size -= 8, data += 8)
+        {
+            const std::uint32_t lo = crc ^ loadLittleEndian32(data);
+            const std::uint32_t hi = loadLittleEndian32(data + 4);
+            crc = t[6][lo & 0xFFU] ^ t[5][(lo >> 8U) & 0xFFU] ^ t[4][(lo >> 16U) & 0xFFU] ^ t[3][lo >> 24U] ^
+                  t[2][hi & 0xFFU] ^ t[1][(hi >> 8U) & 0xFFU] ^ t[0][(hi >> 16U) & 0xFFU] ^ CRC32CTable[hi >> 24U];
+        }
+        return updateBytewise(crc, data, size);
+    }
+
+#if POPCOP_HARDWARE_CRC
+    static std::uint32_t updateHardware(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+    {
+        for (; size >= 8; size -= 8, data += 8)
+        {
+            std::uint64_t word = 0;
+            std::memcpy(&word, data, sizeof(word));         // Little-endian target, see POPCOP_HARDWARE_CRC
+# if defined(__SSE4_2__)
+            crc = std::uint32_t(_mm_crc32_u64(crc, word));
+# else
+            crc = __crc32cd(crc, word);
+# endif
+        }
+
+        for (; size > 0; size--, data++)
+        {
+# if defined(__SSE4_2__)
+            crc = _mm_crc32_u8(crc, *data);
+# else
+            crc = __crc32cb(crc, *data);
+# endif
+        }
+        return crc;
+    }
+#endif
+
+    static std::uint32_t update(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+    {
+#if POPCOP_HARDWARE_CRC
+        return updateHardware(crc, data, size);
+#else
+        return updateSliceBy8(crc, data, size);
+#endif
+    }
+};
+
+} // namespace detail_
+
 /**
  * Implementation of the CRC-32C (Castagnoli) algorithm.
  */
@@ -85,44 +241,16 @@ class CRCComputer
 public:
     void add(std::uint8_t byte)
     {
-        static constexpr std::uint32_t table[] =
-        {
-            0x00000000U, 0xF26B8303U, 0xE13B70F7U, 0x1350F3F4U, 0xC79A971FU, 0x35F1141CU, 0x26A1E7E8U, 0xD4CA64EBU,
-            0x8AD958CFU, 0x78B2DBCCU, 0x6BE22838U, 0x9989AB3BU, 0x4D43CFD0U, 0xBF284CD3U, 0xAC78BF27U, 0x5E133C24U,
-            0x105EC76FU, 0xE235446CU, 0xF165B798U, 0x030E349BU, 0xD7C45070U, 0x25AFD373U, 0x36FF2087U, 0xC494A384U,
-            0x9A879FA0U, 0x68EC1CA3U, 0x7BBCEF57U, 0x89D76C54U, 0x5D1D08BFU, 0xAF768BBCU, 0xBC267848U, 0x4E4DFB4BU,
-            0x20BD8EDEU, 0xD2D60DDDU, 0xC186FE29U, 0x33ED7D2AU, 0xE72719C1U, 0x154C9AC2U, 0x061C6936U, 0xF477EA35U,
-            0xAA64D611U, 0x580F5512U, 0x4B5FA6E6U, 0xB93425E5U, 0x6DFE410EU, 0x9F95C20DU, 0x8CC531F9U, 0x7EAEB2FAU,
-            0x30E349B1U, 0xC288CAB2U, 0xD1D83946U, 0x23B3BA45U, 0xF779DEAEU, 0x05125DADU, 0x1642AE59U, 0xE4292D5AU,
-            0xBA3A117EU, 0x4851927DU, 0x5B016189U, 0xA96AE28AU, 0x7DA08661U, 0x8FCB0562U, 0x9C9BF696U, 0x6EF07595U,
-            0x417B1DBCU, 0xB3109EBFU, 0xA0406D4BU, 0x522BEE48U, 0x86E18AA3U, 0x748A09A0U, 0x67DAFA54U, 0x95B17957U,
-            0xCBA24573U, 0x39C9C670U, 0x2A993584U, 0xD8F2B687U, 0x0C38D26CU, 0xFE53516FU, 0xED03A29BU, 0x1F682198U,
-            0x5125DAD3U, 0xA34E59D0U, 0xB01EAA24U, 0x42752927U, 0x96BF4DCCU, 0x64D4CECFU, 0x77843D3BU, 0x85EFBE38U,
-            0xDBFC821CU, 0x2997011FU, 0x3AC7F2EBU, 0xC8AC71E8U, 0x1C661503U, 0xEE0D9600U, 0xFD5D65F4U, 0x0F36E6F7U,
-            0x61C69362U, 0x93AD1061U, 0x80FDE395U, 0x72966096U, 0xA65C047DU, 0x5437877EU, 0x4767748AU, 0xB50CF789U,
-            0xEB1FCBADU, 0x197448AEU, 0x0A24BB5AU, 0xF84F3859U, 0x2C855CB2U, 0xDEEEDFB1U, 0xCDBE2C45U, 0x3FD5AF46U,
-            0x7198540DU, 0x83F3D70EU, 0x90A324FAU, 0x62C8A7F9U, 0xB602C312U, 0x44694011U, 0x5739B3E5U, 0xA55230E6U,
-            0xFB410CC2U, 0x092A8FC1U, 0x1A7A7C35U, 0xE811FF36U, 0x3CDB9BDDU, 0xCEB018DEU, 0xDDE0EB2AU, 0x2F8B6829U,
-            0x82F63B78U, 0x709DB87BU, 0x63CD4B8FU, 0x91A6C88CU, 0x456CAC67U, 0xB7072F64U, 0xA457DC90U, 0x563C5F93U,
-            0x082F63B7U, 0xFA44E0B4U, 0xE9141340U, 0x1B7F9043U, 0xCFB5F4A8U, 0x3DDE77ABU, 0x2E8E845FU, 0xDCE5075CU,
-            0x92A8FC17U, 0x60C37F14U, 0x73938CE0U, 0x81F80FE3U, 0x55326B08U, 0xA759E80BU, 0xB4091BFFU, 0x466298FCU,
-            0x1871A4D8U, 0xEA1A27DBU, 0xF94AD42FU, 0x0B21572CU, 0xDFEB33C7U, 0x2D80B0C4U, 0x3ED04330U, 0xCCBBC033U,
-            0xA24BB5A6U, 0x502036A5U, 0x4370C551U, 0xB11B4652U, 0x65D122B9U, 0x97BAA1BAU, 0x84EA524EU, 0x7681D14DU,
-            0x2892ED69U, 0xDAF96E6AU, 0xC9A99D9EU, 0x3BC21E9DU, 0xEF087A76U, 0x1D63F975U, 0x0E330A81U, 0xFC588982U,
-            0xB21572C9U, 0x407EF1CAU, 0x532E023EU, 0xA145813DU, 0x758FE5D6U, 0x87E466D5U, 0x94B49521U, 0x66DF1622U,
-            0x38CC2A06U, 0xCAA7A905U, 0xD9F75AF1U, 0x2B9CD9F2U, 0xFF56BD19U, 0x0D3D3E1AU, 0x1E6DCDEEU, 0xEC064EEDU,
-            0xC38D26C4U, 0x31E6A5C7U, 0x22B65633U, 0xD0DDD530U, 0x0417B1DBU, 0xF67C32D8U, 0xE52CC12CU, 0x1747422FU,
-            0x49547E0BU, 0xBB3FFD08U, 0xA86F0EFCU, 0x5A048DFFU, 0x8ECEE914U, 0x7CA56A17U, 0x6FF599E3U, 0x9D9E1AE0U,
-            0xD3D3E1ABU, 0x21B862A8U, 0x32E8915CU, 0xC083125FU, 0x144976B4U, 0xE622F5B7U, 0xF5720643U, 0x07198540U,
-            0x590AB964U, 0xAB613A67U, 0xB831C993U, 0x4A5A4A90U, 0x9E902E7BU, 0x6CFBAD78U, 0x7FAB5E8CU, 0x8DC0DD8FU,
-            0xE330A81AU, 0x115B2B19U, 0x020BD8EDU, 0xF0605BEEU, 0x24AA3F05U, 0xD6C1BC06U, 0xC5914FF2U, 0x37FACCF1U,
-            0x69E9F0D5U, 0x9B8273D6U, 0x88D28022U, 0x7AB90321U, 0xAE7367CAU, 0x5C18E4C9U, 0x4F48173DU, 0xBD23943EU,
-            0xF36E6F75U, 0x0105EC76U, 0x12551F82U, 0xE03E9C81U, 0x34F4F86AU, 0xC69F7B69U, 0xD5CF889DU, 0x27A40B9EU,
-            0x79B737BAU, 0x8BDCB4B9U, 0x988C474DU, 0x6AE7C44EU, 0xBE2DA0A5U, 0x4C4623A6U, 0x5F16D052U, 0xAD7D5351U,
-        };
-        static_assert(sizeof(table) == 1024, "Invalid CRC table");
-
-        value_ = table[byte ^ (value_ & 0xFF)] ^ (value_ >> 8);
+        value_ = detail_::CRC32CTable[byte ^ (value_ & 0xFF)] ^ (value_ >> 8);
+    }
+
+    /**
+     * Adds a block of bytes. The result is the same as if the bytes were added one by one, but it is computed
+     * eight bytes at a time, using the CRC32C instructions if available (see POPCOP_HARDWARE_CRC).
+     */
+    void add(const void* data, std::size_t size)
+    {
+        value_ = detail_::CRC32C::update(value_, static_cast<const std::uint8_t*>(data), size);
     }
 
     [[nodiscard]] std::uint32_t get() const { return value_ ^ 0xFFFFFFFFU; }
@@ -296,6 +424,43 @@ class Parser
     CRCComputer crc_;
     bool unescape_next_ = false;
 
+    /**
+     * Returns the index of the first frame delimiter or escape character in the block, or its size if there are none.
+     * The block is scanned a machine word at a time; the two special characters differ in one bit only,
+     * so setting that bit in every byte reduces the search for either of them to the search for one byte value.
+     */
+    static std::size_t findSpecialCharacter(const std::uint8_t* const data, const std::size_t size)
+    {
+        static_assert((FrameDelimiter | 0x10U) == EscapeCharacter, "The special characters must differ in one bit");
+
+        using Word = std::uint64_t;
+        static constexpr Word Ones = ~Word(0) / 0xFFU;              // 0x0101...01
+        static constexpr Word Mask = Ones * 0x10U;
+        static constexpr Word Pattern = Ones * EscapeCharacter;
+
+        std::size_t i = 0;
+        for (; (i + sizeof(Word)) <= size; i += sizeof(Word))
+        {
+            Word w{};
+            std::memcpy(&w, data + i, sizeof(Word));                // Alignment-agnostic; compiles into one load
+            w = (w | Mask) ^ Pattern;                               // The special characters become zero bytes
+            if (((w - Ones) & ~w & (Ones * 0x80U)) != 0)
+            {
+                break;                                              // There is a zero byte; find it below
+            }
+        }
+
+        for (; i < size; i++)
+        {
+            if ((data[i] | 0x10U) == EscapeCharacter)
+            {
+                break;
+            }
+        }
+
+        return i;
+    }
+
     bool checkIfReceivedFrameValid()
     {
         return (buffer_pos_ >= PayloadOverheadNotIncludingDelimiters) && (crc_.isResidueCorrect());
@@ -401,6 +566,46 @@ public:
         }
     }
 
+    /**
+     * Processes a block of bytes received from the channel.
+     * The result is the same as if processNextByte() was invoked for every byte in the block, but it is much faster:
+     * runs of bytes that need no unescaping are located a machine word at a time, and then copied into the buffer
+     * and added to the CRC in bulk.
+     *
+     * @param data      The data received from the channel.
+     * @param size      The number of bytes in the block.
+     * @param handler   Invoked with every non-empty parser output, in the order of appearance, as
+     *                  handler(const ParserOutput&). The output is valid only until the handler returns.
+     */
+    template <typename Handler>
+    void processBytes(const std::uint8_t* data, std::size_t size, Handler&& handler)
+    {
+        const std::uint8_t* const end = data + size;
+        while (data < end)
+        {
+            // The last free byte of the buffer is left to processNextByte(), which handles the overflow
+            const std::size_t room = buffer_.size() - buffer_pos_ - 1U;
+            if (!unescape_next_ && (room > 0))
+            {
+                const std::size_t run = findSpecialCharacter(data, std::min(room, std::size_t(end - data)));
+                if (run > 0)
+                {
+                    std::memcpy(buffer_.data() + buffer_pos_, data, run);
+                    crc_.add(data, run);
+                    buffer_pos_ += run;
+                    data += run;
+                    continue;
+                }
+            }
+
+            const auto out = processNextByte(*data++);
+            if ((out.getReceivedFrame() != nullptr) || (out.getExtraneousData() != nullptr))
+            {
+                handler(out);
+            }
+        }
+    }
+
     /**
      * Resets the inner state of the parser.
      * Use this method when your communication channel is reset.
@@ -36,6 +36,10 @@
 #include <iostream>
 #include <iomanip>
 #include <cmath>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
 
 // Note that we should NOT define CATCH_CONFIG_MAIN in the same translation unit which also contains tests;
 // that slows things down.
@@ -635,6 +639,100 @@ TEST_CASE("ParserOverflow")
 }
 
 
+namespace
+{
+/**
+ * Parser outputs that can be compared with each other; extraneous data are stored with the type code of -1.
+ */
+using RecordedParserOutput = std::pair<int, std::vector<std::uint8_t>>;
+
+RecordedParserOutput recordParserOutput(const transport::ParserOutput& o)
+{
+    if (auto f = o.getReceivedFrame())
+    {
+        REQUIRE((reinterpret_cast<std::uintptr_t>(f->payload.data()) % transport::ParserBufferAlignment) == 0);
+        return {f->type_code, {f->payload.begin(), f->payload.end()}};
+    }
+
+    auto e = o.getExtraneousData();
+    REQUIRE(e != nullptr);
+    return {-1, {e->begin(), e->end()}};
+}
+
+}
+
+
+TEST_CASE("ParserBulk")
+{
+    std::srand(unsigned(std::time(nullptr)));
+
+    // The alphabet is dominated by the special characters and the values that differ from them in one bit
+    static const std::array<std::uint8_t, 12> Alphabet{{
+        transport::FrameDelimiter, transport::EscapeCharacter, 0x0E, 0x1E, 0x8F, 0x9F, 0xAE, 0xBE, 0xCE, 0x86,
+        0x00, 0xFF
+    }};
+
+    for (int iteration = 0; iteration < 300; iteration++)
+    {
+        // A stream of valid frames, garbage, and frames that are too long for the parser
+        std::vector<std::uint8_t> stream;
+        const auto sink = [&](std::uint8_t x) { stream.push_back(x); };
+        while (stream.size() < 20000)
+        {
+            std::vector<std::uint8_t> data(std::size_t(getRandomByte()) * ((getRandomByte() % 8U) + 1U));
+            for (auto& x : data)
+            {
+                x = getRandomBit() ? Alphabet.at(getRandomByte() % Alphabet.size()) : getRandomByte();
+            }
+
+            if ((getRandomByte() % 4U) == 0)
+            {
+                stream.insert(stream.end(), data.begin(), data.end());
+            }
+            else
+            {
+                std::copy(data.begin(), data.end(), transport::StreamEmitter(getRandomByte(), sink).begin());
+            }
+        }
+
+        // Reference: byte by byte
+        std::vector<RecordedParserOutput> reference;
+        {
+            transport::Parser<1024> parser;
+            for (std::uint8_t x : stream)
+            {
+                const auto out = parser.processNextByte(x);
+                if ((out.getReceivedFrame() != nullptr) || (out.getExtraneousData() != nullptr))
+                {
+                    reference.push_back(recordParserOutput(out));
+                }
+            }
+        }
+
+        // Bulk: blocks of random size, including empty ones
+        std::vector<RecordedParserOutput> bulk;
+        {
+            transport::Parser<1024> parser;
+            std::size_t offset = 0;
+            while (offset < stream.size())
+            {
+                const std::size_t size = std::min<std::size_t>(stream.size() - offset,
+                                                               getRandomBit() ? getRandomByte() % 16U :
+                                                                                getRandomByte() * 16U);
+                parser.processBytes(stream.data() + offset, size, [&](const transport::ParserOutput& out)
+                {
+                    bulk.push_back(recordParserOutput(out));
+                });
+                offset += size;
+            }
+        }
+
+        REQUIRE(reference.size() > 10);
+        REQUIRE(bulk == reference);
+    }
+}
+
+
 TEST_CASE("CRC")
 {
     transport::CRCComputer crc;
@@ -661,6 +759,106 @@ TEST_CASE("CRC")
     crc.add(0xE3);
 
     REQUIRE(crc.isResidueCorrect());
+
+    // Block input
+    transport::CRCComputer block_crc;
+    block_crc.add("1234", 4);
+    block_crc.add("56789", 5);
+    block_crc.add(nullptr, 0);
+    REQUIRE(block_crc.get() == 0xE3069283);
+}
+
+
+namespace
+{
+/**
+ * The block CRC kernels that are available on this target, with their names.
+ */
+using CRCKernel = std::uint32_t (*)(std::uint32_t, const std::uint8_t*, std::size_t);
+
+std::vector<std::pair<std::string, CRCKernel>> getCRCKernels()
+{
+    std::vector<std::pair<std::string, CRCKernel>> out{
+        {"bytewise", &transport::detail_::CRC32C::updateBytewise},
+        {"slice-by-8", &transport::detail_::CRC32C::updateSliceBy8},
+    };
+#if POPCOP_HARDWARE_CRC
+    out.emplace_back("hardware", &transport::detail_::CRC32C::updateHardware);
+#endif
+    return out;
+}
+
+}
+
+
+TEST_CASE("CRCKernels")
+{
+    std::cout << "Hardware CRC: " << POPCOP_HARDWARE_CRC << std::endl;
+
+    std::vector<std::uint8_t> data(4096 + 16);
+    for (auto& x : data)
+    {
+        x = getRandomByte();
+    }
+
+    // All kernels agree with the reference byte-by-byte implementation at any alignment and length
+    for (int i = 0; i < 1000; i++)
+    {
+        const std::size_t offset = getRandomByte() % 16U;
+        const std::size_t size = std::size_t(std::rand()) % (data.size() - offset);  // NOLINT
+
+        transport::CRCComputer reference;
+        for (std::size_t k = 0; k < size; k++)
+        {
+            reference.add(data[offset + k]);
+        }
+
+        for (const auto& [name, kernel] : getCRCKernels())
+        {
+            const std::uint32_t crc = kernel(0xFFFFFFFFU, data.data() + offset, size) ^ 0xFFFFFFFFU;
+            if (crc != reference.get())
+            {
+                FAIL(name << " offset " << offset << " size " << size);
+            }
+        }
+
+        transport::CRCComputer block;
+        block.add(data.data() + offset, size);
+        REQUIRE(block.get() == reference.get());
+
+        // The residue is correct after the CRC itself is added in block mode as well
+        const std::uint32_t value = block.get();
+        const std::array<std::uint8_t, 4> crc_bytes{{std::uint8_t(value), std::uint8_t(value >> 8U),
+                                                     std::uint8_t(value >> 16U), std::uint8_t(value >> 24U)}};
+        block.add(crc_bytes.data(), crc_bytes.size());
+        REQUIRE(block.isResidueCorrect());
+    }
+}
+
+
+TEST_CASE("CRCBenchmark-slow")
+{
+    std::vector<std::uint8_t> data(1024 * 1024);
+    for (auto& x : data)
+    {
+        x = getRandomByte();
+    }
+
+    constexpr int NumberOfIterations = 100;
+    for (const auto& [name, kernel] : getCRCKernels())
+    {
+        std::uint32_t crc = 0xFFFFFFFFU;
+        const auto started_at = std::chrono::steady_clock::now();
+        for (int i = 0; i < NumberOfIterations; i++)
+        {
+            crc = kernel(crc, data.data(), data.size());
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+
+        std::cout << std::setw(12) << name << ": "
+                  << std::fixed << std::setprecision(1) << (double(NumberOfIterations) / seconds) << " MiB/s "
+                  << "(CRC 0x" << std::hex << crc << std::dec << ")" << std::endl;
+    }
 }
 
 
@@ -40,8 +40,10 @@ namespace senoval
 {
 /**
  * A vector with fixed storage, API like std::vector<>.
- * This implementation supports only trivial types, since that is sufficient for the needs of this library.
- * Support for non-trivial types may be added in the future in a fully backward-compatible way.
+ * This implementation supports only trivially copyable and trivially destructible types, since that is sufficient
+ * for the needs of this library. Such types may have default member initializers; note that the whole storage
+ * is default-initialized on construction then.
+ * Support for other non-trivial types may be added in the future in a fully backward-compatible way.
  */
 template <typename T, std::size_t Capacity_>
 class Vector
@@ -50,7 +52,8 @@ public:
     static constexpr std::size_t Capacity = Capacity_;
 
     static_assert(Capacity > 0, "Capacity must be positive");
-    static_assert(std::is_trivial<T>::value, "This implementation supports only trivial types.");
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+                  "This implementation supports only trivially copyable and trivially destructible types.");
 
 private:
     std::size_t len_ = 0;
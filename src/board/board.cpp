@@ -52,10 +52,10 @@ inline void initCAN()
 {
     os::CriticalSectionLocker locker;
 
-    RCC->APB1ENR  |=  RCC_APB1ENR_CAN1EN;           // CAN1
-    RCC->APB1RSTR |=  RCC_APB1RSTR_CAN1RST;
-    RCC->APB1RSTR &= ~RCC_APB1RSTR_CAN1RST;
-    // CAN2 is not used
+    // CAN2 is a slave of CAN1, so both clocks must be enabled
+    RCC->APB1ENR  |=  (RCC_APB1ENR_CAN1EN   | RCC_APB1ENR_CAN2EN);
+    RCC->APB1RSTR |=  (RCC_APB1RSTR_CAN1RST | RCC_APB1RSTR_CAN2RST);
+    RCC->APB1RSTR &= ~(RCC_APB1RSTR_CAN1RST | RCC_APB1RSTR_CAN2RST);
 }
 
 
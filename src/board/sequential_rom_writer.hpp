@@ -98,6 +98,38 @@ class SequentialROMWriter
         FLASH->CR = 0;
     }
 
+    /**
+     * Erases the sectors that we're going to write into beforehand, and advances the address.
+     * Advance the erase sector index as we go - we don't want to erase sectors more than once because
+     * that would destroy data that we've written earlier.
+     * Note that we use granular critical sections to reduce IRQ impact.
+     */
+    bool eraseAndAdvance(const std::size_t how_much)
+    {
+        for (std::size_t offset = 0; offset < how_much; offset++)
+        {
+            const auto sn = mapAddressToSectorNumber(address_);
+            address_++;
+
+            if (!sn)
+            {
+                return false;
+            }
+
+            if (*sn >= next_sector_to_erase_)
+            {
+                next_sector_to_erase_ = *sn;
+
+                DEBUG_LOG("Erasing sector %d @%08x\n", next_sector_to_erase_, unsigned(address_));
+                eraseSector(next_sector_to_erase_);
+
+                next_sector_to_erase_++;
+            }
+        }
+
+        return true;
+    }
+
 public:
     enum class AutoEraseMode
     {
@@ -131,31 +163,9 @@ public:
 
         const std::size_t original_address = address_;
 
-        /*
-         * Erase the sectors that we're going to write into beforehand.
-         * Advance the erase sector index as we go - we don't want to erase sectors more than once because
-         * that would destroy data that we've written earlier.
-         * Note that we use granular critical sections to reduce IRQ impact.
-         */
-        for (std::size_t offset = 0; offset < how_much; offset++)
+        if (!eraseAndAdvance(how_much))
         {
-            const auto sn = mapAddressToSectorNumber(address_);
-            address_++;
-
-            if (!sn)
-            {
-                return false;
-            }
-
-            if (*sn >= next_sector_to_erase_)
-            {
-                next_sector_to_erase_ = *sn;
-
-                DEBUG_LOG("Erasing sector %d @%08x\n", next_sector_to_erase_, unsigned(address_));
-                eraseSector(next_sector_to_erase_);
-
-                next_sector_to_erase_++;
-            }
+            return false;
         }
 
         /*
@@ -188,9 +198,13 @@ public:
         return std::memcmp(what, reinterpret_cast<void*>(original_address), how_much) == 0;
     }
 
-    void skip(const std::size_t how_much)
+    /**
+     * Advances the address without writing. The skipped memory is erased as well, so that it can be written
+     * later out of order using a separate writer with auto erase disabled.
+     */
+    bool skip(const std::size_t how_much)
     {
-        address_ += how_much;
+        return eraseAndAdvance(how_much);
     }
 
     std::size_t getAddress() const { return address_; }
@@ -88,6 +88,32 @@ void setStatusLEDFromBootloaderState(const kocherga::State s)
 }
 
 
+/**
+ * All components are driven from the main loop; none of the calls block.
+ * The loop yields for one time quantum per pass, which is shorter than a CAN frame at the highest bit rate,
+ * so the CAN RX FIFO does not overflow, while the idle thread and other lower priority activities get to run.
+ */
+void pollComponents()
+{
+    board::kickWatchdog();
+    uavcan::poll();
+    serial::poll();
+    chThdSleep(1);
+}
+
+/**
+ * Keeps the components running for a while, e.g. to let them flush their output before reboot.
+ */
+void pollComponentsFor(const std::chrono::milliseconds duration)
+{
+    const auto deadline = board::Clock::now() + duration;
+    while (board::Clock::now() < deadline)
+    {
+        pollComponents();
+    }
+}
+
+
 [[noreturn]]
 void doBoot()
 {
@@ -206,11 +232,11 @@ int main()
     }
 
     /*
-     * Main loop
+     * Main loop; all components run in this thread
      */
     while (!os::isShutdownRequested())
     {
-        board::kickWatchdog();
+        app::pollComponents();
 
         const auto bl_state = bl.getState();
         if (bl_state == kocherga::State::ReadyToBoot)
@@ -219,14 +245,12 @@ int main()
         }
 
         app::setStatusLEDFromBootloaderState(bl_state);
-
-        chThdSleepMilliseconds(50);
     }
 
     if (os::isShutdownRequested())
     {
         std::puts("REBOOT");
-        chThdSleepMilliseconds(500);            // Providing some time for other components to react
+        app::pollComponentsFor(std::chrono::milliseconds(500));     // Providing some time for other components to react
         board::restart();
     }
 
@@ -235,7 +259,7 @@ int main()
      */
     os::requestShutdown();
     std::puts("BOOT");
-    chThdSleepMilliseconds(500);                // Providing some time for other components to react
+    app::pollComponentsFor(std::chrono::milliseconds(500));         // Providing some time for other components to react
     app::doBoot();
 
     return 0;
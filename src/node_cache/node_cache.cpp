@@ -0,0 +1,42 @@
+/**
+ * Copyright (c) 2018  Zubax Robotics  <info@zubax.com>
+ */
+
+#include "node_cache.hpp"
+#include <os.hpp>
+#include <hal.h>
+#include <kocherga.hpp>
+
+
+namespace node_cache
+{
+namespace
+{
+
+auto makeMarshaller()
+{
+    // Backup domain write access (PWR_CR_DBP) is enabled by the HAL during clock initialization.
+    // The last backup registers are used in order to reduce the chance of collisions with the application.
+    return kocherga::makeAppDataExchangeMarshaller<NodeCache>(&RTC->BKP16R,
+                                                              &RTC->BKP17R,
+                                                              &RTC->BKP18R,
+                                                              &RTC->BKP19R);
+}
+
+chibios_rt::Mutex g_mutex;
+
+}
+
+std::optional<NodeCache> readAndInvalidate()
+{
+    os::MutexLocker locker(g_mutex);
+    return makeMarshaller().readAndErase();
+}
+
+void write(const NodeCache& cache)
+{
+    os::MutexLocker locker(g_mutex);
+    makeMarshaller().write(cache);
+}
+
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2018  Zubax Robotics  <info@zubax.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+
+namespace node_cache
+{
+/**
+ * UAVCAN bus parameters that were determined during the previous run of the bootloader.
+ * They are kept in the RTC backup registers, which survive watchdog and software resets, as well as
+ * power cycles if the backup domain is powered from VBAT.
+ */
+struct NodeCache
+{
+    std::uint32_t can_bus_bit_rate = 0;
+    std::uint8_t uavcan_node_id = 0;
+    std::uint8_t reserved[3] = {};          ///< Explicit padding, the whole structure is covered by the CRC
+};
+
+static_assert(sizeof(NodeCache) == 8, "NodeCache must fit into the allocated backup registers");
+
+/**
+ * Reads the cached parameters from the backup registers.
+ * Returns an empty option if there is no valid record (e.g. if the backup domain has lost power).
+ * The record is invalidated after read; it is supposed to be rewritten once the parameters are confirmed.
+ */
+std::optional<NodeCache> readAndInvalidate();
+
+/**
+ * Stores the parameters in the backup registers.
+ * This function cannot fail.
+ */
+void write(const NodeCache& cache);
+
+}
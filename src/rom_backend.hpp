@@ -66,14 +66,17 @@ public:
 
         if (offset < writer_->getAddress())
         {
-            DEBUG_LOG("Non-sequential writes are not supported: %08x < %08x\n",
-                      unsigned(offset), unsigned(writer_->getAddress()));
-            return 0;
+            // Out of order write (fleet distribution fill-in); the memory behind the writer is already erased
+            board::SequentialROMWriter backfill_writer(offset, board::SequentialROMWriter::AutoEraseMode::Disabled);
+            return backfill_writer.append(data, size) ? std::int16_t(size) : -1;
         }
 
         if (offset > writer_->getAddress())
         {
-            writer_->skip(offset - writer_->getAddress());
+            if (!writer_->skip(offset - writer_->getAddress()))
+            {
+                return -1;
+            }
         }
 
         assert(offset == writer_->getAddress());
@@ -6,7 +6,9 @@
 #include <kocherga/kocherga_popcop.hpp>
 #include <board/board.hpp>
 #include <board/usb/usb.hpp>
+#include <uavcan/uavcan.hpp>
 #include <hal.h>
+#include <array>
 #include <cstdlib>
 
 
@@ -19,15 +21,42 @@ namespace
  */
 class PopcopPlatform final : public kocherga_popcop::IPopcopPlatform
 {
+    /**
+     * The USART is clocked from APB1 with 16x oversampling, so its divisor cannot be lower than 16.
+     * The host and the local USART may each deviate from the nominal bit rate by a couple of percent;
+     * the link verification catches the cases where the combined error is too large.
+     */
+    static constexpr std::uint32_t MinUSARTDivisor = 16;
+    static constexpr std::uint32_t MaxBitRateErrorPercent = 2;
+
+    static constexpr std::uint8_t MaxUSBImageDataWindow = 16;
+
     static bool shouldUseUSB()
     {
         return board::usb::getState() == board::usb::State::Connected;
     }
 
-    static ::sysinterval_t getIOTimeout()
+    /**
+     * The output is queued here and handed over to the driver without blocking, because the endpoint shares
+     * the main loop with the UAVCAN node, whose CAN RX FIFO overflows in a few frames if the loop stalls.
+     * The queue must accommodate the longest frame the endpoint emits (endpoint info with a full CoA, escaped).
+     */
+    static constexpr std::size_t TxQueueSize = 2048;
+
+    std::array<std::uint8_t, TxQueueSize> tx_queue_{};
+    std::size_t tx_queue_head_ = 0;         ///< Index of the oldest byte
+    std::size_t tx_queue_length_ = 0;
+
+    static ::BaseChannel* getChannel()
     {
-        const std::int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(IOByteTimeout).count();
-        return TIME_MS2I(std::max<std::int64_t>(1, ms));
+        if (shouldUseUSB())
+        {
+            return reinterpret_cast<::BaseChannel*>(board::usb::getSerialUSBDriver());
+        }
+        else
+        {
+            return reinterpret_cast<::BaseChannel*>(&STDIN_SD);
+        }
     }
 
     void resetWatchdog() override
@@ -37,27 +66,31 @@ class PopcopPlatform final : public kocherga_popcop::IPopcopPlatform
 
     void emit(std::uint8_t byte) override
     {
-        if (shouldUseUSB())
+        if (tx_queue_length_ >= tx_queue_.size())
         {
-            (void) chnPutTimeout(board::usb::getSerialUSBDriver(), byte, getIOTimeout());
+            flush();
         }
-        else
+
+        if (tx_queue_length_ < tx_queue_.size())
         {
-            (void) chnPutTimeout(&STDIN_SD, byte, getIOTimeout());
+            tx_queue_[(tx_queue_head_ + tx_queue_length_) % tx_queue_.size()] = byte;
+            tx_queue_length_++;
         }
+        // Otherwise the byte is dropped; the host will detect the damaged frame and retry
     }
 
     std::optional<std::uint8_t> receive() override
     {
         std::int32_t out = 0;
 
+        // Never blocking because the endpoint shares the main loop with the UAVCAN node
         if (shouldUseUSB())
         {
-            out = chnGetTimeout(board::usb::getSerialUSBDriver(), getIOTimeout());
+            out = chnGetTimeout(board::usb::getSerialUSBDriver(), TIME_IMMEDIATE);
         }
         else
         {
-            out = chnGetTimeout(&STDIN_SD, getIOTimeout());
+            out = chnGetTimeout(&STDIN_SD, TIME_IMMEDIATE);
         }
 
         if (out >= 0)
@@ -131,35 +164,105 @@ class PopcopPlatform final : public kocherga_popcop::IPopcopPlatform
         return os::isShutdownRequested();
     }
 
-    PopcopPlatform(const PopcopPlatform&) = delete;
-    PopcopPlatform& operator=(const PopcopPlatform&) = delete;
+    void processFileReadResponse(std::uint32_t tag,
+                                 std::int16_t error,
+                                 const std::uint8_t* data,
+                                 std::uint16_t size) override
+    {
+        uavcan::respondToFileRead(tag, error, data, size);
+    }
 
-public:
-    PopcopPlatform() = default;
-};
+    std::int16_t processPeerFirmwareUpdateRequest(std::uint8_t node_id, const senoval::String<200>& path) override
+    {
+        return uavcan::requestPeerFirmwareUpdate(node_id, path.data(), path.length());
+    }
 
+    std::uint8_t getMaxImageDataWindow() const override
+    {
+        // USB CDC has flow control, so the pending requests can't overflow the input buffer; the UART doesn't
+        return shouldUseUSB() ? MaxUSBImageDataWindow : 1;
+    }
 
-class Thread final : public chibios_rt::BaseStaticThread<8192>
-{
-    kocherga_popcop::PopcopProtocol& endpoint_;
+    std::uint16_t getMaxImageDataChunkSize() const override
+    {
+        // The UART input queue (SERIAL_BUFFERS_SIZE) can't hold a larger chunk; over USB the flow control takes care
+        return shouldUseUSB() ? kocherga_popcop::MaxImageDataChunkSize : kocherga_popcop::DefaultImageDataChunkSize;
+    }
 
-    void main() final
+    bool isBitRateSupported(std::uint32_t bit_rate) const override
     {
-        endpoint_.run();
+        // Over USB the bit rate has no effect; also the UART may be reconfigured only when it's not in use
+        if (shouldUseUSB() || (bit_rate == 0))
+        {
+            return false;
+        }
+
+        // The driver truncates the divisor, see the USARTv1 LLD
+        const std::uint32_t divisor = STM32_PCLK1 / bit_rate;
+        if (divisor < MinUSARTDivisor)
+        {
+            return false;
+        }
 
-        assert(os::isShutdownRequested());
-        std::puts("Serial endpoint down");
-        os::requestShutdown();
+        const std::uint32_t actual = STM32_PCLK1 / divisor;
+        return ((actual - bit_rate) * 100U) <= (bit_rate * MaxBitRateErrorPercent);
     }
 
+    void setBitRate(std::uint32_t bit_rate) override
+    {
+        // Letting the last response leave the transmitter; the TC flag is not exposed by the driver,
+        // so we wait for the output queue to drain and then for one more character time at the lowest rate
+        for (;;)
+        {
+            flush();
+            chSysLock();
+            const bool empty = (tx_queue_length_ == 0) && oqIsEmptyI(&STDIN_SD.oqueue);
+            chSysUnlock();
+            if (empty)
+            {
+                break;
+            }
+            chThdSleepMilliseconds(1);
+        }
+        chThdSleepMilliseconds(1);
+
+        static SerialConfig config{};
+        config.speed = (bit_rate > 0) ? bit_rate : SERIAL_DEFAULT_BITRATE;
+
+        sdStop(&STDIN_SD);
+        sdStart(&STDIN_SD, &config);
+    }
+
+    PopcopPlatform(const PopcopPlatform&) = delete;
+    PopcopPlatform& operator=(const PopcopPlatform&) = delete;
+
 public:
-    virtual ~Thread() = default;
+    PopcopPlatform() = default;
 
-    explicit Thread(kocherga_popcop::PopcopProtocol& endpoint) :
-        endpoint_(endpoint)
-    { }
+    /**
+     * Hands over as much of the queued output to the driver as it can accept, never blocking.
+     */
+    void flush()
+    {
+        ::BaseChannel* const channel = getChannel();
+        while (tx_queue_length_ > 0)
+        {
+            // Writing the contiguous part up to the end of the buffer first; the rest is picked up on the next pass
+            const std::size_t chunk = std::min(tx_queue_length_, tx_queue_.size() - tx_queue_head_);
+            const std::size_t written = chnWriteTimeout(channel, &tx_queue_[tx_queue_head_], chunk, TIME_IMMEDIATE);
+            tx_queue_head_ = (tx_queue_head_ + written) % tx_queue_.size();
+            tx_queue_length_ -= written;
+            if (written < chunk)
+            {
+                break;          // The driver queue is full, retrying on the next poll
+            }
+        }
+    }
 };
 
+PopcopPlatform* g_platform = nullptr;
+kocherga_popcop::PopcopProtocol* g_endpoint = nullptr;
+
 }  // namespace
 
 
@@ -194,14 +297,33 @@ void init(kocherga::BootloaderController& bl)
         std::copy(sign->begin(), sign->end(), info.certificate_of_authenticity.begin());
     }
 
-    // Construct the node
+    // Construct the node; from now on it is driven by poll()
     static PopcopPlatform platform;
     static kocherga_popcop::PopcopProtocol endpoint(bl, platform, info);
+    g_platform = &platform;
+    g_endpoint = &endpoint;
+}
+
 
-    // Launch the thread
-    static Thread node_thread(endpoint);
-    node_thread.setName("serial");
-    (void) node_thread.start(NORMALPRIO);
+void poll()
+{
+    if (g_endpoint != nullptr)
+    {
+        g_endpoint->step();
+        g_platform->flush();
+    }
+}
+
+
+bool forwardFileReadRequest(std::uint32_t tag, std::uint64_t offset, const char* path, std::size_t path_length)
+{
+    // The gateway is only enabled over USB; the UART is too slow to serve a whole bus
+    if ((g_endpoint != nullptr) && (board::usb::getState() == board::usb::State::Connected))
+    {
+        g_endpoint->sendFileReadRequest(tag, offset, path, path_length);
+        return true;
+    }
+    return false;
 }
 
 }
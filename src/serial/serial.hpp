@@ -16,4 +16,16 @@ namespace serial
  */
 void init(kocherga::BootloaderController& bl);
 
+/**
+ * Processes the pending input without blocking. Must be invoked from the main loop continuously.
+ */
+void poll();
+
+/**
+ * Forwards a file read request to the host via the USB CDC ACM link, see the Popcop gateway frames.
+ * The response is delivered to uavcan::respondToFileRead() with the same tag.
+ * Returns false if the host is not connected via USB, in which case the request is not forwarded.
+ */
+bool forwardFileReadRequest(std::uint32_t tag, std::uint64_t offset, const char* path, std::size_t path_length);
+
 }
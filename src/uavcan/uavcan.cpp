@@ -6,6 +6,8 @@
 #include <kocherga/kocherga_uavcan.hpp>
 #include <canard_stm32.h>
 #include <board/board.hpp>
+#include <node_cache/node_cache.hpp>
+#include <serial/serial.hpp>
 #include <hal.h>
 #include <cstdlib>
 
@@ -31,27 +33,38 @@ class UAVCANPlatform : public kocherga_uavcan::IUAVCANPlatform
      *
      * Therefore, we must read the driver not less frequently than every 192 microseconds, otherwise we might be
      * losing frames due to RX overrun. Therefore we enforce that the system tick interval is less than that.
+     * The same applies to the main loop that polls the node, see poll().
      */
     static_assert((1000000 / CH_CFG_ST_FREQUENCY) < 180,
                   "Minimal delay must be lower in order for the libcanard STM32 driver to work properly");
 
     static constexpr std::uint8_t LEDUpdateIntervalMilliseconds = 25;
 
-    bool had_activity_ = false;
+    /// Both interfaces are connected to the same bus in a redundant configuration
+    static constexpr std::uint8_t NumberOfInterfaces = CANARD_STM32_NUM_IFACES;
+
+    std::array<bool, NumberOfInterfaces> had_activity_{};
     ::systime_t last_led_update_timestamp_st_ = 0;
 
-    inline void wait()
+    inline void updateActivityLEDs()
     {
         if (chVTTimeElapsedSinceX(last_led_update_timestamp_st_) >= TIME_MS2I(LEDUpdateIntervalMilliseconds))
         {
             last_led_update_timestamp_st_ =
                 ::systime_t(last_led_update_timestamp_st_ + TIME_MS2I(LEDUpdateIntervalMilliseconds));
 
-            board::setCANActivityLED(0, had_activity_);
-            had_activity_ = false;
+            for (std::uint8_t i = 0; i < NumberOfInterfaces; i++)
+            {
+                board::setCANActivityLED(i, had_activity_[i]);
+                had_activity_[i] = false;
+            }
         }
+    }
 
-        chThdSleep(1);      // Sleeping for a minimal possible time interval
+    /// Zero timeout means that the operation is attempted once, without sleeping
+    static bool hasTimedOut(const ::systime_t started_at, const std::chrono::microseconds timeout)
+    {
+        return std::int64_t(TIME_I2US(chVTTimeElapsedSinceX(started_at))) >= std::int64_t(timeout.count());
     }
 
     void resetWatchdog() override
@@ -71,17 +84,27 @@ class UAVCANPlatform : public kocherga_uavcan::IUAVCANPlatform
         return lower_bound + rnd % (upper_bound - lower_bound);
     }
 
+    std::uint8_t getNumberOfInterfaces() const override
+    {
+        return NumberOfInterfaces;
+    }
+
     std::int16_t configure(std::uint32_t bitrate,
+                           std::uint32_t data_bit_rate,
                            CANMode mode,
-                           const CANAcceptanceFilterConfig& acceptance_filter) override
+                           const CANAcceptanceFilterList& acceptance_filters) override
     {
-        DEBUG_LOG("CAN init: %9u bps, mode %d, filt id 0x%x mask 0x%x\n",
+        if (data_bit_rate != 0)
+        {
+            return -CANARD_STM32_ERROR_UNSUPPORTED_BIT_RATE;        // bxCAN does not support CAN FD
+        }
+
+        DEBUG_LOG("CAN init: %9u bps, mode %d, %u filters\n",
                   unsigned(bitrate),
                   int(mode),
-                  unsigned(acceptance_filter.id),
-                  unsigned(acceptance_filter.mask));
+                  unsigned(acceptance_filters.size()));
 
-        had_activity_ = false;
+        had_activity_.fill(false);
         last_led_update_timestamp_st_ = chVTGetSystemTimeX();
 
         // Computing CAN timings
@@ -119,12 +142,20 @@ class UAVCANPlatform : public kocherga_uavcan::IUAVCANPlatform
             return res;
         }
 
-        // Configuring acceptance filters
-        CanardSTM32AcceptanceFilterConfiguration acceptance_filter_config;
-        acceptance_filter_config.id   = acceptance_filter.id;
-        acceptance_filter_config.mask = acceptance_filter.mask;
+        // Configuring acceptance filters, one bxCAN filter bank per entry
+        static_assert(MaxCANAcceptanceFilters <= CANARD_STM32_NUM_ACCEPTANCE_FILTERS, "Not enough filter banks");
+        std::array<CanardSTM32AcceptanceFilterConfiguration, MaxCANAcceptanceFilters> acceptance_filter_configs{};
+        for (std::uint8_t i = 0; i < acceptance_filters.size(); i++)
+        {
+            DEBUG_LOG("CAN filt id 0x%08x mask 0x%08x\n",
+                      unsigned(acceptance_filters[i].id),
+                      unsigned(acceptance_filters[i].mask));
+            acceptance_filter_configs[i].id   = acceptance_filters[i].id;
+            acceptance_filter_configs[i].mask = acceptance_filters[i].mask;
+        }
 
-        res = canardSTM32ConfigureAcceptanceFilters(&acceptance_filter_config, 1);
+        res = canardSTM32ConfigureAcceptanceFilters(acceptance_filter_configs.data(),
+                                                    std::uint8_t(acceptance_filters.size()));
         if (res < 0)
         {
             return res;
@@ -136,36 +167,50 @@ class UAVCANPlatform : public kocherga_uavcan::IUAVCANPlatform
     std::int16_t send(const ::CanardCANFrame& frame, std::chrono::microseconds timeout) override
     {
         const auto started_at = chVTGetSystemTimeX();
-        do
+        for (;;)
         {
             std::int16_t res = canardSTM32Transmit(&frame);      // Try to transmit
             if (res != 0)
             {
-                had_activity_ |= res > 0;
+                had_activity_[frame.iface_id] |= res > 0;
                 return res;                             // Either success or error, return
             }
-            wait();                                     // No space in the buffer, skip the time quantum and try again
+            updateActivityLEDs();
+            if (hasTimedOut(started_at, timeout))
+            {
+                break;
+            }
+            chThdSleep(1);                              // No space in the buffer, skip the time quantum and try again
         }
-        while (TIME_I2US(chVTTimeElapsedSinceX(started_at)) < timeout.count());
 
         return 0;                                       // Timed out
     }
 
-    std::pair<std::int16_t, ::CanardCANFrame> receive(std::chrono::microseconds timeout) override
+    std::pair<std::int16_t, ReceivedCANFrame> receive(std::chrono::microseconds timeout) override
     {
         const auto started_at = chVTGetSystemTimeX();
-        CanardCANFrame f{};
-        do
+        ReceivedCANFrame f{};
+        for (;;)
         {
-            std::int16_t res = canardSTM32Receive(&f);
+            std::int16_t res = canardSTM32Receive(&f.frame);
             if (res != 0)
             {
-                had_activity_ |= res > 0;
+                if (res > 0)
+                {
+                    // The driver is polled, so the earliest time we can observe is when the frame leaves the FIFO
+                    f.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                        board::Clock::now().time_since_epoch());
+                    had_activity_[f.frame.iface_id] = true;
+                }
                 return {res, f};                        // Either success or error, return
             }
-            wait();                                     // Buffer is empty, skip the time quantum and try again
+            updateActivityLEDs();
+            if (hasTimedOut(started_at, timeout))
+            {
+                break;
+            }
+            chThdSleep(1);                              // Buffer is empty, skip the time quantum and try again
         }
-        while (TIME_I2US(chVTTimeElapsedSinceX(started_at)) < timeout.count());
 
         return {0, f};                                  // Timed out
     }
@@ -181,6 +226,27 @@ class UAVCANPlatform : public kocherga_uavcan::IUAVCANPlatform
         return true;
     }
 
+    void onBusParametersConfirmed(std::uint32_t can_bus_bit_rate, std::uint8_t node_id) override
+    {
+        node_cache::NodeCache cache;
+        cache.can_bus_bit_rate = can_bus_bit_rate;
+        cache.uavcan_node_id   = node_id;
+        node_cache::write(cache);
+    }
+
+    /**
+     * The requests that can't be served locally are forwarded to the host connected via USB, if there is one,
+     * which makes this node a gateway that can update the entire bus. The requester node ID, transfer ID,
+     * and priority are packed into the tag, so that no state needs to be kept per request in flight.
+     */
+    bool forwardFileReadRequest(const kocherga_uavcan::ForwardedFileReadRequest& request) override
+    {
+        const std::uint32_t tag = std::uint32_t(request.requester_node_id) |
+                                  (std::uint32_t(request.transfer_id) << 8U) |
+                                  (std::uint32_t(request.priority) << 16U);
+        return serial::forwardFileReadRequest(tag, request.offset, request.path.data(), request.path.length());
+    }
+
     UAVCANPlatform(const UAVCANPlatform&) = delete;
     UAVCANPlatform& operator=(const UAVCANPlatform&) = delete;
 
@@ -189,44 +255,17 @@ public:
 };
 
 
-using BootloaderNode = kocherga_uavcan::BootloaderNode<1024 * 16>;
+/// The application occupies the flash above the bootloader, up to the end of the last 128K sector (512K total)
+static constexpr std::size_t MaxFleetImageSize = 512 * 1024 - APPLICATION_OFFSET;
 
+/// Number of peers that can download the installed image from this node, or via the serial gateway, concurrently
+static constexpr std::size_t MaxConcurrentFileReadPeers = 4;
 
-class Thread final : public chibios_rt::BaseStaticThread<8192>
-{
-    BootloaderNode& node_;
-    const std::uint32_t can_bit_rate_;
-    const std::uint8_t local_node_id_;
-    const std::uint8_t file_server_node_id_;
-    const senoval::String<200> remote_image_file_path_;
+/// The pool is sized for the worst case; the actual peak usage is reported via LogMessage after every upgrade
+static constexpr std::size_t MemoryPoolSize =
+    kocherga_uavcan::computeWorstCaseMemoryPoolSize<MaxFleetImageSize, MaxConcurrentFileReadPeers>();
 
-    void main() final
-    {
-        node_.run(can_bit_rate_,
-                  local_node_id_,
-                  file_server_node_id_,
-                  remote_image_file_path_.c_str());
-
-        assert(os::isShutdownRequested());
-        std::puts("UAVCAN node down");
-        os::requestShutdown();
-    }
-
-public:
-    virtual ~Thread() = default;
-
-    Thread(BootloaderNode& node,
-           const std::uint32_t can_bit_rate,
-           const std::uint8_t local_node_id,
-           const std::uint8_t file_server_node_id,
-           const char* const remote_image_file_path) :
-        node_(node),
-        can_bit_rate_(can_bit_rate),
-        local_node_id_(local_node_id),
-        file_server_node_id_(file_server_node_id),
-        remote_image_file_path_(remote_image_file_path)
-    { }
-};
+using BootloaderNode = kocherga_uavcan::BootloaderNode<MemoryPoolSize, MaxFleetImageSize>;
 
 }  // namespace
 
@@ -263,18 +302,69 @@ void init(kocherga::BootloaderController& bl,
         std::copy(sign->begin(), sign->end(), hw.certificate_of_authenticity.begin());
     }
 
-    // Construct the node
+    // If the application didn't supply the bus parameters, reuse the ones from the previous run, if available.
+    // The cached node ID will be checked for conflicts before use, unlike the one supplied by the application.
+    std::uint32_t bit_rate = can_bit_rate;
+    std::uint8_t node_id = local_node_id;
+    bool verify_node_id = false;
+    if ((bit_rate == 0) && (node_id == 0))
+    {
+        if (const auto cache = node_cache::readAndInvalidate())
+        {
+            DEBUG_LOG("Node cache: %u bps NID %u\n", unsigned(cache->can_bus_bit_rate), cache->uavcan_node_id);
+            bit_rate = cache->can_bus_bit_rate;
+            node_id = cache->uavcan_node_id;
+            verify_node_id = true;
+        }
+    }
+
+    // Construct and start the node; from now on it is driven by poll()
     static UAVCANPlatform platform;
     g_node.emplace(bl, platform, PRODUCT_ID_STRING, hw);
+    g_node->start(bit_rate,
+                  node_id,
+                  file_server_node_id,
+                  (remote_image_file_path == nullptr) ? "" : remote_image_file_path,
+                  verify_node_id);
+}
+
+
+void poll()
+{
+    if (g_node)
+    {
+        g_node->step();
+    }
+}
+
+
+void respondToFileRead(std::uint32_t tag, std::int16_t error, const std::uint8_t* data, std::uint16_t size)
+{
+    if (g_node)
+    {
+        kocherga_uavcan::ForwardedFileReadRequest request;
+        request.requester_node_id = std::uint8_t(tag);
+        request.transfer_id       = std::uint8_t(tag >> 8U);
+        request.priority          = std::uint8_t(tag >> 16U);
+        g_node->respondToFileRead(request, error, data, size);
+    }
+}
+
+
+std::int16_t requestPeerFirmwareUpdate(std::uint8_t node_id, const char* path, std::size_t path_length)
+{
+    if (!g_node)
+    {
+        return -kocherga_uavcan::ErrNotReady;
+    }
+
+    senoval::String<200> p;
+    for (std::size_t i = 0; (i < path_length) && (p.length() < p.max_size()); i++)
+    {
+        p.push_back(path[i]);
+    }
 
-    // Launch the thread
-    static Thread node_thread(*g_node,
-                              can_bit_rate,
-                              local_node_id,
-                              file_server_node_id,
-                              remote_image_file_path);
-    node_thread.setName("uavcan");
-    (void) node_thread.start(HIGHPRIO);  // High priority is required to avoid CAN frame loss - we don't have buffers
+    return g_node->requestPeerFirmwareUpdate(node_id, p);
 }
 
 
@@ -26,6 +26,25 @@ void init(kocherga::BootloaderController& bl,
           const std::uint8_t file_server_node_id = 0,
           const char* const remote_image_file_path = nullptr);
 
+/**
+ * Performs one iteration of the node without blocking. Must be invoked from the main loop continuously;
+ * there are no hardware RX buffers besides the 3-frame-deep FIFO, so long pauses between the calls lead to frame loss.
+ */
+void poll();
+
+/**
+ * Delivers the host's response to a file read request that has been forwarded via serial::forwardFileReadRequest().
+ * Must be invoked from the main loop.
+ */
+void respondToFileRead(std::uint32_t tag, std::int16_t error, const std::uint8_t* data, std::uint16_t size);
+
+/**
+ * Commands the specified node on the bus to update its firmware from the specified file,
+ * which is served by the host through this node. Must be invoked from the main loop.
+ * Returns zero on success, negative error code otherwise.
+ */
+std::int16_t requestPeerFirmwareUpdate(std::uint8_t node_id, const char* path, std::size_t path_length);
+
 /**
  * Runtime estimated UAVCAN bus parameters.
  * Unknown parameters are set to zero.